@@ -0,0 +1,165 @@
+/*############################################################################
+  # Copyright (C) 2020 Intel Corporation
+  #
+  # SPDX-License-Identifier: MIT
+  ############################################################################*/
+
+#ifndef __MFXCPU_H__
+#define __MFXCPU_H__
+
+#include "vpl/mfxstructures.h"
+
+// Extension buffers of the CPU runtime, on top of the oneVPL API
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// counters beyond mfxDecodeStat/mfxEncodeStat/mfxVPPStat, returned by
+//   GetVideoParam() when attached to mfxVideoParam::ExtParam
+// times are in microseconds, per step of the component's codec or filter
+//   graph: a packet sent to the decoder, a frame sent to the encoder or
+//   filtered by VPP
+// CpuTime is the CPU time of the thread running that step only, the
+//   threads of the codec library and of the shared thread pool are not
+//   included, so it is below the CPU cost of a step which uses them
+// WallTimeP* are read from a histogram with 4 buckets per power of 2 and
+//   are the lower bound of their bucket
+#define MFX_EXTBUFF_CPU_STAT MFX_MAKEFOURCC('C', 'S', 'T', 'A')
+
+typedef struct {
+    mfxExtBuffer Header;
+    mfxU64 NumFrameIn;
+    mfxU64 NumFrameOut;
+    mfxU64 NumCorruptFrame;
+    mfxU64 NumByte; // bitstream bytes, read by decode and written by encode
+    mfxU64 WallTime;
+    mfxU64 WallTimeMax;
+    mfxU64 CpuTime;
+    mfxU64 CpuTimeMax;
+    mfxU32 WallTimeP50;
+    mfxU32 WallTimeP90;
+    mfxU32 WallTimeP99;
+    mfxU32 reserved[9];
+} mfxExtCpuStat;
+
+// attached to mfxVideoParam::ExtParam in MFXVideoENCODE_Init() to chain
+//   decode, VPP (if initialized) and encode inside the session
+// bitstream goes into MFXVideoDECODE_DecodeFrameAsync(), which returns
+//   MFX_ERR_MORE_DATA once it is consumed (no surface is output), and
+//   comes out of MFXVideoENCODE_EncodeFrameAsync() with a null surface
+// decoder output must match the VPP input or encoder frame size, VPP
+//   with extra outputs (mfxExtCpuVPPOutputs) is rejected with
+//   MFX_ERR_INVALID_VIDEO_PARAM
+#define MFX_EXTBUFF_CPU_PIPELINE MFX_MAKEFOURCC('C', 'P', 'I', 'P')
+
+typedef struct {
+    mfxExtBuffer Header;
+    mfxU16 Enable;
+    mfxU16 reserved[11];
+} mfxExtCpuPipeline;
+
+// attached to mfxVideoParam::ExtParam in MFXVideoVPP_Init() to produce
+//   more outputs from each input, e.g. the rungs of an ABR ladder
+// vpp.Out is output 0, Output[i] is output i + 1. Extra outputs are
+//   scaled copies of output 0, they have its FourCC, no cropping and
+//   are not larger than vpp.Out. Each one is scaled from the next larger
+//   output rather than from the input.
+#define MFX_EXTBUFF_CPU_VPP_OUTPUTS MFX_MAKEFOURCC('C', 'V', 'O', 'U')
+
+typedef struct {
+    mfxExtBuffer Header;
+    mfxU16 NumOutput;
+    mfxU16 reserved[3];
+    mfxFrameInfo* Output;
+} mfxExtCpuVPPOutputs;
+
+// attached to mfxFrameSurface1::Data.ExtParam of the surface_out passed
+//   to MFXVideoVPP_RunFrameVPPAsync(), Surfaces[i] receives output i + 1
+// all outputs are ready once the returned sync point is synced
+// outputs without a surface (0 or beyond NumSurface) are dropped
+#define MFX_EXTBUFF_CPU_VPP_OUT_SURFACES MFX_MAKEFOURCC('C', 'V', 'O', 'S')
+
+typedef struct {
+    mfxExtBuffer Header;
+    mfxU16 NumSurface;
+    mfxU16 reserved[3];
+    mfxFrameSurface1** Surfaces;
+} mfxExtCpuVPPOutSurfaces;
+
+// attached to mfxVideoParam::ExtParam in MFXVideoENCODE_Init() to encode
+//   an ABR ladder from one input
+// mfx.FrameInfo and TargetKbps describe rung 0, Rung[i] is rung i + 1 and
+//   is encoded with the same parameters at its own size and bitrate.
+//   Rungs are not larger than rung 0 and have even dimensions.
+// TargetKbps/MaxKbps == 0 scale those of rung 0 by picture area
+typedef struct {
+    mfxU16 Width;
+    mfxU16 Height;
+    mfxU16 TargetKbps;
+    mfxU16 MaxKbps;
+    mfxU16 reserved[4];
+} mfxCpuLadderRung;
+
+#define MFX_EXTBUFF_CPU_ENCODE_LADDER MFX_MAKEFOURCC('C', 'L', 'A', 'D')
+
+typedef struct {
+    mfxExtBuffer Header;
+    mfxU16 NumRung;
+    mfxU16 reserved[3];
+    mfxCpuLadderRung* Rung;
+} mfxExtCpuEncodeLadder;
+
+// attached to mfxBitstream::ExtParam of the bitstream passed to
+//   MFXVideoENCODE_EncodeFrameAsync(), Bitstreams[i] receives rung i + 1
+// each call writes at most one packet per rung, DataLength shows which
+//   rungs got one
+// packets of rungs without a bitstream (0 or beyond NumBitstream) are
+//   dropped
+#define MFX_EXTBUFF_CPU_LADDER_BITSTREAMS MFX_MAKEFOURCC('C', 'L', 'B', 'S')
+
+typedef struct {
+    mfxExtBuffer Header;
+    mfxU16 NumBitstream;
+    mfxU16 reserved[3];
+    mfxBitstream** Bitstreams;
+} mfxExtCpuLadderBitstreams;
+
+// attached to mfxEncodeCtrl::ExtParam to offset the QP of each block of
+//   one frame, may be combined with mfxExtEncoderROI (whose regions win
+//   where they overlap)
+// blocks are BlockSize x BlockSize pixels, a multiple of 16, and cover the
+//   frame row by row, the last row and column may stick out of it
+// DeltaQP[i] is added to the QP the encoder picks, 0 leaves a block alone
+#define MFX_EXTBUFF_CPU_DELTA_QP_MAP MFX_MAKEFOURCC('C', 'D', 'Q', 'M')
+
+typedef struct {
+    mfxExtBuffer Header;
+    mfxU16 BlockSize;
+    mfxU16 reserved[3];
+    mfxU32 NumDeltaQP;
+    mfxI8* DeltaQP;
+} mfxExtCpuDeltaQPMap;
+
+// attached to mfxVideoParam::ExtParam in MFXVideoENCODE_Init() to encode
+//   offline (file) input in chunks of whole closed GOPs, several at once
+// chunks are ChunkGops GOPs of GopPicSize frames (0 = 1 GOP) and begin
+//   with an IDR, NumChunk of them are encoded in parallel (0 = one per
+//   few threads of the runtime's thread budget)
+// both may be lowered to bound the raw input the runtime holds, chunks
+//   are never shorter than one GOP
+// rate control runs per chunk, and mfxEncodeCtrl only takes SkipFrame
+#define MFX_EXTBUFF_CPU_ENCODE_CHUNKS MFX_MAKEFOURCC('C', 'C', 'H', 'K')
+
+typedef struct {
+    mfxExtBuffer Header;
+    mfxU16 NumChunk;
+    mfxU16 ChunkGops;
+    mfxU16 reserved[10];
+} mfxExtCpuEncodeChunks;
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
+
+#endif // __MFXCPU_H__
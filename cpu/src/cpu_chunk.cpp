@@ -0,0 +1,301 @@
+/*############################################################################
+  # Copyright (C) 2020 Intel Corporation
+  #
+  # SPDX-License-Identifier: MIT
+  ############################################################################*/
+
+#include "src/cpu_chunk.h"
+#include <algorithm>
+#include <memory>
+#include "src/cpu_copy.h"
+#include "src/cpu_thread_pool.h"
+#include "src/cpu_timestamp.h"
+#include "src/cpu_workstream.h"
+
+CpuEncodeChunks::CpuEncodeChunks(CpuWorkstream *session)
+        : m_session(session),
+          m_input_locker(),
+          m_chunkParam({}),
+          m_extParam(),
+          m_roi({}),
+          m_codingOption2({}),
+          m_chunkFrames(0),
+          m_numChunk(0),
+          m_input(),
+          m_frameDuration(0),
+          m_nextPts(0),
+          m_pendingSurface(nullptr),
+          m_draining(false),
+          m_mutex(),
+          m_ready(),
+          m_packets(),
+          m_tasks(0),
+          m_error(MFX_ERR_NONE) {}
+
+CpuEncodeChunks::~CpuEncodeChunks() {
+    m_session->GetScheduler()->Drain(VPL_TASK_LANE_ENCODE);
+
+    for (AVFrame *frame : m_input)
+        av_frame_free(&frame);
+    for (AVPacket *pkt : m_packets)
+        av_packet_free(&pkt);
+}
+
+mfxExtCpuEncodeChunks *CpuEncodeChunks::GetChunksBuffer(mfxVideoParam *par) {
+    if (!par || !par->ExtParam)
+        return nullptr;
+
+    for (mfxU16 i = 0; i < par->NumExtParam; i++) {
+        mfxExtBuffer *ext = par->ExtParam[i];
+        if (ext && ext->BufferId == MFX_EXTBUFF_CPU_ENCODE_CHUNKS)
+            return reinterpret_cast<mfxExtCpuEncodeChunks *>(ext);
+    }
+    return nullptr;
+}
+
+bool CpuEncodeChunks::IsEnabled(mfxVideoParam *par) {
+    return GetChunksBuffer(par) != nullptr;
+}
+
+// the set being encoded and the one being collected are held at once,
+//   each set gets half of VPL_CHUNK_MAX_BYTES
+// chunks are shortened only when one alone is over that, then there are
+//   fewer of them, a chunk is never shorter than one GOP, which is held
+//   whatever the limit
+void CpuEncodeChunks::LimitChunks(const mfxFrameInfo &info, mfxU32 gop) {
+    size_t maxBytes = static_cast<size_t>(VPL_CHUNK_MAX_BYTES);
+    int frameBytes  = av_image_get_buffer_size(MFXFourCC2AVPixelFormat(info.FourCC),
+                                               info.Width,
+                                               info.Height,
+                                               1);
+    if (!maxBytes || frameBytes <= 0)
+        return;
+
+    size_t setFrames = std::max<size_t>(maxBytes / 2 / frameBytes, 1);
+    if (m_chunkFrames > setFrames)
+        m_chunkFrames = gop * static_cast<mfxU32>(std::max<size_t>(setFrames / gop, 1));
+    m_numChunk = static_cast<int>(
+        std::min<size_t>(m_numChunk, std::max<size_t>(setFrames / m_chunkFrames, 1)));
+}
+
+mfxStatus CpuEncodeChunks::InitChunks(mfxVideoParam *par) {
+    mfxExtCpuEncodeChunks *chunks = GetChunksBuffer(par);
+    RET_IF_FALSE(chunks, MFX_ERR_INVALID_VIDEO_PARAM);
+    RET_IF_FALSE(chunks->Header.BufferSz >= sizeof(mfxExtCpuEncodeChunks),
+                 MFX_ERR_INVALID_VIDEO_PARAM);
+    // the others feed encoders of their own from the same input, and JPEG
+    //   has no GOPs (GopPicSize is its Quality)
+    RET_IF_FALSE(!CpuPipeline::IsEnabled(par) && !CpuEncodeLadder::IsEnabled(par) &&
+                     par->mfx.CodecId != MFX_CODEC_JPEG,
+                 MFX_ERR_INVALID_VIDEO_PARAM);
+    RET_IF_FALSE(m_session->GetEncoder(), MFX_ERR_NOT_INITIALIZED);
+
+    // same default as the session encoder
+    const mfxFrameInfo &info = par->mfx.FrameInfo;
+    mfxU32 gop               = par->mfx.GopPicSize;
+    if (!gop)
+        gop = 2 * info.FrameRateExtN / std::max<mfxU32>(info.FrameRateExtD, 1);
+    RET_IF_FALSE(gop && gop <= 0xFFFF, MFX_ERR_INVALID_VIDEO_PARAM);
+
+    m_frameDuration = CpuEncodeTimestamps::GetFrameDuration(info);
+
+    int budget    = CpuThreadPool::Get().GetThreadCount();
+    m_chunkFrames = gop * std::max<mfxU32>(chunks->ChunkGops, 1);
+    m_numChunk    = chunks->NumChunk ? chunks->NumChunk : std::max(budget / VPL_CHUNK_THREADS, 1);
+    LimitChunks(info, gop);
+
+    // every GOP is closed, the first one of each chunk by its new encoder
+    m_chunkParam                = *par;
+    m_chunkParam.mfx.GopPicSize = static_cast<mfxU16>(gop);
+    m_chunkParam.mfx.GopOptFlag |= MFX_GOP_CLOSED;
+    if (!m_chunkParam.mfx.NumThread)
+        m_chunkParam.mfx.NumThread = static_cast<mfxU16>(std::max(budget / m_numChunk, 1));
+
+    // encoder buffers are kept, the session level ones are not needed
+    for (mfxU16 i = 0; i < par->NumExtParam; i++) {
+        mfxExtBuffer *ext = par->ExtParam[i];
+        if (!ext)
+            continue;
+        if (ext->BufferId == MFX_EXTBUFF_ENCODER_ROI && ext->BufferSz >= sizeof(m_roi)) {
+            m_roi = *reinterpret_cast<mfxExtEncoderROI *>(ext);
+            m_extParam.push_back(&m_roi.Header);
+        }
+        else if (ext->BufferId == MFX_EXTBUFF_CODING_OPTION2 &&
+                 ext->BufferSz >= sizeof(m_codingOption2)) {
+            m_codingOption2 = *reinterpret_cast<mfxExtCodingOption2 *>(ext);
+            m_extParam.push_back(&m_codingOption2.Header);
+        }
+    }
+    m_chunkParam.ExtParam    = m_extParam.empty() ? nullptr : m_extParam.data();
+    m_chunkParam.NumExtParam = static_cast<mfxU16>(m_extParam.size());
+
+    // chunk encoders are created with the input, check their parameters now
+    mfxVideoParam chunkPar = m_chunkParam;
+    std::unique_ptr<CpuEncode> encoder(new CpuEncode(m_session));
+    RET_IF_FALSE(encoder, MFX_ERR_MEMORY_ALLOC);
+    return encoder->InitEncode(&chunkPar);
+}
+
+mfxStatus CpuEncodeChunks::EncodeFrame(mfxEncodeCtrl *ctrl,
+                                       mfxFrameSurface1 *surface,
+                                       mfxBitstream *bs,
+                                       mfxSyncPoint *syncp) {
+    // picture types and QPs are up to the chunk encoders
+    bool skip = false;
+    if (ctrl) {
+        RET_IF_FALSE(!ctrl->MfxNalUnitType && !ctrl->QP && !ctrl->FrameType &&
+                         !ctrl->NumExtParam && !ctrl->NumPayload,
+                     MFX_ERR_INVALID_VIDEO_PARAM);
+        skip = ctrl->SkipFrame != 0;
+    }
+
+    if (surface) {
+        // retried after MFX_ERR_NOT_ENOUGH_BUFFER, already collected
+        if (surface != m_pendingSurface && !skip)
+            RET_ERROR(AddSurface(surface));
+    }
+    else if (!m_draining) {
+        RET_ERROR(SubmitChunks());
+        m_draining = true;
+    }
+    m_pendingSurface = nullptr;
+
+    mfxStatus sts = DeliverPacket(bs, syncp);
+    if (sts == MFX_ERR_NOT_ENOUGH_BUFFER)
+        m_pendingSurface = surface;
+    return sts;
+}
+
+mfxStatus CpuEncodeChunks::AddSurface(mfxFrameSurface1 *surface) {
+    // input may still be written by a decode or VPP task
+    m_session->GetScheduler()->WaitSurface(surface);
+
+    AVFrame *av_frame =
+        m_input_locker.GetAVFrame(surface, MFX_MAP_READ, m_session->GetFrameAllocator());
+    RET_IF_FALSE(av_frame, MFX_ERR_ABORTED);
+
+    // kept until its chunk is encoded, the surface is free on return
+    AVFrame *input = CopyAVFrame(av_frame);
+    m_input_locker.Unlock();
+    RET_IF_FALSE(input, MFX_ERR_MEMORY_ALLOC);
+
+    // one timeline across the chunk encoders, untimed input continues it
+    input->pts = CpuEncodeTimestamps::GetSurfacePts(surface);
+    if (input->pts == AV_NOPTS_VALUE)
+        input->pts = m_nextPts;
+    m_nextPts = input->pts + m_frameDuration;
+    m_input.push_back(input);
+
+    if (m_input.size() >= static_cast<size_t>(m_chunkFrames) * m_numChunk)
+        return SubmitChunks();
+    return MFX_ERR_NONE;
+}
+
+// encode the collected input, one chunk per job on the shared pool
+mfxStatus CpuEncodeChunks::SubmitChunks() {
+    if (m_input.empty())
+        return MFX_ERR_NONE;
+
+    // one set of chunks is encoded while the next one is collected
+    CpuScheduler *scheduler = m_session->GetScheduler();
+    scheduler->Drain(VPL_TASK_LANE_ENCODE);
+
+    auto chunks = std::make_shared<std::vector<std::vector<AVFrame *>>>();
+    for (size_t i = 0; i < m_input.size(); i += m_chunkFrames) {
+        size_t end = std::min(i + m_chunkFrames, m_input.size());
+        chunks->emplace_back(m_input.begin() + i, m_input.begin() + end);
+    }
+    m_input.clear();
+
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_tasks++;
+    }
+    mfxStatus sts = scheduler->Submit(
+        VPL_TASK_LANE_ENCODE,
+        [this, chunks]() {
+            size_t count = chunks->size();
+            std::vector<std::vector<AVPacket *>> packets(count);
+            std::vector<mfxStatus> status(count, MFX_ERR_NONE);
+
+            CpuThreadPool::Get().Run(static_cast<int>(count), [&](int i) {
+                status[i] = EncodeChunk((*chunks)[i], &packets[i]);
+            });
+
+            for (std::vector<AVFrame *> &frames : *chunks) {
+                for (AVFrame *frame : frames)
+                    av_frame_free(&frame);
+            }
+
+            // output stops at a chunk which failed, later ones would not
+            //   continue the stream
+            mfxStatus sts = MFX_ERR_NONE;
+            std::lock_guard<std::mutex> lock(m_mutex);
+            for (size_t i = 0; i < count; i++) {
+                if (sts == MFX_ERR_NONE && status[i] >= MFX_ERR_NONE) {
+                    m_packets.insert(m_packets.end(), packets[i].begin(), packets[i].end());
+                    continue;
+                }
+                if (sts == MFX_ERR_NONE)
+                    sts = status[i];
+                for (AVPacket *pkt : packets[i])
+                    av_packet_free(&pkt);
+            }
+            if (sts < MFX_ERR_NONE && m_error == MFX_ERR_NONE)
+                m_error = sts;
+            m_tasks--;
+            m_ready.notify_all();
+            return sts;
+        },
+        nullptr);
+    if (sts < MFX_ERR_NONE) {
+        for (std::vector<AVFrame *> &frames : *chunks) {
+            for (AVFrame *frame : frames)
+                av_frame_free(&frame);
+        }
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_tasks--;
+    }
+    return sts;
+}
+
+// a new encoder starts the chunk with an IDR and is drained at its end
+mfxStatus CpuEncodeChunks::EncodeChunk(const std::vector<AVFrame *> &frames,
+                                       std::vector<AVPacket *> *packets) {
+    std::unique_ptr<CpuEncode> encoder(new CpuEncode(m_session));
+    RET_IF_FALSE(encoder, MFX_ERR_MEMORY_ALLOC);
+
+    mfxVideoParam par = m_chunkParam;
+    RET_ERROR(encoder->InitEncode(&par));
+
+    for (AVFrame *frame : frames)
+        RET_ERROR(encoder->EncodeAVFrame(frame, packets));
+    return encoder->EncodeAVFrame(nullptr, packets);
+}
+
+// next packet in input order, waits for the last chunks when draining
+mfxStatus CpuEncodeChunks::DeliverPacket(mfxBitstream *bs, mfxSyncPoint *syncp) {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    if (m_draining) {
+        VPL_TRACE("chunks wait");
+        m_ready.wait(lock, [&] {
+            return !m_packets.empty() || !m_tasks;
+        });
+    }
+
+    // packets of chunks encoded before an error are still delivered
+    if (m_packets.empty()) {
+        RET_ERROR(m_error);
+        return MFX_ERR_MORE_DATA;
+    }
+
+    // a packet which does not fit stays queued for the next call
+    AVPacket *pkt = m_packets.front();
+    RET_ERROR(m_session->GetEncoder()->WritePacket(pkt, bs));
+    m_packets.pop_front();
+    av_packet_free(&pkt);
+    lock.unlock();
+
+    // payload is already in bs
+    return m_session->GetScheduler()->Complete(syncp, MFX_ERR_NONE);
+}
@@ -0,0 +1,87 @@
+/*############################################################################
+  # Copyright (C) 2020 Intel Corporation
+  #
+  # SPDX-License-Identifier: MIT
+  ############################################################################*/
+
+#ifndef CPU_SRC_CPU_CHUNK_H_
+#define CPU_SRC_CPU_CHUNK_H_
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <vector>
+#include "src/cpu_common.h"
+#include "src/frame_lock.h"
+
+class CpuEncode;
+class CpuWorkstream;
+
+// GOP-split encode for throughput beyond what one encoder instance scales to
+// Input is copied and collected until NumChunk chunks are complete, then
+//   each chunk is encoded by an encoder of its own on the shared thread
+//   pool, in a task on the encode lane so the next chunks are collected
+//   meanwhile. Packets are output in input order, chunk after chunk, and
+//   keep the timestamps of their input, so the stream is continuous.
+// Up to two sets of chunks are held as raw frames, which is the memory
+//   cost of this mode, so sets are made smaller to keep that below
+//   VPL_CHUNK_MAX_BYTES (see LimitChunks()).
+class CpuEncodeChunks {
+public:
+    explicit CpuEncodeChunks(CpuWorkstream* session);
+    ~CpuEncodeChunks();
+
+    static bool IsEnabled(mfxVideoParam* par);
+
+    // par is what the session encoder was initialized with
+    mfxStatus InitChunks(mfxVideoParam* par);
+    // collect surface and output the next packet, surface == 0 encodes
+    //   what is left and drains
+    mfxStatus EncodeFrame(mfxEncodeCtrl* ctrl,
+                          mfxFrameSurface1* surface,
+                          mfxBitstream* bs,
+                          mfxSyncPoint* syncp);
+
+private:
+    static mfxExtCpuEncodeChunks* GetChunksBuffer(mfxVideoParam* par);
+    void LimitChunks(const mfxFrameInfo& info, mfxU32 gop);
+    mfxStatus AddSurface(mfxFrameSurface1* surface);
+    mfxStatus SubmitChunks();
+    mfxStatus EncodeChunk(const std::vector<AVFrame*>& frames, std::vector<AVPacket*>* packets);
+    mfxStatus DeliverPacket(mfxBitstream* bs, mfxSyncPoint* syncp);
+
+    CpuWorkstream* m_session;
+    FrameLock m_input_locker;
+
+    // what chunk encoders are initialized with, ext buffers point to the
+    //   copies below since the application's are gone by then
+    mfxVideoParam m_chunkParam;
+    std::vector<mfxExtBuffer*> m_extParam;
+    mfxExtEncoderROI m_roi;
+    mfxExtCodingOption2 m_codingOption2;
+
+    mfxU32 m_chunkFrames;
+    int m_numChunk;
+    // input of the chunks being collected
+    std::vector<AVFrame*> m_input;
+    // 90 kHz, for input without a time stamp
+    int64_t m_frameDuration;
+    int64_t m_nextPts;
+    // input already collected for the packet which did not fit
+    mfxFrameSurface1* m_pendingSurface;
+    bool m_draining;
+
+    std::mutex m_mutex;
+    std::condition_variable m_ready;
+    std::deque<AVPacket*> m_packets;
+    // chunk sets queued or encoding
+    int m_tasks;
+    // first error from the encode lane, reported by the next call
+    mfxStatus m_error;
+
+    /* copy not allowed */
+    CpuEncodeChunks(const CpuEncodeChunks&);
+    CpuEncodeChunks& operator=(const CpuEncodeChunks&);
+};
+
+#endif // CPU_SRC_CPU_CHUNK_H_
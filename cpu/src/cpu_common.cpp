@@ -5,8 +5,13 @@
   ############################################################################*/
 
 #include "src/cpu_common.h"
+#include "src/cpu_copy.h"
 #include "src/frame_lock.h"
 
+#if defined(_MSC_VER)
+    #include <intrin.h>
+#endif
+
 AVPixelFormat MFXFourCC2AVPixelFormat(uint32_t fourcc) {
     switch (fourcc) {
         case MFX_FOURCC_I010:
@@ -39,6 +44,10 @@ uint32_t AVPixelFormat2MFXFourCC(int format) {
     return 0;
 }
 
+bool IsSemiPlanarFourCC(uint32_t fourcc) {
+    return fourcc == MFX_FOURCC_NV12 || fourcc == MFX_FOURCC_P010;
+}
+
 AVCodecID MFXCodecId_to_AVCodecID(mfxU32 CodecId) {
     switch (CodecId) {
         case MFX_CODEC_AVC:
@@ -67,33 +76,35 @@ mfxU32 AVCodecID_to_MFXCodecId(AVCodecID CodecId) {
     return 0;
 }
 
-mfxStatus AVFrame2mfxFrameSurface(mfxFrameSurface1 *surface,
-                                  AVFrame *frame,
-                                  mfxFrameAllocator *allocator) {
-    FrameLock locker;
-    RET_ERROR(locker.Lock(surface, MFX_MAP_WRITE, allocator));
-    mfxFrameData *data = locker.GetData();
+mfxStatus AVFrame2mfxFrameInfo(mfxFrameSurface1 *surface, AVFrame *frame) {
     mfxFrameInfo *info = &surface->Info;
 
-    mfxU32 w, h, y, pitch, offset;
-
-    RET_IF_FALSE(info->Width == frame->width && info->Height == frame->height,
+    // surface may be padded, e.g. when allocated with aligned dimensions
+    RET_IF_FALSE(info->Width >= frame->width && info->Height >= frame->height,
                  MFX_ERR_INCOMPATIBLE_VIDEO_PARAM);
 
     info->CropX = 0;
     info->CropY = 0;
     info->CropW = frame->width;
     info->CropH = frame->height;
+    // planar frames are interleaved for NV12 and P010 surfaces
     switch (frame->format) {
         case AV_PIX_FMT_YUV420P10LE:
-            info->FourCC         = MFX_FOURCC_I010;
+        case AV_PIX_FMT_P010LE:
+            if (frame->format == AV_PIX_FMT_P010LE || info->FourCC != MFX_FOURCC_P010)
+                info->FourCC = AVPixelFormat2MFXFourCC(frame->format);
             info->BitDepthLuma   = 10;
             info->BitDepthChroma = 10;
             info->ChromaFormat   = MFX_CHROMAFORMAT_YUV420;
+            info->Shift          = (info->FourCC == MFX_FOURCC_P010) ? 1 : 0;
             break;
         case AV_PIX_FMT_YUV420P:
         case AV_PIX_FMT_YUVJ420P:
-            info->FourCC         = MFX_FOURCC_IYUV;
+        case AV_PIX_FMT_NV12:
+            if (frame->format == AV_PIX_FMT_NV12)
+                info->FourCC = MFX_FOURCC_NV12;
+            else if (info->FourCC != MFX_FOURCC_NV12)
+                info->FourCC = MFX_FOURCC_IYUV;
             info->BitDepthLuma   = 8;
             info->BitDepthChroma = 8;
             info->ChromaFormat   = MFX_CHROMAFORMAT_YUV420;
@@ -119,70 +130,149 @@ mfxStatus AVFrame2mfxFrameSurface(mfxFrameSurface1 *surface,
         info->AspectRatioW = frame->sample_aspect_ratio.num;
         info->AspectRatioH = frame->sample_aspect_ratio.den;
     }
+
+    if (frame->pts) {
+        surface->Data.TimeStamp = frame->pts;
+        surface->Data.DataFlag  = MFX_FRAMEDATA_ORIGINAL_TIMESTAMP;
+    }
+
+    return MFX_ERR_NONE;
+}
+
+mfxStatus AVFrame2mfxFrameData(mfxFrameSurface1 *surface,
+                               AVFrame *frame,
+                               mfxFrameAllocator *allocator) {
+    FrameLock locker;
+    RET_ERROR(locker.Lock(surface, MFX_MAP_WRITE, allocator));
+    mfxFrameData *data = locker.GetData();
+    mfxFrameInfo *info = &surface->Info;
+
+    mfxU32 w, h, pitch, offset;
+
+    // planar output is interleaved on the fly for NV12 and P010 surfaces
+    bool interleave = false;
     if (frame->format == AV_PIX_FMT_YUV420P10LE) {
-        RET_IF_FALSE(info->FourCC == MFX_FOURCC_I010, MFX_ERR_INCOMPATIBLE_VIDEO_PARAM);
+        RET_IF_FALSE(info->FourCC == MFX_FOURCC_I010 || info->FourCC == MFX_FOURCC_P010,
+                     MFX_ERR_INCOMPATIBLE_VIDEO_PARAM);
 
-        w = info->Width * 2;
-        h = info->Height;
+        w          = frame->width * 2;
+        h          = frame->height;
+        interleave = (info->FourCC == MFX_FOURCC_P010);
     }
     else if (frame->format == AV_PIX_FMT_YUV420P || frame->format == AV_PIX_FMT_YUVJ420P) {
-        RET_IF_FALSE(info->FourCC == MFX_FOURCC_I420, MFX_ERR_INCOMPATIBLE_VIDEO_PARAM);
+        RET_IF_FALSE(info->FourCC == MFX_FOURCC_I420 || info->FourCC == MFX_FOURCC_NV12,
+                     MFX_ERR_INCOMPATIBLE_VIDEO_PARAM);
+
+        w          = frame->width;
+        h          = frame->height;
+        interleave = (info->FourCC == MFX_FOURCC_NV12);
+    }
+    else if (frame->format == AV_PIX_FMT_NV12) {
+        RET_IF_FALSE(info->FourCC == MFX_FOURCC_NV12, MFX_ERR_INCOMPATIBLE_VIDEO_PARAM);
+
+        w = frame->width;
+        h = frame->height;
+    }
+    else if (frame->format == AV_PIX_FMT_P010LE) {
+        RET_IF_FALSE(info->FourCC == MFX_FOURCC_P010, MFX_ERR_INCOMPATIBLE_VIDEO_PARAM);
 
-        w = info->Width;
-        h = info->Height;
+        w = frame->width * 2;
+        h = frame->height;
     }
     else if (frame->format == AV_PIX_FMT_BGRA) {
         RET_IF_FALSE(info->FourCC == MFX_FOURCC_RGB4, MFX_ERR_INCOMPATIBLE_VIDEO_PARAM);
 
-        w = info->Width * 4;
-        h = info->Height;
+        w = frame->width * 4;
+        h = frame->height;
     }
     else {
         RET_ERROR(MFX_ERR_INCOMPATIBLE_VIDEO_PARAM);
     }
 
-    pitch = data->Pitch;
+    pitch  = data->Pitch;
+    offset = pitch * info->CropY + info->CropX;
 
     if (frame->format == AV_PIX_FMT_BGRA) {
-        for (y = 0; y < h; y++) {
-            offset = pitch * (y + info->CropY) + info->CropX;
-            memcpy_s(data->B + offset, w, frame->data[0] + y * frame->linesize[0], w);
-        }
+        CopyPlane(data->B + offset, pitch, frame->data[0], frame->linesize[0], w, h);
     }
-    else {
-        // copy Y plane
-        for (y = 0; y < h; y++) {
-            offset = pitch * (y + info->CropY) + info->CropX;
-            memcpy_s(data->Y + offset, w, frame->data[0] + y * frame->linesize[0], w);
-        }
-
-        // copy U plane
-        for (y = 0; y < h / 2; y++) {
-            offset = pitch / 2 * (y + info->CropY) + info->CropX;
-            memcpy_s(data->U + offset, w / 2, frame->data[1] + y * frame->linesize[1], w / 2);
-        }
+    else if (interleave) {
+        bool p010 = (info->FourCC == MFX_FOURCC_P010);
+        if (p010)
+            ShiftPlane(data->Y + offset, pitch, frame->data[0], frame->linesize[0], w / 2, h, true);
+        else
+            CopyPlane(data->Y + offset, pitch, frame->data[0], frame->linesize[0], w, h);
+
+        offset = pitch * (info->CropY / 2) + info->CropX;
+        InterleavePlanes(data->UV + offset,
+                         pitch,
+                         frame->data[1],
+                         frame->linesize[1],
+                         frame->data[2],
+                         frame->linesize[2],
+                         (frame->width + 1) / 2,
+                         (frame->height + 1) / 2,
+                         p010);
+    }
+    else if (frame->format == AV_PIX_FMT_NV12 || frame->format == AV_PIX_FMT_P010LE) {
+        CopyPlane(data->Y + offset, pitch, frame->data[0], frame->linesize[0], w, h);
 
-        // copy V plane
-        for (y = 0; y < h / 2; y++) {
-            offset = pitch / 2 * (y + info->CropY) + info->CropX;
-            memcpy_s(data->V + offset, w / 2, frame->data[2] + y * frame->linesize[2], w / 2);
-        }
+        offset = pitch * (info->CropY / 2) + info->CropX;
+        CopyPlane(data->UV + offset, pitch, frame->data[1], frame->linesize[1], w, (h + 1) / 2);
     }
+    else {
+        CopyPlane(data->Y + offset, pitch, frame->data[0], frame->linesize[0], w, h);
 
-    if (frame->pts) {
-        surface->Data.TimeStamp = frame->pts;
-        surface->Data.DataFlag  = MFX_FRAMEDATA_ORIGINAL_TIMESTAMP;
+        offset = pitch / 2 * info->CropY + info->CropX;
+        CopyPlane(data->U + offset, pitch / 2, frame->data[1], frame->linesize[1], w / 2, h / 2);
+        CopyPlane(data->V + offset, pitch / 2, frame->data[2], frame->linesize[2], w / 2, h / 2);
     }
 
     return MFX_ERR_NONE;
 }
 
+mfxStatus AVFrame2mfxFrameSurface(mfxFrameSurface1 *surface,
+                                  AVFrame *frame,
+                                  mfxFrameAllocator *allocator) {
+    RET_ERROR(AVFrame2mfxFrameInfo(surface, frame));
+    return AVFrame2mfxFrameData(surface, frame, allocator);
+}
+
+// effective AsyncDepth, par may be null for internal use
+mfxU16 GetAsyncDepth(mfxVideoParam *par) {
+    if (!par || !par->AsyncDepth)
+        return VPL_DEFAULT_ASYNC_DEPTH;
+
+    return (par->AsyncDepth > VPL_MAX_ASYNC_DEPTH) ? VPL_MAX_ASYNC_DEPTH : par->AsyncDepth;
+}
+
+int GetNumThread(mfxVideoParam *par) {
+#ifdef ENABLE_LIBAV_AUTO_THREADS
+    return par->mfx.NumThread;
+#else
+    return par->mfx.NumThread ? par->mfx.NumThread : 1;
+#endif
+}
+
+bool IsLowLatency(mfxVideoParam *par) {
+    return par && par->AsyncDepth == 1;
+}
+
+// frame threading delays output by one frame per thread, so only
+//   slices are threaded in low latency mode
+int GetThreadType(mfxVideoParam *par) {
+    if (IsLowLatency(par))
+        return FF_THREAD_SLICE;
+    return FF_THREAD_FRAME | FF_THREAD_SLICE;
+}
+
 mfxStatus CheckFrameInfoCommon(mfxFrameInfo *info, mfxU32 codecId) {
     RET_IF_FALSE(info, MFX_ERR_NULL_PTR);
 
     switch (info->FourCC) {
         case MFX_FOURCC_I420:
         case MFX_FOURCC_I010:
+        case MFX_FOURCC_NV12:
+        case MFX_FOURCC_P010:
             break;
         default:
             return MFX_ERR_INVALID_VIDEO_PARAM;
@@ -203,17 +293,17 @@ mfxStatus CheckFrameInfoCommon(mfxFrameInfo *info, mfxU32 codecId) {
     if (info->BitDepthLuma > 8 || info->BitDepthChroma > 8) {
         switch (info->FourCC) {
             case MFX_FOURCC_I010:
-                //case MFX_FOURCC_P010: // for later
+            case MFX_FOURCC_P010:
                 break;
             default:
                 return MFX_ERR_INVALID_VIDEO_PARAM;
         }
     }
 
-    // for later, shift = 1 for ms10bit in msdk
-    //if (info->FourCC == MFX_FOURCC_P010) {
-    //    RET_IF_FALSE(info->Shift, MFX_ERR_INVALID_VIDEO_PARAM);
-    //}
+    // P010 samples are in the high bits (shift = 1 for ms10bit in msdk)
+    if (info->FourCC == MFX_FOURCC_P010) {
+        RET_IF_FALSE(info->Shift, MFX_ERR_INVALID_VIDEO_PARAM);
+    }
 
     RET_IF_FALSE(info->ChromaFormat == MFX_CHROMAFORMAT_YUV420, MFX_ERR_INVALID_VIDEO_PARAM);
     RET_IF_FALSE((info->FrameRateExtN == 0 && info->FrameRateExtD == 0) ||
@@ -232,13 +322,14 @@ mfxStatus CheckFrameInfoCodecs(mfxFrameInfo *info, mfxU32 codecId) {
 
     switch (codecId) {
         case MFX_CODEC_JPEG:
-            if (info->FourCC != MFX_FOURCC_I420)
+            if (info->FourCC != MFX_FOURCC_I420 && info->FourCC != MFX_FOURCC_NV12)
                 return MFX_ERR_INVALID_VIDEO_PARAM;
             break;
         case MFX_CODEC_AVC:
         case MFX_CODEC_HEVC:
         case MFX_CODEC_AV1:
-            if (info->FourCC != MFX_FOURCC_I420 && info->FourCC != MFX_FOURCC_I010)
+            if (info->FourCC != MFX_FOURCC_I420 && info->FourCC != MFX_FOURCC_I010 &&
+                info->FourCC != MFX_FOURCC_NV12 && info->FourCC != MFX_FOURCC_P010)
                 return MFX_ERR_INVALID_VIDEO_PARAM;
             break;
         default:
@@ -298,3 +389,25 @@ mfxStatus CheckVideoParamCommon(mfxVideoParam *in) {
 
     return MFX_ERR_NONE;
 }
+
+void AddLocked(mfxFrameData *data, int delta) {
+#if defined(_MSC_VER)
+    volatile short *locked = reinterpret_cast<volatile short *>(&data->Locked);
+    if (delta > 0)
+        _InterlockedIncrement16(locked);
+    else
+        _InterlockedDecrement16(locked);
+#else
+    __atomic_fetch_add(&data->Locked, static_cast<mfxU16>(delta), __ATOMIC_ACQ_REL);
+#endif
+}
+
+mfxU16 GetLocked(const mfxFrameData *data) {
+#if defined(_MSC_VER)
+    volatile short *locked =
+        reinterpret_cast<volatile short *>(const_cast<mfxU16 *>(&data->Locked));
+    return static_cast<mfxU16>(_InterlockedCompareExchange16(locked, 0, 0));
+#else
+    return __atomic_load_n(&data->Locked, __ATOMIC_ACQUIRE);
+#endif
+}
@@ -14,12 +14,101 @@
 #include <string>
 #include <vector>
 
+#include "vpl/mfxcpu.h"
 #include "vpl/mfxjpeg.h"
 #include "vpl/mfxstructures.h"
 #include "vpl/mfxvideo.h"
 
 #define ENABLE_LIBAV_AUTO_THREADS
 
+// frames in flight per component (mfxVideoParam::AsyncDepth)
+// default is used when the application leaves AsyncDepth at 0
+#define VPL_MAX_ASYNC_DEPTH     16
+#define VPL_DEFAULT_ASYNC_DEPTH 4
+
+// Tunables
+// Each one can be overridden at build time (-DVPL_<NAME>=<value>).
+//
+// surface pools (src/cpu_frame_pool.h, MFXMemory_GetSurfaceFor*)
+//   POOL_MAX_BYTES         frame data after which a pool stops growing,
+//                          0 = no limit, the VPL_POOL_MAX_BYTES environment
+//                          variable overrides it at run time
+//   POOL_ALLOC_TIMEOUT     ms to wait for a released surface at the limit
+//                          before MFX_WRN_ALLOC_TIMEOUT_EXPIRED
+//   POOL_TRIM_IDLE_FRAMES  requests after which surfaces above the initial
+//                          size are freed if unused, 0 = never
+// threads (src/cpu_thread_pool.h)
+//   THREAD_BUDGET          threads shared by all sessions, 0 = cores
+// plane copies (src/cpu_copy.h)
+//   COPY_SPLIT_THRESHOLD   plane bytes from which a copy is split
+//   COPY_MAX_THREADS       threads on one copy including the caller,
+//                          1 = no splitting, capped by the budget
+//   COPY_STREAM_THRESHOLD  plane bytes from which non-temporal stores
+//                          are used, 0 = size of the last level cache
+// components
+//   VPP_MAX_OUTPUTS        mfxExtCpuVPPOutputs outputs per VPP session,
+//                          each one a scaler and a buffersink
+//   LADDER_MAX_RUNGS       mfxExtCpuEncodeLadder rungs, each one an encoder
+//   JPEG_KEEP_FULL_RANGE   1 = 4:2:0 MJPEG output is relabeled yuv420p
+//                          instead of converted to limited range
+//   ROI_PRIORITY_QP_STEP   QP offset per MFX_ROI_MODE_PRIORITY level
+//   LOOKAHEAD_DEPTH        MFX_RATECONTROL_LA depth when LookAheadDepth = 0
+//   CHUNK_THREADS          codec threads per chunk encoder when
+//                          mfxExtCpuEncodeChunks leaves NumChunk at 0
+//   CHUNK_MAX_BYTES        raw input held by chunked encode, ChunkGops
+//                          and NumChunk are lowered to stay below it,
+//                          down to one GOP, 0 = no limit
+//   FRAME_LOCK_CACHE_SIZE  AVFrame wrappers kept by one FrameLock
+//   TRACE_BUFFER_EVENTS    events kept per thread for VPL_TRACE_FILE
+#ifndef VPL_POOL_MAX_BYTES
+    #define VPL_POOL_MAX_BYTES (512 << 20)
+#endif
+#ifndef VPL_POOL_ALLOC_TIMEOUT
+    #define VPL_POOL_ALLOC_TIMEOUT 100
+#endif
+#ifndef VPL_POOL_TRIM_IDLE_FRAMES
+    #define VPL_POOL_TRIM_IDLE_FRAMES 120
+#endif
+#ifndef VPL_THREAD_BUDGET
+    #define VPL_THREAD_BUDGET 0
+#endif
+#ifndef VPL_COPY_SPLIT_THRESHOLD
+    #define VPL_COPY_SPLIT_THRESHOLD (1 << 20)
+#endif
+#ifndef VPL_COPY_MAX_THREADS
+    #define VPL_COPY_MAX_THREADS 4
+#endif
+#ifndef VPL_COPY_STREAM_THRESHOLD
+    #define VPL_COPY_STREAM_THRESHOLD 0
+#endif
+#ifndef VPL_VPP_MAX_OUTPUTS
+    #define VPL_VPP_MAX_OUTPUTS 8
+#endif
+#ifndef VPL_LADDER_MAX_RUNGS
+    #define VPL_LADDER_MAX_RUNGS 8
+#endif
+#ifndef VPL_JPEG_KEEP_FULL_RANGE
+    #define VPL_JPEG_KEEP_FULL_RANGE 0
+#endif
+#ifndef VPL_ROI_PRIORITY_QP_STEP
+    #define VPL_ROI_PRIORITY_QP_STEP 3
+#endif
+#ifndef VPL_LOOKAHEAD_DEPTH
+    #define VPL_LOOKAHEAD_DEPTH 40
+#endif
+#ifndef VPL_CHUNK_THREADS
+    #define VPL_CHUNK_THREADS 4
+#endif
+#ifndef VPL_CHUNK_MAX_BYTES
+    #define VPL_CHUNK_MAX_BYTES (1024 << 20)
+#endif
+#ifndef VPL_FRAME_LOCK_CACHE_SIZE
+    #define VPL_FRAME_LOCK_CACHE_SIZE 64
+#endif
+#ifndef VPL_TRACE_BUFFER_EVENTS
+    #define VPL_TRACE_BUFFER_EVENTS (1 << 16)
+#endif
+
 // TODO(m) do we need this?
 #if !defined(WIN32) && !defined(memcpy_s)
     #define memcpy_s(dest, destsz, src, count) memcpy(dest, src, count)
@@ -48,6 +137,7 @@ extern "C" {
 #endif
 
 // ITT and console tracing
+#include "src/cpu_trace.h"
 #ifdef VPL_ENABLE_CONSOLE_TRACING
     #include <iostream>
 class TraceObject {
@@ -63,11 +153,20 @@ protected:
     const char* m_name;
 };
 
-    #define VPL_TRACE(_NAME) TraceObject trace_object(_NAME)
+    #define VPL_TRACE(_NAME) TraceObject VPL_TRACE_VAR(__LINE__)(_NAME)
 #else
-    #define VPL_TRACE(_NAME)
+    // recorded only when VPL_TRACE_FILE is set (src/cpu_trace.h)
+    #define VPL_TRACE(_NAME) CpuTraceScope VPL_TRACE_VAR(__LINE__)(_NAME)
 #endif
-#define VPL_TRACE_FUNC VPL_TRACE(__FUNCTION__)
+#define VPL_TRACE_VAR(_LINE)      VPL_TRACE_VAR_JOIN(_LINE)
+#define VPL_TRACE_VAR_JOIN(_LINE) trace_object_##_LINE
+#define VPL_TRACE_FUNC            VPL_TRACE(__FUNCTION__)
+// evaluates _EXPR as its own trace event, e.g. a single libav call
+#define VPL_TRACE_CALL(_NAME, _EXPR) \
+    [&]() {                          \
+        VPL_TRACE(_NAME);            \
+        return _EXPR;                \
+    }()
 
 // Returns from current function if (value<0)
 #define RET_ERROR(_VAR)                                                             \
@@ -102,6 +201,8 @@ protected:
 
 AVPixelFormat MFXFourCC2AVPixelFormat(uint32_t fourcc);
 uint32_t AVPixelFormat2MFXFourCC(int format);
+// NV12 and P010, 4:2:0 with interleaved chroma
+bool IsSemiPlanarFourCC(uint32_t fourcc);
 
 AVCodecID MFXCodecId_to_AVCodecID(mfxU32 CodecId);
 mfxU32 AVCodecID_to_MFXCodecId(AVCodecID CodecId);
@@ -109,11 +210,34 @@ mfxU32 AVCodecID_to_MFXCodecId(AVCodecID CodecId);
 std::shared_ptr<AVFrame> GetAVFrameFromMfxSurface(mfxFrameSurface1* surface,
                                                   mfxFrameAllocator* allocator);
 
+// set frame info and timestamp of mfxFrameSurface1 from AVFrame
+mfxStatus AVFrame2mfxFrameInfo(mfxFrameSurface1* surface, AVFrame* frame);
+
+// copy image data only, surface info must already match the frame
+mfxStatus AVFrame2mfxFrameData(mfxFrameSurface1* surface,
+                               AVFrame* frame,
+                               mfxFrameAllocator* allocator);
+
 // copy image data from AVFrame to mfxFrameSurface1
 mfxStatus AVFrame2mfxFrameSurface(mfxFrameSurface1* surface,
                                   AVFrame* frame,
                                   mfxFrameAllocator* allocator);
 
+// Data.Locked tells the application when a surface can be reused, it is
+//   changed from lane workers, codec threads and buffer free callbacks
+void AddLocked(mfxFrameData* data, int delta);
+mfxU16 GetLocked(const mfxFrameData* data);
+
+mfxU16 GetAsyncDepth(mfxVideoParam* par);
+// AsyncDepth 1 = one frame in, one frame out, as soon as it is complete
+bool IsLowLatency(mfxVideoParam* par);
+
+// libav codec threads for mfx.NumThread, 0 = automatic share of the
+//   thread budget
+int GetNumThread(mfxVideoParam* par);
+// FF_THREAD_* for a codec context
+int GetThreadType(mfxVideoParam* par);
+
 mfxStatus CheckFrameInfoCommon(mfxFrameInfo* info, mfxU32 codecId);
 mfxStatus CheckFrameInfoCodecs(mfxFrameInfo* info, mfxU32 codecId);
 mfxStatus CheckVideoParamCommon(mfxVideoParam* in);
@@ -0,0 +1,691 @@
+/*############################################################################
+  # Copyright (C) 2020 Intel Corporation
+  #
+  # SPDX-License-Identifier: MIT
+  ############################################################################*/
+
+#include "src/cpu_copy.h"
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+#include "src/cpu_thread_pool.h"
+
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+    #define VPL_COPY_X86
+    #include <immintrin.h>
+    #if defined(_MSC_VER)
+        #include <intrin.h>
+        #define VPL_TARGET_AVX2
+        #define VPL_TARGET_AVX512
+    #else
+        #define VPL_TARGET_AVX2   __attribute__((target("avx2")))
+        #define VPL_TARGET_AVX512 __attribute__((target("avx512f")))
+    #endif
+#endif
+
+#if defined(_WIN32)
+    #define NOMINMAX
+    #include <windows.h>
+#else
+    #include <unistd.h>
+#endif
+
+// used when no threshold is set at build time and the cache size is unknown
+#define DEFAULT_STREAM_THRESHOLD (8 << 20)
+
+// copy one row, stream = bypass the cache with non-temporal stores
+typedef void (*CopyRowFunc)(uint8_t *dst, const uint8_t *src, size_t size, bool stream);
+
+static void CopyRowC(uint8_t *dst, const uint8_t *src, size_t size, bool stream) {
+    memcpy(dst, src, size);
+}
+
+#ifdef VPL_COPY_X86
+static VPL_TARGET_AVX2 void CopyRowAVX2(uint8_t *dst,
+                                        const uint8_t *src,
+                                        size_t size,
+                                        bool stream) {
+    if (stream) {
+        // non-temporal stores need an aligned destination
+        size_t head = (32 - (reinterpret_cast<uintptr_t>(dst) & 31)) & 31;
+        head        = std::min(head, size);
+        memcpy(dst, src, head);
+        dst += head;
+        src += head;
+        size -= head;
+
+        for (; size >= 128; size -= 128, src += 128, dst += 128) {
+            __m256i r0 = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(src));
+            __m256i r1 = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(src + 32));
+            __m256i r2 = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(src + 64));
+            __m256i r3 = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(src + 96));
+            _mm256_stream_si256(reinterpret_cast<__m256i *>(dst), r0);
+            _mm256_stream_si256(reinterpret_cast<__m256i *>(dst + 32), r1);
+            _mm256_stream_si256(reinterpret_cast<__m256i *>(dst + 64), r2);
+            _mm256_stream_si256(reinterpret_cast<__m256i *>(dst + 96), r3);
+        }
+    }
+    else {
+        for (; size >= 128; size -= 128, src += 128, dst += 128) {
+            __m256i r0 = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(src));
+            __m256i r1 = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(src + 32));
+            __m256i r2 = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(src + 64));
+            __m256i r3 = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(src + 96));
+            _mm256_storeu_si256(reinterpret_cast<__m256i *>(dst), r0);
+            _mm256_storeu_si256(reinterpret_cast<__m256i *>(dst + 32), r1);
+            _mm256_storeu_si256(reinterpret_cast<__m256i *>(dst + 64), r2);
+            _mm256_storeu_si256(reinterpret_cast<__m256i *>(dst + 96), r3);
+        }
+    }
+    memcpy(dst, src, size);
+}
+
+static VPL_TARGET_AVX512 void CopyRowAVX512(uint8_t *dst,
+                                            const uint8_t *src,
+                                            size_t size,
+                                            bool stream) {
+    if (stream) {
+        // non-temporal stores need an aligned destination
+        size_t head = (64 - (reinterpret_cast<uintptr_t>(dst) & 63)) & 63;
+        head        = std::min(head, size);
+        memcpy(dst, src, head);
+        dst += head;
+        src += head;
+        size -= head;
+
+        for (; size >= 256; size -= 256, src += 256, dst += 256) {
+            __m512i r0 = _mm512_loadu_si512(src);
+            __m512i r1 = _mm512_loadu_si512(src + 64);
+            __m512i r2 = _mm512_loadu_si512(src + 128);
+            __m512i r3 = _mm512_loadu_si512(src + 192);
+            _mm512_stream_si512(reinterpret_cast<__m512i *>(dst), r0);
+            _mm512_stream_si512(reinterpret_cast<__m512i *>(dst + 64), r1);
+            _mm512_stream_si512(reinterpret_cast<__m512i *>(dst + 128), r2);
+            _mm512_stream_si512(reinterpret_cast<__m512i *>(dst + 192), r3);
+        }
+    }
+    else {
+        for (; size >= 256; size -= 256, src += 256, dst += 256) {
+            __m512i r0 = _mm512_loadu_si512(src);
+            __m512i r1 = _mm512_loadu_si512(src + 64);
+            __m512i r2 = _mm512_loadu_si512(src + 128);
+            __m512i r3 = _mm512_loadu_si512(src + 192);
+            _mm512_storeu_si512(dst, r0);
+            _mm512_storeu_si512(dst + 64, r1);
+            _mm512_storeu_si512(dst + 128, r2);
+            _mm512_storeu_si512(dst + 192, r3);
+        }
+    }
+    memcpy(dst, src, size);
+}
+#endif
+
+// 4:2:0 chroma conversions between planar (I420, I010) and interleaved
+//   (NV12, P010) layouts, P010 keeps its 10 bits in the high bits
+#define P010_SHIFT 6
+
+typedef void (*InterleaveRowFunc)(uint8_t *dst, const uint8_t *u, const uint8_t *v, int width);
+typedef void (*DeinterleaveRowFunc)(uint8_t *u, uint8_t *v, const uint8_t *src, int width);
+typedef void (*ShiftRowFunc)(uint16_t *dst, const uint16_t *src, int width, bool left);
+
+static void InterleaveRow8C(uint8_t *dst, const uint8_t *u, const uint8_t *v, int width) {
+    for (int x = 0; x < width; x++) {
+        dst[2 * x]     = u[x];
+        dst[2 * x + 1] = v[x];
+    }
+}
+
+static void InterleaveRow16C(uint8_t *dst, const uint8_t *u, const uint8_t *v, int width) {
+    uint16_t *dst16     = reinterpret_cast<uint16_t *>(dst);
+    const uint16_t *u16 = reinterpret_cast<const uint16_t *>(u);
+    const uint16_t *v16 = reinterpret_cast<const uint16_t *>(v);
+    for (int x = 0; x < width; x++) {
+        dst16[2 * x]     = static_cast<uint16_t>(u16[x] << P010_SHIFT);
+        dst16[2 * x + 1] = static_cast<uint16_t>(v16[x] << P010_SHIFT);
+    }
+}
+
+static void DeinterleaveRow8C(uint8_t *u, uint8_t *v, const uint8_t *src, int width) {
+    for (int x = 0; x < width; x++) {
+        u[x] = src[2 * x];
+        v[x] = src[2 * x + 1];
+    }
+}
+
+static void DeinterleaveRow16C(uint8_t *u, uint8_t *v, const uint8_t *src, int width) {
+    uint16_t *u16         = reinterpret_cast<uint16_t *>(u);
+    uint16_t *v16         = reinterpret_cast<uint16_t *>(v);
+    const uint16_t *src16 = reinterpret_cast<const uint16_t *>(src);
+    for (int x = 0; x < width; x++) {
+        u16[x] = src16[2 * x] >> P010_SHIFT;
+        v16[x] = src16[2 * x + 1] >> P010_SHIFT;
+    }
+}
+
+static void ShiftRowC(uint16_t *dst, const uint16_t *src, int width, bool left) {
+    for (int x = 0; x < width; x++)
+        dst[x] = left ? static_cast<uint16_t>(src[x] << P010_SHIFT) : src[x] >> P010_SHIFT;
+}
+
+#ifdef VPL_COPY_X86
+// unpack works within 128 bit lanes, the lane halves are put back in
+//   order with permute2x128
+static VPL_TARGET_AVX2 void InterleaveRow8AVX2(uint8_t *dst,
+                                               const uint8_t *u,
+                                               const uint8_t *v,
+                                               int width) {
+    int x = 0;
+    for (; x + 32 <= width; x += 32) {
+        __m256i ru = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(u + x));
+        __m256i rv = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(v + x));
+        __m256i lo = _mm256_unpacklo_epi8(ru, rv);
+        __m256i hi = _mm256_unpackhi_epi8(ru, rv);
+        _mm256_storeu_si256(reinterpret_cast<__m256i *>(dst + 2 * x),
+                            _mm256_permute2x128_si256(lo, hi, 0x20));
+        _mm256_storeu_si256(reinterpret_cast<__m256i *>(dst + 2 * x + 32),
+                            _mm256_permute2x128_si256(lo, hi, 0x31));
+    }
+    InterleaveRow8C(dst + 2 * x, u + x, v + x, width - x);
+}
+
+static VPL_TARGET_AVX2 void InterleaveRow16AVX2(uint8_t *dst,
+                                                const uint8_t *u,
+                                                const uint8_t *v,
+                                                int width) {
+    int x = 0;
+    for (; x + 16 <= width; x += 16) {
+        __m256i ru = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(u + 2 * x));
+        __m256i rv = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(v + 2 * x));
+        ru         = _mm256_slli_epi16(ru, P010_SHIFT);
+        rv         = _mm256_slli_epi16(rv, P010_SHIFT);
+        __m256i lo = _mm256_unpacklo_epi16(ru, rv);
+        __m256i hi = _mm256_unpackhi_epi16(ru, rv);
+        _mm256_storeu_si256(reinterpret_cast<__m256i *>(dst + 4 * x),
+                            _mm256_permute2x128_si256(lo, hi, 0x20));
+        _mm256_storeu_si256(reinterpret_cast<__m256i *>(dst + 4 * x + 32),
+                            _mm256_permute2x128_si256(lo, hi, 0x31));
+    }
+    InterleaveRow16C(dst + 4 * x, u + 2 * x, v + 2 * x, width - x);
+}
+
+// pack works within 128 bit lanes as well, permute4x64 restores the order
+static VPL_TARGET_AVX2 void DeinterleaveRow8AVX2(uint8_t *u,
+                                                 uint8_t *v,
+                                                 const uint8_t *src,
+                                                 int width) {
+    const __m256i mask = _mm256_set1_epi16(0x00FF);
+    int x              = 0;
+    for (; x + 32 <= width; x += 32) {
+        __m256i a  = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(src + 2 * x));
+        __m256i b  = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(src + 2 * x + 32));
+        __m256i ru = _mm256_packus_epi16(_mm256_and_si256(a, mask), _mm256_and_si256(b, mask));
+        __m256i rv = _mm256_packus_epi16(_mm256_srli_epi16(a, 8), _mm256_srli_epi16(b, 8));
+        _mm256_storeu_si256(reinterpret_cast<__m256i *>(u + x),
+                            _mm256_permute4x64_epi64(ru, 0xD8));
+        _mm256_storeu_si256(reinterpret_cast<__m256i *>(v + x),
+                            _mm256_permute4x64_epi64(rv, 0xD8));
+    }
+    DeinterleaveRow8C(u + x, v + x, src + 2 * x, width - x);
+}
+
+static VPL_TARGET_AVX2 void DeinterleaveRow16AVX2(uint8_t *u,
+                                                  uint8_t *v,
+                                                  const uint8_t *src,
+                                                  int width) {
+    const __m256i mask = _mm256_set1_epi32(0xFFFF);
+    int x              = 0;
+    for (; x + 16 <= width; x += 16) {
+        __m256i a  = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(src + 4 * x));
+        __m256i b  = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(src + 4 * x + 32));
+        __m256i ru = _mm256_packus_epi32(_mm256_and_si256(a, mask), _mm256_and_si256(b, mask));
+        __m256i rv = _mm256_packus_epi32(_mm256_srli_epi32(a, 16), _mm256_srli_epi32(b, 16));
+        ru         = _mm256_srli_epi16(_mm256_permute4x64_epi64(ru, 0xD8), P010_SHIFT);
+        rv         = _mm256_srli_epi16(_mm256_permute4x64_epi64(rv, 0xD8), P010_SHIFT);
+        _mm256_storeu_si256(reinterpret_cast<__m256i *>(u + 2 * x), ru);
+        _mm256_storeu_si256(reinterpret_cast<__m256i *>(v + 2 * x), rv);
+    }
+    DeinterleaveRow16C(u + 2 * x, v + 2 * x, src + 4 * x, width - x);
+}
+
+static VPL_TARGET_AVX2 void ShiftRowAVX2(uint16_t *dst, const uint16_t *src, int width, bool left) {
+    int x = 0;
+    for (; x + 16 <= width; x += 16) {
+        __m256i r = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(src + x));
+        r         = left ? _mm256_slli_epi16(r, P010_SHIFT) : _mm256_srli_epi16(r, P010_SHIFT);
+        _mm256_storeu_si256(reinterpret_cast<__m256i *>(dst + x), r);
+    }
+    ShiftRowC(dst + x, src + x, width - x, left);
+}
+#endif
+
+// full to limited range, out = offset + (in - bias) * scale / 2^15 with
+//   the rounding of pmulhrsw, so both kernels give the same samples
+#define LUMA_RANGE_SCALE   28142 // 219/255
+#define CHROMA_RANGE_SCALE 28784 // 224/255
+
+typedef void (*RangeRowFunc)(uint8_t *data, int width, bool chroma);
+
+static int LimitRangeSample(int in, bool chroma) {
+    int bias  = chroma ? 128 : 0;
+    int scale = chroma ? CHROMA_RANGE_SCALE : LUMA_RANGE_SCALE;
+    int out   = ((in - bias) * scale + (1 << 14)) >> 15;
+    return out + (chroma ? 128 : 16);
+}
+
+static void LimitRangeRowC(uint8_t *data, int width, bool chroma) {
+    struct Tables {
+        uint8_t luma[256];
+        uint8_t chroma[256];
+        Tables() {
+            for (int i = 0; i < 256; i++) {
+                luma[i]   = static_cast<uint8_t>(LimitRangeSample(i, false));
+                chroma[i] = static_cast<uint8_t>(LimitRangeSample(i, true));
+            }
+        }
+    };
+    static const Tables tables;
+
+    const uint8_t *lut = chroma ? tables.chroma : tables.luma;
+    for (int x = 0; x < width; x++)
+        data[x] = lut[data[x]];
+}
+
+#ifdef VPL_COPY_X86
+// unpack and packus are both per 128 bit lane, so samples keep their order
+static VPL_TARGET_AVX2 void LimitRangeRowAVX2(uint8_t *data, int width, bool chroma) {
+    const __m256i zero   = _mm256_setzero_si256();
+    const __m256i bias   = _mm256_set1_epi16(chroma ? 128 : 0);
+    const __m256i scale  = _mm256_set1_epi16(chroma ? CHROMA_RANGE_SCALE : LUMA_RANGE_SCALE);
+    const __m256i offset = _mm256_set1_epi16(chroma ? 128 : 16);
+    int x                = 0;
+    for (; x + 32 <= width; x += 32) {
+        __m256i r  = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(data + x));
+        __m256i lo = _mm256_sub_epi16(_mm256_unpacklo_epi8(r, zero), bias);
+        __m256i hi = _mm256_sub_epi16(_mm256_unpackhi_epi8(r, zero), bias);
+        lo         = _mm256_add_epi16(_mm256_mulhrs_epi16(lo, scale), offset);
+        hi         = _mm256_add_epi16(_mm256_mulhrs_epi16(hi, scale), offset);
+        _mm256_storeu_si256(reinterpret_cast<__m256i *>(data + x), _mm256_packus_epi16(lo, hi));
+    }
+    LimitRangeRowC(data + x, width - x, chroma);
+}
+#endif
+
+enum CopyISA { COPY_ISA_C, COPY_ISA_AVX2, COPY_ISA_AVX512 };
+
+static CopyISA DetectISA() {
+#if defined(VPL_COPY_X86) && defined(_MSC_VER)
+    int info[4];
+    __cpuid(info, 0);
+    int max_leaf = info[0];
+    __cpuid(info, 1);
+    bool osxsave = (info[2] & (1 << 27)) != 0;
+    if (!osxsave || max_leaf < 7)
+        return COPY_ISA_C;
+
+    // registers must be enabled by the OS as well
+    unsigned long long xcr0 = _xgetbv(0);
+    __cpuidex(info, 7, 0);
+    if ((xcr0 & 0xe6) == 0xe6 && (info[1] & (1 << 16)))
+        return COPY_ISA_AVX512;
+    if ((xcr0 & 0x06) == 0x06 && (info[1] & (1 << 5)))
+        return COPY_ISA_AVX2;
+    return COPY_ISA_C;
+#elif defined(VPL_COPY_X86)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f"))
+        return COPY_ISA_AVX512;
+    if (__builtin_cpu_supports("avx2"))
+        return COPY_ISA_AVX2;
+    return COPY_ISA_C;
+#else
+    return COPY_ISA_C;
+#endif
+}
+
+static CopyISA GetISA() {
+    static const CopyISA isa = DetectISA();
+    return isa;
+}
+
+static CopyRowFunc SelectCopyRow() {
+    switch (GetISA()) {
+#ifdef VPL_COPY_X86
+        case COPY_ISA_AVX512:
+            return CopyRowAVX512;
+        case COPY_ISA_AVX2:
+            return CopyRowAVX2;
+#endif
+        default:
+            return CopyRowC;
+    }
+}
+
+static void StoreFence() {
+#ifdef VPL_COPY_X86
+    _mm_sfence();
+#endif
+}
+
+static size_t GetStreamThreshold() {
+#if VPL_COPY_STREAM_THRESHOLD
+    return VPL_COPY_STREAM_THRESHOLD;
+#else
+    size_t cache_size = 0;
+    #if defined(_WIN32)
+    DWORD len = 0;
+    GetLogicalProcessorInformation(nullptr, &len);
+    std::vector<SYSTEM_LOGICAL_PROCESSOR_INFORMATION> procs(
+        len / sizeof(SYSTEM_LOGICAL_PROCESSOR_INFORMATION));
+    if (!procs.empty() && GetLogicalProcessorInformation(procs.data(), &len)) {
+        for (auto &proc : procs) {
+            if (proc.Relationship == RelationCache && proc.Cache.Level == 3)
+                cache_size = std::max(cache_size, static_cast<size_t>(proc.Cache.Size));
+        }
+    }
+    #elif defined(_SC_LEVEL3_CACHE_SIZE)
+    long l3 = sysconf(_SC_LEVEL3_CACHE_SIZE);
+    if (l3 > 0)
+        cache_size = static_cast<size_t>(l3);
+    #endif
+    return cache_size ? cache_size : DEFAULT_STREAM_THRESHOLD;
+#endif
+}
+
+// run rows_func(first, count) over rows, split across copy threads when
+//   plane_size is large enough
+template <typename RowsFunc>
+static void ForEachStripe(size_t plane_size, int rows, RowsFunc rows_func) {
+    static const int max_threads =
+        std::max(1, std::min(VPL_COPY_MAX_THREADS, CpuThreadPool::Get().GetThreadCount()));
+
+    int stripes = 1;
+    if (max_threads > 1 && plane_size >= VPL_COPY_SPLIT_THRESHOLD)
+        stripes = std::min(max_threads, rows);
+
+    if (stripes > 1) {
+        int stripe_rows = (rows + stripes - 1) / stripes;
+        CpuThreadPool::Get().Run(stripes, [&](int stripe) {
+            int first = stripe * stripe_rows;
+            int count = std::min(stripe_rows, rows - first);
+            if (count > 0)
+                rows_func(first, count);
+        });
+        return;
+    }
+
+    rows_func(0, rows);
+}
+
+void CopyPlane(uint8_t *dst,
+               int dst_pitch,
+               const uint8_t *src,
+               int src_pitch,
+               int row_size,
+               int rows) {
+    VPL_TRACE_FUNC;
+    static const CopyRowFunc copy_row    = SelectCopyRow();
+    static const size_t stream_threshold = GetStreamThreshold();
+
+    if (row_size <= 0 || rows <= 0)
+        return;
+
+    size_t plane_size = static_cast<size_t>(row_size) * rows;
+    bool stream       = (copy_row != CopyRowC) && plane_size >= stream_threshold;
+
+    auto copy_rows = [&](int first, int count) {
+        for (int y = first; y < first + count; y++) {
+            copy_row(dst + static_cast<ptrdiff_t>(y) * dst_pitch,
+                     src + static_cast<ptrdiff_t>(y) * src_pitch,
+                     row_size,
+                     stream);
+        }
+        // non-temporal stores are weakly ordered
+        if (stream)
+            StoreFence();
+    };
+
+    ForEachStripe(plane_size, rows, copy_rows);
+}
+
+AVFrame *CopyAVFrame(const AVFrame *frame) {
+    VPL_TRACE_FUNC;
+    AVPixelFormat format           = static_cast<AVPixelFormat>(frame->format);
+    const AVPixFmtDescriptor *desc = av_pix_fmt_desc_get(format);
+    RET_IF_FALSE(desc, nullptr);
+
+    AVFrame *copy = av_frame_alloc();
+    RET_IF_FALSE(copy, nullptr);
+
+    copy->format = frame->format;
+    copy->width  = frame->width;
+    copy->height = frame->height;
+    if (av_frame_get_buffer(copy, 0) < 0 || av_frame_copy_props(copy, frame) < 0) {
+        av_frame_free(&copy);
+        return nullptr;
+    }
+
+    int planes = av_pix_fmt_count_planes(format);
+    for (int i = 0; i < planes; i++) {
+        int rows = frame->height;
+        if (i == 1 || i == 2)
+            rows = AV_CEIL_RSHIFT(frame->height, desc->log2_chroma_h);
+
+        CopyPlane(copy->data[i],
+                  copy->linesize[i],
+                  frame->data[i],
+                  frame->linesize[i],
+                  av_image_get_linesize(format, frame->width, i),
+                  rows);
+    }
+
+    return copy;
+}
+
+// conversions have AVX2 and C kernels only
+static InterleaveRowFunc SelectInterleaveRow(bool p010) {
+#ifdef VPL_COPY_X86
+    if (GetISA() != COPY_ISA_C)
+        return p010 ? InterleaveRow16AVX2 : InterleaveRow8AVX2;
+#endif
+    return p010 ? InterleaveRow16C : InterleaveRow8C;
+}
+
+static DeinterleaveRowFunc SelectDeinterleaveRow(bool p010) {
+#ifdef VPL_COPY_X86
+    if (GetISA() != COPY_ISA_C)
+        return p010 ? DeinterleaveRow16AVX2 : DeinterleaveRow8AVX2;
+#endif
+    return p010 ? DeinterleaveRow16C : DeinterleaveRow8C;
+}
+
+static ShiftRowFunc SelectShiftRow() {
+#ifdef VPL_COPY_X86
+    if (GetISA() != COPY_ISA_C)
+        return ShiftRowAVX2;
+#endif
+    return ShiftRowC;
+}
+
+static RangeRowFunc SelectRangeRow() {
+#ifdef VPL_COPY_X86
+    if (GetISA() != COPY_ISA_C)
+        return LimitRangeRowAVX2;
+#endif
+    return LimitRangeRowC;
+}
+
+void InterleavePlanes(uint8_t *dst,
+                      int dst_pitch,
+                      const uint8_t *src_u,
+                      int u_pitch,
+                      const uint8_t *src_v,
+                      int v_pitch,
+                      int width,
+                      int rows,
+                      bool p010) {
+    VPL_TRACE_FUNC;
+    static const InterleaveRowFunc row8  = SelectInterleaveRow(false);
+    static const InterleaveRowFunc row16 = SelectInterleaveRow(true);
+    InterleaveRowFunc row                = p010 ? row16 : row8;
+
+    if (width <= 0 || rows <= 0)
+        return;
+
+    size_t plane_size = static_cast<size_t>(width) * rows * (p010 ? 4 : 2);
+    ForEachStripe(plane_size, rows, [&](int first, int count) {
+        for (int y = first; y < first + count; y++) {
+            row(dst + static_cast<ptrdiff_t>(y) * dst_pitch,
+                src_u + static_cast<ptrdiff_t>(y) * u_pitch,
+                src_v + static_cast<ptrdiff_t>(y) * v_pitch,
+                width);
+        }
+    });
+}
+
+void DeinterleavePlane(uint8_t *dst_u,
+                       int u_pitch,
+                       uint8_t *dst_v,
+                       int v_pitch,
+                       const uint8_t *src,
+                       int src_pitch,
+                       int width,
+                       int rows,
+                       bool p010) {
+    VPL_TRACE_FUNC;
+    static const DeinterleaveRowFunc row8  = SelectDeinterleaveRow(false);
+    static const DeinterleaveRowFunc row16 = SelectDeinterleaveRow(true);
+    DeinterleaveRowFunc row                = p010 ? row16 : row8;
+
+    if (width <= 0 || rows <= 0)
+        return;
+
+    size_t plane_size = static_cast<size_t>(width) * rows * (p010 ? 4 : 2);
+    ForEachStripe(plane_size, rows, [&](int first, int count) {
+        for (int y = first; y < first + count; y++) {
+            row(dst_u + static_cast<ptrdiff_t>(y) * u_pitch,
+                dst_v + static_cast<ptrdiff_t>(y) * v_pitch,
+                src + static_cast<ptrdiff_t>(y) * src_pitch,
+                width);
+        }
+    });
+}
+
+void ShiftPlane(uint8_t *dst,
+                int dst_pitch,
+                const uint8_t *src,
+                int src_pitch,
+                int width,
+                int rows,
+                bool to_p010) {
+    VPL_TRACE_FUNC;
+    static const ShiftRowFunc shift_row = SelectShiftRow();
+
+    if (width <= 0 || rows <= 0)
+        return;
+
+    size_t plane_size = static_cast<size_t>(width) * rows * 2;
+    ForEachStripe(plane_size, rows, [&](int first, int count) {
+        for (int y = first; y < first + count; y++) {
+            uint8_t *dst_row       = dst + static_cast<ptrdiff_t>(y) * dst_pitch;
+            const uint8_t *src_row = src + static_cast<ptrdiff_t>(y) * src_pitch;
+            shift_row(reinterpret_cast<uint16_t *>(dst_row),
+                      reinterpret_cast<const uint16_t *>(src_row),
+                      width,
+                      to_p010);
+        }
+    });
+}
+
+void LimitRangePlane(uint8_t *data, int pitch, int width, int rows, bool chroma) {
+    VPL_TRACE_FUNC;
+    static const RangeRowFunc range_row = SelectRangeRow();
+
+    if (width <= 0 || rows <= 0)
+        return;
+
+    size_t plane_size = static_cast<size_t>(width) * rows;
+    ForEachStripe(plane_size, rows, [&](int first, int count) {
+        for (int y = first; y < first + count; y++)
+            range_row(data + static_cast<ptrdiff_t>(y) * pitch, width, chroma);
+    });
+}
+
+AVFrame *ConvertAVFrame(const AVFrame *frame, AVPixelFormat format) {
+    VPL_TRACE_FUNC;
+    if (frame->format == format)
+        return CopyAVFrame(frame);
+
+    // only the layout of 4:2:0 chroma changes, the bit depth stays
+    bool to_semi_planar = false;
+    bool p010           = false;
+    if (frame->format == AV_PIX_FMT_YUV420P && format == AV_PIX_FMT_NV12) {
+        to_semi_planar = true;
+    }
+    else if (frame->format == AV_PIX_FMT_YUV420P10LE && format == AV_PIX_FMT_P010LE) {
+        to_semi_planar = true;
+        p010           = true;
+    }
+    else if (frame->format == AV_PIX_FMT_P010LE && format == AV_PIX_FMT_YUV420P10LE) {
+        p010 = true;
+    }
+    else if (frame->format != AV_PIX_FMT_NV12 || format != AV_PIX_FMT_YUV420P) {
+        return nullptr;
+    }
+
+    AVFrame *copy = av_frame_alloc();
+    RET_IF_FALSE(copy, nullptr);
+
+    copy->format = format;
+    copy->width  = frame->width;
+    copy->height = frame->height;
+    if (av_frame_get_buffer(copy, 0) < 0 || av_frame_copy_props(copy, frame) < 0) {
+        av_frame_free(&copy);
+        return nullptr;
+    }
+
+    if (p010) {
+        ShiftPlane(copy->data[0],
+                   copy->linesize[0],
+                   frame->data[0],
+                   frame->linesize[0],
+                   frame->width,
+                   frame->height,
+                   to_semi_planar);
+    }
+    else {
+        CopyPlane(copy->data[0],
+                  copy->linesize[0],
+                  frame->data[0],
+                  frame->linesize[0],
+                  frame->width,
+                  frame->height);
+    }
+
+    int chroma_width  = AV_CEIL_RSHIFT(frame->width, 1);
+    int chroma_height = AV_CEIL_RSHIFT(frame->height, 1);
+    if (to_semi_planar) {
+        InterleavePlanes(copy->data[1],
+                         copy->linesize[1],
+                         frame->data[1],
+                         frame->linesize[1],
+                         frame->data[2],
+                         frame->linesize[2],
+                         chroma_width,
+                         chroma_height,
+                         p010);
+    }
+    else {
+        DeinterleavePlane(copy->data[1],
+                          copy->linesize[1],
+                          copy->data[2],
+                          copy->linesize[2],
+                          frame->data[1],
+                          frame->linesize[1],
+                          chroma_width,
+                          chroma_height,
+                          p010);
+    }
+
+    return copy;
+}
@@ -0,0 +1,72 @@
+/*############################################################################
+  # Copyright (C) 2020 Intel Corporation
+  #
+  # SPDX-License-Identifier: MIT
+  ############################################################################*/
+
+#ifndef CPU_SRC_CPU_COPY_H_
+#define CPU_SRC_CPU_COPY_H_
+
+#include "src/cpu_common.h"
+
+// Image copies which cannot be avoided (surfaces which libav can not
+//   decode into, input staging for encode and VPP) go through here.
+// NV12 and P010 are converted to and from the planar layouts the libav
+//   codecs use with interleaving kernels of their own.
+// Rows are copied with the widest kernel the CPU supports (AVX-512,
+//   AVX2 or memcpy). Large planes are split across a few threads of the
+//   shared pool and written with non-temporal stores once they no longer
+//   fit in cache.
+
+// copy rows bytes wide from src to dst
+void CopyPlane(uint8_t* dst,
+               int dst_pitch,
+               const uint8_t* src,
+               int src_pitch,
+               int row_size,
+               int rows);
+
+// 4:2:0 chroma layout conversions, width and rows count chroma samples
+// p010 = 16 bit samples, 10 bits in the low bits of the planar side
+//   and in the high bits of the interleaved (P010) side
+// u and v planes to one interleaved uv plane (I420 to NV12, I010 to P010)
+void InterleavePlanes(uint8_t* dst,
+                      int dst_pitch,
+                      const uint8_t* src_u,
+                      int u_pitch,
+                      const uint8_t* src_v,
+                      int v_pitch,
+                      int width,
+                      int rows,
+                      bool p010);
+// interleaved uv plane to u and v planes (NV12 to I420, P010 to I010)
+void DeinterleavePlane(uint8_t* dst_u,
+                       int u_pitch,
+                       uint8_t* dst_v,
+                       int v_pitch,
+                       const uint8_t* src,
+                       int src_pitch,
+                       int width,
+                       int rows,
+                       bool p010);
+// 16 bit luma between I010 (low bits) and P010 (high bits)
+void ShiftPlane(uint8_t* dst,
+                int dst_pitch,
+                const uint8_t* src,
+                int src_pitch,
+                int width,
+                int rows,
+                bool to_p010);
+// 8 bit samples from full (JPEG) to limited (MPEG) range in place,
+//   luma to 16..235, chroma to 16..240
+void LimitRangePlane(uint8_t* data, int pitch, int width, int rows, bool chroma);
+
+// refcounted copy of frame
+// libav consumers (encoders, buffersrc) copy frames which are not
+//   refcounted themselves, this does the same with CopyPlane()
+AVFrame* CopyAVFrame(const AVFrame* frame);
+// refcounted copy of frame in format, which is the format of frame or
+//   its planar/interleaved counterpart (I420/NV12, I010/P010)
+AVFrame* ConvertAVFrame(const AVFrame* frame, AVPixelFormat format);
+
+#endif // CPU_SRC_CPU_COPY_H_
@@ -5,9 +5,14 @@
   ############################################################################*/
 
 #include "src/cpu_decode.h"
+#include <algorithm>
+#include <cstdint>
 #include <memory>
 #include <utility>
+#include "src/cpu_copy.h"
+#include "src/cpu_thread_pool.h"
 #include "src/cpu_workstream.h"
+#include "src/frame_lock.h"
 
 CpuDecode::CpuDecode(CpuWorkstream *session)
         : m_session(session),
@@ -20,8 +25,44 @@ CpuDecode::CpuDecode(CpuWorkstream *session)
           m_param(),
           m_decSurfaces(),
           m_frameOrder(0),
+          m_bOneInOneOut(false),
           m_bStreamInfo(false),
-          m_bFrameBuffered(false) {}
+          m_bFrameBuffered(false),
+          m_workSurface(nullptr),
+          m_workMutex(),
+          m_bufferMutex(),
+          m_surfaceBuffers(),
+          m_threadCount(0),
+          m_skipLevel(0),
+          m_packetCount(0),
+          m_packetMutex(),
+          m_pendingPackets(),
+          m_skippedFrames(0),
+          m_stats() {}
+
+// load shedding steps for SetSkipMode(), each one drops more work than
+//   the one before it
+static const struct {
+    AVDiscard frame;
+    AVDiscard loop_filter;
+    AVDiscard idct;
+} skipLadder[] = {
+    { AVDISCARD_DEFAULT, AVDISCARD_DEFAULT, AVDISCARD_DEFAULT }, // no skipping
+    { AVDISCARD_DEFAULT, AVDISCARD_NONREF, AVDISCARD_DEFAULT }, // deblock refs only
+    { AVDISCARD_NONREF, AVDISCARD_NONREF, AVDISCARD_DEFAULT }, // drop non-ref frames
+    { AVDISCARD_NONREF, AVDISCARD_ALL, AVDISCARD_DEFAULT }, // no deblocking
+    { AVDISCARD_BIDIR, AVDISCARD_ALL, AVDISCARD_BIDIR }, // drop all B frames
+    { AVDISCARD_NONKEY, AVDISCARD_ALL, AVDISCARD_NONREF }, // key frames only
+};
+
+// application surface memory handed out to libavcodec
+// lock keeps the surface mapped and marked in use (Data.Locked or
+//   AddRef) for as long as the decoder references the picture
+struct DecodeSurfaceBuffer {
+    CpuDecode *decoder;
+    mfxFrameSurface1 *surface;
+    FrameLock lock;
+};
 
 mfxStatus CpuDecode::ValidateDecodeParams(mfxVideoParam *par, bool canCorrect) {
     bool fixedIncompatible = false;
@@ -38,11 +79,10 @@ mfxStatus CpuDecode::ValidateDecodeParams(mfxVideoParam *par, bool canCorrect) {
 
     // General params
     if (canCorrect) {
-        if (par->AsyncDepth > 16)
-            par->AsyncDepth = 16;
-
-        if (!par->AsyncDepth)
-            par->AsyncDepth = 1;
+        // 0 is left as is, it selects the default depth while 1 selects
+        //   low latency
+        if (par->AsyncDepth > VPL_MAX_ASYNC_DEPTH)
+            par->AsyncDepth = VPL_MAX_ASYNC_DEPTH;
 
         if (par->Protected)
             par->Protected = 0;
@@ -54,12 +94,9 @@ mfxStatus CpuDecode::ValidateDecodeParams(mfxVideoParam *par, bool canCorrect) {
 
         if (!par->mfx.FrameInfo.FourCC)
             par->mfx.FrameInfo.FourCC = MFX_FOURCC_I420;
-
-        if (par->mfx.NumThread)
-            par->mfx.NumThread = 0; //not supported
     }
     else {
-        if (par->AsyncDepth > 16) {
+        if (par->AsyncDepth > VPL_MAX_ASYNC_DEPTH) {
             return MFX_ERR_INVALID_VIDEO_PARAM;
         }
 
@@ -71,17 +108,16 @@ mfxStatus CpuDecode::ValidateDecodeParams(mfxVideoParam *par, bool canCorrect) {
         if (par->IOPattern != MFX_IOPATTERN_OUT_SYSTEM_MEMORY)
             return MFX_ERR_INVALID_VIDEO_PARAM;
 
-        if (par->mfx.NumThread)
-            return MFX_ERR_INVALID_VIDEO_PARAM;
-
         if ((par->mfx.FrameInfo.ChromaFormat) &&
             (par->mfx.FrameInfo.ChromaFormat != MFX_CHROMAFORMAT_YUV420))
             return MFX_ERR_INVALID_VIDEO_PARAM;
     }
 
-    //only I420 and I010 colorspaces allowed
+    // pictures are decoded as I420 or I010, NV12 and P010 surfaces get
+    //   them interleaved on output
     switch (par->mfx.FrameInfo.FourCC) {
         case MFX_FOURCC_I420:
+        case MFX_FOURCC_NV12:
             if (canCorrect) {
                 if (par->mfx.FrameInfo.BitDepthLuma && par->mfx.FrameInfo.BitDepthLuma != 8)
                     fixedIncompatible = true;
@@ -102,6 +138,7 @@ mfxStatus CpuDecode::ValidateDecodeParams(mfxVideoParam *par, bool canCorrect) {
             }
             break;
         case MFX_FOURCC_I010:
+        case MFX_FOURCC_P010:
             if (canCorrect) {
                 if (par->mfx.FrameInfo.BitDepthLuma && par->mfx.FrameInfo.BitDepthLuma != 10)
                     fixedIncompatible = true;
@@ -110,6 +147,8 @@ mfxStatus CpuDecode::ValidateDecodeParams(mfxVideoParam *par, bool canCorrect) {
                 par->mfx.FrameInfo.BitDepthLuma   = 10;
                 par->mfx.FrameInfo.BitDepthChroma = 10;
                 par->mfx.FrameInfo.ChromaFormat   = MFX_CHROMAFORMAT_YUV420;
+                if (par->mfx.FrameInfo.FourCC == MFX_FOURCC_P010)
+                    par->mfx.FrameInfo.Shift = 1;
             }
             else {
                 if (par->mfx.FrameInfo.BitDepthLuma && (par->mfx.FrameInfo.BitDepthLuma != 10))
@@ -187,13 +226,32 @@ mfxStatus CpuDecode::InitDecode(mfxVideoParam *par, mfxBitstream *bs) {
         return MFX_ERR_INVALID_VIDEO_PARAM;
     }
 
-#ifdef ENABLE_LIBAV_AUTO_THREADS
-    m_avDecContext->thread_count = 0;
+    // codec threads count against the process wide budget
+    m_threadCount                = CpuThreadPool::Get().AcquireThreads(GetNumThread(par));
+    m_avDecContext->thread_count = m_threadCount;
+    m_avDecContext->thread_type  = GetThreadType(par);
+
+    // no output delay beyond what the stream's reordering requires
+    // the parser still holds a frame back until the next one starts,
+    //   low latency input should be sent with MFX_BITSTREAM_COMPLETE_FRAME
+    if (IsLowLatency(par))
+        m_avDecContext->flags |= AV_CODEC_FLAG_LOW_DELAY;
+
+    // with frame threading get_buffer2 runs on the codec's threads,
+    //   GetBuffer2() takes the offered surface under m_workMutex
+    if (m_avDecCodec->capabilities & AV_CODEC_CAP_DR1) {
+        m_avDecContext->opaque      = this;
+        m_avDecContext->get_buffer2 = GetBuffer2;
+#if LIBAVCODEC_VERSION_INT < AV_VERSION_INT(58, 134, 100)
+        m_avDecContext->thread_safe_callbacks = 1;
 #endif
+    }
 
     if (avcodec_open2(m_avDecContext, m_avDecCodec, NULL) < 0) {
         return MFX_ERR_INVALID_VIDEO_PARAM;
     }
+    m_bOneInOneOut = !(m_avDecCodec->capabilities & AV_CODEC_CAP_DELAY) &&
+                     !(m_avDecContext->active_thread_type & FF_THREAD_FRAME);
 
     m_avDecPacket = av_packet_alloc();
     if (!m_avDecPacket) {
@@ -206,6 +264,7 @@ mfxStatus CpuDecode::InitDecode(mfxVideoParam *par, mfxBitstream *bs) {
     }
 
     m_param = *par;
+    m_session->GetScheduler()->SetDepth(VPL_TASK_LANE_DECODE, GetAsyncDepth(&m_param));
 
     if (bs) {
         // create copy to not modify caller's mfxBitstream
@@ -214,7 +273,7 @@ mfxStatus CpuDecode::InitDecode(mfxVideoParam *par, mfxBitstream *bs) {
         mfxBitstream bs2 = *bs;
         bs2.DataFlag     = MFX_BITSTREAM_EOS;
         m_bStreamInfo    = true;
-        DecodeFrame(&bs2, nullptr, nullptr);
+        DecodeFrame(&bs2, nullptr, nullptr, nullptr);
         GetVideoParam(par);
     }
 
@@ -246,17 +305,229 @@ CpuDecode::~CpuDecode() {
         avcodec_free_context(&m_avDecContext);
         m_avDecContext = nullptr;
     }
+
+    CpuThreadPool::Get().ReleaseThreads(m_threadCount);
+}
+
+// copy decoded frame into surface
+// with syncp the image data is copied on the decode lane and is only
+//   valid after syncp has been synced, surface info is set immediately
+mfxStatus CpuDecode::SubmitFrameCopy(mfxFrameSurface1 *surface,
+                                     AVFrame *avframe,
+                                     mfxSyncPoint *syncp) {
+    mfxFrameAllocator *allocator = m_session->GetFrameAllocator();
+
+    RET_ERROR(AVFrame2mfxFrameInfo(surface, avframe));
+    if (!syncp)
+        return AVFrame2mfxFrameData(surface, avframe, allocator);
+
+    // new reference, decoder is free to reuse avframe for the next output
+    AVFrame *frame = av_frame_clone(avframe);
+    RET_IF_FALSE(frame, MFX_ERR_MEMORY_ALLOC);
+
+    mfxStatus sts = FrameLock::AddRefSurface(surface);
+    if (sts != MFX_ERR_NONE) {
+        av_frame_free(&frame);
+        return sts;
+    }
+
+    return m_session->GetScheduler()->Submit(
+        VPL_TASK_LANE_DECODE,
+        [surface, frame, allocator]() mutable {
+            mfxStatus sts = AVFrame2mfxFrameData(surface, frame, allocator);
+            av_frame_free(&frame);
+            FrameLock::ReleaseSurface(surface);
+            return sts;
+        },
+        syncp,
+        surface);
+}
+
+int CpuDecode::GetBuffer2(AVCodecContext *avctx, AVFrame *frame, int flags) {
+    CpuDecode *decoder = reinterpret_cast<CpuDecode *>(avctx->opaque);
+
+    // at most one picture per call goes to the application surface
+    {
+        std::lock_guard<std::mutex> lock(decoder->m_workMutex);
+        mfxFrameSurface1 *surface = decoder->m_workSurface;
+        if (surface && decoder->WrapSurface(avctx, surface, frame) == 0) {
+            decoder->m_workSurface = nullptr;
+            return 0;
+        }
+    }
+
+    return avcodec_default_get_buffer2(avctx, frame, flags);
+}
+
+// offer surface to get_buffer2, returns the surface offered before,
+//   nullptr once get_buffer2 took it
+mfxFrameSurface1 *CpuDecode::SetWorkSurface(mfxFrameSurface1 *surface) {
+    std::lock_guard<std::mutex> lock(m_workMutex);
+    mfxFrameSurface1 *previous = m_workSurface;
+    m_workSurface              = surface;
+    return previous;
+}
+
+void CpuDecode::FreeSurfaceBuffer(void *opaque, uint8_t *data) {
+    DecodeSurfaceBuffer *buffer = reinterpret_cast<DecodeSurfaceBuffer *>(opaque);
+    {
+        std::lock_guard<std::mutex> lock(buffer->decoder->m_bufferMutex);
+        buffer->decoder->m_surfaceBuffers.erase(buffer);
+    }
+    FrameLock::ReleaseSurface(buffer->surface);
+    delete buffer; // unlocks the surface
+}
+
+// U and V planes keep a reference on the buffer owning the surface
+void CpuDecode::FreePlaneBuffer(void *opaque, uint8_t *data) {
+    AVBufferRef *parent = reinterpret_cast<AVBufferRef *>(opaque);
+    av_buffer_unref(&parent);
+}
+
+// point frame at the planes of surface, returns 0 on success
+// fails without side effects if the surface cannot hold the picture as
+//   libavcodec needs it, the caller falls back to internal buffers
+int CpuDecode::WrapSurface(AVCodecContext *avctx, mfxFrameSurface1 *surface, AVFrame *frame) {
+    mfxFrameInfo *info = &surface->Info;
+
+    // locked surfaces may still be referenced by the decoder or the application
+    if (GetLocked(&surface->Data))
+        return -1;
+    if (frame->format != AV_PIX_FMT_YUV420P && frame->format != AV_PIX_FMT_YUV420P10LE)
+        return -1;
+    if (frame->format != MFXFourCC2AVPixelFormat(info->FourCC))
+        return -1;
+
+    int width  = frame->width;
+    int height = frame->height;
+    int linesize_align[AV_NUM_DATA_POINTERS];
+    avcodec_align_dimensions2(avctx, &width, &height, linesize_align);
+    if (info->Width < width || info->Height < height)
+        return -1;
+
+    std::unique_ptr<DecodeSurfaceBuffer> buffer(new DecodeSurfaceBuffer);
+    buffer->decoder = this;
+    buffer->surface = surface;
+    if (buffer->lock.Lock(surface, MFX_MAP_WRITE, m_session->GetFrameAllocator()) != MFX_ERR_NONE)
+        return -1;
+
+    mfxFrameData *data   = buffer->lock.GetData();
+    int sample_size      = (frame->format == AV_PIX_FMT_YUV420P10LE) ? 2 : 1;
+    uint8_t *planes[3]   = { data->Y, data->U, data->V };
+    int pitches[3]       = { data->Pitch, data->Pitch / 2, data->Pitch / 2 };
+    int row_sizes[3]     = { width * sample_size,
+                         (width + 1) / 2 * sample_size,
+                         (width + 1) / 2 * sample_size };
+    int plane_heights[3] = { height, (height + 1) / 2, (height + 1) / 2 };
+    for (int i = 0; i < 3; i++) {
+        if (!planes[i] || pitches[i] < row_sizes[i])
+            return -1;
+        if (pitches[i] % linesize_align[i] ||
+            reinterpret_cast<uintptr_t>(planes[i]) % linesize_align[i])
+            return -1;
+    }
+
+    if (FrameLock::AddRefSurface(surface) != MFX_ERR_NONE)
+        return -1;
+
+    {
+        std::lock_guard<std::mutex> lock(m_bufferMutex);
+        m_surfaceBuffers.insert(buffer.get());
+    }
+    frame->buf[0] = av_buffer_create(planes[0],
+                                     pitches[0] * plane_heights[0],
+                                     FreeSurfaceBuffer,
+                                     buffer.get(),
+                                     0);
+    if (!frame->buf[0]) {
+        {
+            std::lock_guard<std::mutex> lock(m_bufferMutex);
+            m_surfaceBuffers.erase(buffer.get());
+        }
+        FrameLock::ReleaseSurface(surface);
+        return -1;
+    }
+    buffer.release(); // owned by buf[0] from here on
+
+    for (int i = 1; i < 3; i++) {
+        AVBufferRef *parent = av_buffer_ref(frame->buf[0]);
+        if (parent) {
+            frame->buf[i] = av_buffer_create(planes[i],
+                                             pitches[i] * plane_heights[i],
+                                             FreePlaneBuffer,
+                                             parent,
+                                             0);
+        }
+        if (!frame->buf[i]) {
+            av_buffer_unref(&parent);
+            for (int j = 0; j < i; j++)
+                av_buffer_unref(&frame->buf[j]);
+            return -1;
+        }
+    }
+
+    for (int i = 0; i < 3; i++) {
+        frame->data[i]     = planes[i];
+        frame->linesize[i] = pitches[i];
+    }
+    frame->extended_data = frame->data;
+
+    return 0;
+}
+
+bool CpuDecode::IsWrappedSurface(mfxFrameSurface1 *surface) {
+    std::lock_guard<std::mutex> lock(m_bufferMutex);
+    for (DecodeSurfaceBuffer *buffer : m_surfaceBuffers) {
+        if (buffer->surface == surface)
+            return true;
+    }
+    return false;
+}
+
+// application surface frame was decoded into, or nullptr if frame
+//   lives in libavcodec's own buffers
+mfxFrameSurface1 *CpuDecode::GetWrappedSurface(AVFrame *frame) {
+    if (!frame->buf[0])
+        return nullptr;
+
+    DecodeSurfaceBuffer *buffer =
+        reinterpret_cast<DecodeSurfaceBuffer *>(av_buffer_get_opaque(frame->buf[0]));
+
+    std::lock_guard<std::mutex> lock(m_bufferMutex);
+    if (m_surfaceBuffers.find(buffer) == m_surfaceBuffers.end())
+        return nullptr;
+    return buffer->surface;
+}
+
+// output is already in place, the task only orders syncp after
+//   earlier work on the decode lane
+mfxStatus CpuDecode::SubmitFrameReady(mfxSyncPoint *syncp) {
+    if (!syncp)
+        return MFX_ERR_NONE;
+
+    return m_session->GetScheduler()->Submit(
+        VPL_TASK_LANE_DECODE,
+        []() {
+            return MFX_ERR_NONE;
+        },
+        syncp);
 }
 
 // bs == 0 is a signal to drain
+// syncp == 0 runs synchronously (internal use)
+// the codec runs on the decode lane, this waits for it when the
+//   outcome decides whether a picture comes out of the call
 mfxStatus CpuDecode::DecodeFrame(mfxBitstream *bs,
                                  mfxFrameSurface1 *surface_work,
-                                 mfxFrameSurface1 **surface_out) {
+                                 mfxFrameSurface1 **surface_out,
+                                 mfxSyncPoint *syncp) {
     if (m_bFrameBuffered) {
         if (surface_work && surface_out) {
-            RET_ERROR(AVFrame2mfxFrameSurface(surface_work,
-                                              m_avDecFrameOut,
-                                              m_session->GetFrameAllocator()));
+            RET_ERROR(SubmitFrameCopy(surface_work, m_avDecFrameOut, syncp));
+
+            CpuFrame *out_frame = CpuFrame::TryCast(surface_work);
+            if (out_frame && syncp)
+                out_frame->SetSyncPoint(m_session->GetScheduler(), *syncp);
 
             surface_work->Data.FrameOrder = m_frameOrder++;
             *surface_out                  = surface_work;
@@ -269,11 +540,21 @@ mfxStatus CpuDecode::DecodeFrame(mfxBitstream *bs,
     }
 
     // Try get AVFrame from surface_work
+    // NV12 and P010 frames are allocated in that layout and get a copy
     AVFrame *avframe    = nullptr;
     CpuFrame *cpu_frame = CpuFrame::TryCast(surface_work);
-    if (cpu_frame) {
+    if (cpu_frame && !IsSemiPlanarFourCC(m_param.mfx.FrameInfo.FourCC)) {
         avframe = cpu_frame->GetAVFrame();
     }
+
+    // other application surfaces are offered to get_buffer2 so the
+    //   decoder can write into them without a copy
+    mfxFrameSurface1 *offered = nullptr;
+    if (surface_work && surface_out && !cpu_frame) {
+        if (IsWrappedSurface(surface_work))
+            return MFX_ERR_MORE_SURFACE; // still a reference picture
+        offered = surface_work;
+    }
     if (!avframe) { // Otherwise use AVFrame allocated in this class
         avframe = m_avDecFrameOut;
     }
@@ -283,6 +564,7 @@ mfxStatus CpuDecode::DecodeFrame(mfxBitstream *bs,
         complete_frame_mode = true;
     }
 
+    CpuScheduler *scheduler = m_session->GetScheduler();
     for (;;) {
         int bytes_parsed = 0;
 
@@ -297,15 +579,16 @@ mfxStatus CpuDecode::DecodeFrame(mfxBitstream *bs,
             // parse
             auto data_ptr = bs ? (bs->Data + bs->DataOffset) : nullptr;
             int data_size = bs ? bs->DataLength : 0;
-            bytes_parsed += av_parser_parse2(m_avDecParser,
-                                             m_avDecContext,
-                                             &m_avDecPacket->data,
-                                             &m_avDecPacket->size,
-                                             data_ptr,
-                                             data_size,
-                                             AV_NOPTS_VALUE,
-                                             AV_NOPTS_VALUE,
-                                             0);
+            bytes_parsed += VPL_TRACE_CALL("av_parser_parse2",
+                                           av_parser_parse2(m_avDecParser,
+                                                            m_avDecContext,
+                                                            &m_avDecPacket->data,
+                                                            &m_avDecPacket->size,
+                                                            data_ptr,
+                                                            data_size,
+                                                            AV_NOPTS_VALUE,
+                                                            AV_NOPTS_VALUE,
+                                                            0));
 
             if (bs && bytes_parsed) {
                 bs->DataOffset += bytes_parsed;
@@ -313,55 +596,72 @@ mfxStatus CpuDecode::DecodeFrame(mfxBitstream *bs,
             }
         }
 
-        // send packet
-        if (m_avDecPacket->size) {
-            if (bs && bs->TimeStamp)
-                m_avDecPacket->pts = bs->TimeStamp;
+        if (m_avDecPacket->size && bs && bs->TimeStamp)
+            m_avDecPacket->pts = bs->TimeStamp;
 
-            auto av_ret = avcodec_send_packet(m_avDecContext, m_avDecPacket);
-            if (av_ret < 0) {
-                return MFX_ERR_ABORTED;
+        // nothing to wait for, the surface goes out now and syncp
+        //   reports the decode
+        if (m_bOneInOneOut && m_avDecPacket->size && surface_work && surface_out && syncp) {
+            if (bs && bs->TimeStamp) {
+                surface_work->Data.TimeStamp = bs->TimeStamp;
+                surface_work->Data.DataFlag  = MFX_FRAMEDATA_ORIGINAL_TIMESTAMP;
             }
+            CpuFrame *direct = (avframe != m_avDecFrameOut) ? cpu_frame : nullptr;
+            RET_ERROR(SubmitPacket(surface_work, direct, syncp));
+            if (cpu_frame)
+                cpu_frame->SetSyncPoint(scheduler, *syncp);
+            surface_work->Data.FrameOrder = m_frameOrder++;
+            *surface_out                  = surface_work;
+            return MFX_ERR_NONE;
         }
 
-        if (!bs) {
-            // null bitstream indicates drain, send EOF packet
-            avcodec_send_packet(m_avDecContext, nullptr);
-        }
+        int av_ret = 0;
+        RET_ERROR(scheduler->Run(VPL_TASK_LANE_DECODE, [&]() {
+            SetWorkSurface(offered);
+            mfxStatus sts = DecodePacket(m_avDecPacket, !bs, avframe, &av_ret);
+            if (SetWorkSurface(nullptr) != offered)
+                offered = nullptr; // taken by get_buffer2
+            return sts;
+        }));
 
-        // receive frame
-        auto av_ret = avcodec_receive_frame(m_avDecContext, avframe);
         if (av_ret == 0) {
-            // in case mjpeg, convert yuvj420p -> yuv420p
-            if (m_avDecContext->codec_id == AV_CODEC_ID_MJPEG) {
-                if (m_avDecContext->pix_fmt != AV_PIX_FMT_YUV420P) {
-                    avframe = ConvertJPEGOutputColorSpace(avframe, AV_PIX_FMT_YUV420P);
-                    if (avframe == nullptr)
-                        return MFX_ERR_ABORTED;
-                }
-            }
             if (m_param.mfx.FrameInfo.Width != m_avDecContext->width ||
                 m_param.mfx.FrameInfo.Height != m_avDecContext->height) {
                 m_param.mfx.FrameInfo.Width  = m_avDecContext->width;
                 m_param.mfx.FrameInfo.Height = m_avDecContext->height;
 
+                // the chroma layout asked for at Init is kept
+                bool semiPlanar = IsSemiPlanarFourCC(m_param.mfx.FrameInfo.FourCC);
                 switch (m_avDecContext->pix_fmt) {
                     case AV_PIX_FMT_YUV420P10LE:
-                        m_param.mfx.FrameInfo.FourCC = MFX_FOURCC_I010;
+                        m_param.mfx.FrameInfo.FourCC =
+                            semiPlanar ? MFX_FOURCC_P010 : MFX_FOURCC_I010;
                         break;
                     case AV_PIX_FMT_YUV420P:
                     case AV_PIX_FMT_YUVJ420P:
                     default:
-                        m_param.mfx.FrameInfo.FourCC = MFX_FOURCC_I420;
+                        m_param.mfx.FrameInfo.FourCC =
+                            semiPlanar ? MFX_FOURCC_NV12 : MFX_FOURCC_I420;
                         break;
                 }
             }
+            mfxFrameSurface1 *wrapped = GetWrappedSurface(avframe);
+            if (surface_out && wrapped) { // decoded in place
+                RET_ERROR(AVFrame2mfxFrameInfo(wrapped, avframe));
+                wrapped->Info.FrameRateExtN = (uint16_t)m_avDecContext->framerate.num;
+                wrapped->Info.FrameRateExtD = (uint16_t)m_avDecContext->framerate.den;
+                wrapped->Data.FrameOrder    = m_frameOrder++;
+                *surface_out                = wrapped;
+
+                // the decoder keeps its own reference while the picture is
+                //   still needed for prediction
+                av_frame_unref(avframe);
+                return SubmitFrameReady(syncp);
+            }
             if (surface_out) {
                 if (avframe == m_avDecFrameOut) { // copy image data
                     m_bFrameBuffered = true;
-                    RET_ERROR(AVFrame2mfxFrameSurface(surface_work,
-                                                      m_avDecFrameOut,
-                                                      m_session->GetFrameAllocator()));
+                    RET_ERROR(SubmitFrameCopy(surface_work, m_avDecFrameOut, syncp));
                     surface_work->Info.FrameRateExtN = (uint16_t)m_avDecContext->framerate.num;
                     surface_work->Info.FrameRateExtD = (uint16_t)m_avDecContext->framerate.den;
                     m_bFrameBuffered                 = false;
@@ -372,7 +672,10 @@ mfxStatus CpuDecode::DecodeFrame(mfxBitstream *bs,
                         surface_work->Info.FrameRateExtN = (uint16_t)m_avDecContext->framerate.num;
                         surface_work->Info.FrameRateExtD = (uint16_t)m_avDecContext->framerate.den;
                     }
+                    RET_ERROR(SubmitFrameReady(syncp));
                 }
+                if (cpu_frame && syncp)
+                    cpu_frame->SetSyncPoint(scheduler, *syncp);
                 surface_work->Data.FrameOrder = m_frameOrder++;
                 *surface_out                  = surface_work;
             }
@@ -386,7 +689,10 @@ mfxStatus CpuDecode::DecodeFrame(mfxBitstream *bs,
                 if (m_bStreamInfo && bs &&
                     ((bs->DataFlag & MFX_BITSTREAM_EOS) == MFX_BITSTREAM_EOS)) {
                     //send a null packet and continue
-                    avcodec_send_packet(m_avDecContext, nullptr);
+                    RET_ERROR(scheduler->Run(VPL_TASK_LANE_DECODE, [this]() {
+                        avcodec_send_packet(m_avDecContext, nullptr);
+                        return MFX_ERR_NONE;
+                    }));
                     m_bStreamInfo = false;
                     continue;
                 }
@@ -402,42 +708,265 @@ mfxStatus CpuDecode::DecodeFrame(mfxBitstream *bs,
     }
 }
 
+// decode one packet into surface on the decode lane, used when the
+//   decoder has no output delay
+// cpu_frame is set for internal surfaces which are decoded into directly
+mfxStatus CpuDecode::SubmitPacket(mfxFrameSurface1 *surface,
+                                  CpuFrame *cpu_frame,
+                                  mfxSyncPoint *syncp) {
+    mfxFrameAllocator *allocator = m_session->GetFrameAllocator();
+
+    // parser output is only valid until the next call
+    AVPacket *pkt = av_packet_alloc();
+    RET_IF_FALSE(pkt, MFX_ERR_MEMORY_ALLOC);
+    if (av_packet_ref(pkt, m_avDecPacket) < 0) {
+        av_packet_free(&pkt);
+        return MFX_ERR_MEMORY_ALLOC;
+    }
+
+    mfxStatus sts = FrameLock::AddRefSurface(surface);
+    if (sts != MFX_ERR_NONE) {
+        av_packet_free(&pkt);
+        return sts;
+    }
+
+    sts = m_session->GetScheduler()->Submit(
+        VPL_TASK_LANE_DECODE,
+        [this, pkt, surface, cpu_frame, allocator]() mutable {
+            AVFrame *avframe = cpu_frame ? cpu_frame->GetAVFrame() : m_avDecFrameOut;
+            int av_ret       = 0;
+            mfxStatus sts    = DecodePacket(pkt, false, avframe, &av_ret);
+            av_packet_free(&pkt);
+
+            // a packet without a picture leaves the surface unwritten
+            if (sts == MFX_ERR_NONE && av_ret != 0)
+                sts = MFX_ERR_ABORTED;
+            if (sts == MFX_ERR_NONE) {
+                if (cpu_frame)
+                    cpu_frame->Update();
+                else
+                    sts = AVFrame2mfxFrameSurface(surface, avframe, allocator);
+                surface->Info.FrameRateExtN = (uint16_t)m_avDecContext->framerate.num;
+                surface->Info.FrameRateExtD = (uint16_t)m_avDecContext->framerate.den;
+            }
+            if (!cpu_frame)
+                av_frame_unref(avframe);
+            FrameLock::ReleaseSurface(surface);
+            return sts;
+        },
+        syncp,
+        surface);
+    if (sts < MFX_ERR_NONE) {
+        av_packet_free(&pkt);
+        FrameLock::ReleaseSurface(surface);
+    }
+    return sts;
+}
+
+mfxStatus CpuDecode::DecodePacket(AVPacket *pkt, bool drain, AVFrame *avframe, int *av_ret) {
+    CpuStats::Timer timer;
+    mfxStatus sts = RunDecodePacket(pkt, drain, avframe, av_ret);
+    m_stats.AddTime(timer);
+    return sts;
+}
+
+// send pkt if it holds data, then the drain signal if drain is set, and
+//   try to receive the next picture into avframe
+// *av_ret is the result of avcodec_receive_frame()
+mfxStatus CpuDecode::RunDecodePacket(AVPacket *pkt, bool drain, AVFrame *avframe, int *av_ret) {
+    *av_ret = AVERROR(EAGAIN);
+
+    // send packet
+    if (pkt->size) {
+        pkt->pos    = m_packetCount;
+        auto av_err = VPL_TRACE_CALL("avcodec_send_packet",
+                                     avcodec_send_packet(m_avDecContext, pkt));
+        RET_IF_FALSE(av_err >= 0, MFX_ERR_ABORTED);
+        {
+            std::lock_guard<std::mutex> lock(m_packetMutex);
+            m_pendingPackets.insert(m_packetCount++);
+        }
+        m_stats.AddFrameIn(pkt->size);
+    }
+
+    if (drain) {
+        // null bitstream indicates drain, send EOF packet
+        avcodec_send_packet(m_avDecContext, nullptr);
+    }
+
+    // receive frame
+    *av_ret = VPL_TRACE_CALL("avcodec_receive_frame",
+                             avcodec_receive_frame(m_avDecContext, avframe));
+    if (*av_ret == AVERROR_EOF) {
+        // drained, whatever did not come out was dropped
+        std::lock_guard<std::mutex> lock(m_packetMutex);
+        m_skippedFrames += static_cast<mfxU32>(m_pendingPackets.size());
+        m_pendingPackets.clear();
+    }
+    if (*av_ret != 0)
+        return MFX_ERR_NONE;
+
+    RetirePacket(avframe->pkt_pos);
+    m_stats.AddFrameOut();
+    if (avframe->decode_error_flags || (avframe->flags & AV_FRAME_FLAG_CORRUPT))
+        m_stats.AddCorruptFrame();
+
+    // in case mjpeg, convert yuvj420p -> yuv420p
+    if (m_avDecContext->codec_id == AV_CODEC_ID_MJPEG && avframe->format != AV_PIX_FMT_YUV420P)
+        RET_IF_FALSE(ConvertJPEGOutputColorSpace(avframe, AV_PIX_FMT_YUV420P), MFX_ERR_ABORTED);
+
+    return MFX_ERR_NONE;
+}
+
+mfxStatus CpuDecode::DecodeAVFrame(mfxBitstream *bs, AVFrame *frame) {
+    // without surfaces the picture stays in m_avDecFrameOut, in buffers
+    //   from the default allocator
+    mfxStatus sts = DecodeFrame(bs, nullptr, nullptr, nullptr);
+    if (sts != MFX_ERR_NONE)
+        return sts;
+
+    av_frame_move_ref(frame, m_avDecFrameOut);
+    m_frameOrder++;
+    return MFX_ERR_NONE;
+}
+
+// called on the decode lane
+void CpuDecode::RetirePacket(int64_t index) {
+    std::lock_guard<std::mutex> lock(m_packetMutex);
+
+    // a packet counted as dropped came out after all, e.g. because
+    //   has_b_frames grew after it was counted
+    if (!m_pendingPackets.erase(index) && index >= 0 && index < m_packetCount &&
+        m_skippedFrames)
+        m_skippedFrames--;
+
+    // output is reordered by at most has_b_frames and held back by one
+    //   frame per extra frame thread, packets older than that are not
+    //   coming out anymore
+    int delay = m_avDecContext->has_b_frames;
+    if (m_avDecContext->active_thread_type & FF_THREAD_FRAME)
+        delay += std::max(m_avDecContext->thread_count - 1, 0);
+    int64_t oldest = index - delay - 1;
+    auto dropped   = m_pendingPackets.begin();
+    while (dropped != m_pendingPackets.end() && *dropped < oldest) {
+        m_skippedFrames++;
+        dropped = m_pendingPackets.erase(dropped);
+    }
+}
+
+void CpuDecode::ApplySkipLevel(int level) {
+    m_avDecContext->skip_frame       = skipLadder[level].frame;
+    m_avDecContext->skip_loop_filter = skipLadder[level].loop_filter;
+    m_avDecContext->skip_idct        = skipLadder[level].idct;
+}
+
+// frame threads pick up the new levels from the user context with the
+//   next packet, so this takes effect without a reset
+// the context belongs to the decode lane, the levels are set there
+//   ahead of the next packet
+mfxStatus CpuDecode::SetSkipMode(mfxSkipMode mode) {
+    const int maxLevel = sizeof(skipLadder) / sizeof(skipLadder[0]) - 1;
+
+    switch (mode) {
+        case MFX_SKIPMODE_NOSKIP:
+            if (m_skipLevel == 0)
+                return MFX_WRN_VALUE_NOT_CHANGED;
+            m_skipLevel = 0;
+            break;
+        case MFX_SKIPMODE_MORE:
+            if (m_skipLevel == maxLevel)
+                return MFX_WRN_VALUE_NOT_CHANGED;
+            m_skipLevel++;
+            break;
+        case MFX_SKIPMODE_LESS:
+            if (m_skipLevel == 0)
+                return MFX_WRN_VALUE_NOT_CHANGED;
+            m_skipLevel--;
+            break;
+        default:
+            return MFX_ERR_UNSUPPORTED;
+    }
+
+    int level = m_skipLevel;
+    return m_session->GetScheduler()->Submit(
+        VPL_TASK_LANE_DECODE,
+        [this, level]() {
+            ApplySkipLevel(level);
+            return MFX_ERR_NONE;
+        },
+        nullptr);
+}
+
+mfxStatus CpuDecode::GetDecodeStat(mfxDecodeStat *stat) {
+    std::lock_guard<std::mutex> lock(m_packetMutex);
+    stat->NumFrame        = m_frameOrder;
+    stat->NumSkippedFrame = m_skippedFrames;
+    stat->NumError        = static_cast<mfxU32>(m_stats.GetCorruptFrames());
+    stat->NumCachedFrame  = static_cast<mfxU32>(m_pendingPackets.size());
+    return MFX_ERR_NONE;
+}
+
+// full range MJPEG output to target_pixfmt, avframe keeps its address
+// 4:2:0 only has its range compressed in place, other subsamplings are
+//   resampled by swscale into a new buffer
 AVFrame *CpuDecode::ConvertJPEGOutputColorSpace(AVFrame *avframe, AVPixelFormat target_pixfmt) {
-    static int prev_w, prev_h;
-
-    if (!m_swsContext || (prev_w != avframe->width || prev_h != avframe->height)) {
-        if (m_swsContext)
-            sws_freeContext(m_swsContext);
-        m_swsContext = sws_getContext(m_avDecContext->width,
-                                      m_avDecContext->height,
-                                      m_avDecContext->pix_fmt,
-                                      m_avDecContext->width,
-                                      m_avDecContext->height,
-                                      target_pixfmt,
-                                      SWS_BILINEAR,
-                                      NULL,
-                                      NULL,
-                                      NULL);
-        if (!m_swsContext) {
-            return nullptr;
+    if (avframe->format == AV_PIX_FMT_YUVJ420P && target_pixfmt == AV_PIX_FMT_YUV420P) {
+#if VPL_JPEG_KEEP_FULL_RANGE
+        avframe->color_range = AVCOL_RANGE_JPEG;
+#else
+        for (int i = 0; i < 3; i++) {
+            int width = i ? AV_CEIL_RSHIFT(avframe->width, 1) : avframe->width;
+            int rows  = i ? AV_CEIL_RSHIFT(avframe->height, 1) : avframe->height;
+            LimitRangePlane(avframe->data[i], avframe->linesize[i], width, rows, i != 0);
         }
+        avframe->color_range = AVCOL_RANGE_MPEG;
+#endif
+        avframe->format = target_pixfmt;
+        return avframe;
+    }
+
+    // rebuilt only when the size or format changes
+    m_swsContext = sws_getCachedContext(m_swsContext,
+                                        avframe->width,
+                                        avframe->height,
+                                        static_cast<AVPixelFormat>(avframe->format),
+                                        avframe->width,
+                                        avframe->height,
+                                        target_pixfmt,
+                                        SWS_BILINEAR,
+                                        NULL,
+                                        NULL,
+                                        NULL);
+    RET_IF_FALSE(m_swsContext, nullptr);
+
+    AVFrame *converted = av_frame_alloc();
+    RET_IF_FALSE(converted, nullptr);
+
+    converted->format = target_pixfmt;
+    converted->width  = avframe->width;
+    converted->height = avframe->height;
+    if (av_frame_get_buffer(converted, 0) < 0 || av_frame_copy_props(converted, avframe) < 0) {
+        av_frame_free(&converted);
+        return nullptr;
     }
 
+    VPL_TRACE("sws_scale");
     int ret = sws_scale(m_swsContext,
                         avframe->data,
                         avframe->linesize,
                         0,
                         avframe->height,
-                        avframe->data,
-                        avframe->linesize);
-    if (ret != avframe->height)
+                        converted->data,
+                        converted->linesize);
+    if (ret != avframe->height) {
+        av_frame_free(&converted);
         return nullptr;
-    else
-        avframe->format = target_pixfmt;
-
-    prev_w = avframe->width;
-    prev_h = avframe->height;
+    }
 
+    converted->color_range = AVCOL_RANGE_MPEG;
+    av_frame_unref(avframe);
+    av_frame_move_ref(avframe, converted);
+    av_frame_free(&converted);
     return avframe;
 }
 
@@ -452,8 +981,9 @@ mfxStatus CpuDecode::DecodeQueryIOSurf(mfxVideoParam *par, mfxFrameAllocRequest
         if (ValidateDecodeParams(par, false) < 0)
             return MFX_ERR_INVALID_VIDEO_PARAM;
 
+    // each frame in flight holds one more output surface
     request->NumFrameMin       = 1;
-    request->NumFrameSuggested = 3;
+    request->NumFrameSuggested = 3 + GetAsyncDepth(par) - 1;
     request->Type              = MFX_MEMTYPE_SYSTEM_MEMORY | MFX_MEMTYPE_FROM_DECODE;
 
     return MFX_ERR_NONE;
@@ -480,6 +1010,7 @@ mfxStatus CpuDecode::DecodeQuery(mfxVideoParam *in, mfxVideoParam *out) {
         // set output struct to zero for unsupported params, non-zero for supported params
         *out                              = { 0 };
         out->mfx.CodecId                  = 1;
+        out->mfx.NumThread                = 1;
         out->mfx.FrameInfo.BitDepthChroma = 1;
         out->mfx.FrameInfo.BitDepthLuma   = 1;
         out->mfx.FrameInfo.PicStruct      = 1;
@@ -507,8 +1038,15 @@ mfxStatus CpuDecode::GetDecodeSurface(mfxFrameSurface1 **surface) {
         mfxFrameAllocRequest DecRequest = { 0 };
         RET_ERROR(DecodeQueryIOSurf(&m_param, &DecRequest));
 
-        auto pool = std::make_unique<CpuFramePool>();
-        RET_ERROR(pool->Init(DecRequest.NumFrameSuggested));
+        // libav decodes into planar frames, other layouts are copied into
+        //   frames allocated up front
+        auto pool          = std::make_unique<CpuFramePool>();
+        mfxFrameInfo &info = m_param.mfx.FrameInfo;
+        mfxU32 count       = DecRequest.NumFrameSuggested;
+        if (IsSemiPlanarFourCC(info.FourCC))
+            RET_ERROR(pool->Init(info.FourCC, info.Width, info.Height, count));
+        else
+            RET_ERROR(pool->Init(info, count));
         m_decSurfaces = std::move(pool);
     }
 
@@ -516,7 +1054,7 @@ mfxStatus CpuDecode::GetDecodeSurface(mfxFrameSurface1 **surface) {
     if (sts != MFX_ERR_NONE) {
         return sts;
     }
-    if (surface == nullptr) {
+    if (*surface == nullptr) {
         return MFX_ERR_NOT_ENOUGH_BUFFER;
     }
     (*surface)->Data.MemType |=
@@ -525,8 +1063,13 @@ mfxStatus CpuDecode::GetDecodeSurface(mfxFrameSurface1 **surface) {
 }
 
 mfxStatus CpuDecode::GetVideoParam(mfxVideoParam *par) {
-    par->mfx       = m_param.mfx;
-    par->IOPattern = m_param.IOPattern;
+    // the context is read once the decode lane is done with it
+    m_session->GetScheduler()->Drain(VPL_TASK_LANE_DECODE);
+    m_stats.FillExtBuffer(par);
+
+    par->mfx           = m_param.mfx;
+    par->mfx.NumThread = static_cast<mfxU16>(m_threadCount);
+    par->IOPattern     = m_param.IOPattern;
 
     //If DecodeFrame() is not executed at all, we can't update params from m_avDecContext
     //but return current params
@@ -576,6 +1119,13 @@ mfxStatus CpuDecode::GetVideoParam(mfxVideoParam *par) {
             par->mfx.FrameInfo.FourCC = 0;
     }
 
+    // output surfaces get the chroma layout asked for at Init
+    if (par->mfx.FrameInfo.FourCC && IsSemiPlanarFourCC(m_param.mfx.FrameInfo.FourCC)) {
+        bool p010                 = (par->mfx.FrameInfo.BitDepthLuma == 10);
+        par->mfx.FrameInfo.FourCC = p010 ? MFX_FOURCC_P010 : MFX_FOURCC_NV12;
+        par->mfx.FrameInfo.Shift  = p010 ? 1 : 0;
+    }
+
     // Frame rate
     par->mfx.FrameInfo.FrameRateExtN = (uint16_t)m_avDecContext->framerate.num;
     par->mfx.FrameInfo.FrameRateExtD = (uint16_t)m_avDecContext->framerate.den;
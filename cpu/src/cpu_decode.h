@@ -8,10 +8,14 @@
 #define CPU_SRC_CPU_DECODE_H_
 
 #include <memory>
+#include <mutex>
+#include <set>
 #include "src/cpu_common.h"
 #include "src/cpu_frame_pool.h"
+#include "src/cpu_stats.h"
 
 class CpuWorkstream;
+struct DecodeSurfaceBuffer;
 
 class CpuDecode {
 public:
@@ -24,16 +28,42 @@ public:
     mfxStatus InitDecode(mfxVideoParam* par, mfxBitstream* bs);
     mfxStatus DecodeFrame(mfxBitstream* bs,
                           mfxFrameSurface1* surface_work,
-                          mfxFrameSurface1** surface_out);
+                          mfxFrameSurface1** surface_out,
+                          mfxSyncPoint* syncp);
+    // next decoded picture as a new reference in frame, no surface is
+    //   involved (used by the transcode pipeline)
+    // bs == 0 is a signal to drain
+    mfxStatus DecodeAVFrame(mfxBitstream* bs, AVFrame* frame);
     mfxStatus GetVideoParam(mfxVideoParam* par);
     mfxStatus GetDecodeSurface(mfxFrameSurface1** surface);
+    mfxStatus SetSkipMode(mfxSkipMode mode);
+    mfxStatus GetDecodeStat(mfxDecodeStat* stat);
 
     mfxStatus CheckVideoParamDecoders(mfxVideoParam* in);
     mfxStatus IsSameVideoParam(mfxVideoParam* newPar, mfxVideoParam* oldPar);
 
 private:
     static mfxStatus ValidateDecodeParams(mfxVideoParam* par, bool canCorrect);
+    // codec side of DecodeFrame(), runs on the decode lane
+    mfxStatus DecodePacket(AVPacket* pkt, bool drain, AVFrame* avframe, int* av_ret);
+    mfxStatus RunDecodePacket(AVPacket* pkt, bool drain, AVFrame* avframe, int* av_ret);
     AVFrame* ConvertJPEGOutputColorSpace(AVFrame* avframe, AVPixelFormat target_pixfmt);
+    mfxStatus SubmitPacket(mfxFrameSurface1* surface, CpuFrame* cpu_frame, mfxSyncPoint* syncp);
+    mfxStatus SubmitFrameCopy(mfxFrameSurface1* surface, AVFrame* avframe, mfxSyncPoint* syncp);
+    mfxStatus SubmitFrameReady(mfxSyncPoint* syncp);
+
+    // libavcodec decodes straight into application surfaces when their
+    //   layout allows it (AVCodecContext::get_buffer2)
+    static int GetBuffer2(AVCodecContext* avctx, AVFrame* frame, int flags);
+    static void FreeSurfaceBuffer(void* opaque, uint8_t* data);
+    static void FreePlaneBuffer(void* opaque, uint8_t* data);
+    int WrapSurface(AVCodecContext* avctx, mfxFrameSurface1* surface, AVFrame* frame);
+    mfxFrameSurface1* SetWorkSurface(mfxFrameSurface1* surface);
+    mfxFrameSurface1* GetWrappedSurface(AVFrame* frame);
+    bool IsWrappedSurface(mfxFrameSurface1* surface);
+    void ApplySkipLevel(int level);
+    void RetirePacket(int64_t index);
+
     const AVCodec* m_avDecCodec;
     AVCodecContext* m_avDecContext;
     AVCodecParserContext* m_avDecParser;
@@ -50,6 +80,34 @@ private:
 
     mfxU32 m_frameOrder;
 
+    // the decoder has no output delay, each packet is a picture which
+    //   comes out of the call that sends it
+    bool m_bOneInOneOut;
+
+    // surface offered to get_buffer2 during the current decode step,
+    //   get_buffer2 runs on the codec's frame threads, m_workMutex is held
+    //   while the surface is taken and wrapped, before m_bufferMutex
+    mfxFrameSurface1* m_workSurface;
+    std::mutex m_workMutex;
+    // buffers are released from decoder threads
+    std::mutex m_bufferMutex;
+    std::set<DecodeSurfaceBuffer*> m_surfaceBuffers;
+
+    // taken from the thread budget
+    int m_threadCount;
+
+    // index into the skip ladder, raised and lowered by SetSkipMode()
+    int m_skipLevel;
+    // packets are numbered through AVPacket::pos, numbers not seen again
+    //   in AVFrame::pkt_pos were dropped by the decoder
+    int64_t m_packetCount;
+    // updated on the decode lane, m_packetMutex guards the two below
+    std::mutex m_packetMutex;
+    std::set<int64_t> m_pendingPackets;
+    mfxU32 m_skippedFrames;
+
+    CpuStats m_stats;
+
     /* copy not allowed */
     CpuDecode(const CpuDecode&);
     CpuDecode& operator=(const CpuDecode&);
@@ -5,8 +5,11 @@
   ############################################################################*/
 
 #include "src/cpu_encode.h"
+#include <algorithm>
 #include <memory>
 #include <sstream>
+#include "src/cpu_copy.h"
+#include "src/cpu_thread_pool.h"
 #include "src/cpu_workstream.h"
 
 #define X264_DEFAULT_QUALITY_VALUE 23
@@ -18,7 +21,18 @@ CpuEncode::CpuEncode(CpuWorkstream *session)
           m_avEncPacket(nullptr),
           m_param({}),
           m_encSurfaces(),
-          m_bFrameEncoded(false) {}
+          m_bFrameEncoded(false),
+          m_bPacketPending(false),
+          m_pendingSurface(nullptr),
+          m_directBitstream(nullptr),
+          m_maxPacketSize(0),
+          m_inputFormat(AV_PIX_FMT_NONE),
+          m_frameQP(0),
+          m_roi(),
+          m_timestamps(),
+          m_lookAheadDepth(0),
+          m_threadCount(0),
+          m_stats() {}
 
 CpuEncode::~CpuEncode() {
     if (m_bFrameEncoded) {
@@ -26,7 +40,12 @@ CpuEncode::~CpuEncode() {
         mfxBitstream bs{};
         mfxStatus sts;
         do {
-            sts = EncodeFrame(nullptr, nullptr, &bs);
+            sts = EncodeFrame(nullptr, nullptr, &bs, nullptr);
+            // output is discarded
+            if (sts == MFX_ERR_NOT_ENOUGH_BUFFER) {
+                av_packet_unref(m_avEncPacket);
+                m_bPacketPending = false;
+            }
         } while (sts == MFX_ERR_NOT_ENOUGH_BUFFER || sts == MFX_ERR_NONE);
 
         m_bFrameEncoded = false;
@@ -42,6 +61,68 @@ CpuEncode::~CpuEncode() {
         av_packet_free(&m_avEncPacket);
         m_avEncPacket = nullptr;
     }
+
+    CpuThreadPool::Get().ReleaseThreads(m_threadCount);
+}
+
+// session level buffers and the ROI, which is checked by InitROI()
+static bool HasUnsupportedExtParam(mfxVideoParam *par) {
+    for (mfxU16 i = 0; i < par->NumExtParam; i++) {
+        if (!par->ExtParam || !par->ExtParam[i])
+            return true;
+        if (par->ExtParam[i]->BufferId != MFX_EXTBUFF_CPU_PIPELINE &&
+            par->ExtParam[i]->BufferId != MFX_EXTBUFF_CPU_ENCODE_LADDER &&
+            par->ExtParam[i]->BufferId != MFX_EXTBUFF_CPU_ENCODE_CHUNKS &&
+            par->ExtParam[i]->BufferId != MFX_EXTBUFF_ENCODER_ROI &&
+            par->ExtParam[i]->BufferId != MFX_EXTBUFF_CODING_OPTION2)
+            return true;
+    }
+    return false;
+}
+
+// only LookAheadDepth is read from it
+static mfxExtCodingOption2 *GetCodingOption2(mfxVideoParam *par) {
+    if (!par->ExtParam)
+        return nullptr;
+
+    for (mfxU16 i = 0; i < par->NumExtParam; i++) {
+        mfxExtBuffer *ext = par->ExtParam[i];
+        if (ext && ext->BufferId == MFX_EXTBUFF_CODING_OPTION2 &&
+            ext->BufferSz >= sizeof(mfxExtCodingOption2))
+            return reinterpret_cast<mfxExtCodingOption2 *>(ext);
+    }
+    return nullptr;
+}
+
+// frames the encoder looks ahead in MFX_RATECONTROL_LA, 0 in other modes
+static mfxU16 GetLookAheadDepth(mfxVideoParam *par) {
+    // JPEG has no rate control, the field belongs to its options
+    if (!par || par->mfx.CodecId == MFX_CODEC_JPEG ||
+        par->mfx.RateControlMethod != MFX_RATECONTROL_LA)
+        return 0;
+
+    mfxExtCodingOption2 *co2 = GetCodingOption2(par);
+    return (co2 && co2->LookAheadDepth) ? co2->LookAheadDepth : VPL_LOOKAHEAD_DEPTH;
+}
+
+// LookAheadDepth range of the MSDK encoders, 0 = no look ahead
+static bool IsLookAheadDepthValid(mfxU16 lookAheadDepth) {
+    return !lookAheadDepth || (lookAheadDepth >= 10 && lookAheadDepth <= 100);
+}
+
+// VBV of libx264, the peak rate needs a buffer size to take effect
+// rc_buffer_size is in bits, BufferSizeInKB in KB (TargetKbps if not set,
+//   as in GetVideoParam)
+static void SetAVCRateLimits(AVCodecContext *ctx, const mfxInfoMFX &mfx) {
+    if (mfx.RateControlMethod != MFX_RATECONTROL_CQP && mfx.MaxKbps > mfx.TargetKbps) {
+        mfxU16 sizeInKB     = mfx.BufferSizeInKB ? mfx.BufferSizeInKB : mfx.TargetKbps;
+        ctx->rc_max_rate    = static_cast<int64_t>(mfx.MaxKbps) * 1000;
+        ctx->rc_buffer_size = static_cast<int>(sizeInKB) * 8000;
+    }
+    else {
+        ctx->rc_max_rate    = 0;
+        ctx->rc_buffer_size = 0;
+    }
 }
 
 mfxStatus CpuEncode::ValidateEncodeParams(mfxVideoParam *par, bool canCorrect) {
@@ -51,25 +132,25 @@ mfxStatus CpuEncode::ValidateEncodeParams(mfxVideoParam *par, bool canCorrect) {
 
     // General params
     if (canCorrect) {
-        if (par->AsyncDepth > 16) {
-            par->AsyncDepth = 16;
+        if (par->AsyncDepth > VPL_MAX_ASYNC_DEPTH) {
+            par->AsyncDepth = VPL_MAX_ASYNC_DEPTH;
         }
 
         if (par->Protected)
             par->Protected = 0;
-        if (par->NumExtParam)
+        if (HasUnsupportedExtParam(par))
             par->NumExtParam = 0;
         if (par->IOPattern != MFX_IOPATTERN_IN_SYSTEM_MEMORY)
             par->IOPattern = MFX_IOPATTERN_IN_SYSTEM_MEMORY;
     }
     else {
-        if (par->AsyncDepth > 16) {
+        if (par->AsyncDepth > VPL_MAX_ASYNC_DEPTH) {
             return MFX_ERR_INVALID_VIDEO_PARAM;
         }
 
         if (par->Protected)
             return MFX_ERR_INVALID_VIDEO_PARAM;
-        if (par->NumExtParam)
+        if (HasUnsupportedExtParam(par))
             return MFX_ERR_INVALID_VIDEO_PARAM;
 
         if (par->IOPattern != MFX_IOPATTERN_IN_SYSTEM_MEMORY)
@@ -82,8 +163,6 @@ mfxStatus CpuEncode::ValidateEncodeParams(mfxVideoParam *par, bool canCorrect) {
             par->mfx.LowPower = 0; //not supported
         if (par->mfx.BRCParamMultiplier)
             par->mfx.BRCParamMultiplier = 0; //not supported
-        if (par->mfx.NumThread)
-            par->mfx.NumThread = 0; //not supported
         if (par->mfx.TargetUsage < MFX_TARGETUSAGE_1 || par->mfx.TargetUsage > MFX_TARGETUSAGE_7) {
             par->mfx.TargetUsage = MFX_TARGETUSAGE_BALANCED;
         }
@@ -112,8 +191,6 @@ mfxStatus CpuEncode::ValidateEncodeParams(mfxVideoParam *par, bool canCorrect) {
             return MFX_ERR_INVALID_VIDEO_PARAM;
         if (par->mfx.BRCParamMultiplier)
             return MFX_ERR_INVALID_VIDEO_PARAM;
-        if (par->mfx.NumThread)
-            return MFX_ERR_INVALID_VIDEO_PARAM;
 
         //only GOP_CLOSED flag is supported in the CPU reference implementation
         if (par->mfx.GopOptFlag != 0 && par->mfx.GopOptFlag != MFX_GOP_CLOSED)
@@ -138,11 +215,21 @@ mfxStatus CpuEncode::ValidateEncodeParams(mfxVideoParam *par, bool canCorrect) {
 
     // mfx.FrameInfo params
 
-    if (par->mfx.FrameInfo.Shift)
+    // only P010 keeps its samples in the high bits
+    if (par->mfx.FrameInfo.FourCC == MFX_FOURCC_P010) {
+        if (par->mfx.FrameInfo.Shift != 1) {
+            if (canCorrect)
+                par->mfx.FrameInfo.Shift = 1;
+            else
+                return MFX_ERR_INVALID_VIDEO_PARAM;
+        }
+    }
+    else if (par->mfx.FrameInfo.Shift) {
         if (canCorrect)
             par->mfx.FrameInfo.Shift = 0;
         else
             return MFX_ERR_INVALID_VIDEO_PARAM;
+    }
 
     if (par->mfx.FrameInfo.BitDepthChroma) {
         if (par->mfx.FrameInfo.BitDepthChroma != 8 && par->mfx.FrameInfo.BitDepthChroma != 10)
@@ -162,7 +249,9 @@ mfxStatus CpuEncode::ValidateEncodeParams(mfxVideoParam *par, bool canCorrect) {
 
     if (par->mfx.FrameInfo.FourCC) {
         if (par->mfx.FrameInfo.FourCC != MFX_FOURCC_I420 &&
-            par->mfx.FrameInfo.FourCC != MFX_FOURCC_I010)
+            par->mfx.FrameInfo.FourCC != MFX_FOURCC_I010 &&
+            par->mfx.FrameInfo.FourCC != MFX_FOURCC_NV12 &&
+            par->mfx.FrameInfo.FourCC != MFX_FOURCC_P010)
             return MFX_ERR_INVALID_VIDEO_PARAM;
     }
     else if (canCorrect) {
@@ -188,8 +277,8 @@ mfxStatus CpuEncode::ValidateEncodeParams(mfxVideoParam *par, bool canCorrect) {
         par->mfx.FrameInfo.CropH + par->mfx.FrameInfo.CropY > par->mfx.FrameInfo.Height)
         return MFX_ERR_INVALID_VIDEO_PARAM;
 
-    if (par->mfx.FrameInfo.FourCC == MFX_FOURCC_I420 ||
-        par->mfx.FrameInfo.FourCC == MFX_FOURCC_I010) {
+    // every accepted FourCC is 4:2:0
+    if (par->mfx.FrameInfo.FourCC) {
         if (par->mfx.FrameInfo.CropW % 2 || par->mfx.FrameInfo.CropH % 2)
             return MFX_ERR_INVALID_VIDEO_PARAM;
     }
@@ -230,7 +319,8 @@ mfxStatus CpuEncode::ValidateEncodeParams(mfxVideoParam *par, bool canCorrect) {
     if ((par->mfx.FrameInfo.BitDepthLuma == 8) && (par->mfx.FrameInfo.BitDepthChroma == 10)) {
         if (canCorrect)
             fixedIncompatible = true;
-        if (par->mfx.FrameInfo.FourCC == MFX_FOURCC_I420)
+        if (par->mfx.FrameInfo.FourCC == MFX_FOURCC_I420 ||
+            par->mfx.FrameInfo.FourCC == MFX_FOURCC_NV12)
             par->mfx.FrameInfo.BitDepthChroma = 8;
         else
             par->mfx.FrameInfo.BitDepthChroma = 10;
@@ -239,7 +329,8 @@ mfxStatus CpuEncode::ValidateEncodeParams(mfxVideoParam *par, bool canCorrect) {
     if ((par->mfx.FrameInfo.BitDepthLuma == 10) && (par->mfx.FrameInfo.BitDepthChroma == 8)) {
         if (canCorrect)
             fixedIncompatible = true;
-        if (par->mfx.FrameInfo.FourCC == MFX_FOURCC_I420)
+        if (par->mfx.FrameInfo.FourCC == MFX_FOURCC_I420 ||
+            par->mfx.FrameInfo.FourCC == MFX_FOURCC_NV12)
             par->mfx.FrameInfo.BitDepthLuma = 8;
         else
             par->mfx.FrameInfo.BitDepthLuma = 10;
@@ -266,7 +357,8 @@ mfxStatus CpuEncode::ValidateEncodeParams(mfxVideoParam *par, bool canCorrect) {
             if (par->mfx.RateControlMethod) {
                 if (par->mfx.RateControlMethod != MFX_RATECONTROL_CQP &&
                     par->mfx.RateControlMethod != MFX_RATECONTROL_CBR &&
-                    par->mfx.RateControlMethod != MFX_RATECONTROL_VBR)
+                    par->mfx.RateControlMethod != MFX_RATECONTROL_VBR &&
+                    par->mfx.RateControlMethod != MFX_RATECONTROL_LA)
                     return MFX_ERR_INVALID_VIDEO_PARAM;
             }
             else if (canCorrect) {
@@ -278,7 +370,8 @@ mfxStatus CpuEncode::ValidateEncodeParams(mfxVideoParam *par, bool canCorrect) {
                     return MFX_ERR_INVALID_VIDEO_PARAM;
 
             if (par->mfx.CodecProfile) {
-                if (par->mfx.FrameInfo.FourCC == MFX_FOURCC_I010) {
+                if (par->mfx.FrameInfo.FourCC == MFX_FOURCC_I010 ||
+                    par->mfx.FrameInfo.FourCC == MFX_FOURCC_P010) {
                     if (par->mfx.CodecProfile != MFX_PROFILE_AVC_HIGH10 &&
                         par->mfx.CodecProfile != MFX_PROFILE_AVC_HIGH_422)
                         return MFX_ERR_INVALID_VIDEO_PARAM;
@@ -291,7 +384,8 @@ mfxStatus CpuEncode::ValidateEncodeParams(mfxVideoParam *par, bool canCorrect) {
                 }
             }
             else if (canCorrect) {
-                if (par->mfx.FrameInfo.FourCC == MFX_FOURCC_I010) {
+                if (par->mfx.FrameInfo.FourCC == MFX_FOURCC_I010 ||
+                    par->mfx.FrameInfo.FourCC == MFX_FOURCC_P010) {
                     par->mfx.CodecProfile = MFX_PROFILE_AVC_HIGH10;
                 }
                 else
@@ -339,7 +433,8 @@ mfxStatus CpuEncode::ValidateEncodeParams(mfxVideoParam *par, bool canCorrect) {
 
             if (par->mfx.RateControlMethod) {
                 if (par->mfx.RateControlMethod != MFX_RATECONTROL_CQP &&
-                    par->mfx.RateControlMethod != MFX_RATECONTROL_VBR)
+                    par->mfx.RateControlMethod != MFX_RATECONTROL_VBR &&
+                    par->mfx.RateControlMethod != MFX_RATECONTROL_LA)
                     return MFX_ERR_INVALID_VIDEO_PARAM;
             }
             else if (canCorrect) {
@@ -421,7 +516,8 @@ mfxStatus CpuEncode::ValidateEncodeParams(mfxVideoParam *par, bool canCorrect) {
             if (par->mfx.RateControlMethod) {
                 if (par->mfx.RateControlMethod != MFX_RATECONTROL_CQP &&
                     par->mfx.RateControlMethod != MFX_RATECONTROL_CBR &&
-                    par->mfx.RateControlMethod != MFX_RATECONTROL_VBR)
+                    par->mfx.RateControlMethod != MFX_RATECONTROL_VBR &&
+                    par->mfx.RateControlMethod != MFX_RATECONTROL_LA)
                     return MFX_ERR_INVALID_VIDEO_PARAM;
             }
             else if (canCorrect) {
@@ -446,6 +542,9 @@ mfxStatus CpuEncode::ValidateEncodeParams(mfxVideoParam *par, bool canCorrect) {
             return MFX_ERR_INVALID_VIDEO_PARAM;
     }
 
+    if (!IsLookAheadDepthValid(GetLookAheadDepth(par)))
+        return MFX_ERR_INVALID_VIDEO_PARAM;
+
     if (fixedIncompatible)
         return MFX_WRN_INCOMPATIBLE_VIDEO_PARAM;
     else
@@ -457,6 +556,7 @@ mfxStatus CpuEncode::InitEncode(mfxVideoParam *par) {
     par     = &m_param;
 
     RET_VAR_IF_NOT(ValidateEncodeParams(par, false), MFX_ERR_NONE);
+    m_lookAheadDepth = GetLookAheadDepth(par);
 
     AVCodecID cid = MFXCodecId_to_AVCodecID(m_param.mfx.CodecId);
     RET_IF_FALSE(cid, MFX_ERR_INVALID_VIDEO_PARAM);
@@ -485,7 +585,8 @@ mfxStatus CpuEncode::InitEncode(mfxVideoParam *par) {
     m_avEncContext->framerate.num = par->mfx.FrameInfo.FrameRateExtN;
     m_avEncContext->framerate.den = par->mfx.FrameInfo.FrameRateExtD;
 
-    //time_base is intended to be 1/framerate
+    // time_base is 1/framerate, CpuEncodeTimestamps converts from and to
+    //   the 90 kHz MFX clock
     m_avEncContext->time_base.num = par->mfx.FrameInfo.FrameRateExtD;
     m_avEncContext->time_base.den = par->mfx.FrameInfo.FrameRateExtN;
 
@@ -495,8 +596,8 @@ mfxStatus CpuEncode::InitEncode(mfxVideoParam *par) {
     m_avEncContext->slices = par->mfx.NumSlice;
     m_avEncContext->refs   = par->mfx.NumRefFrame;
 
-    if (par->mfx.GopOptFlag == MFX_GOP_CLOSED)
-        m_avEncContext->flags &= AV_CODEC_FLAG_CLOSED_GOP;
+    if (par->mfx.GopOptFlag & MFX_GOP_CLOSED)
+        m_avEncContext->flags |= AV_CODEC_FLAG_CLOSED_GOP;
 
     if (par->mfx.FrameInfo.BitDepthChroma == 10) {
         // Main10: 10-bit 420
@@ -510,10 +611,26 @@ mfxStatus CpuEncode::InitEncode(mfxVideoParam *par) {
             m_avEncContext->pix_fmt = AV_PIX_FMT_YUV420P;
     }
 
-    if (m_avEncContext->pix_fmt == AV_PIX_FMT_YUV420P10LE)
+    // libav encoders are planar except a few which also take NV12
+    if (IsSemiPlanarFourCC(par->mfx.FrameInfo.FourCC) && m_avEncCodec->pix_fmts) {
+        AVPixelFormat semi_planar = (par->mfx.FrameInfo.FourCC == MFX_FOURCC_P010)
+                                        ? AV_PIX_FMT_P010LE
+                                        : AV_PIX_FMT_NV12;
+        for (const AVPixelFormat *fmt = m_avEncCodec->pix_fmts; *fmt != AV_PIX_FMT_NONE; fmt++) {
+            if (*fmt == semi_planar)
+                m_avEncContext->pix_fmt = semi_planar;
+        }
+    }
+
+    // YUVJ420P only changes the range, frames are sent as YUV420P
+    m_inputFormat = (m_avEncContext->pix_fmt == AV_PIX_FMT_YUVJ420P) ? AV_PIX_FMT_YUV420P
+                                                                      : m_avEncContext->pix_fmt;
+
+    if (IsSemiPlanarFourCC(par->mfx.FrameInfo.FourCC))
+        m_param.mfx.FrameInfo.FourCC =
+            (par->mfx.FrameInfo.BitDepthChroma == 10) ? MFX_FOURCC_P010 : MFX_FOURCC_NV12;
+    else if (m_avEncContext->pix_fmt == AV_PIX_FMT_YUV420P10LE)
         m_param.mfx.FrameInfo.FourCC = MFX_FOURCC_I010;
-    else if (m_avEncContext->pix_fmt == AV_PIX_FMT_YUV420P)
-        m_param.mfx.FrameInfo.FourCC = MFX_FOURCC_I420;
     else
         m_param.mfx.FrameInfo.FourCC = MFX_FOURCC_I420;
 
@@ -523,11 +640,17 @@ mfxStatus CpuEncode::InitEncode(mfxVideoParam *par) {
             2 * static_cast<int>(static_cast<float>(m_avEncContext->framerate.num) /
                                  m_avEncContext->framerate.den);
 
+    // libx265 takes its own options in one string
+    std::string x265Params;
+
     switch (m_param.mfx.CodecId) {
         case MFX_CODEC_HEVC:
             if (m_avEncCodec->name != std::string("libx265")) {
                 RET_ERROR(InitHEVCParams(par)); // SVT-HEVC specific params
             }
+            else if (m_lookAheadDepth) {
+                x265Params = "rc-lookahead=" + std::to_string(m_lookAheadDepth);
+            }
             break;
         case MFX_CODEC_AV1:
             RET_ERROR(InitAV1Params(par));
@@ -542,19 +665,154 @@ mfxStatus CpuEncode::InitEncode(mfxVideoParam *par) {
             return MFX_ERR_INVALID_VIDEO_PARAM;
     }
 
-#ifdef ENABLE_LIBAV_AUTO_THREADS
-    m_avEncContext->thread_count = 0;
-#endif
+    if (CpuEncodeLadder::IsEnabled(par)) {
+        // key frames are placed by the ladder, the same on every rung, so
+        //   encoders which have these options skip their scene detection
+        av_opt_set_int(m_avEncContext, "sc_threshold", 0, AV_OPT_SEARCH_CHILDREN);
+        av_opt_set_int(m_avEncContext->priv_data, "sc_detection", 0, AV_OPT_SEARCH_CHILDREN);
+        x265Params += x265Params.empty() ? "scenecut=0" : ":scenecut=0";
+    }
+    if (!x265Params.empty())
+        av_opt_set(m_avEncContext->priv_data,
+                   "x265-params",
+                   x265Params.c_str(),
+                   AV_OPT_SEARCH_CHILDREN);
+
+    // key frames forced through mfxEncodeCtrl or the ladder are IDR, so
+    //   decoding can start at them
+    av_opt_set_int(m_avEncContext->priv_data, "forced-idr", 1, AV_OPT_SEARCH_CHILDREN);
+    m_frameQP = par->mfx.QPI;
+
+    // codec threads count against the process wide budget
+    m_threadCount                = CpuThreadPool::Get().AcquireThreads(GetNumThread(par));
+    m_avEncContext->thread_count = m_threadCount;
+    m_avEncContext->thread_type  = GetThreadType(par);
 
     int err = 0;
     err     = avcodec_open2(m_avEncContext, m_avEncCodec, NULL);
     RET_IF_FALSE(err == 0, MFX_ERR_INVALID_VIDEO_PARAM);
 
+    RET_ERROR(m_roi.InitROI(par, m_avEncContext));
+    m_timestamps.InitTimestamps(m_avEncContext);
+
+#ifdef ENABLE_ENCODE_DIRECT_BITSTREAM
+    // packets from encoders without delay come out in the same call,
+    //   so they can be written straight into the caller's mfxBitstream
+    if ((m_avEncCodec->capabilities & AV_CODEC_CAP_DR1) &&
+        !(m_avEncCodec->capabilities & AV_CODEC_CAP_DELAY) &&
+        !(m_avEncContext->active_thread_type & FF_THREAD_FRAME)) {
+        m_avEncContext->opaque            = this;
+        m_avEncContext->get_encode_buffer = GetEncodeBuffer;
+    }
+#endif
+
     if (!m_param.mfx.BufferSizeInKB) {
         // TODO(estimate better based on RateControlMethod)
         m_param.mfx.BufferSizeInKB = m_param.mfx.TargetKbps;
     }
 
+    m_session->GetScheduler()->SetDepth(VPL_TASK_LANE_ENCODE, GetAsyncDepth(&m_param));
+
+    return MFX_ERR_NONE;
+}
+
+mfxStatus CpuEncode::ReconfigureEncode(mfxVideoParam *par) {
+    RET_IF_FALSE(m_avEncContext, MFX_ERR_NOT_INITIALIZED);
+
+    // ext buffers (pipeline, ladder, chunks, ROI, reset options) need a
+    //   new encoder
+    if (par->NumExtParam || m_param.NumExtParam)
+        return MFX_ERR_UNSUPPORTED;
+
+    mfxVideoParam newParam = *par;
+    RET_VAR_IF_NOT(ValidateEncodeParams(&newParam, false), MFX_ERR_NONE);
+
+    const mfxInfoMFX &cur = m_param.mfx;
+    const mfxInfoMFX &req = newParam.mfx;
+    bool jpeg             = (cur.CodecId == MFX_CODEC_JPEG);
+
+    // JPEG options share their fields with the GOP and rate control ones
+    bool same_stream = req.CodecId == cur.CodecId && req.CodecProfile == cur.CodecProfile &&
+                       req.CodecLevel == cur.CodecLevel &&
+                       newParam.AsyncDepth == m_param.AsyncDepth;
+    if (jpeg) {
+        same_stream = same_stream && req.Interleaved == cur.Interleaved &&
+                      req.RestartInterval == cur.RestartInterval;
+    }
+    else {
+        same_stream = same_stream && req.TargetUsage == cur.TargetUsage &&
+                      req.GopPicSize == cur.GopPicSize && req.GopRefDist == cur.GopRefDist &&
+                      req.GopOptFlag == cur.GopOptFlag && req.NumSlice == cur.NumSlice &&
+                      req.NumRefFrame == cur.NumRefFrame;
+    }
+    bool same_frames = req.FrameInfo.Width == cur.FrameInfo.Width &&
+                       req.FrameInfo.Height == cur.FrameInfo.Height &&
+                       req.FrameInfo.CropW == cur.FrameInfo.CropW &&
+                       req.FrameInfo.CropH == cur.FrameInfo.CropH &&
+                       req.FrameInfo.BitDepthLuma == cur.FrameInfo.BitDepthLuma &&
+                       req.FrameInfo.BitDepthChroma == cur.FrameInfo.BitDepthChroma &&
+                       IsSemiPlanarFourCC(req.FrameInfo.FourCC) ==
+                           IsSemiPlanarFourCC(cur.FrameInfo.FourCC) &&
+                       req.FrameInfo.AspectRatioW == cur.FrameInfo.AspectRatioW &&
+                       req.FrameInfo.AspectRatioH == cur.FrameInfo.AspectRatioH;
+    // the frame rate sets the time base, MJPEG has no rate control to use it
+    bool same_rate = jpeg || (req.FrameInfo.FrameRateExtN == cur.FrameInfo.FrameRateExtN &&
+                              req.FrameInfo.FrameRateExtD == cur.FrameInfo.FrameRateExtD);
+    if (!same_stream || !same_frames || !same_rate)
+        return MFX_ERR_UNSUPPORTED;
+
+    // frames already submitted are encoded with the old settings
+    m_session->GetScheduler()->Drain(VPL_TASK_LANE_ENCODE);
+
+    switch (cur.CodecId) {
+        case MFX_CODEC_AVC:
+            // libx264 compares its settings with these before every frame
+            //   and reconfigures itself, without a new IDR
+            if (m_avEncCodec->name != std::string("libx264") ||
+                req.RateControlMethod != cur.RateControlMethod)
+                return MFX_ERR_UNSUPPORTED;
+
+            if (req.RateControlMethod == MFX_RATECONTROL_CQP) {
+                int ret = av_opt_set_int(m_avEncContext->priv_data,
+                                         "qp",
+                                         req.QPI,
+                                         AV_OPT_SEARCH_CHILDREN);
+                RET_IF_FALSE(ret == 0, MFX_ERR_INVALID_VIDEO_PARAM);
+                m_frameQP = req.QPI;
+            }
+            else {
+                m_avEncContext->bit_rate = req.TargetKbps * 1000; // prop is in kbps;
+                SetAVCRateLimits(m_avEncContext, req);
+            }
+            break;
+        case MFX_CODEC_JPEG: {
+            // the quality of every frame is taken from global_quality, but
+            //   fixed quality itself is chosen at init
+            if (!req.Quality != !cur.Quality)
+                return MFX_ERR_UNSUPPORTED;
+            int flags = m_avEncContext->flags;
+            RET_ERROR(InitJPEGParams(&newParam));
+            m_avEncContext->flags = flags;
+
+            m_avEncContext->framerate.num       = req.FrameInfo.FrameRateExtN;
+            m_avEncContext->framerate.den       = req.FrameInfo.FrameRateExtD;
+            m_param.mfx.FrameInfo.FrameRateExtN = req.FrameInfo.FrameRateExtN;
+            m_param.mfx.FrameInfo.FrameRateExtD = req.FrameInfo.FrameRateExtD;
+            m_param.mfx.Quality                 = req.Quality;
+            return MFX_ERR_NONE;
+        }
+        default:
+            // SVT encoders take their configuration once at init
+            return MFX_ERR_UNSUPPORTED;
+    }
+
+    // QPI/QPP/QPB share these fields
+    m_param.mfx.InitialDelayInKB   = req.InitialDelayInKB;
+    m_param.mfx.TargetKbps         = req.TargetKbps;
+    m_param.mfx.MaxKbps            = req.MaxKbps;
+    m_param.mfx.BufferSizeInKB     = req.BufferSizeInKB ? req.BufferSizeInKB : req.TargetKbps;
+    m_param.mfx.BRCParamMultiplier = req.BRCParamMultiplier;
+
     return MFX_ERR_NONE;
 }
 
@@ -590,7 +848,7 @@ mfxStatus CpuEncode::InitHEVCParams(mfxVideoParam *par) {
         av_opt_set_int(m_avEncContext->priv_data, "rc", 1, AV_OPT_SEARCH_CHILDREN);
         ret = av_opt_set_int(m_avEncContext->priv_data,
                              "la_depth",
-                             par->mfx.GopPicSize,
+                             m_lookAheadDepth ? m_lookAheadDepth : par->mfx.GopPicSize,
                              AV_OPT_SEARCH_CHILDREN);
         if (ret)
             return MFX_ERR_INVALID_VIDEO_PARAM;
@@ -757,12 +1015,29 @@ mfxStatus CpuEncode::InitAVCParams(mfxVideoParam *par) {
             av_opt_set(m_avEncContext->priv_data, "qp", qpss.str().c_str(), AV_OPT_SEARCH_CHILDREN);
         if (ret)
             return MFX_ERR_INVALID_VIDEO_PARAM;
+
+        // without B-frames constant QP has no use for the lookahead, turning
+        //   it off encodes every frame as it is sent, see HasFrameQP()
+        if (!m_avEncContext->max_b_frames)
+            av_opt_set_int(m_avEncContext->priv_data, "rc-lookahead", 0, AV_OPT_SEARCH_CHILDREN);
+    }
+    else if (m_lookAheadDepth) {
+        // VBR planned over the lookahead, zerolatency would turn it off
+        m_avEncContext->bit_rate = par->mfx.TargetKbps * 1000; // prop is in kbps;
+
+        ret = av_opt_set_int(m_avEncContext->priv_data,
+                             "rc-lookahead",
+                             m_lookAheadDepth,
+                             AV_OPT_SEARCH_CHILDREN);
+        if (ret)
+            return MFX_ERR_INVALID_VIDEO_PARAM;
     }
     else {
         // default to VBR
         m_avEncContext->bit_rate = par->mfx.TargetKbps * 1000; // prop is in kbps;
         ret = av_opt_set(m_avEncContext->priv_data, "tune", "zerolatency", AV_OPT_SEARCH_CHILDREN);
     }
+    SetAVCRateLimits(m_avEncContext, par->mfx);
 
     if (par->mfx.TargetUsage) {
         std::string encMode;
@@ -921,7 +1196,7 @@ mfxStatus CpuEncode::GetAVCParams(mfxVideoParam *par) {
             par->mfx.InitialDelayInKB = m_avEncContext->rc_initial_buffer_occupancy / 8000;
         }
         if (m_avEncContext->rc_buffer_size) {
-            par->mfx.BufferSizeInKB = m_avEncContext->rc_buffer_size / 1000;
+            par->mfx.BufferSizeInKB = m_avEncContext->rc_buffer_size / 8000;
         }
         if (m_avEncContext->rc_max_rate) {
             par->mfx.MaxKbps = static_cast<mfxU16>(m_avEncContext->rc_max_rate / 1000);
@@ -999,6 +1274,15 @@ mfxStatus CpuEncode::InitAV1Params(mfxVideoParam *par) {
         // default to SVT-AV1 rc 2=CVBR
         av_opt_set_int(m_avEncContext->priv_data, "rc", 2, AV_OPT_SEARCH_CHILDREN);
         m_avEncContext->bit_rate = par->mfx.TargetKbps * 1000; // prop is in kbps
+
+        if (m_lookAheadDepth) {
+            ret = av_opt_set_int(m_avEncContext->priv_data,
+                                 "la_depth",
+                                 m_lookAheadDepth,
+                                 AV_OPT_SEARCH_CHILDREN);
+            if (ret)
+                return MFX_ERR_INVALID_VIDEO_PARAM;
+        }
     }
 
     // set targetUsage
@@ -1049,55 +1333,53 @@ mfxStatus CpuEncode::GetAV1Params(mfxVideoParam *par) {
     return MFX_ERR_NONE;
 }
 
-mfxStatus CpuEncode::EncodeFrame(mfxFrameSurface1 *surface, mfxEncodeCtrl *ctrl, mfxBitstream *bs) {
+// syncp == 0 runs synchronously (internal use)
+// the codec runs on the encode lane, this waits for it since the packet
+//   decides what the call returns
+mfxStatus CpuEncode::EncodeFrame(mfxFrameSurface1 *surface,
+                                 mfxEncodeCtrl *ctrl,
+                                 mfxBitstream *bs,
+                                 mfxSyncPoint *syncp) {
     RET_IF_FALSE(m_avEncContext, MFX_ERR_NOT_INITIALIZED);
-    int err;
+    CpuScheduler *scheduler = m_session->GetScheduler();
+    int err                 = 0;
 
     // check mfxEncodeCtrl
-    // none of these features are implemented so function returns invalid param
+    // FrameType, QP, SkipFrame and ROI buffers are supported, see
+    //   ApplyEncodeCtrl()
     if (ctrl) {
         if (ctrl->MfxNalUnitType)
             return MFX_ERR_INVALID_VIDEO_PARAM;
-        if (ctrl->SkipFrame)
-            return MFX_ERR_INVALID_VIDEO_PARAM;
-        if (ctrl->QP)
-            return MFX_ERR_INVALID_VIDEO_PARAM;
-        if (ctrl->FrameType)
-            return MFX_ERR_INVALID_VIDEO_PARAM;
-        if (ctrl->NumExtParam)
+        if (ctrl->QP && (!HasFrameQP() || ctrl->QP > 51))
             return MFX_ERR_INVALID_VIDEO_PARAM;
+        RET_ERROR(m_roi.CheckEncodeCtrl(ctrl));
         if (ctrl->NumPayload)
             return MFX_ERR_INVALID_VIDEO_PARAM;
     }
 
-    // encode one frame
-    if (surface) {
-        AVFrame *av_frame =
-            m_input_locker.GetAVFrame(surface, MFX_MAP_READ, m_session->GetFrameAllocator());
-        RET_IF_FALSE(av_frame, MFX_ERR_ABORTED);
-
-        if (m_param.mfx.CodecId == MFX_CODEC_JPEG) {
-            // must be set for every frame
-            av_frame->quality = m_avEncContext->global_quality;
-        }
-
-        if (surface->Data.TimeStamp)
-            av_frame->pts = surface->Data.TimeStamp;
+    // skipped input is dropped, packets of earlier frames still come out
+    bool skip = surface && ctrl && ctrl->SkipFrame;
 
-        err = avcodec_send_frame(m_avEncContext, av_frame);
-        m_input_locker.Unlock();
-        RET_IF_FALSE(err >= 0, MFX_ERR_ABORTED);
-    }
-    else {
-        // send NULL packet to drain frames
-        err = avcodec_send_frame(m_avEncContext, NULL);
-        RET_IF_FALSE(err == 0 || err == AVERROR_EOF, MFX_ERR_UNKNOWN);
+    // a packet which did not fit last time goes out before anything else,
+    //   the input which produced it has already been sent
+    // other input is refused until the application retries with that
+    //   input, so nothing is encoded twice or sent without its packet
+    //   being received
+    if (m_bPacketPending) {
+        if (surface != m_pendingSurface)
+            return MFX_ERR_NOT_ENOUGH_BUFFER;
+        return DeliverPacket(bs, syncp);
     }
 
-    // get encoded packet, if available
-    mfxU32 nBytesOut = 0, nBytesAvail = 0;
+    // encode one frame
+    m_directBitstream = bs;
+    mfxStatus sts     = scheduler->Run(VPL_TASK_LANE_ENCODE, [&]() {
+        return EncodeStep(surface, ctrl, skip, &err);
+    });
+    m_directBitstream = nullptr;
+    RET_ERROR(sts);
 
-    err = avcodec_receive_packet(m_avEncContext, m_avEncPacket);
+    // get encoded packet, if available
     if (err == AVERROR(EAGAIN)) {
         // need more data - nothing to do
         RET_ERROR(MFX_ERR_MORE_DATA);
@@ -1109,49 +1391,326 @@ mfxStatus CpuEncode::EncodeFrame(mfxFrameSurface1 *surface, mfxEncodeCtrl *ctrl,
         // other error
         RET_ERROR(MFX_ERR_UNDEFINED_BEHAVIOR);
     }
-    else {
-        if (!m_bFrameEncoded)
-            m_bFrameEncoded = true;
 
-        // copy encoded data to output buffer
-        nBytesOut   = m_avEncPacket->size;
-        nBytesAvail = bs->MaxLength - (bs->DataLength + bs->DataOffset);
+    if (!m_bFrameEncoded)
+        m_bFrameEncoded = true;
 
-        if (nBytesOut > nBytesAvail) {
-            //error if encoded bytes out is larger than provided output buffer size
-            return MFX_ERR_NOT_ENOUGH_BUFFER;
+    m_pendingSurface = surface;
+    return DeliverPacket(bs, syncp);
+}
+
+// codec side of EncodeFrame(), runs on the encode lane
+// surface is sent unless skip is set, then the next packet is received
+//   into m_avEncPacket if err is set, *err is the result of
+//   avcodec_receive_packet()
+mfxStatus CpuEncode::EncodeStep(mfxFrameSurface1 *surface,
+                                mfxEncodeCtrl *ctrl,
+                                bool skip,
+                                int *err) {
+    CpuStats::Timer timer;
+    mfxStatus sts = skip ? MFX_ERR_NONE : SendFrame(surface, ctrl);
+    if (sts == MFX_ERR_NONE && err) {
+        *err = VPL_TRACE_CALL("avcodec_receive_packet",
+                              avcodec_receive_packet(m_avEncContext, m_avEncPacket));
+        if (*err == 0)
+            m_timestamps.SetPacketTimes(m_avEncPacket);
+    }
+    m_stats.AddTime(timer);
+    return sts;
+}
+
+bool CpuEncode::HasFrameQP() const {
+    // libx264 compares its qp option with its settings when a frame is
+    //   encoded, not when it is sent, so the option only reaches the frame
+    //   just sent if nothing is held back: no B-frames, no lookahead (off
+    //   in InitAVCParams() then) and no frame threads
+    return m_param.mfx.CodecId == MFX_CODEC_AVC &&
+           m_param.mfx.RateControlMethod == MFX_RATECONTROL_CQP &&
+           m_avEncCodec->name == std::string("libx264") && m_avEncContext->max_b_frames == 0 &&
+           (!(m_avEncContext->thread_type & FF_THREAD_FRAME) || m_threadCount <= 1);
+}
+
+// picture type, QP and regions for frame, ctrl may be null
+// a QP or ROI from ctrl holds for this frame only, later frames get
+//   mfx.QPI and the ROI from MFXVideoENCODE_Init() back
+mfxStatus CpuEncode::ApplyEncodeCtrl(AVFrame *frame, mfxEncodeCtrl *ctrl) {
+    mfxU16 type      = ctrl ? ctrl->FrameType : 0;
+    frame->pict_type = AV_PICTURE_TYPE_NONE;
+    if (type & (MFX_FRAMETYPE_I | MFX_FRAMETYPE_IDR))
+        frame->pict_type = AV_PICTURE_TYPE_I;
+    else if (type & MFX_FRAMETYPE_P)
+        frame->pict_type = AV_PICTURE_TYPE_P;
+    else if (type & MFX_FRAMETYPE_B)
+        frame->pict_type = AV_PICTURE_TYPE_B;
+
+    if (HasFrameQP()) {
+        mfxU16 qp = (ctrl && ctrl->QP) ? ctrl->QP : m_param.mfx.QPI;
+        if (qp != m_frameQP) {
+            int ret = av_opt_set_int(m_avEncContext->priv_data, "qp", qp, AV_OPT_SEARCH_CHILDREN);
+            RET_IF_FALSE(ret == 0, MFX_ERR_INVALID_VIDEO_PARAM);
+            m_frameQP = qp;
         }
-        memcpy_s(bs->Data + bs->DataOffset, nBytesAvail, m_avEncPacket->data, nBytesOut);
-        bs->DataLength += nBytesOut;
-        // TO DO - convert to 90khz timestamps (read m_avEncPacket->pts, ->dts)
-        // Note dts may start at < 0, should +=1 each frame
-        bs->TimeStamp       = m_avEncPacket->pts;
-        bs->DecodeTimeStamp = MFX_TIMESTAMP_UNKNOWN;
-        bs->CodecId         = m_param.mfx.CodecId;
-        bs->PicStruct       = MFX_PICSTRUCT_PROGRESSIVE;
-
-        // TO DO - verify logic across codecs - may require parsing
-        //   output packets to get correct mapping of frame types
-        bs->FrameType = MFX_FRAMETYPE_UNKNOWN;
-        if (m_avEncPacket->flags & AV_PKT_FLAG_KEY) {
-            bs->FrameType = MFX_FRAMETYPE_I;
-            bs->FrameType |= MFX_FRAMETYPE_REF;
+    }
+    return m_roi.AttachRegions(frame, ctrl);
+}
+
+// surface == 0 starts draining the encoder
+mfxStatus CpuEncode::SendFrame(mfxFrameSurface1 *surface, mfxEncodeCtrl *ctrl) {
+    int err;
+
+    if (!surface) {
+        // send NULL packet to drain frames
+        err = avcodec_send_frame(m_avEncContext, NULL);
+        RET_IF_FALSE(err == 0 || err == AVERROR_EOF, MFX_ERR_UNKNOWN);
+        return MFX_ERR_NONE;
+    }
+
+    // input may still be written by a decode or VPP task
+    m_session->GetScheduler()->WaitSurface(surface);
+
+    AVFrame *av_frame =
+        m_input_locker.GetAVFrame(surface, MFX_MAP_READ, m_session->GetFrameAllocator());
+    RET_IF_FALSE(av_frame, MFX_ERR_ABORTED);
+
+    if (m_param.mfx.CodecId == MFX_CODEC_JPEG) {
+        // must be set for every frame
+        av_frame->quality = m_avEncContext->global_quality;
+    }
+
+    // wrappers are reused, so this is set for every frame
+    mfxStatus sts = ApplyEncodeCtrl(av_frame, ctrl);
+    if (sts != MFX_ERR_NONE) {
+        m_input_locker.Unlock();
+        return sts;
+    }
+    av_frame->pts = CpuEncodeTimestamps::GetSurfacePts(surface);
+    m_timestamps.SetFramePts(av_frame);
+
+    // libavcodec would copy a frame it cannot reference itself,
+    //   semi-planar input is interleaved or split on the way
+    AVFrame *staged = nullptr;
+    if (!av_frame->buf[0] || av_frame->format != m_inputFormat) {
+        staged = ConvertAVFrame(av_frame, m_inputFormat);
+        if (!staged) {
+            m_input_locker.Unlock();
+            return MFX_ERR_MEMORY_ALLOC;
         }
-        else if (m_avEncPacket->flags & AV_PKT_FLAG_DISPOSABLE) {
-            bs->FrameType = MFX_FRAMETYPE_B;
+    }
+
+    err = VPL_TRACE_CALL("avcodec_send_frame",
+                         avcodec_send_frame(m_avEncContext, staged ? staged : av_frame));
+    av_frame_free(&staged);
+    m_input_locker.Unlock();
+    RET_IF_FALSE(err >= 0, MFX_ERR_ABORTED);
+    m_stats.AddFrameIn();
+
+    return MFX_ERR_NONE;
+}
+
+// move m_avEncPacket to the end of bs
+// a packet which does not fit stays pending for the next call, so the
+//   application can retry with a larger buffer without losing it
+mfxStatus CpuEncode::DeliverPacket(mfxBitstream *bs, mfxSyncPoint *syncp) {
+    mfxU32 nBytesOut   = m_avEncPacket->size;
+    mfxU32 nBytesAvail = bs->MaxLength - (bs->DataLength + bs->DataOffset);
+    mfxU8 *dst         = bs->Data + bs->DataOffset + bs->DataLength;
+
+    // reported through GetVideoParam() BufferSizeInKB
+    m_maxPacketSize = std::max(m_maxPacketSize, nBytesOut);
+
+    // already written to dst through get_encode_buffer
+    bool in_place = nBytesOut && m_avEncPacket->data == dst;
+
+    if (!in_place && nBytesOut > nBytesAvail) {
+        //error if encoded bytes out is larger than provided output buffer size
+        m_bPacketPending = true;
+        return MFX_ERR_NOT_ENOUGH_BUFFER;
+    }
+    m_bPacketPending = false;
+    m_stats.AddFrameOut(nBytesOut);
+
+    bs->DataLength += nBytesOut;
+    SetBitstreamInfo(bs, m_avEncPacket);
+
+    if (in_place) {
+        av_packet_unref(m_avEncPacket);
+        if (!syncp)
+            return MFX_ERR_NONE;
+
+        // nothing left to do, the task only orders syncp after
+        //   earlier work on the encode lane
+        return m_session->GetScheduler()->Submit(
+            VPL_TASK_LANE_ENCODE,
+            []() {
+                return MFX_ERR_NONE;
+            },
+            syncp);
+    }
+
+    if (syncp) {
+        // bitstream fields are final, payload is written on the encode lane
+        AVPacket *pkt = av_packet_alloc();
+        RET_IF_FALSE(pkt, MFX_ERR_MEMORY_ALLOC);
+        av_packet_move_ref(pkt, m_avEncPacket);
+
+        return m_session->GetScheduler()->Submit(
+            VPL_TASK_LANE_ENCODE,
+            [dst, pkt]() mutable {
+                memcpy_s(dst, pkt->size, pkt->data, pkt->size);
+                av_packet_free(&pkt);
+                return MFX_ERR_NONE;
+            },
+            syncp);
+    }
+    memcpy_s(dst, nBytesAvail, m_avEncPacket->data, nBytesOut);
+
+    av_packet_unref(m_avEncPacket);
+
+    return MFX_ERR_NONE;
+}
+
+void CpuEncode::SetBitstreamInfo(mfxBitstream *bs, const AVPacket *pkt) {
+    // already 90 kHz, see CpuEncodeTimestamps
+    bs->TimeStamp       = pkt->pts;
+    bs->DecodeTimeStamp = (pkt->dts != AV_NOPTS_VALUE) ? pkt->dts : MFX_TIMESTAMP_UNKNOWN;
+    bs->CodecId         = m_param.mfx.CodecId;
+    bs->PicStruct       = MFX_PICSTRUCT_PROGRESSIVE;
+
+    // TO DO - verify logic across codecs - may require parsing
+    //   output packets to get correct mapping of frame types
+    bs->FrameType = MFX_FRAMETYPE_UNKNOWN;
+    if (pkt->flags & AV_PKT_FLAG_KEY) {
+        bs->FrameType = MFX_FRAMETYPE_I;
+        bs->FrameType |= MFX_FRAMETYPE_REF;
+    }
+    else if (pkt->flags & AV_PKT_FLAG_DISPOSABLE) {
+        bs->FrameType = MFX_FRAMETYPE_B;
+    }
+    else {
+        bs->FrameType = MFX_FRAMETYPE_P;
+        bs->FrameType |= MFX_FRAMETYPE_REF;
+    }
+}
+
+mfxStatus CpuEncode::EncodeAVFrame(AVFrame *frame,
+                                   std::vector<AVPacket *> *packets,
+                                   bool keyFrame) {
+    RET_IF_FALSE(m_avEncContext, MFX_ERR_NOT_INITIALIZED);
+    CpuStats::Timer timer;
+    int err;
+
+    if (frame) {
+        // encoder reads width x height from the frame buffers
+        RET_IF_FALSE(frame->width == m_avEncContext->width &&
+                         frame->height == m_avEncContext->height,
+                     MFX_ERR_INCOMPATIBLE_VIDEO_PARAM);
+
+        // decoder or VPP output in the other chroma layout
+        AVFrame *staged = nullptr;
+        if (frame->format != m_inputFormat && frame->format != m_avEncContext->pix_fmt) {
+            staged = ConvertAVFrame(frame, m_inputFormat);
+            RET_IF_FALSE(staged, MFX_ERR_INCOMPATIBLE_VIDEO_PARAM);
+            frame = staged;
         }
-        else {
-            bs->FrameType = MFX_FRAMETYPE_P;
-            bs->FrameType |= MFX_FRAMETYPE_REF;
+
+        if (m_param.mfx.CodecId == MFX_CODEC_JPEG)
+            frame->quality = m_avEncContext->global_quality;
+        // picture types chosen by the source encoder are not forced
+        frame->pict_type = keyFrame ? AV_PICTURE_TYPE_I : AV_PICTURE_TYPE_NONE;
+
+        mfxStatus sts = m_roi.AttachRegions(frame, nullptr);
+        if (sts != MFX_ERR_NONE) {
+            av_frame_free(&staged);
+            return sts;
+        }
+        m_timestamps.SetFramePts(frame);
+
+        err = VPL_TRACE_CALL("avcodec_send_frame", avcodec_send_frame(m_avEncContext, frame));
+        av_frame_free(&staged);
+        RET_IF_FALSE(err >= 0, MFX_ERR_ABORTED);
+        m_stats.AddFrameIn();
+    }
+    else {
+        err = avcodec_send_frame(m_avEncContext, NULL);
+        RET_IF_FALSE(err == 0 || err == AVERROR_EOF, MFX_ERR_UNKNOWN);
+    }
+
+    for (;;) {
+        AVPacket *pkt = av_packet_alloc();
+        RET_IF_FALSE(pkt, MFX_ERR_MEMORY_ALLOC);
+
+        err = VPL_TRACE_CALL("avcodec_receive_packet", avcodec_receive_packet(m_avEncContext, pkt));
+        if (err < 0) {
+            av_packet_free(&pkt);
+            break;
         }
+        m_maxPacketSize = std::max(m_maxPacketSize, static_cast<mfxU32>(pkt->size));
+        m_timestamps.SetPacketTimes(pkt);
+        packets->push_back(pkt);
     }
+    RET_IF_FALSE(err == AVERROR(EAGAIN) || err == AVERROR_EOF, MFX_ERR_UNDEFINED_BEHAVIOR);
 
-    av_packet_unref(m_avEncPacket);
+    m_bFrameEncoded = true;
+    m_stats.AddTime(timer);
+    return MFX_ERR_NONE;
+}
+
+mfxStatus CpuEncode::WritePacket(AVPacket *pkt, mfxBitstream *bs) {
+    mfxU32 nBytesOut   = pkt->size;
+    mfxU32 nBytesAvail = bs->MaxLength - (bs->DataLength + bs->DataOffset);
+    RET_IF_FALSE(nBytesOut <= nBytesAvail, MFX_ERR_NOT_ENOUGH_BUFFER);
 
+    memcpy_s(bs->Data + bs->DataOffset + bs->DataLength, nBytesAvail, pkt->data, nBytesOut);
+    bs->DataLength += nBytesOut;
+    SetBitstreamInfo(bs, pkt);
+    m_stats.AddFrameOut(nBytesOut);
     return MFX_ERR_NONE;
 }
 
+#ifdef ENABLE_ENCODE_DIRECT_BITSTREAM
+// bitstream memory belongs to the application
+static void KeepBitstreamData(void *opaque, uint8_t *data) {}
+
+// hand the free space at the end of the current mfxBitstream to the
+//   encoder, so the packet needs no copy
+int CpuEncode::GetEncodeBuffer(AVCodecContext *avctx, AVPacket *pkt, int flags) {
+    CpuEncode *encoder = reinterpret_cast<CpuEncode *>(avctx->opaque);
+    mfxBitstream *bs   = encoder->m_directBitstream;
+
+    // one packet per call, never one the encoder keeps referencing
+    if (bs && bs->Data && !(flags & AV_GET_ENCODE_BUFFER_FLAG_REF)) {
+        mfxU64 needed = static_cast<mfxU64>(pkt->size) + AV_INPUT_BUFFER_PADDING_SIZE;
+        mfxU32 avail  = bs->MaxLength - (bs->DataOffset + bs->DataLength);
+        if (needed <= avail) {
+            mfxU8 *dst = bs->Data + bs->DataOffset + bs->DataLength;
+            pkt->buf   = av_buffer_create(dst,
+                                        static_cast<int>(needed),
+                                        KeepBitstreamData,
+                                        nullptr,
+                                        0);
+            if (pkt->buf) {
+                pkt->data = dst;
+                memset(dst + pkt->size, 0, AV_INPUT_BUFFER_PADDING_SIZE);
+                encoder->m_directBitstream = nullptr;
+                return 0;
+            }
+        }
+    }
+
+    return avcodec_default_get_encode_buffer(avctx, pkt, flags);
+}
+#endif
+
 mfxStatus CpuEncode::EncodeQueryIOSurf(mfxVideoParam *par, mfxFrameAllocRequest *request) {
+    // the only parameter checked here, the count depends on it
+    mfxU16 lookAheadDepth = GetLookAheadDepth(par);
+    RET_IF_FALSE(IsLookAheadDepthValid(lookAheadDepth), MFX_ERR_INVALID_VIDEO_PARAM);
+    return EncodeQueryIOSurf(par, lookAheadDepth, request);
+}
+
+mfxStatus CpuEncode::EncodeQueryIOSurf(mfxVideoParam *par,
+                                       mfxU16 lookAheadDepth,
+                                       mfxFrameAllocRequest *request) {
     // may be null for internal use
     if (par)
         request->Info = par->mfx.FrameInfo;
@@ -1165,8 +1724,10 @@ mfxStatus CpuEncode::EncodeQueryIOSurf(mfxVideoParam *par, mfxFrameAllocRequest
     //  if (sts < 0) return MFX_ERR_INVALID_VIDEO_PARAM;
     //}
 
-    request->NumFrameMin       = 3; // TO DO - calculate correctly from libav
-    request->NumFrameSuggested = 3;
+    // each frame in flight holds one more input surface, and so does each
+    //   one in the lookahead
+    request->NumFrameMin       = 3 + lookAheadDepth; // TO DO - calculate correctly from libav
+    request->NumFrameSuggested = 3 + lookAheadDepth + GetAsyncDepth(par) - 1;
     request->Type              = MFX_MEMTYPE_SYSTEM_MEMORY | MFX_MEMTYPE_FROM_ENCODE;
 
     return MFX_ERR_NONE;
@@ -1207,6 +1768,7 @@ mfxStatus CpuEncode::EncodeQuery(mfxVideoParam *in, mfxVideoParam *out) {
         out->mfx.RateControlMethod        = 1;
         out->mfx.QPI                      = 1;
         out->mfx.Quality                  = 1;
+        out->mfx.NumThread                = 1;
         out->mfx.FrameInfo.PicStruct      = 1;
         out->mfx.FrameInfo.BitDepthChroma = 1;
         out->mfx.FrameInfo.BitDepthLuma   = 1;
@@ -1231,7 +1793,8 @@ mfxStatus CpuEncode::EncodeQuery(mfxVideoParam *in, mfxVideoParam *out) {
 mfxStatus CpuEncode::GetEncodeSurface(mfxFrameSurface1 **surface) {
     if (!m_encSurfaces) {
         mfxFrameAllocRequest EncRequest = { 0 };
-        RET_ERROR(EncodeQueryIOSurf(nullptr, &EncRequest));
+        // ext buffers of m_param are the application's and may be gone
+        RET_ERROR(EncodeQueryIOSurf(&m_param, m_lookAheadDepth, &EncRequest));
 
         auto pool = std::make_unique<CpuFramePool>();
         RET_ERROR(pool->Init(m_param.mfx.FrameInfo.FourCC,
@@ -1242,17 +1805,31 @@ mfxStatus CpuEncode::GetEncodeSurface(mfxFrameSurface1 **surface) {
     }
 
     mfxStatus sts = m_encSurfaces->GetFreeSurface(surface);
+    if (sts != MFX_ERR_NONE) {
+        return sts;
+    }
+    if (*surface == nullptr) {
+        return MFX_ERR_NOT_ENOUGH_BUFFER;
+    }
     (*surface)->Data.MemType |=
         MFX_MEMTYPE_FROM_ENC | MFX_MEMTYPE_SYSTEM_MEMORY | MFX_MEMTYPE_INTERNAL_FRAME;
     return sts;
 }
 
 mfxStatus CpuEncode::GetVideoParam(mfxVideoParam *par) {
+    // ext buffers are the caller's
+    mfxExtBuffer **extParam = par->ExtParam;
+    mfxU16 numExtParam      = par->NumExtParam;
+
     *par = m_param;
     //*par = { 0 };
+    par->ExtParam    = extParam;
+    par->NumExtParam = numExtParam;
+    m_stats.FillExtBuffer(par);
 
-    par->IOPattern  = MFX_IOPATTERN_IN_SYSTEM_MEMORY;
-    par->AsyncDepth = 1;
+    par->IOPattern     = MFX_IOPATTERN_IN_SYSTEM_MEMORY;
+    par->AsyncDepth    = GetAsyncDepth(&m_param);
+    par->mfx.NumThread = static_cast<mfxU16>(m_threadCount);
 
     switch (m_avEncCodec->id) {
         case AV_CODEC_ID_H264:
@@ -1284,12 +1861,14 @@ mfxStatus CpuEncode::GetVideoParam(mfxVideoParam *par) {
     // FourCC and chroma format
     switch (m_avEncContext->pix_fmt) {
         case AV_PIX_FMT_YUV420P10LE:
+        case AV_PIX_FMT_P010LE:
             par->mfx.FrameInfo.FourCC         = MFX_FOURCC_I010;
             par->mfx.FrameInfo.BitDepthLuma   = 10;
             par->mfx.FrameInfo.BitDepthChroma = 10;
             par->mfx.FrameInfo.ChromaFormat   = MFX_CHROMAFORMAT_YUV420;
             break;
         case AV_PIX_FMT_YUV420P:
+        case AV_PIX_FMT_NV12:
             par->mfx.FrameInfo.FourCC         = MFX_FOURCC_IYUV;
             par->mfx.FrameInfo.BitDepthLuma   = 8;
             par->mfx.FrameInfo.BitDepthChroma = 8;
@@ -1301,6 +1880,12 @@ mfxStatus CpuEncode::GetVideoParam(mfxVideoParam *par) {
             par->mfx.FrameInfo.FourCC = 0;
     }
 
+    // surfaces stay semi-planar whatever the encoder takes
+    if (IsSemiPlanarFourCC(m_param.mfx.FrameInfo.FourCC)) {
+        par->mfx.FrameInfo.FourCC = m_param.mfx.FrameInfo.FourCC;
+        par->mfx.FrameInfo.Shift  = m_param.mfx.FrameInfo.Shift;
+    }
+
     // Frame rate
     par->mfx.FrameInfo.FrameRateExtN = (uint16_t)m_avEncContext->framerate.num;
     par->mfx.FrameInfo.FrameRateExtD = (uint16_t)m_avEncContext->framerate.den;
@@ -1328,6 +1913,33 @@ mfxStatus CpuEncode::GetVideoParam(mfxVideoParam *par) {
             break;
     }
 
+    // the encoders report their bitrate mode, the lookahead is ours
+    if (m_lookAheadDepth) {
+        par->mfx.RateControlMethod = MFX_RATECONTROL_LA;
+        mfxExtCodingOption2 *co2   = GetCodingOption2(par);
+        if (co2)
+            co2->LookAheadDepth = m_lookAheadDepth;
+    }
+
+    // large enough for every packet so far, lets applications size
+    //   their buffers after MFX_ERR_NOT_ENOUGH_BUFFER
+    if (par->mfx.CodecId != MFX_CODEC_JPEG && m_maxPacketSize) {
+        mfxU32 multiplier = par->mfx.BRCParamMultiplier ? par->mfx.BRCParamMultiplier : 1;
+        mfxU32 sizeInKB   = (m_maxPacketSize + 999) / 1000;
+        if (par->mfx.BufferSizeInKB * multiplier < sizeInKB) {
+            par->mfx.BufferSizeInKB =
+                static_cast<mfxU16>(std::min<mfxU32>((sizeInKB + multiplier - 1) / multiplier,
+                                                     0xFFFF));
+        }
+    }
+
+    return MFX_ERR_NONE;
+}
+
+mfxStatus CpuEncode::GetEncodeStat(mfxEncodeStat *stat) {
+    stat->NumFrame       = static_cast<mfxU32>(m_stats.GetFramesOut());
+    stat->NumBit         = m_stats.GetBytes() * 8;
+    stat->NumCachedFrame = m_stats.GetCachedFrames();
     return MFX_ERR_NONE;
 }
 
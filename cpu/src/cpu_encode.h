@@ -10,10 +10,20 @@
 #include <memory>
 #include <string>
 #include <utility>
+#include <vector>
 #include "src/cpu_common.h"
 #include "src/cpu_frame_pool.h"
+#include "src/cpu_roi.h"
+#include "src/cpu_stats.h"
+#include "src/cpu_timestamp.h"
 #include "src/frame_lock.h"
 
+// encoders can write packets into application memory (get_encode_buffer)
+//   since libavcodec 58.134 (FFmpeg 4.4)
+#if LIBAVCODEC_VERSION_INT >= AV_VERSION_INT(58, 134, 100)
+    #define ENABLE_ENCODE_DIRECT_BITSTREAM
+#endif
+
 class CpuWorkstream;
 
 class CpuEncode {
@@ -25,13 +35,33 @@ public:
     static mfxStatus EncodeQueryIOSurf(mfxVideoParam* par, mfxFrameAllocRequest* request);
 
     mfxStatus InitEncode(mfxVideoParam* par);
-    mfxStatus EncodeFrame(mfxFrameSurface1* surface, mfxEncodeCtrl* ctrl, mfxBitstream* bs);
+    // apply par to the open encoder if it only changes what the encoder
+    //   takes on the fly (bitrate, QP, JPEG quality)
+    // MFX_ERR_UNSUPPORTED when the encoder has to be initialized again
+    mfxStatus ReconfigureEncode(mfxVideoParam* par);
+    mfxStatus EncodeFrame(mfxFrameSurface1* surface,
+                          mfxEncodeCtrl* ctrl,
+                          mfxBitstream* bs,
+                          mfxSyncPoint* syncp);
+    // transcode pipeline input, frames come straight from the decoder or
+    //   VPP and encoded packets are appended to packets
+    // frame == 0 starts draining the encoder
+    // keyFrame forces a key frame, picture types are not forced otherwise
+    // frame->pts is 90 kHz (AV_NOPTS_VALUE if unknown), and so are the
+    //   PTS and DTS of packets
+    mfxStatus EncodeAVFrame(AVFrame* frame, std::vector<AVPacket*>* packets, bool keyFrame = false);
+    // copy a packet from EncodeAVFrame() to the end of bs
+    mfxStatus WritePacket(AVPacket* pkt, mfxBitstream* bs);
     mfxStatus GetVideoParam(mfxVideoParam* par);
     mfxStatus GetEncodeSurface(mfxFrameSurface1** surface);
+    mfxStatus GetEncodeStat(mfxEncodeStat* stat);
     mfxStatus IsSameVideoParam(mfxVideoParam* newPar, mfxVideoParam* oldPar);
 
 private:
     static mfxStatus ValidateEncodeParams(mfxVideoParam* par, bool canCorrect);
+    static mfxStatus EncodeQueryIOSurf(mfxVideoParam* par,
+                                       mfxU16 lookAheadDepth,
+                                       mfxFrameAllocRequest* request);
     int convertTargetUsageVal(int val, int minIn, int maxIn, int minOut, int maxOut);
     mfxStatus InitHEVCParams(mfxVideoParam* par);
     mfxStatus GetHEVCParams(mfxVideoParam* par);
@@ -43,6 +73,15 @@ private:
     mfxStatus GetJPEGParams(mfxVideoParam* par);
 
     AVFrame* CreateAVFrame(mfxFrameSurface1* surface);
+    mfxStatus EncodeStep(mfxFrameSurface1* surface, mfxEncodeCtrl* ctrl, bool skip, int* err);
+    bool HasFrameQP() const;
+    mfxStatus ApplyEncodeCtrl(AVFrame* frame, mfxEncodeCtrl* ctrl);
+    mfxStatus SendFrame(mfxFrameSurface1* surface, mfxEncodeCtrl* ctrl);
+    mfxStatus DeliverPacket(mfxBitstream* bs, mfxSyncPoint* syncp);
+    void SetBitstreamInfo(mfxBitstream* bs, const AVPacket* pkt);
+#ifdef ENABLE_ENCODE_DIRECT_BITSTREAM
+    static int GetEncodeBuffer(AVCodecContext* avctx, AVPacket* pkt, int flags);
+#endif
 
     const AVCodec* m_avEncCodec;
     AVCodecContext* m_avEncContext;
@@ -52,6 +91,30 @@ private:
     mfxVideoParam m_param;
     bool m_bFrameEncoded;
 
+    // m_avEncPacket did not fit into the last bitstream
+    bool m_bPacketPending;
+    // input already sent for the pending packet, compared only
+    mfxFrameSurface1* m_pendingSurface;
+    // bitstream offered to get_encode_buffer during EncodeFrame(), read
+    //   on the encode lane while the caller waits
+    mfxBitstream* m_directBitstream;
+    mfxU32 m_maxPacketSize;
+    // layout frames are sent in, semi-planar input is converted to it
+    //   unless the encoder takes that layout natively
+    AVPixelFormat m_inputFormat;
+    // qp libx264 was last given, mfx.QPI or the one of the last ctrl
+    mfxU16 m_frameQP;
+    CpuEncodeROI m_roi;
+    // packets leave with 90 kHz PTS and DTS
+    CpuEncodeTimestamps m_timestamps;
+    // MFX_RATECONTROL_LA frames, 0 in other modes
+    mfxU16 m_lookAheadDepth;
+
+    // taken from the thread budget
+    int m_threadCount;
+
+    CpuStats m_stats;
+
     CpuWorkstream* m_session;
 
     std::unique_ptr<CpuFramePool> m_encSurfaces;
@@ -5,6 +5,8 @@
   ############################################################################*/
 
 #include "src/cpu_frame.h"
+#include "src/cpu_frame_pool.h"
+#include "src/cpu_scheduler.h"
 
 // increase refCount on surface (+1)
 mfxStatus CpuFrame::AddRef(mfxFrameSurface1* surface) {
@@ -26,10 +28,15 @@ mfxStatus CpuFrame::Release(mfxFrameSurface1* surface) {
     CpuFrame* cpu_frame = TryCast(surface);
     RET_IF_FALSE(cpu_frame, MFX_ERR_INVALID_HANDLE);
 
-    if (cpu_frame->m_refCount == 0)
-        return MFX_ERR_UNDEFINED_BEHAVIOR;
+    mfxU32 count = cpu_frame->m_refCount;
+    do {
+        if (count == 0)
+            return MFX_ERR_UNDEFINED_BEHAVIOR;
+    } while (!cpu_frame->m_refCount.compare_exchange_weak(count, count - 1));
 
-    cpu_frame->m_refCount--;
+    // last reference, frame goes back to its pool
+    if (count == 1 && cpu_frame->m_pool)
+        cpu_frame->m_pool->ReturnFrame(cpu_frame);
 
     return MFX_ERR_NONE;
 }
@@ -66,7 +73,7 @@ mfxStatus CpuFrame::Map(mfxFrameSurface1* surface, mfxU32 flags) {
     if ((flags | validFlags) != validFlags)
         return MFX_ERR_UNSUPPORTED;
 
-    if ((flags & MFX_MAP_WRITE) && (cpu_frame->Data.Locked != 0))
+    if ((flags & MFX_MAP_WRITE) && (GetLocked(&cpu_frame->Data) != 0))
         return MFX_ERR_LOCK_MEMORY;
 
     // save mapping flags
@@ -132,11 +139,16 @@ mfxStatus CpuFrame::Synchronize(mfxFrameSurface1* surface, mfxU32 wait) {
     CpuFrame* cpu_frame = TryCast(surface);
     RET_IF_FALSE(cpu_frame, MFX_ERR_INVALID_HANDLE);
 
-    // TO DO - VPL CPU ref is currently synchronous (Sync does nothing)
-    // need to align sync behavior between legacy SyncOperation()
-    //   and new sync on surfaces
-    // probably need to track mapping of unique sync points to associated
-    //   mfxFrameSurface1 surfaces, and sync here
+    // no task was ever submitted for this surface
+    if (!cpu_frame->m_scheduler || !cpu_frame->m_syncp)
+        return MFX_ERR_NONE;
 
-    return MFX_ERR_NONE;
+    mfxStatus sts = cpu_frame->m_scheduler->Sync(cpu_frame->m_syncp, wait);
+    if (sts != MFX_WRN_IN_EXECUTION)
+        cpu_frame->m_syncp = nullptr;
+    // the application already synced the operation itself
+    if (sts == MFX_ERR_NOT_FOUND)
+        sts = MFX_ERR_NONE;
+
+    return sts;
 }
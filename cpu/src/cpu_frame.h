@@ -9,10 +9,22 @@
 
 #include "src/cpu_common.h"
 
+class CpuFramePool;
+class CpuScheduler;
+
 // Implemented via AVFrame
 class CpuFrame : public mfxFrameSurface1 {
 public:
-    CpuFrame() : m_refCount(0), m_mappedFlags(0) {
+    CpuFrame()
+            : m_refCount(0),
+              m_mappedFlags(0),
+              m_scheduler(nullptr),
+              m_syncp(nullptr),
+              m_pool(nullptr),
+              m_nextFree(nullptr),
+              m_isFree(false),
+              m_isHeld(false),
+              m_lastUsed(0) {
         m_avframe = av_frame_alloc();
 
         *(mfxFrameSurface1*)this    = {};
@@ -69,12 +81,15 @@ public:
         Info.FourCC = AVPixelFormat2MFXFourCC(avframe->format);
         switch (avframe->format) {
             case AV_PIX_FMT_YUV420P10LE:
+            case AV_PIX_FMT_P010LE:
                 Info.BitDepthLuma   = 10;
                 Info.BitDepthChroma = 10;
                 Info.ChromaFormat   = MFX_CHROMAFORMAT_YUV420;
+                Info.Shift          = (avframe->format == AV_PIX_FMT_P010LE) ? 1 : 0;
                 break;
             case AV_PIX_FMT_YUV420P:
             case AV_PIX_FMT_YUVJ420P:
+            case AV_PIX_FMT_NV12:
                 Info.BitDepthLuma   = 8;
                 Info.BitDepthChroma = 8;
                 Info.ChromaFormat   = MFX_CHROMAFORMAT_YUV420;
@@ -107,6 +122,13 @@ public:
             Data.R = avframe->data[0] + 2;
             Data.A = avframe->data[0] + 3;
         }
+        else if (IsSemiPlanarFourCC(Info.FourCC)) {
+            // V is the second sample of each interleaved pair
+            Data.Y  = avframe->data[0];
+            Data.UV = avframe->data[1];
+            Data.V  = avframe->data[1] + ((Info.FourCC == MFX_FOURCC_P010) ? 2 : 1);
+            Data.A  = nullptr;
+        }
         else {
             Data.Y = avframe->data[0];
             Data.U = avframe->data[1];
@@ -123,11 +145,28 @@ public:
         return ImportAVFrame(m_avframe);
     }
 
+    // remember the task which produces this frame, for Synchronize()
+    void SetSyncPoint(CpuScheduler* scheduler, mfxSyncPoint syncp) {
+        m_scheduler = scheduler;
+        m_syncp     = syncp;
+    }
+
 private:
+    friend class CpuFramePool;
+
     std::atomic<mfxU32> m_refCount; // TODO(we have C++11, correct?)
     mfxU32 m_mappedFlags;
     AVFrame* m_avframe;
     mfxFrameSurfaceInterface m_interface;
+    CpuScheduler* m_scheduler;
+    mfxSyncPoint m_syncp;
+
+    // free or held list links, owned by m_pool and protected by its mutex
+    CpuFramePool* m_pool;
+    CpuFrame* m_nextFree;
+    bool m_isFree;
+    bool m_isHeld;
+    mfxU64 m_lastUsed;
 
     static mfxStatus AddRef(mfxFrameSurface1* surface);
     static mfxStatus Release(mfxFrameSurface1* surface);
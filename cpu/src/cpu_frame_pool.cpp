@@ -5,16 +5,68 @@
   ############################################################################*/
 
 #include "src/cpu_frame_pool.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
 #include <memory>
 #include <utility>
 
-mfxStatus CpuFramePool::Init(mfxU32 nPoolSize) {
+CpuFramePool::~CpuFramePool() {
+    // frames still referenced by the application are destroyed with the pool
+    for (std::unique_ptr<CpuFrame>& surf : m_surfaces) {
+        surf->m_pool = nullptr;
+    }
+}
+
+// VPL_POOL_MAX_BYTES from the environment, or the build time default
+size_t CpuFramePool::GetDefaultMaxBytes() {
+    const char* value = getenv("VPL_POOL_MAX_BYTES");
+    if (value && *value) {
+        char* end            = nullptr;
+        unsigned long long n = strtoull(value, &end, 0);
+        if (end && !*end)
+            return static_cast<size_t>(n);
+    }
+    return static_cast<size_t>(VPL_POOL_MAX_BYTES);
+}
+
+// bytes of one frame as described by the pool parameters, 0 if unknown
+size_t CpuFramePool::GetInfoBytes(mfxU32 FourCC, mfxU32 width, mfxU32 height) {
+    int bytes = av_image_get_buffer_size(MFXFourCC2AVPixelFormat(FourCC), width, height, 1);
+    return bytes > 0 ? static_cast<size_t>(bytes) : 0;
+}
+
+// bytes of frame data, 0 for frames the decoder has not filled yet
+size_t CpuFramePool::GetFrameBytes(CpuFrame* frame) {
+    AVFrame* avframe = frame->GetAVFrame();
+    size_t bytes     = 0;
+    for (int i = 0; avframe && i < AV_NUM_DATA_POINTERS; i++) {
+        if (avframe->buf[i])
+            bytes += avframe->buf[i]->size;
+    }
+    return bytes;
+}
+
+void CpuFramePool::SetMaxBytes(size_t maxBytes) {
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_maxBytes = maxBytes;
+    }
+    // a raised limit lets waiting requests allocate
+    m_frameReturned.notify_all();
+}
+
+mfxStatus CpuFramePool::Init(const mfxFrameInfo& info, mfxU32 nPoolSize) {
+    m_frameBytes = GetInfoBytes(info.FourCC, info.Width, info.Height);
+
     for (mfxU32 i = 0; i < nPoolSize; i++) {
         auto cpu_frame = std::make_unique<CpuFrame>();
         RET_IF_FALSE(cpu_frame->GetAVFrame(), MFX_ERR_MEMORY_ALLOC);
-        m_surfaces.push_back(std::move(cpu_frame));
+        RET_ERROR(AddFrame(std::move(cpu_frame)));
     }
 
+    m_minSurfaces = nPoolSize;
+
     return MFX_ERR_NONE;
 }
 
@@ -22,41 +74,205 @@ mfxStatus CpuFramePool::Init(mfxU32 FourCC, mfxU32 width, mfxU32 height, mfxU32
     for (mfxU32 i = 0; i < nPoolSize; i++) {
         auto cpu_frame = std::make_unique<CpuFrame>();
         RET_ERROR(cpu_frame->Allocate(FourCC, width, height));
-        m_surfaces.push_back(std::move(cpu_frame));
+        RET_ERROR(AddFrame(std::move(cpu_frame)));
     }
 
     m_info.FourCC = FourCC;
     m_info.Width  = width;
     m_info.Height = height;
+    m_frameBytes  = GetInfoBytes(FourCC, width, height);
+
+    m_minSurfaces = nPoolSize;
 
     return MFX_ERR_NONE;
 }
 
+// take ownership of a new frame and put it on the free list
+mfxStatus CpuFramePool::AddFrame(std::unique_ptr<CpuFrame> frame) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    frame->m_pool = this;
+    PushFree(frame.get());
+    m_surfaces.push_back(std::move(frame));
+    return MFX_ERR_NONE;
+}
+
+// allocate a frame owned by the pool, not on the free list
+// called with m_mutex held
+mfxStatus CpuFramePool::NewFrame(CpuFrame** frame) {
+    auto cpu_frame = std::make_unique<CpuFrame>();
+    RET_IF_FALSE(cpu_frame && cpu_frame->GetAVFrame(), MFX_ERR_MEMORY_ALLOC);
+    if (m_info.FourCC) {
+        RET_ERROR(cpu_frame->Allocate(m_info.FourCC, m_info.Width, m_info.Height));
+    }
+    cpu_frame->m_pool = this;
+    *frame            = cpu_frame.get();
+    m_surfaces.push_back(std::move(cpu_frame));
+    return MFX_ERR_NONE;
+}
+
+// called with m_mutex held
+void CpuFramePool::PushFree(CpuFrame* frame) {
+    frame->m_isFree   = true;
+    frame->m_nextFree = m_freeHead;
+    m_freeHead        = frame;
+}
+
+// called with m_mutex held
+CpuFrame* CpuFramePool::PopFree() {
+    CpuFrame* frame = m_freeHead;
+    if (frame) {
+        m_freeHead        = frame->m_nextFree;
+        frame->m_nextFree = nullptr;
+        frame->m_isFree   = false;
+    }
+    return frame;
+}
+
+// frames with no references left may still be referenced by libav (e.g.
+//   an encoder or filter graph keeping the AVFrame) or locked through the
+//   1.x API, they wait on the held list instead of the free list
+bool CpuFramePool::IsUnused(CpuFrame* frame) {
+    mfxU32 counter = 0xFFFFFFFF;
+    CpuFrame::GetRefCounter(frame, &counter);
+    return !counter && !GetLocked(&frame->Data);
+}
+
+// called with m_mutex held
+void CpuFramePool::PushHeld(CpuFrame* frame) {
+    frame->m_isHeld   = true;
+    frame->m_nextFree = m_heldHead;
+    m_heldHead        = frame;
+}
+
+// move held frames which are no longer used to the free list
+// libav gives no notification when it drops its reference, so this runs
+//   only when the free list is empty
+// called with m_mutex held
+void CpuFramePool::ReclaimHeld() {
+    CpuFrame** link = &m_heldHead;
+    while (CpuFrame* frame = *link) {
+        if (IsUnused(frame)) {
+            *link           = frame->m_nextFree;
+            frame->m_isHeld = false;
+            PushFree(frame);
+        }
+        else {
+            link = &frame->m_nextFree;
+        }
+    }
+}
+
+// only unused frames are on the free list, so this is a pop unless the
+//   free list ran empty and held frames have to be checked
+// called with m_mutex held
+CpuFrame* CpuFramePool::AcquireFree() {
+    CpuFrame* frame = PopFree();
+    if (!frame && m_heldHead) {
+        ReclaimHeld();
+        frame = PopFree();
+    }
+    return frame;
+}
+
+// the pool may allocate another frame while its frames and the new one
+//   fit in m_maxBytes, only checked when no frame is free
+// frames the decoder has not filled yet count with the size they will
+//   have, so handing out empty decode surfaces is bounded as well
+// called with m_mutex held
+bool CpuFramePool::CanGrow() {
+    if (!m_maxBytes)
+        return true;
+
+    size_t bytes = m_frameBytes;
+    for (std::unique_ptr<CpuFrame>& surf : m_surfaces) {
+        bytes += std::max(GetFrameBytes(surf.get()), m_frameBytes);
+        if (bytes > m_maxBytes)
+            return false;
+    }
+    return bytes <= m_maxBytes;
+}
+
+// release free frames above the initial pool size which have not been
+//   handed out for m_trimIdleFrames requests
+// called with m_mutex held
+void CpuFramePool::Trim() {
+    mfxU32 nSurfaces = (mfxU32)m_surfaces.size();
+    if (nSurfaces <= m_minSurfaces)
+        return;
+
+    CpuFrame** link = &m_freeHead;
+    while (CpuFrame* frame = *link) {
+        if (nSurfaces > m_minSurfaces && m_requests - frame->m_lastUsed > m_trimIdleFrames) {
+            *link           = frame->m_nextFree;
+            frame->m_isFree = false;
+            frame->m_pool   = nullptr; // mark for removal
+            nSurfaces--;
+        }
+        else {
+            link = &frame->m_nextFree;
+        }
+    }
+
+    m_surfaces.erase(std::remove_if(m_surfaces.begin(),
+                                    m_surfaces.end(),
+                                    [](const std::unique_ptr<CpuFrame>& surf) {
+                                        return surf->m_pool == nullptr;
+                                    }),
+                     m_surfaces.end());
+}
+
+void CpuFramePool::ReturnFrame(CpuFrame* frame) {
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (frame->m_isFree || frame->m_isHeld)
+            return;
+        if (IsUnused(frame))
+            PushFree(frame);
+        else
+            PushHeld(frame);
+    }
+    m_frameReturned.notify_one();
+}
+
 // return free surface and set refCount to 1
+// if the pool is at its limit, wait up to m_allocTimeout for a surface
+//   and return MFX_WRN_ALLOC_TIMEOUT_EXPIRED with no surface otherwise
 mfxStatus CpuFramePool::GetFreeSurface(mfxFrameSurface1** surface) {
     RET_IF_FALSE(surface, MFX_ERR_NULL_PTR);
     *surface = nullptr;
 
-    for (std::unique_ptr<CpuFrame>& surf : m_surfaces) {
-        mfxU32 counter = 0xFFFFFFFF;
-        surf->FrameInterface->GetRefCounter(surf.get(), &counter);
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_requests++;
 
-        if (!counter && !surf->Data.Locked) {
-            *surface = surf.get();
-            (*surface)->FrameInterface->AddRef(*surface);
-            return MFX_ERR_NONE;
-        }
+    if (m_trimIdleFrames && (m_requests % m_trimIdleFrames) == 0)
+        Trim();
+
+    CpuFrame* frame = AcquireFree();
+    if (!frame && CanGrow()) {
+        // no free surface found in pool, create new one
+        RET_ERROR(NewFrame(&frame));
     }
 
-    // no free surface found in pool, create new one
-    auto cpu_frame = std::make_unique<CpuFrame>();
-    RET_IF_FALSE(cpu_frame && cpu_frame->GetAVFrame(), MFX_ERR_MEMORY_ALLOC);
-    if (m_info.FourCC) {
-        RET_ERROR(cpu_frame->Allocate(m_info.FourCC, m_info.Width, m_info.Height));
+    if (!frame) {
+        VPL_TRACE("surface pool wait");
+        // woken by ReturnFrame() or SetMaxBytes(), frames libav drops its
+        //   reference to are found at the next wake up or at the deadline
+        auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(m_allocTimeout);
+        bool grow     = false;
+        m_frameReturned.wait_until(lock, deadline, [&] {
+            frame = AcquireFree();
+            grow  = !frame && CanGrow();
+            return frame || grow;
+        });
+        if (grow)
+            RET_ERROR(NewFrame(&frame));
+        if (!frame)
+            return MFX_WRN_ALLOC_TIMEOUT_EXPIRED;
     }
-    *surface = cpu_frame.get();
+
+    frame->m_lastUsed = m_requests;
+    *surface          = frame;
     (*surface)->FrameInterface->AddRef(*surface);
-    m_surfaces.push_back(std::move(cpu_frame));
 
     return MFX_ERR_NONE;
 }
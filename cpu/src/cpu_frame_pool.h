@@ -7,22 +7,80 @@
 #ifndef CPU_SRC_CPU_FRAME_POOL_H_
 #define CPU_SRC_CPU_FRAME_POOL_H_
 
+#include <condition_variable>
 #include <memory>
+#include <mutex>
 #include <vector>
 #include "src/cpu_common.h"
 #include "src/cpu_frame.h"
 
+// Frames with no references are kept on an intrusive LIFO free list, so
+//   getting a surface does not scan the pool and the most recently
+//   released (cache warm) surface is handed out first.
+//   CpuFrame::Release() puts a frame back when its last reference is
+//   dropped, frames libav still references go on a held list until they
+//   are unused. Both lists are protected by m_mutex, which also guards
+//   growing and trimming the pool.
+// The pool grows on demand up to VPL_POOL_MAX_BYTES of frame data and
+//   gives back surfaces that stay unused (see VPL_POOL_TRIM_IDLE_FRAMES).
 class CpuFramePool {
 public:
-    CpuFramePool() : m_info({}) {}
+    CpuFramePool()
+            : m_info({}),
+              m_freeHead(nullptr),
+              m_heldHead(nullptr),
+              m_minSurfaces(0),
+              m_frameBytes(0),
+              m_maxBytes(GetDefaultMaxBytes()),
+              m_allocTimeout(VPL_POOL_ALLOC_TIMEOUT),
+              m_trimIdleFrames(VPL_POOL_TRIM_IDLE_FRAMES),
+              m_requests(0) {}
+    ~CpuFramePool();
 
-    mfxStatus Init(mfxU32 nPoolSize);
+    // frames are filled by the decoder, info gives the size they will have
+    mfxStatus Init(const mfxFrameInfo& info, mfxU32 nPoolSize);
     mfxStatus Init(mfxU32 FourCC, mfxU32 width, mfxU32 height, mfxU32 nPoolSize);
     mfxStatus GetFreeSurface(mfxFrameSurface1** surface);
 
+    void ReturnFrame(CpuFrame* frame);
+
+    // 0 = no limit, frames above the limit are not freed, the pool only
+    //   stops growing
+    void SetMaxBytes(size_t maxBytes);
+
 private:
+    static size_t GetDefaultMaxBytes();
+    static size_t GetInfoBytes(mfxU32 FourCC, mfxU32 width, mfxU32 height);
+    static size_t GetFrameBytes(CpuFrame* frame);
+
+    mfxStatus AddFrame(std::unique_ptr<CpuFrame> frame);
+    mfxStatus NewFrame(CpuFrame** frame);
+    void PushFree(CpuFrame* frame);
+    CpuFrame* PopFree();
+    void PushHeld(CpuFrame* frame);
+    void ReclaimHeld();
+    CpuFrame* AcquireFree();
+    bool IsUnused(CpuFrame* frame);
+    bool CanGrow();
+    void Trim();
+
+    std::mutex m_mutex;
+    std::condition_variable m_frameReturned;
     std::vector<std::unique_ptr<CpuFrame>> m_surfaces;
     mfxFrameInfo m_info;
+    CpuFrame* m_freeHead;
+    CpuFrame* m_heldHead;
+
+    mfxU32 m_minSurfaces;
+    size_t m_frameBytes;
+    size_t m_maxBytes;
+    mfxU32 m_allocTimeout;
+    mfxU32 m_trimIdleFrames;
+    mfxU64 m_requests;
+
+    /* copy not allowed */
+    CpuFramePool(const CpuFramePool&);
+    CpuFramePool& operator=(const CpuFramePool&);
 };
 
 #endif // CPU_SRC_CPU_FRAME_POOL_H_
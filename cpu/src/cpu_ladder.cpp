@@ -0,0 +1,367 @@
+/*############################################################################
+  # Copyright (C) 2020 Intel Corporation
+  #
+  # SPDX-License-Identifier: MIT
+  ############################################################################*/
+
+#include "src/cpu_ladder.h"
+#include <algorithm>
+#include <cstdlib>
+#include <utility>
+#include "src/cpu_copy.h"
+#include "src/cpu_roi.h"
+#include "src/cpu_thread_pool.h"
+#include "src/cpu_timestamp.h"
+#include "src/cpu_workstream.h"
+
+// luma is sampled every SCENE_SAMPLE_STEP pixels in both directions
+#define SCENE_SAMPLE_STEP 8
+// mean absolute difference of the sampled luma (8 bit) at a scene cut
+#define SCENE_CUT_THRESHOLD 30
+// frames after a key frame before a scene cut forces another one
+#define SCENE_CUT_MIN_DISTANCE 4
+
+CpuEncodeLadder::CpuEncodeLadder(CpuWorkstream *session)
+        : m_session(session),
+          m_input_locker(),
+          m_encoders(),
+          m_rungs(),
+          m_scaleOrder(),
+          m_prevLuma(),
+          m_luma(),
+          m_framesSinceKey(0),
+          m_pendingSurface(nullptr),
+          m_draining(false) {}
+
+CpuEncodeLadder::~CpuEncodeLadder() {
+    for (Rung &rung : m_rungs) {
+        if (rung.sws)
+            sws_freeContext(rung.sws);
+        for (AVPacket *pkt : rung.packets)
+            av_packet_free(&pkt);
+    }
+}
+
+mfxExtCpuEncodeLadder *CpuEncodeLadder::GetLadderBuffer(mfxVideoParam *par) {
+    if (!par || !par->ExtParam)
+        return nullptr;
+
+    for (mfxU16 i = 0; i < par->NumExtParam; i++) {
+        mfxExtBuffer *ext = par->ExtParam[i];
+        if (ext && ext->BufferId == MFX_EXTBUFF_CPU_ENCODE_LADDER)
+            return reinterpret_cast<mfxExtCpuEncodeLadder *>(ext);
+    }
+    return nullptr;
+}
+
+bool CpuEncodeLadder::IsEnabled(mfxVideoParam *par) {
+    return GetLadderBuffer(par) != nullptr;
+}
+
+mfxStatus CpuEncodeLadder::InitLadder(mfxVideoParam *par) {
+    mfxExtCpuEncodeLadder *ladder = GetLadderBuffer(par);
+    RET_IF_FALSE(ladder, MFX_ERR_INVALID_VIDEO_PARAM);
+    RET_IF_FALSE(ladder->Header.BufferSz >= sizeof(mfxExtCpuEncodeLadder),
+                 MFX_ERR_INVALID_VIDEO_PARAM);
+    RET_IF_FALSE(ladder->NumRung <= VPL_LADDER_MAX_RUNGS, MFX_ERR_INVALID_VIDEO_PARAM);
+    RET_IF_FALSE(ladder->Rung || !ladder->NumRung, MFX_ERR_NULL_PTR);
+    // the pipeline feeds a single stream
+    RET_IF_FALSE(!CpuPipeline::IsEnabled(par), MFX_ERR_INVALID_VIDEO_PARAM);
+
+    CpuEncode *encoder = m_session->GetEncoder();
+    RET_IF_FALSE(encoder, MFX_ERR_NOT_INITIALIZED);
+
+    Rung top    = {};
+    top.encoder = encoder;
+    top.width   = par->mfx.FrameInfo.Width;
+    top.height  = par->mfx.FrameInfo.Height;
+    m_rungs.push_back(std::move(top));
+
+    for (mfxU16 i = 0; i < ladder->NumRung; i++)
+        RET_ERROR(AddRung(par, ladder->Rung[i]));
+
+    // each rung is scaled from the smallest rung larger than itself
+    for (size_t i = 1; i < m_rungs.size(); i++)
+        m_scaleOrder.push_back(i);
+    std::stable_sort(m_scaleOrder.begin(), m_scaleOrder.end(), [this](size_t a, size_t b) {
+        return m_rungs[a].width * m_rungs[a].height > m_rungs[b].width * m_rungs[b].height;
+    });
+    for (size_t k = 0; k < m_scaleOrder.size(); k++)
+        m_rungs[m_scaleOrder[k]].source = k ? m_scaleOrder[k - 1] : 0;
+
+    return MFX_ERR_NONE;
+}
+
+// rungs are encoded with the parameters of rung 0 at their own size and
+//   bitrate, the ladder buffer is kept so they leave key frames to us
+mfxStatus CpuEncodeLadder::AddRung(mfxVideoParam *par, const mfxCpuLadderRung &desc) {
+    const mfxFrameInfo &top = par->mfx.FrameInfo;
+    RET_IF_FALSE(desc.Width && desc.Height && !(desc.Width & 1) && !(desc.Height & 1),
+                 MFX_ERR_INVALID_VIDEO_PARAM);
+    RET_IF_FALSE(desc.Width <= top.Width && desc.Height <= top.Height,
+                 MFX_ERR_INVALID_VIDEO_PARAM);
+
+    mfxU64 area    = static_cast<mfxU64>(desc.Width) * desc.Height;
+    mfxU64 topArea = static_cast<mfxU64>(top.Width) * top.Height;
+    auto scaleKbps = [&](mfxU16 kbps) {
+        mfxU64 scaled = std::max<mfxU64>(kbps * area / topArea, 1);
+        return kbps ? static_cast<mfxU16>(std::min<mfxU64>(scaled, 0xFFFF)) : kbps;
+    };
+
+    mfxVideoParam rungPar        = *par;
+    rungPar.mfx.FrameInfo.Width  = desc.Width;
+    rungPar.mfx.FrameInfo.Height = desc.Height;
+    rungPar.mfx.FrameInfo.CropX  = 0;
+    rungPar.mfx.FrameInfo.CropY  = 0;
+    rungPar.mfx.FrameInfo.CropW  = desc.Width;
+    rungPar.mfx.FrameInfo.CropH  = desc.Height;
+    rungPar.mfx.BufferSizeInKB   = 0;
+    rungPar.mfx.TargetKbps = desc.TargetKbps ? desc.TargetKbps : scaleKbps(par->mfx.TargetKbps);
+    rungPar.mfx.MaxKbps    = desc.MaxKbps ? desc.MaxKbps : scaleKbps(par->mfx.MaxKbps);
+
+    // ROI are in rung 0 coordinates, the other rungs are encoded without
+    std::vector<mfxExtBuffer *> extParam;
+    for (mfxU16 i = 0; par->ExtParam && i < par->NumExtParam; i++) {
+        if (!CpuEncodeROI::IsROIBuffer(par->ExtParam[i]))
+            extParam.push_back(par->ExtParam[i]);
+    }
+    rungPar.ExtParam    = extParam.data();
+    rungPar.NumExtParam = static_cast<mfxU16>(extParam.size());
+
+    std::unique_ptr<CpuEncode> encoder(new CpuEncode(m_session));
+    RET_IF_FALSE(encoder, MFX_ERR_MEMORY_ALLOC);
+    RET_ERROR(encoder->InitEncode(&rungPar));
+
+    Rung rung    = {};
+    rung.encoder = encoder.get();
+    rung.width   = desc.Width;
+    rung.height  = desc.Height;
+    m_rungs.push_back(std::move(rung));
+    m_encoders.push_back(std::move(encoder));
+
+    return MFX_ERR_NONE;
+}
+
+// bs followed by the bitstreams from its mfxExtCpuLadderBitstreams, one
+//   per extra rung, 0 where there is none
+mfxStatus CpuEncodeLadder::GetBitstreams(mfxBitstream *bs,
+                                         std::vector<mfxBitstream *> *bitstreams) {
+    bitstreams->assign(m_rungs.size(), nullptr);
+    (*bitstreams)[0] = bs;
+    if (!bs->ExtParam)
+        return MFX_ERR_NONE;
+
+    for (mfxU16 i = 0; i < bs->NumExtParam; i++) {
+        mfxExtBuffer *ext = bs->ExtParam[i];
+        if (!ext || ext->BufferId != MFX_EXTBUFF_CPU_LADDER_BITSTREAMS)
+            continue;
+        RET_IF_FALSE(ext->BufferSz >= sizeof(mfxExtCpuLadderBitstreams),
+                     MFX_ERR_UNDEFINED_BEHAVIOR);
+
+        mfxExtCpuLadderBitstreams *out = reinterpret_cast<mfxExtCpuLadderBitstreams *>(ext);
+        RET_IF_FALSE(out->Bitstreams || !out->NumBitstream, MFX_ERR_NULL_PTR);
+
+        size_t count = std::min<size_t>(out->NumBitstream, m_rungs.size() - 1);
+        for (size_t j = 0; j < count; j++)
+            (*bitstreams)[j + 1] = out->Bitstreams[j];
+        break;
+    }
+    return MFX_ERR_NONE;
+}
+
+mfxStatus CpuEncodeLadder::EncodeFrame(mfxEncodeCtrl *ctrl,
+                                       mfxFrameSurface1 *surface,
+                                       mfxBitstream *bs,
+                                       mfxSyncPoint *syncp) {
+    // key frames and skipped input apply to every rung at once, a QP
+    //   would not suit all of them
+    bool forceKey = false;
+    bool skip     = false;
+    if (ctrl) {
+        RET_IF_FALSE(!ctrl->MfxNalUnitType && !ctrl->QP && !ctrl->NumExtParam &&
+                         !ctrl->NumPayload,
+                     MFX_ERR_INVALID_VIDEO_PARAM);
+        forceKey = (ctrl->FrameType & (MFX_FRAMETYPE_I | MFX_FRAMETYPE_IDR)) != 0;
+        skip     = ctrl->SkipFrame != 0;
+    }
+
+    std::vector<mfxBitstream *> bitstreams;
+    RET_ERROR(GetBitstreams(bs, &bitstreams));
+
+    if (surface) {
+        // retried after MFX_ERR_NOT_ENOUGH_BUFFER, already encoded
+        if (surface != m_pendingSurface && !skip)
+            RET_ERROR(EncodeSurface(surface, forceKey));
+    }
+    else if (!m_draining) {
+        std::vector<AVFrame *> frames(m_rungs.size(), nullptr);
+        RET_ERROR(EncodeRungs(frames, false));
+        m_draining = true;
+    }
+    m_pendingSurface = nullptr;
+
+    mfxStatus sts = DeliverPackets(bitstreams, syncp);
+    if (sts == MFX_ERR_NOT_ENOUGH_BUFFER)
+        m_pendingSurface = surface;
+    return sts;
+}
+
+mfxStatus CpuEncodeLadder::EncodeSurface(mfxFrameSurface1 *surface, bool forceKey) {
+    // input may still be written by a decode or VPP task
+    m_session->GetScheduler()->WaitSurface(surface);
+
+    AVFrame *av_frame =
+        m_input_locker.GetAVFrame(surface, MFX_MAP_READ, m_session->GetFrameAllocator());
+    RET_IF_FALSE(av_frame, MFX_ERR_ABORTED);
+
+    // rung 0 keeps a reference, so memory which is not refcounted is copied
+    AVFrame *input = av_frame->buf[0] ? av_frame_clone(av_frame) : CopyAVFrame(av_frame);
+    m_input_locker.Unlock();
+    RET_IF_FALSE(input, MFX_ERR_MEMORY_ALLOC);
+
+    // every rung converts it to its own time base
+    input->pts = CpuEncodeTimestamps::GetSurfacePts(surface);
+
+    // analysis always runs, it keeps the previous input
+    bool key         = IsSceneCut(input) || forceKey;
+    m_framesSinceKey = key ? 0 : m_framesSinceKey + 1;
+
+    std::vector<AVFrame *> frames(m_rungs.size(), nullptr);
+    frames[0]     = input;
+    mfxStatus sts = MFX_ERR_NONE;
+    for (size_t i : m_scaleOrder) {
+        frames[i] = ScaleFrame(&m_rungs[i], frames[m_rungs[i].source]);
+        if (!frames[i]) {
+            sts = MFX_ERR_MEMORY_ALLOC;
+            break;
+        }
+    }
+
+    if (sts == MFX_ERR_NONE)
+        sts = EncodeRungs(frames, key);
+
+    for (AVFrame *frame : frames)
+        av_frame_free(&frame);
+    return sts;
+}
+
+// each rung is encoded by a job of its own on the shared pool
+// frames[i] == 0 drains rung i
+mfxStatus CpuEncodeLadder::EncodeRungs(const std::vector<AVFrame *> &frames, bool key) {
+    std::vector<std::vector<AVPacket *>> packets(m_rungs.size());
+    std::vector<mfxStatus> status(m_rungs.size(), MFX_ERR_NONE);
+
+    CpuThreadPool::Get().Run(static_cast<int>(m_rungs.size()), [&](int i) {
+        status[i] = m_rungs[i].encoder->EncodeAVFrame(frames[i], &packets[i], key);
+    });
+
+    for (size_t i = 0; i < m_rungs.size(); i++) {
+        std::deque<AVPacket *> &queue = m_rungs[i].packets;
+        queue.insert(queue.end(), packets[i].begin(), packets[i].end());
+    }
+    for (mfxStatus sts : status)
+        RET_ERROR(sts);
+    return MFX_ERR_NONE;
+}
+
+// scaled copy of src at the size of rung
+AVFrame *CpuEncodeLadder::ScaleFrame(Rung *rung, const AVFrame *src) {
+    AVPixelFormat format = static_cast<AVPixelFormat>(src->format);
+
+    rung->sws = sws_getCachedContext(rung->sws,
+                                     src->width,
+                                     src->height,
+                                     format,
+                                     rung->width,
+                                     rung->height,
+                                     format,
+                                     SWS_BICUBIC,
+                                     NULL,
+                                     NULL,
+                                     NULL);
+    if (!rung->sws)
+        return nullptr;
+
+    AVFrame *dst = av_frame_alloc();
+    if (!dst)
+        return nullptr;
+
+    dst->width  = rung->width;
+    dst->height = rung->height;
+    dst->format = format;
+    if (av_frame_get_buffer(dst, 0) < 0 || av_frame_copy_props(dst, src) < 0) {
+        av_frame_free(&dst);
+        return nullptr;
+    }
+
+    VPL_TRACE("sws_scale");
+    sws_scale(rung->sws, src->data, src->linesize, 0, src->height, dst->data, dst->linesize);
+    return dst;
+}
+
+// compares subsampled luma with that of the previous input
+bool CpuEncodeLadder::IsSceneCut(const AVFrame *frame) {
+    bool highBitDepth = frame->format == AV_PIX_FMT_YUV420P10LE;
+    // P010 keeps the 10 bits in the high bits of each sample
+    bool msbAligned = frame->format == AV_PIX_FMT_P010LE;
+
+    m_luma.clear();
+    for (int y = 0; y < frame->height; y += SCENE_SAMPLE_STEP) {
+        const uint8_t *row = frame->data[0] + static_cast<ptrdiff_t>(y) * frame->linesize[0];
+        for (int x = 0; x < frame->width; x += SCENE_SAMPLE_STEP) {
+            if (highBitDepth)
+                m_luma.push_back(
+                    static_cast<mfxU8>(reinterpret_cast<const uint16_t *>(row)[x] >> 2));
+            else if (msbAligned)
+                m_luma.push_back(
+                    static_cast<mfxU8>(reinterpret_cast<const uint16_t *>(row)[x] >> 8));
+            else
+                m_luma.push_back(row[x]);
+        }
+    }
+
+    bool cut = false;
+    if (!m_luma.empty() && m_luma.size() == m_prevLuma.size()) {
+        mfxU64 sad = 0;
+        for (size_t i = 0; i < m_luma.size(); i++)
+            sad += std::abs(static_cast<int>(m_luma[i]) - static_cast<int>(m_prevLuma[i]));
+        cut = sad >= static_cast<mfxU64>(SCENE_CUT_THRESHOLD) * m_luma.size();
+    }
+    std::swap(m_luma, m_prevLuma);
+
+    return cut && m_framesSinceKey >= SCENE_CUT_MIN_DISTANCE;
+}
+
+// next packet of every rung, nothing is written unless all of them fit
+mfxStatus CpuEncodeLadder::DeliverPackets(const std::vector<mfxBitstream *> &bitstreams,
+                                          mfxSyncPoint *syncp) {
+    bool ready = false;
+    for (size_t i = 0; i < m_rungs.size(); i++) {
+        if (m_rungs[i].packets.empty())
+            continue;
+        ready = true;
+
+        mfxBitstream *bs = bitstreams[i];
+        if (bs) {
+            mfxU32 nBytesAvail = bs->MaxLength - (bs->DataOffset + bs->DataLength);
+            RET_IF_FALSE(static_cast<mfxU32>(m_rungs[i].packets.front()->size) <= nBytesAvail,
+                         MFX_ERR_NOT_ENOUGH_BUFFER);
+        }
+    }
+    if (!ready)
+        return MFX_ERR_MORE_DATA;
+
+    for (size_t i = 0; i < m_rungs.size(); i++) {
+        if (m_rungs[i].packets.empty())
+            continue;
+
+        AVPacket *pkt = m_rungs[i].packets.front();
+        if (bitstreams[i])
+            RET_ERROR(m_rungs[i].encoder->WritePacket(pkt, bitstreams[i]));
+        m_rungs[i].packets.pop_front();
+        av_packet_free(&pkt);
+    }
+
+    // payload is already in the bitstreams
+    return m_session->GetScheduler()->Complete(syncp, MFX_ERR_NONE);
+}
@@ -0,0 +1,84 @@
+/*############################################################################
+  # Copyright (C) 2020 Intel Corporation
+  #
+  # SPDX-License-Identifier: MIT
+  ############################################################################*/
+
+#ifndef CPU_SRC_CPU_LADDER_H_
+#define CPU_SRC_CPU_LADDER_H_
+
+#include <deque>
+#include <memory>
+#include <vector>
+#include "src/cpu_common.h"
+#include "src/frame_lock.h"
+
+class CpuEncode;
+class CpuWorkstream;
+
+// Multi-resolution encode sharing one input and its analysis
+// Each input is scaled down the ladder, every rung from the next larger
+//   one, and all rungs are encoded in parallel on the shared thread pool.
+// Scene cuts are detected once on the input and forced as key frames on
+//   every rung, so GOPs stay aligned for switching and the rung encoders
+//   skip their own scene detection where they allow it.
+class CpuEncodeLadder {
+public:
+    explicit CpuEncodeLadder(CpuWorkstream* session);
+    ~CpuEncodeLadder();
+
+    static bool IsEnabled(mfxVideoParam* par);
+
+    // rung 0 is the session encoder, par is what it was initialized with
+    mfxStatus InitLadder(mfxVideoParam* par);
+    // encode surface on every rung and output the next packets,
+    //   surface == 0 drains all rungs
+    mfxStatus EncodeFrame(mfxEncodeCtrl* ctrl,
+                          mfxFrameSurface1* surface,
+                          mfxBitstream* bs,
+                          mfxSyncPoint* syncp);
+
+private:
+    struct Rung {
+        // session encoder for rung 0, one of m_encoders otherwise
+        CpuEncode* encoder;
+        mfxU16 width;
+        mfxU16 height;
+        // larger rung this one is scaled from
+        size_t source;
+        SwsContext* sws;
+        std::deque<AVPacket*> packets;
+    };
+
+    static mfxExtCpuEncodeLadder* GetLadderBuffer(mfxVideoParam* par);
+    mfxStatus AddRung(mfxVideoParam* par, const mfxCpuLadderRung& desc);
+    mfxStatus GetBitstreams(mfxBitstream* bs, std::vector<mfxBitstream*>* bitstreams);
+    mfxStatus EncodeSurface(mfxFrameSurface1* surface, bool forceKey);
+    mfxStatus EncodeRungs(const std::vector<AVFrame*>& frames, bool key);
+    AVFrame* ScaleFrame(Rung* rung, const AVFrame* src);
+    bool IsSceneCut(const AVFrame* frame);
+    mfxStatus DeliverPackets(const std::vector<mfxBitstream*>& bitstreams, mfxSyncPoint* syncp);
+
+    CpuWorkstream* m_session;
+    // destroyed after the rung encoders, which may still reference input
+    FrameLock m_input_locker;
+    std::vector<std::unique_ptr<CpuEncode>> m_encoders;
+    // in ladder order, rung i is written to bitstream i
+    std::vector<Rung> m_rungs;
+    // rungs 1..n largest first, so sources are scaled before their users
+    std::vector<size_t> m_scaleOrder;
+
+    // subsampled luma of the previous input
+    std::vector<mfxU8> m_prevLuma;
+    std::vector<mfxU8> m_luma;
+    mfxU32 m_framesSinceKey;
+    // packets for this input are queued, it is not encoded again
+    mfxFrameSurface1* m_pendingSurface;
+    bool m_draining;
+
+    /* copy not allowed */
+    CpuEncodeLadder(const CpuEncodeLadder&);
+    CpuEncodeLadder& operator=(const CpuEncodeLadder&);
+};
+
+#endif // CPU_SRC_CPU_LADDER_H_
@@ -0,0 +1,215 @@
+/*############################################################################
+  # Copyright (C) 2020 Intel Corporation
+  #
+  # SPDX-License-Identifier: MIT
+  ############################################################################*/
+
+#include "src/cpu_pipeline.h"
+#include <vector>
+#include "src/cpu_workstream.h"
+
+CpuPipeline::CpuPipeline(CpuWorkstream *session, mfxVideoParam *par)
+        : m_session(session),
+          m_asyncDepth(GetAsyncDepth(par)),
+          m_mutex(),
+          m_ready(),
+          m_packets(),
+          m_tasks(0),
+          m_error(MFX_ERR_NONE),
+          m_draining(false) {}
+
+CpuPipeline::~CpuPipeline() {
+    Drain();
+}
+
+// VPP tasks submit encode tasks, so VPP has to finish first
+void CpuPipeline::Drain() {
+    CpuScheduler *scheduler = m_session->GetScheduler();
+    scheduler->Drain(VPL_TASK_LANE_VPP);
+    scheduler->Drain(VPL_TASK_LANE_ENCODE);
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    for (AVPacket *pkt : m_packets)
+        av_packet_free(&pkt);
+    m_packets.clear();
+}
+
+// a drained encoder stays drained, m_draining is kept
+void CpuPipeline::Reset() {
+    Drain();
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_error = MFX_ERR_NONE;
+}
+
+bool CpuPipeline::IsEnabled(mfxVideoParam *par) {
+    if (!par || !par->ExtParam)
+        return false;
+
+    for (mfxU16 i = 0; i < par->NumExtParam; i++) {
+        mfxExtBuffer *ext = par->ExtParam[i];
+        if (ext && ext->BufferId == MFX_EXTBUFF_CPU_PIPELINE &&
+            ext->BufferSz >= sizeof(mfxExtCpuPipeline))
+            return reinterpret_cast<mfxExtCpuPipeline *>(ext)->Enable != 0;
+    }
+    return false;
+}
+
+mfxStatus CpuPipeline::PutBitstream(mfxBitstream *bs) {
+    CpuDecode *decoder = m_session->GetDecoder();
+    RET_IF_FALSE(decoder, MFX_ERR_NOT_INITIALIZED);
+
+    for (;;) {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            RET_ERROR(m_error);
+            if (m_draining)
+                return MFX_ERR_MORE_DATA;
+            // packets are only freed by GetBitstream()
+            if (m_packets.size() >= m_asyncDepth)
+                return MFX_WRN_DEVICE_BUSY;
+        }
+
+        AVFrame *frame = av_frame_alloc();
+        RET_IF_FALSE(frame, MFX_ERR_MEMORY_ALLOC);
+
+        mfxStatus sts = decoder->DecodeAVFrame(bs, frame);
+        if (sts != MFX_ERR_NONE) {
+            av_frame_free(&frame);
+            if (sts == MFX_ERR_MORE_DATA && !bs)
+                RET_ERROR(SubmitDrain());
+            return sts;
+        }
+        RET_ERROR(SubmitFrame(frame));
+    }
+}
+
+mfxStatus CpuPipeline::GetBitstream(mfxBitstream *bs, mfxSyncPoint *syncp) {
+    CpuEncode *encoder = m_session->GetEncoder();
+    RET_IF_FALSE(encoder, MFX_ERR_NOT_INITIALIZED);
+
+    std::unique_lock<std::mutex> lock(m_mutex);
+    {
+        VPL_TRACE("pipeline wait");
+        m_ready.wait(lock, [&] {
+            return !m_packets.empty() || !m_tasks || m_error < MFX_ERR_NONE;
+        });
+    }
+
+    // packets encoded before an error are still delivered
+    if (m_packets.empty()) {
+        RET_ERROR(m_error);
+        return MFX_ERR_MORE_DATA;
+    }
+
+    // a packet which does not fit stays queued for the next call
+    AVPacket *pkt = m_packets.front();
+    RET_ERROR(encoder->WritePacket(pkt, bs));
+    m_packets.pop_front();
+    av_packet_free(&pkt);
+    lock.unlock();
+
+    // payload is already in bs
+    return m_session->GetScheduler()->Complete(syncp, MFX_ERR_NONE);
+}
+
+// frame is owned by the pipeline from here on
+mfxStatus CpuPipeline::SubmitFrame(AVFrame *frame) {
+    CpuVPP *vpp = m_session->GetVPP();
+    if (!vpp)
+        return SubmitEncode(frame);
+
+    BeginTask();
+    mfxStatus sts = m_session->GetScheduler()->Submit(
+        VPL_TASK_LANE_VPP,
+        [this, vpp, frame]() mutable {
+            std::vector<AVFrame *> out;
+            mfxStatus sts = vpp->FilterAVFrame(frame, &out);
+            av_frame_free(&frame);
+            for (AVFrame *filtered : out) {
+                if (sts == MFX_ERR_NONE)
+                    sts = SubmitEncode(filtered);
+                else
+                    av_frame_free(&filtered);
+            }
+            EndTask(sts);
+            return sts;
+        },
+        nullptr);
+    if (sts < MFX_ERR_NONE) {
+        av_frame_free(&frame);
+        EndTask(sts);
+    }
+    return sts;
+}
+
+// frame == 0 drains the encoder
+mfxStatus CpuPipeline::SubmitEncode(AVFrame *frame) {
+    BeginTask();
+    mfxStatus sts = m_session->GetScheduler()->Submit(
+        VPL_TASK_LANE_ENCODE,
+        [this, frame]() mutable {
+            std::vector<AVPacket *> packets;
+            mfxStatus sts = m_session->GetEncoder()->EncodeAVFrame(frame, &packets);
+            av_frame_free(&frame);
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                m_packets.insert(m_packets.end(), packets.begin(), packets.end());
+            }
+            EndTask(sts);
+            return sts;
+        },
+        nullptr);
+    if (sts < MFX_ERR_NONE) {
+        av_frame_free(&frame);
+        EndTask(sts);
+    }
+    return sts;
+}
+
+// decoder is drained, flush VPP and then the encoder behind the last frame
+mfxStatus CpuPipeline::SubmitDrain() {
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_draining = true;
+    }
+
+    CpuVPP *vpp = m_session->GetVPP();
+    if (!vpp)
+        return SubmitEncode(nullptr);
+
+    BeginTask();
+    mfxStatus sts = m_session->GetScheduler()->Submit(
+        VPL_TASK_LANE_VPP,
+        [this, vpp]() {
+            std::vector<AVFrame *> out;
+            mfxStatus sts = vpp->FilterAVFrame(nullptr, &out);
+            for (AVFrame *filtered : out) {
+                if (sts == MFX_ERR_NONE)
+                    sts = SubmitEncode(filtered);
+                else
+                    av_frame_free(&filtered);
+            }
+            if (sts == MFX_ERR_NONE)
+                sts = SubmitEncode(nullptr);
+            EndTask(sts);
+            return sts;
+        },
+        nullptr);
+    if (sts < MFX_ERR_NONE)
+        EndTask(sts);
+    return sts;
+}
+
+void CpuPipeline::BeginTask() {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_tasks++;
+}
+
+void CpuPipeline::EndTask(mfxStatus sts) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_tasks--;
+    if (sts < MFX_ERR_NONE && m_error == MFX_ERR_NONE)
+        m_error = sts;
+    m_ready.notify_all();
+}
@@ -0,0 +1,69 @@
+/*############################################################################
+  # Copyright (C) 2020 Intel Corporation
+  #
+  # SPDX-License-Identifier: MIT
+  ############################################################################*/
+
+#ifndef CPU_SRC_CPU_PIPELINE_H_
+#define CPU_SRC_CPU_PIPELINE_H_
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include "src/cpu_common.h"
+
+class CpuWorkstream;
+
+// In-session transcode: decoded pictures go to the VPP and encode lanes
+//   as AVFrame references, never as mfxFrameSurface1
+// Decoding runs on the calling thread, filtering and encoding on their
+//   scheduler lanes, so all three stages overlap. Lane depth (AsyncDepth)
+//   holds the decoder back when a later stage falls behind, and decoding
+//   stops with MFX_WRN_DEVICE_BUSY once AsyncDepth packets wait for the
+//   application.
+class CpuPipeline {
+public:
+    CpuPipeline(CpuWorkstream* session, mfxVideoParam* par);
+    ~CpuPipeline();
+
+    static bool IsEnabled(mfxVideoParam* par);
+
+    // finish the frames in flight, drop the packets not yet output and
+    //   clear the error, called when the encoder is reset
+    void Reset();
+
+    // decode everything in bs, bs == 0 drains the whole pipeline
+    // MFX_WRN_DEVICE_BUSY when packets have to be output first, the rest
+    //   of bs is decoded by the next call
+    mfxStatus PutBitstream(mfxBitstream* bs);
+    // next encoded packet, waits while frames are still in flight
+    // MFX_ERR_MORE_DATA when nothing is left to output
+    mfxStatus GetBitstream(mfxBitstream* bs, mfxSyncPoint* syncp);
+
+private:
+    mfxStatus SubmitFrame(AVFrame* frame);
+    mfxStatus SubmitEncode(AVFrame* frame);
+    mfxStatus SubmitDrain();
+    void BeginTask();
+    void EndTask(mfxStatus sts);
+    void Drain();
+
+    CpuWorkstream* m_session;
+    // packets output before decoding is held back
+    size_t m_asyncDepth;
+
+    std::mutex m_mutex;
+    std::condition_variable m_ready;
+    std::deque<AVPacket*> m_packets;
+    // VPP and encode tasks queued or running
+    int m_tasks;
+    // first error from a lane, reported by the next call until Reset()
+    mfxStatus m_error;
+    bool m_draining;
+
+    /* copy not allowed */
+    CpuPipeline(const CpuPipeline&);
+    CpuPipeline& operator=(const CpuPipeline&);
+};
+
+#endif // CPU_SRC_CPU_PIPELINE_H_
@@ -0,0 +1,179 @@
+/*############################################################################
+  # Copyright (C) 2020 Intel Corporation
+  #
+  # SPDX-License-Identifier: MIT
+  ############################################################################*/
+
+#include "src/cpu_roi.h"
+#include <algorithm>
+#include <cstring>
+#include <string>
+
+CpuEncodeROI::CpuEncodeROI()
+        : m_supported(false),
+          m_width(0),
+          m_height(0),
+          m_qpRange(51),
+          m_regions() {}
+
+bool CpuEncodeROI::IsSupported(const AVCodec *codec) {
+    // libavcodec wrappers which turn the side data into quant offsets
+    return codec && (codec->name == std::string("libx264") ||
+                     codec->name == std::string("libx265"));
+}
+
+bool CpuEncodeROI::IsROIBuffer(const mfxExtBuffer *ext) {
+    return ext && (ext->BufferId == MFX_EXTBUFF_ENCODER_ROI ||
+                   ext->BufferId == MFX_EXTBUFF_CPU_DELTA_QP_MAP);
+}
+
+mfxStatus CpuEncodeROI::InitROI(mfxVideoParam *par, const AVCodecContext *ctx) {
+    // constant QP turns adaptive quantization off, so the offsets would be
+    //   dropped without notice
+    m_supported = IsSupported(ctx->codec) && par->mfx.RateControlMethod != MFX_RATECONTROL_CQP;
+    m_width     = ctx->width;
+    m_height    = ctx->height;
+    m_regions.clear();
+
+    // same range the wrappers scale qoffset by
+    const AVPixFmtDescriptor *desc = av_pix_fmt_desc_get(ctx->pix_fmt);
+    m_qpRange                      = 51 + 6 * ((desc ? desc->comp[0].depth : 8) - 8);
+
+    if (!par->ExtParam)
+        return MFX_ERR_NONE;
+
+    for (mfxU16 i = 0; i < par->NumExtParam; i++) {
+        mfxExtBuffer *ext = par->ExtParam[i];
+        if (!ext || ext->BufferId != MFX_EXTBUFF_ENCODER_ROI)
+            continue;
+        RET_IF_FALSE(m_supported, MFX_ERR_INVALID_VIDEO_PARAM);
+        RET_ERROR(AddROI(reinterpret_cast<mfxExtEncoderROI *>(ext), &m_regions));
+    }
+    return MFX_ERR_NONE;
+}
+
+mfxStatus CpuEncodeROI::CheckEncodeCtrl(mfxEncodeCtrl *ctrl) const {
+    if (!ctrl || !ctrl->NumExtParam)
+        return MFX_ERR_NONE;
+    RET_IF_FALSE(ctrl->ExtParam, MFX_ERR_NULL_PTR);
+
+    for (mfxU16 i = 0; i < ctrl->NumExtParam; i++) {
+        RET_IF_FALSE(IsROIBuffer(ctrl->ExtParam[i]), MFX_ERR_INVALID_VIDEO_PARAM);
+        RET_IF_FALSE(m_supported, MFX_ERR_INVALID_VIDEO_PARAM);
+    }
+    return MFX_ERR_NONE;
+}
+
+mfxStatus CpuEncodeROI::AttachRegions(AVFrame *frame, mfxEncodeCtrl *ctrl) const {
+    av_frame_remove_side_data(frame, AV_FRAME_DATA_REGIONS_OF_INTEREST);
+
+    std::vector<AVRegionOfInterest> ctrlRegions;
+    const std::vector<AVRegionOfInterest> *regions = &m_regions;
+    if (ctrl && ctrl->NumExtParam) {
+        RET_ERROR(GetRegions(ctrl->ExtParam, ctrl->NumExtParam, &ctrlRegions));
+        regions = &ctrlRegions;
+    }
+    if (regions->empty())
+        return MFX_ERR_NONE;
+
+    size_t size = regions->size() * sizeof(AVRegionOfInterest);
+    AVFrameSideData *sd =
+        av_frame_new_side_data(frame, AV_FRAME_DATA_REGIONS_OF_INTEREST, static_cast<int>(size));
+    RET_IF_FALSE(sd, MFX_ERR_MEMORY_ALLOC);
+    memcpy(sd->data, regions->data(), size);
+    return MFX_ERR_NONE;
+}
+
+// where regions overlap the first one counts, so ROI go before the map
+mfxStatus CpuEncodeROI::GetRegions(mfxExtBuffer **ext,
+                                   mfxU16 numExt,
+                                   std::vector<AVRegionOfInterest> *regions) const {
+    RET_IF_FALSE(ext, MFX_ERR_NULL_PTR);
+    for (mfxU16 i = 0; i < numExt; i++) {
+        if (ext[i] && ext[i]->BufferId == MFX_EXTBUFF_ENCODER_ROI)
+            RET_ERROR(AddROI(reinterpret_cast<mfxExtEncoderROI *>(ext[i]), regions));
+    }
+    for (mfxU16 i = 0; i < numExt; i++) {
+        if (ext[i] && ext[i]->BufferId == MFX_EXTBUFF_CPU_DELTA_QP_MAP)
+            RET_ERROR(AddDeltaQPMap(reinterpret_cast<mfxExtCpuDeltaQPMap *>(ext[i]), regions));
+    }
+    return MFX_ERR_NONE;
+}
+
+mfxStatus CpuEncodeROI::AddROI(const mfxExtEncoderROI *roi,
+                               std::vector<AVRegionOfInterest> *regions) const {
+    RET_IF_FALSE(roi->Header.BufferSz >= sizeof(mfxExtEncoderROI), MFX_ERR_INVALID_VIDEO_PARAM);
+    RET_IF_FALSE(roi->NumROI <= sizeof(roi->ROI) / sizeof(roi->ROI[0]),
+                 MFX_ERR_INVALID_VIDEO_PARAM);
+    // absolute QP values cannot be expressed as offsets
+    RET_IF_FALSE(roi->ROIMode == MFX_ROI_MODE_PRIORITY || roi->ROIMode == MFX_ROI_MODE_QP_DELTA,
+                 MFX_ERR_INVALID_VIDEO_PARAM);
+
+    for (mfxU16 i = 0; i < roi->NumROI; i++) {
+        const auto &rect = roi->ROI[i];
+        RET_IF_FALSE(rect.Left < rect.Right && rect.Right <= static_cast<mfxU32>(m_width) &&
+                         rect.Top < rect.Bottom && rect.Bottom <= static_cast<mfxU32>(m_height),
+                     MFX_ERR_INVALID_VIDEO_PARAM);
+
+        int deltaQP = rect.DeltaQP;
+        if (roi->ROIMode == MFX_ROI_MODE_PRIORITY) {
+            // higher priority, better quality
+            RET_IF_FALSE(rect.Priority >= -3 && rect.Priority <= 3, MFX_ERR_INVALID_VIDEO_PARAM);
+            deltaQP = -rect.Priority * VPL_ROI_PRIORITY_QP_STEP;
+        }
+        RET_IF_FALSE(deltaQP >= -51 && deltaQP <= 51, MFX_ERR_INVALID_VIDEO_PARAM);
+
+        regions->push_back(MakeRegion(rect.Left, rect.Top, rect.Right, rect.Bottom, deltaQP));
+    }
+    return MFX_ERR_NONE;
+}
+
+// equal offsets next to each other in a block row become one region
+mfxStatus CpuEncodeROI::AddDeltaQPMap(const mfxExtCpuDeltaQPMap *map,
+                                      std::vector<AVRegionOfInterest> *regions) const {
+    RET_IF_FALSE(map->Header.BufferSz >= sizeof(mfxExtCpuDeltaQPMap),
+                 MFX_ERR_INVALID_VIDEO_PARAM);
+    // libx264 and libx265 apply offsets per 16x16 block
+    RET_IF_FALSE(map->BlockSize && !(map->BlockSize % 16), MFX_ERR_INVALID_VIDEO_PARAM);
+
+    int bs   = map->BlockSize;
+    int cols = (m_width + bs - 1) / bs;
+    int rows = (m_height + bs - 1) / bs;
+    RET_IF_FALSE(map->NumDeltaQP >= static_cast<mfxU32>(cols * rows),
+                 MFX_ERR_INVALID_VIDEO_PARAM);
+    RET_IF_FALSE(map->DeltaQP, MFX_ERR_NULL_PTR);
+
+    for (int y = 0; y < rows; y++) {
+        const mfxI8 *row = map->DeltaQP + y * cols;
+        int top          = y * bs;
+        int bottom       = std::min(top + bs, m_height);
+        for (int x = 0; x < cols;) {
+            int end = x + 1;
+            while (end < cols && row[end] == row[x])
+                end++;
+            if (row[x]) {
+                RET_IF_FALSE(row[x] >= -51 && row[x] <= 51, MFX_ERR_INVALID_VIDEO_PARAM);
+                regions->push_back(
+                    MakeRegion(x * bs, top, std::min(end * bs, m_width), bottom, row[x]));
+            }
+            x = end;
+        }
+    }
+    return MFX_ERR_NONE;
+}
+
+AVRegionOfInterest CpuEncodeROI::MakeRegion(int left,
+                                            int top,
+                                            int right,
+                                            int bottom,
+                                            int deltaQP) const {
+    // the wrappers multiply qoffset by their QP range
+    AVRegionOfInterest region = {};
+    region.self_size          = sizeof(AVRegionOfInterest);
+    region.left               = left;
+    region.top                = top;
+    region.right              = right;
+    region.bottom             = bottom;
+    region.qoffset            = av_make_q(deltaQP, m_qpRange);
+    return region;
+}
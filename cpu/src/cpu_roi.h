@@ -0,0 +1,57 @@
+/*############################################################################
+  # Copyright (C) 2020 Intel Corporation
+  #
+  # SPDX-License-Identifier: MIT
+  ############################################################################*/
+
+#ifndef CPU_SRC_CPU_ROI_H_
+#define CPU_SRC_CPU_ROI_H_
+
+#include <vector>
+#include "src/cpu_common.h"
+
+// QP offsets for parts of the picture, sent to the encoder as
+//   AV_FRAME_DATA_REGIONS_OF_INTEREST side data
+// mfxExtEncoderROI given to MFXVideoENCODE_Init() holds for every frame,
+//   ROI and QP map buffers on mfxEncodeCtrl replace it for one frame.
+// Only encoders which read the side data take these, libx264 and libx265
+//   (SVT-HEVC and SVT-AV1 ignore it), and they need adaptive quantization,
+//   so ROI with constant QP rate control are rejected with
+//   MFX_ERR_INVALID_VIDEO_PARAM like those for other encoders.
+class CpuEncodeROI {
+public:
+    CpuEncodeROI();
+
+    static bool IsSupported(const AVCodec* codec);
+    static bool IsROIBuffer(const mfxExtBuffer* ext);
+
+    // ROI of the encoder initialized with par and opened as ctx
+    mfxStatus InitROI(mfxVideoParam* par, const AVCodecContext* ctx);
+    // check ROI buffers on ctrl, nothing is kept
+    mfxStatus CheckEncodeCtrl(mfxEncodeCtrl* ctrl) const;
+    // replace the regions of frame with those for ctrl, ctrl may be null
+    mfxStatus AttachRegions(AVFrame* frame, mfxEncodeCtrl* ctrl) const;
+
+private:
+    mfxStatus AddROI(const mfxExtEncoderROI* roi, std::vector<AVRegionOfInterest>* regions) const;
+    mfxStatus AddDeltaQPMap(const mfxExtCpuDeltaQPMap* map,
+                            std::vector<AVRegionOfInterest>* regions) const;
+    mfxStatus GetRegions(mfxExtBuffer** ext,
+                         mfxU16 numExt,
+                         std::vector<AVRegionOfInterest>* regions) const;
+    AVRegionOfInterest MakeRegion(int left, int top, int right, int bottom, int deltaQP) const;
+
+    bool m_supported;
+    int m_width;
+    int m_height;
+    // qoffset is a fraction of this, the encoder's QP range
+    int m_qpRange;
+    // from MFXVideoENCODE_Init(), for frames without ROI buffers on ctrl
+    std::vector<AVRegionOfInterest> m_regions;
+
+    /* copy not allowed */
+    CpuEncodeROI(const CpuEncodeROI&);
+    CpuEncodeROI& operator=(const CpuEncodeROI&);
+};
+
+#endif // CPU_SRC_CPU_ROI_H_
@@ -0,0 +1,244 @@
+/*############################################################################
+  # Copyright (C) 2020 Intel Corporation
+  #
+  # SPDX-License-Identifier: MIT
+  ############################################################################*/
+
+#include "src/cpu_scheduler.h"
+#include <chrono>
+#include <cstdint>
+#include <utility>
+
+// completed results kept for sync points the application never syncs
+#define MAX_RETIRED_TASKS 1024
+// ids of successful tasks retired from the table, still valid to sync
+#define MAX_RETIRED_IDS (16 * MAX_RETIRED_TASKS)
+
+CpuScheduler::CpuScheduler()
+        : m_tasks(),
+          m_retired(),
+          m_outputs(),
+          m_nextId(1),
+          m_stop(false) {
+    for (Lane& lane : m_lanes) {
+        lane.busy  = false;
+        lane.depth = 0;
+    }
+}
+
+CpuScheduler::~CpuScheduler() {
+    DrainAll();
+
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stop = true;
+    }
+
+    for (Lane& lane : m_lanes) {
+        lane.ready.notify_all();
+        if (lane.worker.joinable())
+            lane.worker.join();
+    }
+}
+
+void CpuScheduler::WorkerLoop(Lane* lane) {
+    static const char* taskNames[VPL_TASK_LANE_COUNT] = { "decode task",
+                                                          "vpp task",
+                                                          "encode task" };
+    const char* taskName = taskNames[lane - m_lanes];
+
+    std::unique_lock<std::mutex> lock(m_mutex);
+    for (;;) {
+        lane->ready.wait(lock, [&] {
+            return m_stop || !lane->queue.empty();
+        });
+        if (lane->queue.empty())
+            return; // m_stop
+
+        TaskEntry task = std::move(lane->queue.front());
+        lane->queue.pop_front();
+        lane->busy = true;
+
+        lock.unlock();
+        mfxStatus sts = VPL_TRACE_CALL(taskName, task.func());
+        lock.lock();
+
+        auto it = m_tasks.find(task.id);
+        if (it != m_tasks.end()) {
+            it->second.done = true;
+            it->second.sts  = sts;
+        }
+        for (mfxFrameSurface1* output : task.outputs) {
+            auto out = m_outputs.find(output);
+            if (out != m_outputs.end() && out->second == task.id)
+                m_outputs.erase(out);
+        }
+        lane->busy = false;
+        m_taskDone.notify_all();
+    }
+}
+
+// drop the oldest successful results once the table is full, failures
+//   are kept until they are synced
+// called with m_mutex held
+void CpuScheduler::RetireCompleted() {
+    auto it = m_tasks.begin();
+    while (m_tasks.size() > MAX_RETIRED_TASKS && it != m_tasks.end()) {
+        if (it->second.done && it->second.sts == MFX_ERR_NONE) {
+            m_retired.insert(it->first);
+            it = m_tasks.erase(it);
+        }
+        else {
+            ++it;
+        }
+    }
+    while (m_retired.size() > MAX_RETIRED_IDS)
+        m_retired.erase(m_retired.begin());
+}
+
+mfxStatus CpuScheduler::Submit(eTaskLane lane_id,
+                               CpuTask task,
+                               mfxSyncPoint* syncp,
+                               mfxFrameSurface1* output) {
+    std::vector<mfxFrameSurface1*> outputs;
+    if (output)
+        outputs.push_back(output);
+    return Submit(lane_id, std::move(task), syncp, outputs);
+}
+
+mfxStatus CpuScheduler::Submit(eTaskLane lane_id,
+                               CpuTask task,
+                               mfxSyncPoint* syncp,
+                               const std::vector<mfxFrameSurface1*>& outputs) {
+    VPL_TRACE_FUNC;
+    RET_IF_FALSE(lane_id < VPL_TASK_LANE_COUNT, MFX_ERR_UNDEFINED_BEHAVIOR);
+    RET_IF_FALSE(task, MFX_ERR_NULL_PTR);
+    Lane& lane = m_lanes[lane_id];
+
+    std::unique_lock<std::mutex> lock(m_mutex);
+    if (lane.depth) {
+        m_taskDone.wait(lock, [&] {
+            return lane.queue.size() + (lane.busy ? 1 : 0) < lane.depth;
+        });
+    }
+    RetireCompleted();
+
+    // tasks without a sync point have no result to keep, the id only
+    //   tracks their outputs
+    mfxU64 id = m_nextId++;
+    if (syncp)
+        m_tasks[id] = { false, MFX_ERR_NONE };
+    TaskEntry te = { id, std::move(task), outputs };
+    lane.queue.push_back(std::move(te));
+    for (mfxFrameSurface1* output : outputs)
+        m_outputs[output] = id;
+
+    // worker threads are only started for lanes which are actually used
+    if (!lane.worker.joinable()) {
+        lane.worker = std::thread(&CpuScheduler::WorkerLoop, this, &lane);
+    }
+    lane.ready.notify_one();
+
+    if (syncp)
+        *syncp = reinterpret_cast<mfxSyncPoint>(static_cast<uintptr_t>(id));
+
+    return MFX_ERR_NONE;
+}
+
+// wait up to "wait" ms for the task behind syncp and return its status
+// sync points which are unknown or were already synced report
+//   MFX_ERR_NOT_FOUND
+mfxStatus CpuScheduler::Sync(mfxSyncPoint syncp, mfxU32 wait) {
+    VPL_TRACE_FUNC;
+    RET_IF_FALSE(syncp, MFX_ERR_NULL_PTR);
+    mfxU64 id = static_cast<mfxU64>(reinterpret_cast<uintptr_t>(syncp));
+
+    std::unique_lock<std::mutex> lock(m_mutex);
+    auto it = m_tasks.find(id);
+    if (it == m_tasks.end())
+        return TakeRetired(id);
+
+    auto is_done = [&] {
+        it = m_tasks.find(id);
+        return it == m_tasks.end() || it->second.done;
+    };
+
+    if (wait == MFX_INFINITE) {
+        m_taskDone.wait(lock, is_done);
+    }
+    else if (!m_taskDone.wait_for(lock, std::chrono::milliseconds(wait), is_done)) {
+        return MFX_WRN_IN_EXECUTION;
+    }
+
+    // retired while waiting, or synced by another thread
+    if (it == m_tasks.end())
+        return TakeRetired(id);
+
+    mfxStatus sts = it->second.sts;
+    m_tasks.erase(it);
+    return sts;
+}
+
+mfxStatus CpuScheduler::Run(eTaskLane lane_id, CpuTask task) {
+    mfxSyncPoint syncp = nullptr;
+    RET_ERROR(Submit(lane_id, std::move(task), &syncp));
+    return Sync(syncp, MFX_INFINITE);
+}
+
+// status of a task which left the table without being synced
+// called with m_mutex held
+mfxStatus CpuScheduler::TakeRetired(mfxU64 id) {
+    auto it = m_retired.find(id);
+    RET_IF_FALSE(it != m_retired.end(), MFX_ERR_NOT_FOUND);
+    m_retired.erase(it);
+    return MFX_ERR_NONE;
+}
+
+mfxStatus CpuScheduler::Complete(mfxSyncPoint* syncp, mfxStatus sts) {
+    RET_IF_FALSE(syncp, MFX_ERR_NULL_PTR);
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    RetireCompleted();
+
+    mfxU64 id   = m_nextId++;
+    m_tasks[id] = { true, sts };
+    *syncp      = reinterpret_cast<mfxSyncPoint>(static_cast<uintptr_t>(id));
+    return MFX_ERR_NONE;
+}
+
+void CpuScheduler::WaitSurface(mfxFrameSurface1* surface) {
+    VPL_TRACE_FUNC;
+    if (!surface)
+        return;
+
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_taskDone.wait(lock, [&] {
+        return m_outputs.find(surface) == m_outputs.end();
+    });
+}
+
+void CpuScheduler::SetDepth(eTaskLane lane_id, mfxU32 depth) {
+    if (lane_id >= VPL_TASK_LANE_COUNT)
+        return;
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_lanes[lane_id].depth = depth;
+}
+
+void CpuScheduler::Drain(eTaskLane lane_id) {
+    VPL_TRACE_FUNC;
+    if (lane_id >= VPL_TASK_LANE_COUNT)
+        return;
+    Lane& lane = m_lanes[lane_id];
+
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_taskDone.wait(lock, [&] {
+        return lane.queue.empty() && !lane.busy;
+    });
+}
+
+void CpuScheduler::DrainAll() {
+    for (int lane = 0; lane < VPL_TASK_LANE_COUNT; lane++) {
+        Drain(static_cast<eTaskLane>(lane));
+    }
+}
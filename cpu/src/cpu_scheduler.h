@@ -0,0 +1,115 @@
+/*############################################################################
+  # Copyright (C) 2020 Intel Corporation
+  #
+  # SPDX-License-Identifier: MIT
+  ############################################################################*/
+
+#ifndef CPU_SRC_CPU_SCHEDULER_H_
+#define CPU_SRC_CPU_SCHEDULER_H_
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <set>
+#include <thread>
+#include <vector>
+#include "src/cpu_common.h"
+
+// each component runs its deferred work on its own lane, so decode,
+//   VPP and encode can overlap within one session
+typedef enum {
+    VPL_TASK_LANE_DECODE = 0,
+    VPL_TASK_LANE_VPP    = 1,
+    VPL_TASK_LANE_ENCODE = 2,
+    VPL_TASK_LANE_COUNT  = 3
+} eTaskLane;
+
+typedef std::function<mfxStatus(void)> CpuTask;
+
+// Per-session task queue behind the *Async() entry points
+// Tasks on one lane run in submission order on a worker thread owned by
+//   that lane. Tasks submitted with a sync point keep their result until
+//   MFXVideoCORE_SyncOperation() collects it.
+class CpuScheduler {
+public:
+    CpuScheduler();
+    ~CpuScheduler();
+
+    // output is the surface written by task, if any
+    mfxStatus Submit(eTaskLane lane,
+                     CpuTask task,
+                     mfxSyncPoint* syncp,
+                     mfxFrameSurface1* output = nullptr);
+    // same, for tasks writing to several surfaces
+    mfxStatus Submit(eTaskLane lane,
+                     CpuTask task,
+                     mfxSyncPoint* syncp,
+                     const std::vector<mfxFrameSurface1*>& outputs);
+    mfxStatus Sync(mfxSyncPoint syncp, mfxU32 wait);
+
+    // submit task and wait for its status, for codec work the caller
+    //   needs the outcome of before it returns
+    // must not be called from a task on the same lane
+    mfxStatus Run(eTaskLane lane, CpuTask task);
+
+    // sync point for work the caller has already finished, reports sts
+    mfxStatus Complete(mfxSyncPoint* syncp, mfxStatus sts);
+
+    // block until no queued task writes to surface, so it can be read
+    //   by another component without the application syncing first
+    void WaitSurface(mfxFrameSurface1* surface);
+
+    // max number of tasks queued or running on lane, 0 = no limit
+    // Submit() blocks the caller while the lane is full
+    void SetDepth(eTaskLane lane, mfxU32 depth);
+
+    // block until everything queued on lane has completed
+    void Drain(eTaskLane lane);
+    void DrainAll();
+
+private:
+    struct TaskEntry {
+        mfxU64 id;
+        CpuTask func;
+        std::vector<mfxFrameSurface1*> outputs;
+    };
+
+    struct TaskState {
+        bool done;
+        mfxStatus sts;
+    };
+
+    struct Lane {
+        std::thread worker;
+        std::condition_variable ready;
+        std::deque<TaskEntry> queue;
+        bool busy;
+        mfxU32 depth;
+    };
+
+    void WorkerLoop(Lane* lane);
+    void RetireCompleted();
+    mfxStatus TakeRetired(mfxU64 id);
+
+    std::mutex m_mutex;
+    std::condition_variable m_taskDone;
+    Lane m_lanes[VPL_TASK_LANE_COUNT];
+
+    // results are kept until synced, or until the table grows too large
+    //   (applications are not required to sync every operation)
+    std::map<mfxU64, TaskState> m_tasks;
+    // successful tasks dropped from m_tasks before they were synced
+    std::set<mfxU64> m_retired;
+    // surface -> last task writing to it
+    std::map<mfxFrameSurface1*, mfxU64> m_outputs;
+    mfxU64 m_nextId;
+    bool m_stop;
+
+    /* copy not allowed */
+    CpuScheduler(const CpuScheduler&);
+    CpuScheduler& operator=(const CpuScheduler&);
+};
+
+#endif // CPU_SRC_CPU_SCHEDULER_H_
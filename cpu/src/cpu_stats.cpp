@@ -0,0 +1,180 @@
+/*############################################################################
+  # Copyright (C) 2020 Intel Corporation
+  #
+  # SPDX-License-Identifier: MIT
+  ############################################################################*/
+
+#include "src/cpu_stats.h"
+#include <algorithm>
+
+#if defined(_WIN32)
+    #define NOMINMAX
+    #include <windows.h>
+#else
+    #include <time.h>
+#endif
+
+CpuStats::Timer::Timer()
+        : m_wallStart(std::chrono::steady_clock::now()),
+          m_cpuStart(ThreadCpuTime()) {}
+
+mfxU64 CpuStats::Timer::GetWallTime() const {
+    auto elapsed = std::chrono::steady_clock::now() - m_wallStart;
+    return std::chrono::duration_cast<std::chrono::microseconds>(elapsed).count();
+}
+
+mfxU64 CpuStats::Timer::GetCpuTime() const {
+    mfxU64 now = ThreadCpuTime();
+    return (now > m_cpuStart) ? now - m_cpuStart : 0;
+}
+
+// user + kernel time of the calling thread, in microseconds
+mfxU64 CpuStats::Timer::ThreadCpuTime() {
+#if defined(_WIN32)
+    FILETIME creation, exit, kernel, user;
+    if (!GetThreadTimes(GetCurrentThread(), &creation, &exit, &kernel, &user))
+        return 0;
+    mfxU64 k = (static_cast<mfxU64>(kernel.dwHighDateTime) << 32) | kernel.dwLowDateTime;
+    mfxU64 u = (static_cast<mfxU64>(user.dwHighDateTime) << 32) | user.dwLowDateTime;
+    return (k + u) / 10; // 100ns units
+#else
+    struct timespec ts;
+    if (clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts) != 0)
+        return 0;
+    return static_cast<mfxU64>(ts.tv_sec) * 1000000 + ts.tv_nsec / 1000;
+#endif
+}
+
+CpuStats::CpuStats()
+        : m_framesIn(0),
+          m_framesOut(0),
+          m_corruptFrames(0),
+          m_bytes(0),
+          m_wallTime(0),
+          m_wallTimeMax(0),
+          m_cpuTime(0),
+          m_cpuTimeMax(0) {
+    for (auto &bucket : m_latency)
+        bucket.store(0, std::memory_order_relaxed);
+}
+
+void CpuStats::AddFrameIn(mfxU64 bytes) {
+    m_framesIn.fetch_add(1, std::memory_order_relaxed);
+    m_bytes.fetch_add(bytes, std::memory_order_relaxed);
+}
+
+void CpuStats::AddFrameOut(mfxU64 bytes) {
+    m_framesOut.fetch_add(1, std::memory_order_relaxed);
+    m_bytes.fetch_add(bytes, std::memory_order_relaxed);
+}
+
+void CpuStats::AddCorruptFrame() {
+    m_corruptFrames.fetch_add(1, std::memory_order_relaxed);
+}
+
+void CpuStats::AddTime(const Timer &timer) {
+    mfxU64 wall = timer.GetWallTime();
+    mfxU64 cpu  = timer.GetCpuTime();
+
+    m_wallTime.fetch_add(wall, std::memory_order_relaxed);
+    m_cpuTime.fetch_add(cpu, std::memory_order_relaxed);
+    UpdateMax(m_wallTimeMax, wall);
+    UpdateMax(m_cpuTimeMax, cpu);
+    m_latency[LatencyBucket(wall)].fetch_add(1, std::memory_order_relaxed);
+}
+
+mfxU64 CpuStats::GetFramesIn() const {
+    return m_framesIn.load(std::memory_order_relaxed);
+}
+
+mfxU64 CpuStats::GetFramesOut() const {
+    return m_framesOut.load(std::memory_order_relaxed);
+}
+
+mfxU64 CpuStats::GetCorruptFrames() const {
+    return m_corruptFrames.load(std::memory_order_relaxed);
+}
+
+mfxU64 CpuStats::GetBytes() const {
+    return m_bytes.load(std::memory_order_relaxed);
+}
+
+mfxU32 CpuStats::GetCachedFrames() const {
+    mfxU64 in  = GetFramesIn();
+    mfxU64 out = GetFramesOut();
+    return (in > out) ? static_cast<mfxU32>(in - out) : 0;
+}
+
+void CpuStats::FillExtBuffer(mfxVideoParam *par) const {
+    if (!par->ExtParam)
+        return;
+
+    for (mfxU16 i = 0; i < par->NumExtParam; i++) {
+        mfxExtBuffer *ext = par->ExtParam[i];
+        if (!ext || ext->BufferId != MFX_EXTBUFF_CPU_STAT || ext->BufferSz < sizeof(mfxExtCpuStat))
+            continue;
+
+        mfxExtCpuStat *stat   = reinterpret_cast<mfxExtCpuStat *>(ext);
+        stat->NumFrameIn      = GetFramesIn();
+        stat->NumFrameOut     = GetFramesOut();
+        stat->NumCorruptFrame = GetCorruptFrames();
+        stat->NumByte         = GetBytes();
+        stat->WallTime        = m_wallTime.load(std::memory_order_relaxed);
+        stat->WallTimeMax     = m_wallTimeMax.load(std::memory_order_relaxed);
+        stat->CpuTime         = m_cpuTime.load(std::memory_order_relaxed);
+        stat->CpuTimeMax      = m_cpuTimeMax.load(std::memory_order_relaxed);
+        stat->WallTimeP50     = GetPercentile(0.50);
+        stat->WallTimeP90     = GetPercentile(0.90);
+        stat->WallTimeP99     = GetPercentile(0.99);
+    }
+}
+
+void CpuStats::UpdateMax(std::atomic<mfxU64> &max, mfxU64 value) {
+    mfxU64 prev = max.load(std::memory_order_relaxed);
+    while (prev < value && !max.compare_exchange_weak(prev, value, std::memory_order_relaxed)) {
+    }
+}
+
+// 0..3 us get a bucket each, above that each power of 2 is split into
+//   4 buckets, so a percentile is off by at most 25%
+int CpuStats::LatencyBucket(mfxU64 us) {
+    if (us < 4)
+        return static_cast<int>(us);
+
+    int msb = 0;
+    while ((us >> msb) > 1)
+        msb++;
+    int sub = static_cast<int>((us >> (msb - 2)) & 3);
+    return std::min(4 * (msb - 1) + sub, VPL_STAT_LATENCY_BUCKETS - 1);
+}
+
+// lowest value falling into bucket
+mfxU64 CpuStats::BucketValue(int bucket) {
+    if (bucket < 4)
+        return bucket;
+
+    int msb = bucket / 4 + 1;
+    int sub = bucket % 4;
+    return static_cast<mfxU64>(4 + sub) << (msb - 2);
+}
+
+mfxU32 CpuStats::GetPercentile(double p) const {
+    mfxU64 counts[VPL_STAT_LATENCY_BUCKETS];
+    mfxU64 total = 0;
+    for (int i = 0; i < VPL_STAT_LATENCY_BUCKETS; i++) {
+        counts[i] = m_latency[i].load(std::memory_order_relaxed);
+        total += counts[i];
+    }
+    if (!total)
+        return 0;
+
+    mfxU64 rank = static_cast<mfxU64>(p * total);
+    mfxU64 seen = 0;
+    for (int i = 0; i < VPL_STAT_LATENCY_BUCKETS; i++) {
+        seen += counts[i];
+        if (seen > rank)
+            return static_cast<mfxU32>(std::min<mfxU64>(BucketValue(i), 0xffffffff));
+    }
+    return static_cast<mfxU32>(std::min<mfxU64>(BucketValue(VPL_STAT_LATENCY_BUCKETS - 1),
+                                                0xffffffff));
+}
@@ -0,0 +1,75 @@
+/*############################################################################
+  # Copyright (C) 2020 Intel Corporation
+  #
+  # SPDX-License-Identifier: MIT
+  ############################################################################*/
+
+#ifndef CPU_SRC_CPU_STATS_H_
+#define CPU_SRC_CPU_STATS_H_
+
+#include <atomic>
+#include <chrono>
+#include "src/cpu_common.h"
+
+// number of wall time histogram buckets, 4 per power of 2 microseconds
+#define VPL_STAT_LATENCY_BUCKETS 128
+
+// Per component counters for the Get*Stat() entry points
+// Updated from the application thread and from the scheduler lanes, all
+//   counters are atomics so neither side ever waits for the other.
+class CpuStats {
+public:
+    // measures one call on the thread which created it
+    class Timer {
+    public:
+        Timer();
+        mfxU64 GetWallTime() const;
+        mfxU64 GetCpuTime() const;
+
+    private:
+        static mfxU64 ThreadCpuTime();
+
+        std::chrono::steady_clock::time_point m_wallStart;
+        mfxU64 m_cpuStart;
+    };
+
+    CpuStats();
+
+    void AddFrameIn(mfxU64 bytes = 0);
+    void AddFrameOut(mfxU64 bytes = 0);
+    void AddCorruptFrame();
+    void AddTime(const Timer& timer);
+
+    mfxU64 GetFramesIn() const;
+    mfxU64 GetFramesOut() const;
+    mfxU64 GetCorruptFrames() const;
+    mfxU64 GetBytes() const;
+    // frames accepted but not output yet
+    mfxU32 GetCachedFrames() const;
+
+    // fills MFX_EXTBUFF_CPU_STAT if par carries one
+    void FillExtBuffer(mfxVideoParam* par) const;
+
+private:
+    static void UpdateMax(std::atomic<mfxU64>& max, mfxU64 value);
+    static int LatencyBucket(mfxU64 us);
+    static mfxU64 BucketValue(int bucket);
+    // wall time below which fraction p of the calls completed
+    mfxU32 GetPercentile(double p) const;
+
+    std::atomic<mfxU64> m_framesIn;
+    std::atomic<mfxU64> m_framesOut;
+    std::atomic<mfxU64> m_corruptFrames;
+    std::atomic<mfxU64> m_bytes;
+    std::atomic<mfxU64> m_wallTime;
+    std::atomic<mfxU64> m_wallTimeMax;
+    std::atomic<mfxU64> m_cpuTime;
+    std::atomic<mfxU64> m_cpuTimeMax;
+    std::atomic<mfxU32> m_latency[VPL_STAT_LATENCY_BUCKETS];
+
+    /* copy not allowed */
+    CpuStats(const CpuStats&);
+    CpuStats& operator=(const CpuStats&);
+};
+
+#endif // CPU_SRC_CPU_STATS_H_
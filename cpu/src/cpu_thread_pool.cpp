@@ -0,0 +1,145 @@
+/*############################################################################
+  # Copyright (C) 2020 Intel Corporation
+  #
+  # SPDX-License-Identifier: MIT
+  ############################################################################*/
+
+#include "src/cpu_thread_pool.h"
+#include <algorithm>
+
+static int GetBudget() {
+    if (VPL_THREAD_BUDGET > 0)
+        return VPL_THREAD_BUDGET;
+    return std::max(1, static_cast<int>(std::thread::hardware_concurrency()));
+}
+
+CpuThreadPool &CpuThreadPool::Get() {
+    static CpuThreadPool pool(GetBudget());
+    return pool;
+}
+
+// the thread calling Run() is the last one of the budget
+CpuThreadPool::CpuThreadPool(int threads)
+        : m_threadCount(threads),
+          m_threadsInUse(0),
+          m_contexts(0),
+          m_busyWorkers(0),
+          m_jobs(),
+          m_workers(),
+          m_stop(false) {
+    for (int i = 0; i < threads - 1; i++)
+        m_workers.emplace_back(&CpuThreadPool::WorkerLoop, this);
+}
+
+CpuThreadPool::~CpuThreadPool() {
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stop = true;
+    }
+    m_ready.notify_all();
+    for (std::thread &worker : m_workers)
+        worker.join();
+}
+
+int CpuThreadPool::TakeIndex(Job *job) {
+    int i = job->next++;
+    if (job->next == job->count) // nothing left to hand out
+        m_jobs.erase(std::find(m_jobs.begin(), m_jobs.end(), job));
+    return i;
+}
+
+// workers share what codec threads leave of the budget with the threads
+//   calling Run()
+bool CpuThreadPool::CanWork() {
+    return !m_jobs.empty() && m_busyWorkers < m_threadCount - 1 - m_threadsInUse;
+}
+
+void CpuThreadPool::WorkerLoop() {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    for (;;) {
+        m_ready.wait(lock, [&] {
+            return m_stop || CanWork();
+        });
+        if (m_stop)
+            return;
+
+        Job *job = m_jobs.front();
+        int i    = TakeIndex(job);
+        m_busyWorkers++;
+        lock.unlock();
+        VPL_TRACE_CALL("thread pool job", (*job->func)(i));
+        lock.lock();
+        m_busyWorkers--;
+        if (--job->pending == 0)
+            m_done.notify_all();
+    }
+}
+
+void CpuThreadPool::Run(int count, const std::function<void(int)> &func) {
+    VPL_TRACE_FUNC;
+    if (count <= 0)
+        return;
+
+    if (count == 1 || m_workers.empty()) {
+        for (int i = 0; i < count; i++)
+            func(i);
+        return;
+    }
+
+    Job job = { &func, 0, count, count };
+
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_jobs.push_back(&job);
+    m_ready.notify_all();
+
+    while (job.next < job.count) {
+        int i = TakeIndex(&job);
+        lock.unlock();
+        func(i);
+        lock.lock();
+        job.pending--;
+    }
+    VPL_TRACE("thread pool wait");
+    m_done.wait(lock, [&] {
+        return job.pending == 0;
+    });
+}
+
+int CpuThreadPool::AcquireThreads(int wanted) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    int granted = wanted;
+    if (granted <= 0) {
+        int share = m_threadCount / (m_contexts + 2);
+        granted   = std::max(1, std::min(share, m_threadCount - m_threadsInUse));
+    }
+
+    m_threadsInUse += granted;
+    m_contexts++;
+    return granted;
+}
+
+void CpuThreadPool::ReleaseThreads(int count) {
+    if (count <= 0)
+        return;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_threadsInUse = std::max(0, m_threadsInUse - count);
+        m_contexts     = std::max(0, m_contexts - 1);
+    }
+    // workers held back for codec threads may run again
+    m_ready.notify_all();
+}
+
+int CpuThreadPool::FilterExecute(AVFilterContext *ctx,
+                                 avfilter_action_func *func,
+                                 void *arg,
+                                 int *ret,
+                                 int nb_jobs) {
+    Get().Run(nb_jobs, [&](int job) {
+        int r = func(ctx, arg, job, nb_jobs);
+        if (ret)
+            ret[job] = r;
+    });
+    return 0;
+}
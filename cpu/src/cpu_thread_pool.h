@@ -0,0 +1,93 @@
+/*############################################################################
+  # Copyright (C) 2020 Intel Corporation
+  #
+  # SPDX-License-Identifier: MIT
+  ############################################################################*/
+
+#ifndef CPU_SRC_CPU_THREAD_POOL_H_
+#define CPU_SRC_CPU_THREAD_POOL_H_
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "src/cpu_common.h"
+
+// Threads shared by all sessions in the process
+// The pool has one thread per core of the budget (VPL_THREAD_BUDGET), the
+//   thread calling Run() being one of them. Our own kernels and libavfilter
+//   slice jobs run on it. libavcodec creates its own codec threads, so the
+//   budget also hands out codec thread counts, and the threads handed out
+//   are taken off the workers allowed to run jobs. This keeps the total
+//   close to the number of cores however many sessions are open.
+class CpuThreadPool {
+public:
+    static CpuThreadPool& Get();
+
+    // threads in the budget
+    int GetThreadCount() {
+        return m_threadCount;
+    }
+
+    // run func(0) .. func(count - 1) and wait for all of them
+    // the caller works on its own jobs too, so Run() may be nested, and
+    //   does all of them when codec threads use up the budget
+    void Run(int count, const std::function<void(int)>& func);
+
+    // thread count for a new libav codec context, wanted = 0 for automatic
+    // automatic requests get an equal share of the budget with the
+    //   contexts already open and one still to come (a transcode opens its
+    //   decoder before its encoder), capped at what is left, at least 1
+    // explicit requests are granted as is, even over the budget: codec
+    //   thread counts are fixed once a context is open, and the chunked
+    //   encoders ask for budget / NumChunk each and must get it together.
+    //   Overcommitted threads leave the pool without workers, Run() then
+    //   does all jobs on the calling thread.
+    int AcquireThreads(int wanted);
+    // count is the grant of one context, 0 if it never acquired any
+    void ReleaseThreads(int count);
+
+    // AVFilterGraph::execute, runs filter slice jobs on the pool
+    static int FilterExecute(AVFilterContext* ctx,
+                             avfilter_action_func* func,
+                             void* arg,
+                             int* ret,
+                             int nb_jobs);
+
+private:
+    struct Job {
+        const std::function<void(int)>* func;
+        int next;
+        int count;
+        int pending;
+    };
+
+    explicit CpuThreadPool(int threads);
+    ~CpuThreadPool();
+
+    void WorkerLoop();
+    // next index of job, called with m_mutex held
+    int TakeIndex(Job* job);
+    // a worker may take a job, called with m_mutex held
+    bool CanWork();
+
+    int m_threadCount;
+    int m_threadsInUse; // codec threads handed out
+    int m_contexts;     // codec contexts holding threads
+    int m_busyWorkers;
+
+    std::mutex m_mutex;
+    std::condition_variable m_ready;
+    std::condition_variable m_done;
+    std::deque<Job*> m_jobs;
+    std::vector<std::thread> m_workers;
+    bool m_stop;
+
+    /* copy not allowed */
+    CpuThreadPool(const CpuThreadPool&);
+    CpuThreadPool& operator=(const CpuThreadPool&);
+};
+
+#endif // CPU_SRC_CPU_THREAD_POOL_H_
@@ -0,0 +1,108 @@
+/*############################################################################
+  # Copyright (C) 2020 Intel Corporation
+  #
+  # SPDX-License-Identifier: MIT
+  ############################################################################*/
+
+#include "src/cpu_timestamp.h"
+#include <algorithm>
+
+static const AVRational mfxTimeBase = { 1, 90000 };
+
+CpuEncodeTimestamps::CpuEncodeTimestamps()
+        : m_timeBase({ 1, 90000 }),
+          m_frameDuration(0),
+          m_hasInput(false),
+          m_lastPts(0),
+          m_lastTimeStamp(0),
+          m_timeStamps(),
+          m_dtsQueue(),
+          m_dtsLead(-1) {}
+
+int64_t CpuEncodeTimestamps::GetFrameDuration(const mfxFrameInfo &info) {
+    if (!info.FrameRateExtN || !info.FrameRateExtD)
+        return 0;
+    return av_rescale(mfxTimeBase.den, info.FrameRateExtD, info.FrameRateExtN);
+}
+
+int64_t CpuEncodeTimestamps::GetSurfacePts(const mfxFrameSurface1 *surface) {
+    // 0 is what surfaces without a time stamp have in this runtime
+    mfxU64 timeStamp = surface->Data.TimeStamp;
+    if (!timeStamp || timeStamp == static_cast<mfxU64>(MFX_TIMESTAMP_UNKNOWN))
+        return AV_NOPTS_VALUE;
+    return static_cast<int64_t>(timeStamp);
+}
+
+void CpuEncodeTimestamps::InitTimestamps(const AVCodecContext *ctx) {
+    m_timeBase      = ctx->time_base;
+    m_frameDuration = av_rescale_q(1, m_timeBase, mfxTimeBase);
+    m_hasInput      = false;
+    m_lastPts       = 0;
+    m_lastTimeStamp = 0;
+    m_timeStamps.clear();
+    m_dtsQueue.clear();
+    m_dtsLead = -1;
+}
+
+void CpuEncodeTimestamps::SetFramePts(AVFrame *frame) {
+    int64_t timeStamp = frame->pts;
+    if (timeStamp == AV_NOPTS_VALUE)
+        timeStamp = m_hasInput ? m_lastTimeStamp + m_frameDuration : 0;
+
+    // encoders want increasing pts, so time stamps closer together than
+    //   the time base still get one each
+    int64_t pts = av_rescale_q(timeStamp, mfxTimeBase, m_timeBase);
+    if (m_hasInput && pts <= m_lastPts)
+        pts = m_lastPts + 1;
+
+    m_hasInput      = true;
+    m_lastPts       = pts;
+    m_lastTimeStamp = timeStamp;
+    frame->pts      = pts;
+
+    m_timeStamps[pts] = timeStamp;
+    m_dtsQueue.push_back(timeStamp);
+}
+
+void CpuEncodeTimestamps::SetPacketTimes(AVPacket *pkt) {
+    int64_t pts = pkt->pts;
+    int64_t dts = pkt->dts;
+
+    if (pts != AV_NOPTS_VALUE) {
+        auto it = m_timeStamps.find(pts);
+        if (it != m_timeStamps.end()) {
+            pkt->pts = it->second;
+            m_timeStamps.erase(it);
+        }
+        else {
+            pkt->pts = av_rescale_q(pts, m_timeBase, mfxTimeBase);
+        }
+    }
+
+    // the first packet tells how many frames the encoder reorders by
+    // SVT encoders count DTS from 0 rather than from the first pts, so no
+    //   more than the frames held back for the first packet are trusted
+    if (m_dtsLead < 0) {
+        int held  = std::max(static_cast<int>(m_dtsQueue.size()) - 1, 0);
+        m_dtsLead = held;
+        if (pts != AV_NOPTS_VALUE && dts != AV_NOPTS_VALUE) {
+            int64_t frame =
+                std::max<int64_t>(av_rescale_q(m_frameDuration, mfxTimeBase, m_timeBase), 1);
+            int64_t depth = std::max<int64_t>((pts - dts + frame - 1) / frame, 0);
+            m_dtsLead     = static_cast<int>(std::min<int64_t>(depth, held));
+        }
+    }
+
+    if (m_dtsQueue.empty()) {
+        pkt->dts = (dts != AV_NOPTS_VALUE) ? av_rescale_q(dts, m_timeBase, mfxTimeBase) : pkt->pts;
+    }
+    else if (m_dtsLead > 0) {
+        // packets ahead of the first input count back from it
+        pkt->dts = m_dtsQueue.front() - m_dtsLead * m_frameDuration;
+        m_dtsLead--;
+    }
+    else {
+        pkt->dts = m_dtsQueue.front();
+        m_dtsQueue.pop_front();
+    }
+}
@@ -0,0 +1,56 @@
+/*############################################################################
+  # Copyright (C) 2020 Intel Corporation
+  #
+  # SPDX-License-Identifier: MIT
+  ############################################################################*/
+
+#ifndef CPU_SRC_CPU_TIMESTAMP_H_
+#define CPU_SRC_CPU_TIMESTAMP_H_
+
+#include <deque>
+#include <map>
+#include "src/cpu_common.h"
+
+// MFX time stamps count a 90 kHz clock, encoders count their time base
+//   (1/frame rate), so frames are converted on the way in and packets on
+//   the way out
+// A packet gets back the exact time stamp its frame came with, not one
+//   rounded through the time base. Its DTS is the time stamp of an earlier
+//   input, delayed by the reorder depth of the encoder, so DTS increase
+//   and never exceed the PTS of their packet.
+class CpuEncodeTimestamps {
+public:
+    CpuEncodeTimestamps();
+
+    // 90 kHz ticks per frame at the frame rate of info
+    static int64_t GetFrameDuration(const mfxFrameInfo& info);
+    // time stamp of surface, AV_NOPTS_VALUE if not set
+    static int64_t GetSurfacePts(const mfxFrameSurface1* surface);
+
+    void InitTimestamps(const AVCodecContext* ctx);
+    // frame->pts in 90 kHz to the time base, AV_NOPTS_VALUE is one frame
+    //   after the last input
+    void SetFramePts(AVFrame* frame);
+    // pkt->pts and pkt->dts in the time base to 90 kHz
+    void SetPacketTimes(AVPacket* pkt);
+
+private:
+    AVRational m_timeBase;
+    int64_t m_frameDuration;
+    bool m_hasInput;
+    int64_t m_lastPts;
+    int64_t m_lastTimeStamp;
+    // time stamps of the frames in the encoder by their pts
+    std::map<int64_t, int64_t> m_timeStamps;
+    // time stamps in input order, the next DTS first
+    std::deque<int64_t> m_dtsQueue;
+    // packets left to go out before the first input time stamp, -1 until
+    //   the reorder depth is known
+    int m_dtsLead;
+
+    /* copy not allowed */
+    CpuEncodeTimestamps(const CpuEncodeTimestamps&);
+    CpuEncodeTimestamps& operator=(const CpuEncodeTimestamps&);
+};
+
+#endif // CPU_SRC_CPU_TIMESTAMP_H_
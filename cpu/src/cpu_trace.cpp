@@ -0,0 +1,190 @@
+/*############################################################################
+  # Copyright (C) 2020 Intel Corporation
+  #
+  # SPDX-License-Identifier: MIT
+  ############################################################################*/
+
+#include "src/cpu_trace.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include "src/cpu_common.h"
+
+static bool ReadTraceEnable() {
+    const char *path = getenv("VPL_TRACE_FILE");
+    return path && *path;
+}
+
+std::atomic<bool> CpuTrace::s_enabled(ReadTraceEnable());
+
+void CpuTrace::Init() {
+    s_enabled.store(ReadTraceEnable(), std::memory_order_relaxed);
+}
+
+namespace {
+
+// events are kept in chunks allocated as a buffer fills, so threads which
+//   record little do not cost a whole buffer
+#define TRACE_CHUNK_EVENTS 1024
+#define TRACE_CHUNKS       ((VPL_TRACE_BUFFER_EVENTS + TRACE_CHUNK_EVENTS - 1) / TRACE_CHUNK_EVENTS)
+#define TRACE_CAPACITY     ((uint64_t)TRACE_CHUNKS * TRACE_CHUNK_EVENTS)
+
+// fields are atomic because Dump() copies events the owner may be
+//   overwriting, relaxed stores cost nothing over plain ones
+struct TraceEvent {
+    std::atomic<const char *> name;
+    std::atomic<uint64_t> start;
+    std::atomic<uint64_t> duration;
+};
+
+// written only by the thread which created it, so recording takes no lock
+// written is published with release after the event is stored, Dump()
+//   reads it before and after copying to drop events overwritten meanwhile
+struct TraceBuffer {
+    std::atomic<TraceEvent *> chunks[TRACE_CHUNKS];
+    std::atomic<uint64_t> written;
+    int tid;
+};
+
+// buffers outlive their threads, so events of codec and lane threads
+//   which exited before the session was closed are still written
+// a buffer is never handed to another thread, each tid in the trace is
+//   one thread
+// never destroyed, threads may still record during process exit
+struct TraceRegistry {
+    std::mutex mutex;
+    std::vector<std::unique_ptr<TraceBuffer>> buffers;
+};
+
+TraceRegistry *GetRegistry() {
+    static TraceRegistry *registry = new TraceRegistry();
+    return registry;
+}
+
+thread_local TraceBuffer *t_buffer = nullptr;
+
+// the registry lock is taken once per thread, on its first event
+TraceBuffer *GetThreadBuffer() {
+    if (t_buffer)
+        return t_buffer;
+
+    std::unique_ptr<TraceBuffer> buffer(new TraceBuffer());
+    for (auto &chunk : buffer->chunks)
+        chunk.store(nullptr, std::memory_order_relaxed);
+    buffer->written.store(0, std::memory_order_relaxed);
+
+    TraceRegistry *registry = GetRegistry();
+    std::lock_guard<std::mutex> lock(registry->mutex);
+    buffer->tid = static_cast<int>(registry->buffers.size()) + 1;
+    t_buffer    = buffer.get();
+    registry->buffers.push_back(std::move(buffer));
+    return t_buffer;
+}
+
+struct TraceEventCopy {
+    const char *name;
+    uint64_t start;
+    uint64_t duration;
+};
+
+// copy the events still in the ring, while the owner may keep recording
+void CopyEvents(TraceBuffer *buffer, std::vector<TraceEventCopy> *events) {
+    events->clear();
+    uint64_t end   = buffer->written.load(std::memory_order_acquire);
+    uint64_t begin = (end > TRACE_CAPACITY) ? end - TRACE_CAPACITY : 0;
+    for (uint64_t i = begin; i < end; i++) {
+        uint64_t slot     = i % TRACE_CAPACITY;
+        auto &chunk_ptr   = buffer->chunks[slot / TRACE_CHUNK_EVENTS];
+        TraceEvent *chunk = chunk_ptr.load(std::memory_order_acquire);
+        TraceEvent &event = chunk[slot % TRACE_CHUNK_EVENTS];
+        events->push_back({ event.name.load(std::memory_order_relaxed),
+                            event.start.load(std::memory_order_relaxed),
+                            event.duration.load(std::memory_order_relaxed) });
+    }
+
+    // the owner may have overwritten the oldest slots, including the one
+    //   it is writing now, while they were copied
+    std::atomic_thread_fence(std::memory_order_acquire);
+    uint64_t after = buffer->written.load(std::memory_order_relaxed);
+    uint64_t valid = (after + 1 > TRACE_CAPACITY) ? after + 1 - TRACE_CAPACITY : 0;
+    if (valid > begin)
+        events->erase(events->begin(),
+                      events->begin() + static_cast<size_t>(std::min(valid - begin, end - begin)));
+}
+
+void WriteName(FILE *file, const char *name) {
+    for (; *name; name++) {
+        if (*name == '"' || *name == '\\')
+            fputc('\\', file);
+        fputc(*name, file);
+    }
+}
+
+} // namespace
+
+uint64_t CpuTrace::Now() {
+    auto now = std::chrono::steady_clock::now().time_since_epoch();
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(now).count();
+}
+
+void CpuTrace::Record(const char *name, uint64_t start, uint64_t end) {
+    TraceBuffer *buffer = GetThreadBuffer();
+
+    uint64_t written  = buffer->written.load(std::memory_order_relaxed);
+    uint64_t slot     = written % TRACE_CAPACITY;
+    auto &chunk_ptr   = buffer->chunks[slot / TRACE_CHUNK_EVENTS];
+    TraceEvent *chunk = chunk_ptr.load(std::memory_order_relaxed);
+    if (!chunk) {
+        chunk = new TraceEvent[TRACE_CHUNK_EVENTS];
+        chunk_ptr.store(chunk, std::memory_order_release);
+    }
+
+    TraceEvent &event = chunk[slot % TRACE_CHUNK_EVENTS];
+    event.name.store(name, std::memory_order_relaxed);
+    event.start.store(start, std::memory_order_relaxed);
+    event.duration.store(end - start, std::memory_order_relaxed);
+    buffer->written.store(written + 1, std::memory_order_release);
+}
+
+void CpuTrace::Dump() {
+    if (!IsEnabled())
+        return;
+
+    const char *path = getenv("VPL_TRACE_FILE");
+    if (!path || !*path)
+        return;
+
+    // the registry lock only keeps threads from adding buffers meanwhile,
+    //   recording goes on while the trace is written
+    TraceRegistry *registry = GetRegistry();
+    std::lock_guard<std::mutex> lock(registry->mutex);
+
+    FILE *file = fopen(path, "w");
+    if (!file)
+        return;
+
+    // ts and dur are in us
+    fprintf(file, "{\"traceEvents\":[\n");
+    bool first = true;
+    std::vector<TraceEventCopy> events;
+    for (auto &buffer : registry->buffers) {
+        CopyEvents(buffer.get(), &events);
+        for (const TraceEventCopy &event : events) {
+            fprintf(file, "%s{\"name\":\"", first ? "" : ",\n");
+            WriteName(file, event.name);
+            fprintf(file,
+                    "\",\"ph\":\"X\",\"pid\":1,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f}",
+                    buffer->tid,
+                    event.start / 1000.0,
+                    event.duration / 1000.0);
+            first = false;
+        }
+    }
+    fprintf(file, "\n]}\n");
+    fclose(file);
+}
@@ -0,0 +1,62 @@
+/*############################################################################
+  # Copyright (C) 2020 Intel Corporation
+  #
+  # SPDX-License-Identifier: MIT
+  ############################################################################*/
+
+#ifndef CPU_SRC_CPU_TRACE_H_
+#define CPU_SRC_CPU_TRACE_H_
+
+#include <atomic>
+#include <cstdint>
+
+// Runtime tracing, enabled by setting VPL_TRACE_FILE to an output path
+// Every thread records complete events (name, start, duration) into a
+//   ring buffer only it writes, so recording takes no lock and each tid in
+//   the trace is one thread. The buffers are written as Chrome trace JSON
+//   (chrome://tracing, Perfetto) whenever a session is closed, oldest
+//   events being overwritten first. Buffers are kept after their thread
+//   exits, so enable tracing for debugging only.
+class CpuTrace {
+public:
+    static bool IsEnabled() {
+        return s_enabled.load(std::memory_order_relaxed);
+    }
+
+    // read VPL_TRACE_FILE again, called when a session is created
+    static void Init();
+
+    // ns on a steady clock
+    static uint64_t Now();
+
+    // name must stay valid until the trace is written (string literal)
+    static void Record(const char* name, uint64_t start, uint64_t end);
+
+    // write all buffers to VPL_TRACE_FILE
+    static void Dump();
+
+private:
+    static std::atomic<bool> s_enabled;
+};
+
+// records the lifetime of the enclosing scope
+class CpuTraceScope {
+public:
+    explicit CpuTraceScope(const char* name)
+            : m_name(name),
+              m_start(CpuTrace::IsEnabled() ? CpuTrace::Now() : 0) {}
+    ~CpuTraceScope() {
+        if (m_start)
+            CpuTrace::Record(m_name, m_start, CpuTrace::Now());
+    }
+
+private:
+    const char* m_name;
+    uint64_t m_start;
+
+    /* copy not allowed */
+    CpuTraceScope(const CpuTraceScope&);
+    CpuTraceScope& operator=(const CpuTraceScope&);
+};
+
+#endif // CPU_SRC_CPU_TRACE_H_
@@ -6,9 +6,12 @@
 
 #include "src/cpu_vpp.h"
 #include <algorithm>
+#include <iterator>
 #include <string>
 #include <utility>
 #include <vector>
+#include "src/cpu_copy.h"
+#include "src/cpu_thread_pool.h"
 #include "src/cpu_workstream.h"
 
 // vpp in/out type
@@ -20,12 +23,15 @@ CpuVPP::CpuVPP(CpuWorkstream* session)
           m_vpp_graph(nullptr),
           m_buffersrc_ctx(nullptr),
           m_buffersink_ctx(nullptr),
+          m_outputs(),
+          m_output_sinks(),
           m_vppInFormat(MFX_FOURCC_I420),
           m_vppWidth(0),
           m_vppHeight(0),
           m_vppFunc(0),
           m_param(),
-          m_vppSurfaces() {
+          m_vppSurfaces(),
+          m_stats() {
     memset(m_vpp_filter_desc, 0, sizeof(m_vpp_filter_desc));
 }
 
@@ -46,6 +52,10 @@ bool CpuVPP::InitFilters(void) {
         return false;
     }
 
+    // slice jobs run on the shared pool instead of threads owned by the graph
+    m_vpp_graph->nb_threads = CpuThreadPool::Get().GetThreadCount();
+    m_vpp_graph->execute    = CpuThreadPool::FilterExecute;
+
     snprintf(buffersrc_fmt,
              sizeof(buffersrc_fmt),
              "video_size=%ux%u:pix_fmt=%d:time_base=%u/%u", //:pixel_aspect=1/1",
@@ -172,12 +182,10 @@ bool CpuVPP::InitFilters(void) {
         }
 
         char pixel_format[50] = { 0 };
-        if (csc_dst_fmt == AV_PIX_FMT_YUV420P)
-            snprintf(pixel_format, sizeof(pixel_format), "format=pix_fmts=yuv420p");
-        else if (csc_dst_fmt == AV_PIX_FMT_YUV420P10LE)
-            snprintf(pixel_format, sizeof(pixel_format), "format=pix_fmts=yuv420p10le");
-        else if (csc_dst_fmt == AV_PIX_FMT_BGRA)
-            snprintf(pixel_format, sizeof(pixel_format), "format=pix_fmts=bgra");
+        snprintf(pixel_format,
+                 sizeof(pixel_format),
+                 "format=pix_fmts=%s",
+                 av_get_pix_fmt_name(csc_dst_fmt));
 
         if (m_vppFunc == VPL_VPP_CSC) // there's no filter assigned
             snprintf(m_vpp_filter_desc, sizeof(m_vpp_filter_desc), "%s", pixel_format);
@@ -206,6 +214,11 @@ bool CpuVPP::InitFilters(void) {
         snprintf(m_vpp_filter_desc, sizeof(m_vpp_filter_desc), "null");
     }
 
+    if (!InitOutputs(buffersink_in_pad)) {
+        CloseFilterPads(buffersrc_out_pad, buffersink_in_pad);
+        return false;
+    }
+
     ret = avfilter_graph_parse_ptr(m_vpp_graph,
                                    (const char*)m_vpp_filter_desc,
                                    &buffersink_in_pad,
@@ -229,6 +242,83 @@ bool CpuVPP::InitFilters(void) {
     }
 }
 
+// output 0 --> split --> scale --> split --> scale ...
+// a buffersink is added for each extra output and output 0 is labelled
+//   explicitly, sink_in is the pad list the description is parsed with
+bool CpuVPP::InitOutputs(AVFilterInOut* sink_in) {
+    if (m_outputs.empty())
+        return true;
+
+    const AVFilter* buffersink    = avfilter_get_by_name("buffersink");
+    enum AVPixelFormat pix_fmts[] = { MFXFourCC2AVPixelFormat(m_param.vpp.Out.FourCC),
+                                      AV_PIX_FMT_NONE };
+
+    AVFilterInOut* last_pad = sink_in;
+    for (size_t i = 0; i < m_outputs.size(); i++) {
+        AVFilterContext* sink_ctx = nullptr;
+        std::string sink_name     = "video-out" + std::to_string(i + 1);
+
+        int ret = avfilter_graph_create_filter(&sink_ctx,
+                                               buffersink,
+                                               sink_name.c_str(),
+                                               NULL,
+                                               NULL,
+                                               m_vpp_graph);
+        if (ret >= 0) {
+            ret = av_opt_set_int_list(sink_ctx,
+                                      "pix_fmts",
+                                      pix_fmts,
+                                      AV_PIX_FMT_NONE,
+                                      AV_OPT_SEARCH_CHILDREN);
+        }
+        if (ret < 0) {
+            printf("cannot create buffer sink for output %zu\n", i + 1);
+            return false;
+        }
+        m_output_sinks.push_back(sink_ctx);
+
+        AVFilterInOut* pad = avfilter_inout_alloc();
+        if (!pad) {
+            printf("cannot alloc filter pad\n");
+            return false;
+        }
+        pad->name       = av_strdup(("out" + std::to_string(i + 1)).c_str());
+        pad->filter_ctx = sink_ctx;
+        pad->pad_idx    = 0;
+        pad->next       = NULL;
+        last_pad->next  = pad;
+        last_pad        = pad;
+    }
+
+    // each output is scaled from the next larger one
+    std::vector<size_t> order(m_outputs.size());
+    for (size_t i = 0; i < order.size(); i++)
+        order[i] = i;
+    std::stable_sort(order.begin(), order.end(), [this](size_t a, size_t b) {
+        return m_outputs[a].Width * m_outputs[a].Height > m_outputs[b].Width * m_outputs[b].Height;
+    });
+
+    std::string desc = std::string(m_vpp_filter_desc) + ",split=2[out][rung0]";
+    for (size_t k = 0; k < order.size(); k++) {
+        const mfxFrameInfo& info = m_outputs[order[k]];
+        std::string out_label    = "[out" + std::to_string(order[k] + 1) + "]";
+
+        desc += ";[rung" + std::to_string(k) + "]scale=" + std::to_string(info.Width) + ":" +
+                std::to_string(info.Height);
+        if (k + 1 < order.size())
+            desc += ",split=2" + out_label + "[rung" + std::to_string(k + 1) + "]";
+        else
+            desc += out_label;
+    }
+
+    if (desc.size() >= sizeof(m_vpp_filter_desc)) {
+        printf("filter description is too long\n");
+        return false;
+    }
+    snprintf(m_vpp_filter_desc, sizeof(m_vpp_filter_desc), "%s", desc.c_str());
+    return true;
+}
+
 void CpuVPP::CloseFilterPads(AVFilterInOut* src_out, AVFilterInOut* sink_in) {
     if (src_out)
         avfilter_inout_free(&src_out);
@@ -237,20 +327,30 @@ void CpuVPP::CloseFilterPads(AVFilterInOut* src_out, AVFilterInOut* sink_in) {
     return;
 }
 
+// only mfxExtCpuVPPOutputs is accepted
+static bool HasUnsupportedExtParam(mfxVideoParam* par) {
+    for (mfxU16 i = 0; i < par->NumExtParam; i++) {
+        if (!par->ExtParam || !par->ExtParam[i])
+            return true;
+        if (par->ExtParam[i]->BufferId != MFX_EXTBUFF_CPU_VPP_OUTPUTS)
+            return true;
+    }
+    return false;
+}
+
 mfxStatus CpuVPP::ValidateVPPParams(mfxVideoParam* par, bool canCorrect) {
     bool fixedIncompatible = false;
 
     if (canCorrect) {
-        if (par->AsyncDepth > 16)
-            par->AsyncDepth = 16;
-
-        if (!par->AsyncDepth)
-            par->AsyncDepth = 1;
+        // 0 is left as is, it selects the default depth while 1 selects
+        //   low latency
+        if (par->AsyncDepth > VPL_MAX_ASYNC_DEPTH)
+            par->AsyncDepth = VPL_MAX_ASYNC_DEPTH;
 
         if (par->Protected)
             par->Protected = 0;
 
-        if (par->NumExtParam)
+        if (HasUnsupportedExtParam(par))
             par->NumExtParam = 0;
 
         if (!par->vpp.Out.Width)
@@ -291,7 +391,8 @@ mfxStatus CpuVPP::ValidateVPPParams(mfxVideoParam* par, bool canCorrect) {
         if ((par->vpp.In.BitDepthLuma == 8) && (par->vpp.In.BitDepthChroma == 10)) {
             if (canCorrect)
                 fixedIncompatible = true;
-            if (par->vpp.In.FourCC == MFX_FOURCC_I420)
+            if (par->vpp.In.FourCC == MFX_FOURCC_I420 ||
+                par->vpp.In.FourCC == MFX_FOURCC_NV12)
                 par->vpp.In.BitDepthChroma = 8;
             else
                 par->vpp.In.BitDepthChroma = 10;
@@ -300,7 +401,8 @@ mfxStatus CpuVPP::ValidateVPPParams(mfxVideoParam* par, bool canCorrect) {
         if ((par->vpp.In.BitDepthLuma == 10) && (par->vpp.In.BitDepthChroma == 8)) {
             if (canCorrect)
                 fixedIncompatible = true;
-            if (par->vpp.In.FourCC == MFX_FOURCC_I420)
+            if (par->vpp.In.FourCC == MFX_FOURCC_I420 ||
+                par->vpp.In.FourCC == MFX_FOURCC_NV12)
                 par->vpp.In.BitDepthLuma = 8;
             else
                 par->vpp.In.BitDepthLuma = 10;
@@ -309,7 +411,8 @@ mfxStatus CpuVPP::ValidateVPPParams(mfxVideoParam* par, bool canCorrect) {
         if ((par->vpp.Out.BitDepthLuma == 8) && (par->vpp.Out.BitDepthChroma == 10)) {
             if (canCorrect)
                 fixedIncompatible = true;
-            if (par->vpp.Out.FourCC == MFX_FOURCC_I420)
+            if (par->vpp.Out.FourCC == MFX_FOURCC_I420 ||
+                par->vpp.Out.FourCC == MFX_FOURCC_NV12)
                 par->vpp.Out.BitDepthChroma = 8;
             else
                 par->vpp.Out.BitDepthChroma = 10;
@@ -318,7 +421,8 @@ mfxStatus CpuVPP::ValidateVPPParams(mfxVideoParam* par, bool canCorrect) {
         if ((par->vpp.Out.BitDepthLuma == 10) && (par->vpp.Out.BitDepthChroma == 8)) {
             if (canCorrect)
                 fixedIncompatible = true;
-            if (par->vpp.In.FourCC == MFX_FOURCC_I420)
+            if (par->vpp.In.FourCC == MFX_FOURCC_I420 ||
+                par->vpp.In.FourCC == MFX_FOURCC_NV12)
                 par->vpp.Out.BitDepthLuma = 8;
             else
                 par->vpp.Out.BitDepthLuma = 10;
@@ -327,13 +431,13 @@ mfxStatus CpuVPP::ValidateVPPParams(mfxVideoParam* par, bool canCorrect) {
         par->IOPattern = MFX_IOPATTERN_IN_SYSTEM_MEMORY | MFX_IOPATTERN_OUT_SYSTEM_MEMORY;
     }
     else {
-        if (par->AsyncDepth > 16)
+        if (par->AsyncDepth > VPL_MAX_ASYNC_DEPTH)
             return MFX_ERR_INVALID_VIDEO_PARAM;
 
         if (par->Protected)
             return MFX_ERR_INVALID_VIDEO_PARAM;
 
-        if (par->NumExtParam)
+        if (HasUnsupportedExtParam(par))
             return MFX_ERR_INVALID_VIDEO_PARAM;
 
         if (!par->vpp.Out.Width)
@@ -376,14 +480,14 @@ mfxStatus CpuVPP::ValidateVPPParams(mfxVideoParam* par, bool canCorrect) {
         !(par->IOPattern & MFX_IOPATTERN_OUT_SYSTEM_MEMORY))
         return MFX_ERR_INVALID_VIDEO_PARAM;
 
-    if (par->AsyncDepth > 16) {
+    if (par->AsyncDepth > VPL_MAX_ASYNC_DEPTH) {
         return MFX_ERR_INVALID_VIDEO_PARAM;
     }
 
     if (par->Protected)
         return MFX_ERR_INVALID_VIDEO_PARAM;
 
-    if (par->NumExtParam)
+    if (HasUnsupportedExtParam(par))
         return MFX_ERR_INVALID_VIDEO_PARAM;
 
     if (par->mfx.NumThread)
@@ -438,6 +542,10 @@ mfxStatus CpuVPP::InitVPP(mfxVideoParam* par) {
         m_vppFunc |= VPL_VPP_SCALE;
     }
 
+    sts = InitOutputParams(par);
+    if (sts != MFX_ERR_NONE)
+        return sts;
+
     if (InitFilters() == false)
         return MFX_ERR_NOT_INITIALIZED;
 
@@ -449,9 +557,54 @@ mfxStatus CpuVPP::InitVPP(mfxVideoParam* par) {
     m_vppWidth    = m_param.vpp.In.Width;
     m_vppHeight   = m_param.vpp.In.Height;
 
+    m_session->GetScheduler()->SetDepth(VPL_TASK_LANE_VPP, GetAsyncDepth(&m_param));
+
     return sts;
 }
 
+// extra outputs are checked against vpp.Out, which is output 0
+mfxStatus CpuVPP::InitOutputParams(mfxVideoParam* par) {
+    mfxExtCpuVPPOutputs* ext = nullptr;
+    for (mfxU16 i = 0; i < par->NumExtParam; i++) {
+        if (par->ExtParam[i]->BufferId == MFX_EXTBUFF_CPU_VPP_OUTPUTS)
+            ext = reinterpret_cast<mfxExtCpuVPPOutputs*>(par->ExtParam[i]);
+    }
+    if (!ext)
+        return MFX_ERR_NONE;
+
+    RET_IF_FALSE(ext->Header.BufferSz >= sizeof(mfxExtCpuVPPOutputs),
+                 MFX_ERR_INVALID_VIDEO_PARAM);
+    RET_IF_FALSE(ext->NumOutput <= VPL_VPP_MAX_OUTPUTS, MFX_ERR_INVALID_VIDEO_PARAM);
+    RET_IF_FALSE(ext->Output || !ext->NumOutput, MFX_ERR_NULL_PTR);
+
+    const mfxFrameInfo& out = m_param.vpp.Out;
+    for (mfxU16 i = 0; i < ext->NumOutput; i++) {
+        mfxFrameInfo info = ext->Output[i];
+        if (!info.FourCC)
+            info.FourCC = out.FourCC;
+        if (!info.ChromaFormat)
+            info.ChromaFormat = out.ChromaFormat;
+        if (!info.CropW)
+            info.CropW = info.Width;
+        if (!info.CropH)
+            info.CropH = info.Height;
+
+        RET_ERROR(CheckFrameInfo(&info));
+        RET_IF_FALSE(info.FourCC == out.FourCC, MFX_ERR_INVALID_VIDEO_PARAM);
+        RET_IF_FALSE(!info.CropX && !info.CropY && info.CropW == info.Width &&
+                         info.CropH == info.Height,
+                     MFX_ERR_INVALID_VIDEO_PARAM);
+        RET_IF_FALSE(info.Width <= out.Width && info.Height <= out.Height,
+                     MFX_ERR_INVALID_VIDEO_PARAM);
+
+        info.PicStruct     = out.PicStruct;
+        info.FrameRateExtN = out.FrameRateExtN;
+        info.FrameRateExtD = out.FrameRateExtD;
+        m_outputs.push_back(info);
+    }
+    return MFX_ERR_NONE;
+}
+
 CpuVPP::~CpuVPP() {
     if (m_avVppFrameOut) {
         av_frame_free(&m_avVppFrameOut);
@@ -463,12 +616,11 @@ CpuVPP::~CpuVPP() {
     }
 }
 
-mfxStatus CpuVPP::ProcessFrame(mfxFrameSurface1* surface_in,
-                               mfxFrameSurface1* surface_out,
-                               mfxExtVppAuxData* aux) {
-    // Try get AVFrame from surface_out
+// moves the next frame of sink into surface, surface == 0 drops it
+mfxStatus CpuVPP::ReceiveFrame(AVFilterContext* sink, mfxFrameSurface1* surface) {
+    // Try get AVFrame from surface
     AVFrame* dst_avframe = nullptr;
-    CpuFrame* dst_frame  = CpuFrame::TryCast(surface_out);
+    CpuFrame* dst_frame  = CpuFrame::TryCast(surface);
     if (dst_frame) {
         dst_avframe = dst_frame->GetAVFrame();
     }
@@ -476,39 +628,249 @@ mfxStatus CpuVPP::ProcessFrame(mfxFrameSurface1* surface_in,
         dst_avframe = m_avVppFrameOut;
     }
 
+    // av_buffersink_get_frame
+    int ret = VPL_TRACE_CALL("av_buffersink_get_frame", av_buffersink_get_frame(sink, dst_avframe));
+    if (ret == AVERROR(EAGAIN) || ret == AVERROR_EOF) {
+        return MFX_ERR_MORE_DATA;
+    }
+    RET_IF_FALSE(ret >= 0, MFX_ERR_ABORTED);
+
+    if (!surface) {
+        av_frame_unref(m_avVppFrameOut);
+    }
+    else if (dst_avframe == m_avVppFrameOut) { // copy image data
+        mfxStatus sts =
+            AVFrame2mfxFrameSurface(surface, m_avVppFrameOut, m_session->GetFrameAllocator());
+        av_frame_unref(m_avVppFrameOut);
+        RET_ERROR(sts);
+    }
+    else if (dst_frame) { // update MFXFrameSurface from AVFrame
+        dst_frame->Update();
+    }
+    return MFX_ERR_NONE;
+}
+
+// runs the filter graph for one frame, on the VPP lane unless draining
+// outputs[0] is surface_out, then one entry per extra output
+mfxStatus CpuVPP::FilterFrame(mfxFrameSurface1* surface_in,
+                              const std::vector<mfxFrameSurface1*>& outputs) {
     if (surface_in) {
+        // input may still be written by a decode task
+        m_session->GetScheduler()->WaitSurface(surface_in);
+
         AVFrame* av_frame =
             m_input_locker.GetAVFrame(surface_in, MFX_MAP_READ, m_session->GetFrameAllocator());
         RET_IF_FALSE(av_frame, MFX_ERR_ABORTED);
 
-        int ret =
-            av_buffersrc_add_frame_flags(m_buffersrc_ctx, av_frame, AV_BUFFERSRC_FLAG_KEEP_REF);
+        int ret;
+        if (av_frame->buf[0]) {
+            ret = VPL_TRACE_CALL("av_buffersrc_add_frame_flags",
+                                 av_buffersrc_add_frame_flags(m_buffersrc_ctx,
+                                                              av_frame,
+                                                              AV_BUFFERSRC_FLAG_KEEP_REF));
+        }
+        else {
+            // buffersrc would copy a frame it cannot reference itself,
+            //   hand it a refcounted copy instead
+            AVFrame* staged = CopyAVFrame(av_frame);
+            if (!staged) {
+                m_input_locker.Unlock();
+                return MFX_ERR_MEMORY_ALLOC;
+            }
+            ret = VPL_TRACE_CALL("av_buffersrc_add_frame_flags",
+                                 av_buffersrc_add_frame_flags(m_buffersrc_ctx, staged, 0));
+            av_frame_free(&staged);
+        }
         m_input_locker.Unlock();
         RET_IF_FALSE(ret >= 0, MFX_ERR_ABORTED);
+        m_stats.AddFrameIn();
     }
 
-    // av_buffersink_get_frame
-    int ret = av_buffersink_get_frame(m_buffersink_ctx, dst_avframe);
-    if (ret == AVERROR(EAGAIN) || ret == AVERROR_EOF) {
-        return MFX_ERR_MORE_DATA;
+    RET_ERROR(ReceiveFrame(m_buffersink_ctx, outputs[0]));
+
+    // split hands the frame to every branch, so the others have one too
+    for (size_t i = 0; i < m_output_sinks.size(); i++) {
+        mfxFrameSurface1* surface = (i + 1 < outputs.size()) ? outputs[i + 1] : nullptr;
+        RET_ERROR(ReceiveFrame(m_output_sinks[i], surface));
     }
-    RET_IF_FALSE(ret >= 0, MFX_ERR_ABORTED);
 
-    if (dst_avframe == m_avVppFrameOut) { // copy image data
-        RET_ERROR(
-            AVFrame2mfxFrameSurface(surface_out, m_avVppFrameOut, m_session->GetFrameAllocator()));
-        av_frame_unref(m_avVppFrameOut);
+    if (surface_in && surface_in->Data.TimeStamp) {
+        for (mfxFrameSurface1* surface : outputs) {
+            if (!surface)
+                continue;
+            surface->Data.TimeStamp = surface_in->Data.TimeStamp;
+            surface->Data.DataFlag  = MFX_FRAMEDATA_ORIGINAL_TIMESTAMP;
+        }
     }
-    else if (dst_frame) { // update MFXFrameSurface from AVFrame
-        dst_frame->Update();
+    m_stats.AddFrameOut();
+    return MFX_ERR_NONE;
+}
+
+mfxStatus CpuVPP::FilterAVFrame(AVFrame* in, std::vector<AVFrame*>* out) {
+    CpuStats::Timer timer;
+
+    // the pipeline carries a single stream
+    RET_IF_FALSE(m_output_sinks.empty(), MFX_ERR_UNSUPPORTED);
+
+    if (in) {
+        // buffersrc is configured for vpp.In and does not rescale
+        RET_IF_FALSE(static_cast<mfxU32>(in->width) == m_vppWidth &&
+                         static_cast<mfxU32>(in->height) == m_vppHeight,
+                     MFX_ERR_INCOMPATIBLE_VIDEO_PARAM);
+
+        // planar decoder output for a semi-planar vpp.In
+        AVFrame* staged      = nullptr;
+        AVPixelFormat in_fmt = MFXFourCC2AVPixelFormat(m_vppInFormat);
+        if (in->format != in_fmt) {
+            staged = ConvertAVFrame(in, in_fmt);
+            RET_IF_FALSE(staged, MFX_ERR_INCOMPATIBLE_VIDEO_PARAM);
+        }
+
+        int ret = VPL_TRACE_CALL("av_buffersrc_add_frame_flags",
+                                 av_buffersrc_add_frame_flags(m_buffersrc_ctx,
+                                                              staged ? staged : in,
+                                                              AV_BUFFERSRC_FLAG_KEEP_REF));
+        av_frame_free(&staged);
+        RET_IF_FALSE(ret >= 0, MFX_ERR_ABORTED);
+        m_stats.AddFrameIn();
     }
 
-    if (surface_in) {
-        if (surface_in->Data.TimeStamp) {
-            surface_out->Data.TimeStamp = surface_in->Data.TimeStamp;
-            surface_out->Data.DataFlag  = MFX_FRAMEDATA_ORIGINAL_TIMESTAMP;
+    for (;;) {
+        AVFrame* frame = av_frame_alloc();
+        RET_IF_FALSE(frame, MFX_ERR_MEMORY_ALLOC);
+
+        int ret = VPL_TRACE_CALL("av_buffersink_get_frame",
+                                 av_buffersink_get_frame(m_buffersink_ctx, frame));
+        if (ret < 0) {
+            av_frame_free(&frame);
+            RET_IF_FALSE(ret == AVERROR(EAGAIN) || ret == AVERROR_EOF, MFX_ERR_ABORTED);
+            break;
         }
+        m_stats.AddFrameOut();
+        out->push_back(frame);
     }
+
+    m_stats.AddTime(timer);
+    return MFX_ERR_NONE;
+}
+
+// surface_out followed by the surfaces from its mfxExtCpuVPPOutSurfaces,
+//   one per extra output, 0 where there is none
+mfxStatus CpuVPP::GetOutputSurfaces(mfxFrameSurface1* surface_out,
+                                    std::vector<mfxFrameSurface1*>* outputs) {
+    outputs->assign(1 + m_outputs.size(), nullptr);
+    (*outputs)[0] = surface_out;
+    if (m_outputs.empty() || !surface_out->Data.ExtParam)
+        return MFX_ERR_NONE;
+
+    for (mfxU16 i = 0; i < surface_out->Data.NumExtParam; i++) {
+        mfxExtBuffer* ext = surface_out->Data.ExtParam[i];
+        if (!ext || ext->BufferId != MFX_EXTBUFF_CPU_VPP_OUT_SURFACES)
+            continue;
+        RET_IF_FALSE(ext->BufferSz >= sizeof(mfxExtCpuVPPOutSurfaces), MFX_ERR_UNDEFINED_BEHAVIOR);
+
+        mfxExtCpuVPPOutSurfaces* surfaces = reinterpret_cast<mfxExtCpuVPPOutSurfaces*>(ext);
+        RET_IF_FALSE(surfaces->Surfaces || !surfaces->NumSurface, MFX_ERR_NULL_PTR);
+
+        size_t count = std::min<size_t>(surfaces->NumSurface, m_outputs.size());
+        for (size_t j = 0; j < count; j++) {
+            // each output is written by this task only
+            RET_IF_FALSE(surfaces->Surfaces[j] != surface_out, MFX_ERR_UNDEFINED_BEHAVIOR);
+            (*outputs)[j + 1] = surfaces->Surfaces[j];
+        }
+        break;
+    }
+    return MFX_ERR_NONE;
+}
+
+// syncp == 0 runs synchronously (internal use)
+mfxStatus CpuVPP::ProcessFrame(mfxFrameSurface1* surface_in,
+                               mfxFrameSurface1* surface_out,
+                               mfxExtVppAuxData* aux,
+                               mfxSyncPoint* syncp) {
+    CpuScheduler* scheduler = m_session->GetScheduler();
+
+    std::vector<mfxFrameSurface1*> outputs;
+    RET_ERROR(GetOutputSurfaces(surface_out, &outputs));
+    // surfaces written by this call, without the dropped outputs
+    std::vector<mfxFrameSurface1*> written;
+    std::copy_if(outputs.begin(),
+                 outputs.end(),
+                 std::back_inserter(written),
+                 [](mfxFrameSurface1* surface) {
+                     return surface != nullptr;
+                 });
+
+    if (!surface_in || !syncp) {
+        // draining must report MFX_ERR_MORE_DATA immediately, so let
+        //   queued frames finish and run the graph here
+        scheduler->Drain(VPL_TASK_LANE_VPP);
+        CpuStats::Timer timer;
+        mfxStatus sts = FilterFrame(surface_in, outputs);
+        m_stats.AddTime(timer);
+        RET_ERROR(sts);
+        if (syncp) {
+            RET_ERROR(scheduler->Submit(
+                VPL_TASK_LANE_VPP,
+                []() {
+                    return MFX_ERR_NONE;
+                },
+                syncp));
+            for (mfxFrameSurface1* surface : written) {
+                CpuFrame* dst_frame = CpuFrame::TryCast(surface);
+                if (dst_frame)
+                    dst_frame->SetSyncPoint(scheduler, *syncp);
+            }
+        }
+        return MFX_ERR_NONE;
+    }
+
+    // filter graph is 1:1, so one input always produces one output
+    // timestamp is set now, image data and frame info once syncp is synced
+    if (surface_in->Data.TimeStamp) {
+        for (mfxFrameSurface1* surface : written) {
+            surface->Data.TimeStamp = surface_in->Data.TimeStamp;
+            surface->Data.DataFlag  = MFX_FRAMEDATA_ORIGINAL_TIMESTAMP;
+        }
+    }
+
+    RET_ERROR(FrameLock::AddRefSurface(surface_in));
+    for (size_t i = 0; i < written.size(); i++) {
+        mfxStatus sts = FrameLock::AddRefSurface(written[i]);
+        if (sts != MFX_ERR_NONE) {
+            FrameLock::ReleaseSurface(surface_in);
+            for (size_t j = 0; j < i; j++)
+                FrameLock::ReleaseSurface(written[j]);
+            return sts;
+        }
+    }
+
+    mfxStatus sts = scheduler->Submit(
+        VPL_TASK_LANE_VPP,
+        [this, surface_in, outputs, written]() {
+            CpuStats::Timer timer;
+            mfxStatus sts = FilterFrame(surface_in, outputs);
+            m_stats.AddTime(timer);
+            FrameLock::ReleaseSurface(surface_in);
+            for (mfxFrameSurface1* surface : written)
+                FrameLock::ReleaseSurface(surface);
+            return sts;
+        },
+        syncp,
+        written);
+    if (sts < MFX_ERR_NONE) {
+        // the task was not queued, so its references are dropped here
+        FrameLock::ReleaseSurface(surface_in);
+        for (mfxFrameSurface1* surface : written)
+            FrameLock::ReleaseSurface(surface);
+        return sts;
+    }
+    for (mfxFrameSurface1* surface : written) {
+        CpuFrame* dst_frame = CpuFrame::TryCast(surface);
+        if (dst_frame)
+            dst_frame->SetSyncPoint(scheduler, *syncp);
+    }
+
     return MFX_ERR_NONE;
 }
 
@@ -568,22 +930,44 @@ mfxStatus CpuVPP::VPPQuery(mfxVideoParam* in, mfxVideoParam* out) {
     return sts;
 }
 
+// number of outputs per input, 1 + the extra outputs of
+//   mfxExtCpuVPPOutputs when it is valid
+static mfxU16 GetNumOutputs(mfxVideoParam* par) {
+    for (mfxU16 i = 0; par->ExtParam && i < par->NumExtParam; i++) {
+        mfxExtBuffer* ext = par->ExtParam[i];
+        if (!ext || ext->BufferId != MFX_EXTBUFF_CPU_VPP_OUTPUTS ||
+            ext->BufferSz < sizeof(mfxExtCpuVPPOutputs))
+            continue;
+        mfxU16 numOutput = reinterpret_cast<mfxExtCpuVPPOutputs*>(ext)->NumOutput;
+        if (numOutput <= VPL_VPP_MAX_OUTPUTS)
+            return static_cast<mfxU16>(1 + numOutput);
+    }
+    return 1;
+}
+
 mfxStatus CpuVPP::VPPQueryIOSurf(mfxVideoParam* par, mfxFrameAllocRequest request[2]) {
     mfxStatus sts;
 
+    // each frame in flight holds one input and one output surface
     // VPP_IN
     request[VPP_IN].NumFrameMin       = 1;
-    request[VPP_IN].NumFrameSuggested = 1;
+    request[VPP_IN].NumFrameSuggested = GetAsyncDepth(par);
 
     //VPP_OUT
     request[VPP_OUT].NumFrameMin       = 1;
-    request[VPP_OUT].NumFrameSuggested = 1;
+    request[VPP_OUT].NumFrameSuggested = GetAsyncDepth(par);
 
     // may be null for internal use
     if (par) {
         request[VPP_IN].Info  = par->vpp.In;
         request[VPP_OUT].Info = par->vpp.Out;
 
+        // extra outputs are no larger than vpp.Out and each frame in
+        //   flight writes one of every output
+        mfxU16 numOutputs = GetNumOutputs(par);
+        request[VPP_OUT].NumFrameMin       = numOutputs;
+        request[VPP_OUT].NumFrameSuggested = GetAsyncDepth(par) * numOutputs;
+
         sts = CheckIOPattern_AndSetIOMemTypes(par->IOPattern,
                                               &request[VPP_IN].Type,
                                               &request[VPP_OUT].Type);
@@ -626,6 +1010,8 @@ mfxStatus CpuVPP::CheckFrameInfo(mfxFrameInfo* info) {
         case MFX_FOURCC_BGRA:
         case MFX_FOURCC_I420:
         case MFX_FOURCC_I010:
+        case MFX_FOURCC_NV12:
+        case MFX_FOURCC_P010:
             break;
         default:
             return MFX_ERR_INVALID_VIDEO_PARAM;
@@ -657,15 +1043,42 @@ mfxStatus CpuVPP::CheckFrameInfo(mfxFrameInfo* info) {
 }
 
 mfxStatus CpuVPP::GetVideoParam(mfxVideoParam* par) {
-    *par = m_param;
+    // ext buffers are the caller's
+    mfxExtBuffer** extParam = par->ExtParam;
+    mfxU16 numExtParam      = par->NumExtParam;
+
+    *par             = m_param;
+    par->ExtParam    = extParam;
+    par->NumExtParam = numExtParam;
+    m_stats.FillExtBuffer(par);
+
+    // NumOutput is set to the number of extra outputs, Output (if set)
+    //   receives as many as it has room for
+    for (mfxU16 i = 0; extParam && i < numExtParam; i++) {
+        if (!extParam[i] || extParam[i]->BufferId != MFX_EXTBUFF_CPU_VPP_OUTPUTS ||
+            extParam[i]->BufferSz < sizeof(mfxExtCpuVPPOutputs))
+            continue;
+        mfxExtCpuVPPOutputs* ext = reinterpret_cast<mfxExtCpuVPPOutputs*>(extParam[i]);
+        if (ext->Output) {
+            size_t count = std::min<size_t>(ext->NumOutput, m_outputs.size());
+            std::copy(m_outputs.begin(), m_outputs.begin() + count, ext->Output);
+        }
+        ext->NumOutput = static_cast<mfxU16>(m_outputs.size());
+    }
+
+    return MFX_ERR_NONE;
+}
 
+mfxStatus CpuVPP::GetVPPStat(mfxVPPStat* stat) {
+    stat->NumFrame       = static_cast<mfxU32>(m_stats.GetFramesOut());
+    stat->NumCachedFrame = m_stats.GetCachedFrames();
     return MFX_ERR_NONE;
 }
 
 mfxStatus CpuVPP::GetVPPSurface(mfxFrameSurface1** surface) {
     if (!m_vppSurfaces) {
         mfxFrameAllocRequest VPPRequest[2] = { 0 };
-        VPPQueryIOSurf(nullptr, VPPRequest);
+        VPPQueryIOSurf(&m_param, VPPRequest);
 
         auto pool = std::make_unique<CpuFramePool>();
         RET_ERROR(
@@ -677,7 +1090,7 @@ mfxStatus CpuVPP::GetVPPSurface(mfxFrameSurface1** surface) {
     if (sts != MFX_ERR_NONE) {
         return sts;
     }
-    if (surface == nullptr) {
+    if (*surface == nullptr) {
         return MFX_ERR_NOT_ENOUGH_BUFFER;
     }
     (*surface)->Data.MemType |=
@@ -11,6 +11,7 @@
 #include <vector>
 #include "src/cpu_common.h"
 #include "src/cpu_frame_pool.h"
+#include "src/cpu_stats.h"
 #include "src/frame_lock.h"
 
 typedef enum {
@@ -64,16 +65,29 @@ public:
     mfxStatus InitVPP(mfxVideoParam* par);
     mfxStatus ProcessFrame(mfxFrameSurface1* surface_in,
                            mfxFrameSurface1* surface_out,
-                           mfxExtVppAuxData* aux);
+                           mfxExtVppAuxData* aux,
+                           mfxSyncPoint* syncp);
+    // runs the filter graph on a decoded picture, outputs are appended to
+    //   out as new frames (used by the transcode pipeline)
+    // in == 0 collects what is left in the graph
+    mfxStatus FilterAVFrame(AVFrame* in, std::vector<AVFrame*>* out);
     mfxStatus GetVideoParam(mfxVideoParam* par);
     mfxStatus GetVPPSurface(mfxFrameSurface1** surface);
+    mfxStatus GetVPPStat(mfxVPPStat* stat);
     mfxStatus IsSameVideoParam(mfxVideoParam* newPar, mfxVideoParam* oldPar);
+    // outputs from mfxExtCpuVPPOutputs besides vpp.Out
+    bool HasExtraOutputs() {
+        return !m_outputs.empty();
+    }
 
 private:
     char m_vpp_filter_desc[1024];
     AVFilterGraph* m_vpp_graph;
     AVFilterContext* m_buffersrc_ctx;
     AVFilterContext* m_buffersink_ctx;
+    // extra outputs from mfxExtCpuVPPOutputs, with one buffersink each
+    std::vector<mfxFrameInfo> m_outputs;
+    std::vector<AVFilterContext*> m_output_sinks;
     FrameLock m_input_locker;
     AVFrame* m_avVppFrameOut;
 
@@ -84,8 +98,17 @@ private:
     mfxU32 m_vppFunc;
     mfxVideoParam m_param;
     std::unique_ptr<CpuFramePool> m_vppSurfaces;
+    // updated on the VPP lane
+    CpuStats m_stats;
 
     bool InitFilters(void);
+    bool InitOutputs(AVFilterInOut* sink_in);
+    mfxStatus InitOutputParams(mfxVideoParam* par);
+    mfxStatus GetOutputSurfaces(mfxFrameSurface1* surface_out,
+                                std::vector<mfxFrameSurface1*>* outputs);
+    mfxStatus FilterFrame(mfxFrameSurface1* surface_in,
+                          const std::vector<mfxFrameSurface1*>& outputs);
+    mfxStatus ReceiveFrame(AVFilterContext* sink, mfxFrameSurface1* surface);
     void CloseFilterPads(AVFilterInOut* src_out, AVFilterInOut* sink_in);
     static mfxStatus CheckIOPattern_AndSetIOMemTypes(mfxU16 IOPattern,
                                                      mfxU16* pInMemType,
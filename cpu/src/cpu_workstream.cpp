@@ -7,12 +7,15 @@
 #include "src/cpu_workstream.h"
 #include "src/cpu_common.h"
 
-CpuWorkstream::CpuWorkstream() : m_allocator({}) {
+CpuWorkstream::CpuWorkstream() : m_scheduler(), m_allocator({}) {
     av_log_set_level(AV_LOG_QUIET);
 }
 
-CpuWorkstream::~CpuWorkstream() {}
+CpuWorkstream::~CpuWorkstream() {
+    // finish pending tasks before the components they use are destroyed
+    m_scheduler.DrainAll();
+}
 
 mfxStatus CpuWorkstream::Sync(mfxSyncPoint &syncp, mfxU32 wait) {
-    return MFX_ERR_NONE;
+    return m_scheduler.Sync(syncp, wait);
 }
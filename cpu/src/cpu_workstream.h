@@ -9,11 +9,15 @@
 
 #include <map>
 #include <memory>
+#include "src/cpu_chunk.h"
 #include "src/cpu_common.h"
 #include "src/cpu_decode.h"
 #include "src/cpu_encode.h"
 #include "src/cpu_frame.h"
 #include "src/cpu_frame_pool.h"
+#include "src/cpu_ladder.h"
+#include "src/cpu_pipeline.h"
+#include "src/cpu_scheduler.h"
 #include "src/cpu_vpp.h"
 
 class CpuWorkstream {
@@ -21,16 +25,32 @@ public:
     CpuWorkstream();
     ~CpuWorkstream();
 
+    // outstanding tasks may still reference the component being replaced
     void SetDecoder(CpuDecode* decode) {
+        m_scheduler.Drain(VPL_TASK_LANE_DECODE);
         m_decode.reset(decode);
     }
     void SetEncoder(CpuEncode* encode) {
+        m_scheduler.Drain(VPL_TASK_LANE_ENCODE);
         m_encode.reset(encode);
     }
     void SetVPP(CpuVPP* vpp) {
+        m_scheduler.Drain(VPL_TASK_LANE_VPP);
         m_vpp.reset(vpp);
     }
 
+    // replaced pipeline finishes its frames in flight first
+    void SetPipeline(CpuPipeline* pipeline) {
+        m_pipeline.reset(pipeline);
+    }
+    void SetLadder(CpuEncodeLadder* ladder) {
+        m_ladder.reset(ladder);
+    }
+    // chunks being encoded are waited for
+    void SetChunks(CpuEncodeChunks* chunks) {
+        m_chunks.reset(chunks);
+    }
+
     CpuDecode* GetDecoder() {
         return m_decode.get();
     }
@@ -40,6 +60,19 @@ public:
     CpuVPP* GetVPP() {
         return m_vpp.get();
     }
+    CpuPipeline* GetPipeline() {
+        return m_pipeline.get();
+    }
+    CpuEncodeLadder* GetLadder() {
+        return m_ladder.get();
+    }
+    CpuEncodeChunks* GetChunks() {
+        return m_chunks.get();
+    }
+
+    CpuScheduler* GetScheduler() {
+        return &m_scheduler;
+    }
 
     mfxStatus Sync(mfxSyncPoint& syncp, mfxU32 wait);
 
@@ -67,9 +100,16 @@ public:
     }
 
 private:
+    // declared first so it is destroyed last, after the components
+    CpuScheduler m_scheduler;
+
     std::unique_ptr<CpuDecode> m_decode;
     std::unique_ptr<CpuEncode> m_encode;
     std::unique_ptr<CpuVPP> m_vpp;
+    // destroyed before the components its tasks use
+    std::unique_ptr<CpuPipeline> m_pipeline;
+    std::unique_ptr<CpuEncodeLadder> m_ladder;
+    std::unique_ptr<CpuEncodeChunks> m_chunks;
 
     mfxFrameAllocator m_allocator;
     std::map<mfxHandleType, mfxHDL> m_handles;
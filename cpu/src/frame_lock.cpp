@@ -5,6 +5,9 @@
   ############################################################################*/
 
 #include "src/frame_lock.h"
+#include <climits>
+#include <cstring>
+#include <utility>
 #include "src/cpu_frame.h"
 
 FrameLock::FrameLock()
@@ -12,14 +15,15 @@ FrameLock::FrameLock()
           m_surface(nullptr),
           m_allocator(nullptr),
           m_newapi(false),
-          m_avframe(nullptr),
-          mem_id(0) {}
+          mem_id(0),
+          m_cache(),
+          m_active(nullptr),
+          m_transient() {}
 
 FrameLock::~FrameLock() {
     Unlock();
-    if (m_avframe) {
-        av_frame_free(&m_avframe);
-    }
+    for (std::unique_ptr<CachedFrame> &entry : m_cache)
+        FreeCachedFrame(entry.get());
 }
 
 mfxStatus FrameLock::Lock(mfxFrameSurface1 *surface, mfxU32 flags, mfxFrameAllocator *allocator) {
@@ -39,7 +43,7 @@ mfxStatus FrameLock::Lock(mfxFrameSurface1 *surface, mfxU32 flags, mfxFrameAlloc
             surface->FrameInterface->AddRef(surface);
         }
         else {
-            surface->Data.Locked++; // TODO(make atomic)
+            AddLocked(&surface->Data, 1);
         }
         m_data = &surface->Data;
     }
@@ -49,6 +53,15 @@ mfxStatus FrameLock::Lock(mfxFrameSurface1 *surface, mfxU32 flags, mfxFrameAlloc
 
 void FrameLock::Unlock() {
     VPL_TRACE_FUNC;
+    // consumers which still reference the frame hold their own reference
+    if (m_active) {
+        av_buffer_unref(&m_active->frame->buf[0]);
+        m_active = nullptr;
+    }
+    if (m_transient) {
+        FreeCachedFrame(m_transient.get());
+        m_transient.reset();
+    }
     if (m_data) {
         if (m_allocator && m_allocator->pthis) {
             m_allocator->Unlock(m_allocator->pthis, mem_id, m_data);
@@ -59,13 +72,35 @@ void FrameLock::Unlock() {
                 m_surface->FrameInterface->Release(m_surface);
             }
             else {
-                m_surface->Data.Locked--; // TODO(make atomic)
+                AddLocked(&m_surface->Data, -1);
             }
         }
         m_data = nullptr;
     }
 }
 
+mfxStatus FrameLock::AddRefSurface(mfxFrameSurface1 *surface) {
+    RET_IF_FALSE(surface, MFX_ERR_NULL_PTR);
+    if (surface->Version.Version >= MFX_FRAMESURFACE1_VERSION && surface->FrameInterface) {
+        RET_ERROR(surface->FrameInterface->AddRef(surface));
+    }
+    else {
+        AddLocked(&surface->Data, 1);
+    }
+    return MFX_ERR_NONE;
+}
+
+void FrameLock::ReleaseSurface(mfxFrameSurface1 *surface) {
+    if (!surface)
+        return;
+    if (surface->Version.Version >= MFX_FRAMESURFACE1_VERSION && surface->FrameInterface) {
+        surface->FrameInterface->Release(surface);
+    }
+    else {
+        AddLocked(&surface->Data, -1);
+    }
+}
+
 mfxFrameData *FrameLock::GetData() {
     return m_data;
 }
@@ -84,6 +119,10 @@ AVFrame *FrameLock::GetAVFrame(mfxFrameSurface1 *surface,
             if (surface->Info.FourCC == MFX_FOURCC_RGB4) {
                 avframe->data[0] = surface->Data.B;
             }
+            else if (IsSemiPlanarFourCC(surface->Info.FourCC)) {
+                avframe->data[0] = surface->Data.Y;
+                avframe->data[1] = surface->Data.UV;
+            }
             else {
                 avframe->data[0] = surface->Data.Y;
                 avframe->data[1] = surface->Data.U;
@@ -94,43 +133,218 @@ AVFrame *FrameLock::GetAVFrame(mfxFrameSurface1 *surface,
         }
     }
 
-    // Lock and convert to AVFrame
-    RET_IF_FALSE(Lock(surface, flags, allocator) >= 0, nullptr);
+    CachedFrame *entry = GetCachedFrame(surface, flags, allocator);
+    RET_IF_FALSE(entry, nullptr);
+    AVFrame *frame = entry->frame;
+
+    // the buffer references the surface memory of every plane instead of
+    //   copying it, consumers keeping the frame keep the surface locked
+    uint8_t *base = nullptr;
+    int size      = 0;
+    RET_IF_FALSE(GetFrameSpan(frame, &base, &size), nullptr);
+    RET_IF_FALSE(AddRefSurface(surface) == MFX_ERR_NONE, nullptr);
+
+    SurfaceReference *ref = new SurfaceReference();
+    ref->surface          = surface;
+    ref->uses             = entry->uses;
+    ref->transient        = m_transient.get();
+    frame->buf[0] =
+        av_buffer_create(base, size, FreeSurfaceReference, ref, AV_BUFFER_FLAG_READONLY);
+    if (!frame->buf[0]) {
+        delete ref;
+        ReleaseSurface(surface);
+        return nullptr;
+    }
+    entry->uses->fetch_add(1);
+    m_transient.release();
+    frame->pts = AV_NOPTS_VALUE;
+    m_active   = entry;
+
+    return frame;
+}
+
+// entry for surface with its frame up to date, locks the surface unless
+//   it is already mapped
+FrameLock::CachedFrame *FrameLock::GetCachedFrame(mfxFrameSurface1 *surface,
+                                                  mfxU32 flags,
+                                                  mfxFrameAllocator *allocator) {
+    Unlock();
+
+    CachedFrame *entry = nullptr;
+    bool refill        = false;
+    if (allocator && allocator->pthis) {
+        // MemId and allocator identify the memory, not the surface
+        for (std::unique_ptr<CachedFrame> &cached : m_cache) {
+            if (cached->mapped && cached->mem_id == surface->Data.MemId &&
+                cached->allocator.pthis == allocator->pthis) {
+                entry = cached.get();
+                break;
+            }
+        }
+        if (!entry) {
+            entry = AddCachedFrame();
+            RET_IF_FALSE(entry, nullptr);
+            if (allocator->Lock(allocator->pthis, surface->Data.MemId, &entry->data) !=
+                MFX_ERR_NONE) {
+                RemoveCachedFrame(entry);
+                return nullptr;
+            }
+            entry->mapped    = true;
+            entry->allocator = *allocator;
+            entry->mem_id    = surface->Data.MemId;
+            refill           = true;
+        }
+    }
+    else {
+        RET_IF_FALSE(Lock(surface, flags, allocator) == MFX_ERR_NONE, nullptr);
+        for (std::unique_ptr<CachedFrame> &cached : m_cache) {
+            if (!cached->mapped && cached->surface == surface) {
+                entry = cached.get();
+                break;
+            }
+        }
+        if (!entry) {
+            entry = AddCachedFrame();
+            if (!entry) {
+                Unlock();
+                return nullptr;
+            }
+        }
+        // the application may point the surface at other memory
+        entry->data = *m_data;
+        refill      = true;
+    }
+
+    entry->surface = surface;
+    if (refill || memcmp(&entry->info, &surface->Info, sizeof(mfxFrameInfo))) {
+        entry->info = surface->Info;
+        if (!FillAVFrame(entry->frame, entry->info, entry->data)) {
+            Unlock();
+            return nullptr;
+        }
+    }
+    return entry;
+}
+
+// new entry at the end of the cache, evicts one when the cache is full
+// mapped memory stays in use while a consumer references it, when every
+//   entry is mapped and in use a transient entry is returned instead
+FrameLock::CachedFrame *FrameLock::AddCachedFrame() {
+    std::unique_ptr<CachedFrame> entry(new CachedFrame());
+    entry->frame = av_frame_alloc();
+    RET_IF_FALSE(entry->frame, nullptr);
+    entry->uses = std::make_shared<std::atomic<int>>(0);
 
-    if (!m_avframe) {
-        m_avframe = av_frame_alloc();
+    if (m_cache.size() >= VPL_FRAME_LOCK_CACHE_SIZE) {
+        auto victim = m_cache.begin();
+        while (victim != m_cache.end() && (*victim)->mapped && (*victim)->uses->load() > 0)
+            victim++;
+        if (victim == m_cache.end()) {
+            m_transient = std::move(entry);
+            return m_transient.get();
+        }
+        FreeCachedFrame(victim->get());
+        m_cache.erase(victim);
     }
-    RET_IF_FALSE(m_avframe, nullptr);
 
-    mfxFrameInfo *info = &m_surface->Info;
-    m_avframe->format  = MFXFourCC2AVPixelFormat(info->FourCC);
-    m_avframe->width   = info->Width;
-    m_avframe->height  = info->Height;
-    if (info->FourCC == MFX_FOURCC_RGB4) {
-        m_avframe->data[0] = m_data->B;
+    m_cache.push_back(std::move(entry));
+    return m_cache.back().get();
+}
+
+// drop an entry returned by AddCachedFrame() which was not filled
+void FrameLock::RemoveCachedFrame(CachedFrame *entry) {
+    FreeCachedFrame(entry);
+    if (entry == m_transient.get())
+        m_transient.reset();
+    else
+        m_cache.pop_back();
+}
+
+void FrameLock::FreeCachedFrame(CachedFrame *entry) {
+    if (entry->mapped)
+        entry->allocator.Unlock(entry->allocator.pthis, entry->mem_id, &entry->data);
+    av_frame_free(&entry->frame);
+}
+
+bool FrameLock::FillAVFrame(AVFrame *frame, const mfxFrameInfo &info, const mfxFrameData &data) {
+    frame->format = MFXFourCC2AVPixelFormat(info.FourCC);
+    frame->width  = info.Width;
+    frame->height = info.Height;
+    if (info.FourCC == MFX_FOURCC_RGB4) {
+        frame->data[0] = data.B;
+    }
+    else if (IsSemiPlanarFourCC(info.FourCC)) {
+        // V only points into the interleaved plane
+        frame->data[0] = data.Y;
+        frame->data[1] = data.UV;
+        frame->data[2] = nullptr;
+        frame->data[3] = nullptr;
     }
     else {
-        m_avframe->data[0] = m_data->Y;
-        m_avframe->data[1] = m_data->U;
-        m_avframe->data[2] = m_data->V;
-        m_avframe->data[3] = m_data->A;
+        frame->data[0] = data.Y;
+        frame->data[1] = data.U;
+        frame->data[2] = data.V;
+        frame->data[3] = data.A;
     }
-    m_avframe->linesize[0] = m_data->Pitch;
-    switch (info->FourCC) {
+    frame->linesize[0] = data.Pitch;
+    switch (info.FourCC) {
         case MFX_FOURCC_I420:
         case MFX_FOURCC_I010:
-            m_avframe->linesize[1] = m_data->Pitch / 2;
-            m_avframe->linesize[2] = m_data->Pitch / 2;
+            frame->linesize[1] = data.Pitch / 2;
+            frame->linesize[2] = data.Pitch / 2;
             break;
         case MFX_FOURCC_NV12:
-            m_avframe->linesize[1] = m_data->Pitch;
+        case MFX_FOURCC_P010:
+            frame->linesize[1] = data.Pitch;
             break;
         case MFX_FOURCC_YUY2:
         case MFX_FOURCC_RGB4:
             break;
         default:
-            RET_IF_FALSE(!"Unsupported format", nullptr);
+            RET_IF_FALSE(!"Unsupported format", false);
     }
+    return frame->data[0] != nullptr;
+}
+
+// memory of all planes of frame, which may be in any order
+bool FrameLock::GetFrameSpan(const AVFrame *frame, uint8_t **base, int *size) {
+    AVPixelFormat format           = static_cast<AVPixelFormat>(frame->format);
+    const AVPixFmtDescriptor *desc = av_pix_fmt_desc_get(format);
+    RET_IF_FALSE(desc, false);
+
+    uint8_t *begin = nullptr;
+    uint8_t *end   = nullptr;
+    int planes     = av_pix_fmt_count_planes(format);
+    for (int i = 0; i < planes; i++) {
+        if (!frame->data[i])
+            continue;
+        int rows = frame->height;
+        if (i == 1 || i == 2)
+            rows = AV_CEIL_RSHIFT(frame->height, desc->log2_chroma_h);
+        // the last row may not be padded to the pitch
+        uint8_t *plane_end = frame->data[i] +
+                             static_cast<ptrdiff_t>(frame->linesize[i]) * (rows - 1) +
+                             av_image_get_linesize(format, frame->width, i);
+        if (!begin || frame->data[i] < begin)
+            begin = frame->data[i];
+        if (!end || plane_end > end)
+            end = plane_end;
+    }
+    RET_IF_FALSE(begin && end - begin <= INT_MAX, false);
 
-    return m_avframe;
+    *base = begin;
+    *size = static_cast<int>(end - begin);
+    return true;
+}
+
+// last reference on the surface memory is gone
+void FrameLock::FreeSurfaceReference(void *opaque, uint8_t *data) {
+    SurfaceReference *ref = reinterpret_cast<SurfaceReference *>(opaque);
+    if (ref->transient) {
+        FreeCachedFrame(ref->transient);
+        delete ref->transient;
+    }
+    ReleaseSurface(ref->surface);
+    ref->uses->fetch_sub(1);
+    delete ref;
 }
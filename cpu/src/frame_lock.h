@@ -7,6 +7,9 @@
 #ifndef CPU_SRC_FRAME_LOCK_H_
 #define CPU_SRC_FRAME_LOCK_H_
 
+#include <atomic>
+#include <memory>
+#include <vector>
 #include "src/cpu_common.h"
 
 class FrameLock {
@@ -20,18 +23,68 @@ public:
     void Unlock();
 
     mfxFrameData *GetData();
+    // frame is valid until Unlock(), its buffers do not copy the surface
+    //   and keep it locked while a consumer still references them
     AVFrame *GetAVFrame(mfxFrameSurface1 *surface,
                         mfxU32 flags                 = 0,
                         mfxFrameAllocator *allocator = nullptr);
 
+    // keep surface from being reused while a task still references it
+    static mfxStatus AddRefSurface(mfxFrameSurface1 *surface);
+    static void ReleaseSurface(mfxFrameSurface1 *surface);
+
 private:
+    // AVFrame built once per surface, or per MemId of an external allocator
+    struct CachedFrame {
+        mfxFrameSurface1 *surface;
+        // surfaces of an external allocator stay locked with it until the
+        //   entry is evicted, others are locked per use
+        bool mapped;
+        mfxFrameAllocator allocator;
+        mfxMemId mem_id;
+        mfxFrameData data;
+        mfxFrameInfo info;
+        AVFrame *frame;
+        // buffers of the entry consumers still reference, entries are
+        //   never evicted by looking at a surface which may be gone
+        std::shared_ptr<std::atomic<int>> uses;
+    };
+
+    // opaque of the buffers handed out by GetAVFrame()
+    struct SurfaceReference {
+        mfxFrameSurface1 *surface;
+        std::shared_ptr<std::atomic<int>> uses;
+        // uncached entry, freed with the last reference
+        CachedFrame *transient;
+    };
+
+    CachedFrame *GetCachedFrame(mfxFrameSurface1 *surface,
+                                mfxU32 flags,
+                                mfxFrameAllocator *allocator);
+    CachedFrame *AddCachedFrame();
+    void RemoveCachedFrame(CachedFrame *entry);
+    static void FreeCachedFrame(CachedFrame *entry);
+    static bool FillAVFrame(AVFrame *frame, const mfxFrameInfo &info, const mfxFrameData &data);
+    static bool GetFrameSpan(const AVFrame *frame, uint8_t **base, int *size);
+    static void FreeSurfaceReference(void *opaque, uint8_t *data);
+
     mfxFrameSurface1 *m_surface;
     mfxFrameAllocator *m_allocator;
     bool m_newapi;
     mfxFrameData *m_data;
     mfxFrameData m_locked_data;
     mfxMemId mem_id;
-    AVFrame *m_avframe;
+
+    std::vector<std::unique_ptr<CachedFrame>> m_cache;
+    // entry returned by GetAVFrame() until Unlock()
+    CachedFrame *m_active;
+    // used instead of a cache entry when every mapped entry is still
+    //   referenced, until GetAVFrame() hands it to the buffer
+    std::unique_ptr<CachedFrame> m_transient;
+
+    /* copy not allowed */
+    FrameLock(const FrameLock &);
+    FrameLock &operator=(const FrameLock &);
 };
 
 #endif // CPU_SRC_FRAME_LOCK_H_
@@ -62,6 +62,8 @@ mfxStatus MFXInitEx(mfxInitParam par, mfxSession *session) {
             return MFX_ERR_UNSUPPORTED;
     }
 
+    CpuTrace::Init();
+
     // create CPU workstream
     CpuWorkstream *ws = new CpuWorkstream;
 
@@ -85,6 +87,9 @@ mfxStatus MFXClose(mfxSession session) {
     delete ws;
     ws = nullptr;
 
+    // lane and codec threads of the session have finished by now
+    CpuTrace::Dump();
+
     return MFX_ERR_NONE;
 }
 
@@ -50,8 +50,8 @@ mfxStatus MFXVideoCORE_QueryPlatform(mfxSession session, mfxPlatform *platform)
     return MFX_ERR_NOT_IMPLEMENTED;
 }
 
-// Sync operation is implemented as a simple passthrough
-// until asynchronous operation is added
+// wait for the task behind syncp, returns MFX_WRN_IN_EXECUTION
+//   if it is still running after "wait" ms
 mfxStatus MFXVideoCORE_SyncOperation(mfxSession session, mfxSyncPoint syncp, mfxU32 wait) {
     if (0 == session) {
         return MFX_ERR_INVALID_HANDLE;
@@ -131,16 +131,28 @@ mfxStatus MFXVideoDECODE_DecodeFrameAsync(mfxSession session,
         decoder = ws->GetDecoder();
     }
 
+    // output goes to the encoder, see src/cpu_pipeline.h
+    CpuPipeline *pipeline = ws->GetPipeline();
+    if (pipeline) {
+        *surface_out = nullptr;
+        *syncp       = nullptr;
+        return pipeline->PutBitstream(bs);
+    }
+
     bool bInternalMem = false;
     if (surface_work == 0) {
         // get a ref-counted surface for decoding into
         // behavior is equivalent to the application calling this and then
         //   passing the surface into DecodeFrameAsync()
-        RET_ERROR(MFXMemory_GetSurfaceForDecode(session, &surface_work));
+        // MFX_WRN_ALLOC_TIMEOUT_EXPIRED: pool is at its limit, no surface
+        RET_VAR_IF_NOT(MFXMemory_GetSurfaceForDecode(session, &surface_work), MFX_ERR_NONE);
         bInternalMem = true;
     }
 
-    mfxStatus sts = decoder->DecodeFrame(bs, surface_work, surface_out);
+    // set by the decoder only when a frame is output
+    *syncp = nullptr;
+
+    mfxStatus sts = decoder->DecodeFrame(bs, surface_work, surface_out, syncp);
 
     // application will not know to release surface (e.g. if we
     //   need more data) so need to release it here
@@ -148,8 +160,6 @@ mfxStatus MFXVideoDECODE_DecodeFrameAsync(mfxSession session,
         surface_work->FrameInterface->Release(surface_work);
     }
 
-    *syncp = (mfxSyncPoint)(0x12345678);
-
     return sts;
 }
 
@@ -183,15 +193,37 @@ mfxStatus MFXVideoDECODE_Reset(mfxSession session, mfxVideoParam *par) {
     return MFXVideoDECODE_Init(session, par);
 }
 
-// stubs
+// NOTES - NumError counts frames output with decode errors
+//   mfxExtCpuStat (src/cpu_stats.h) passed to GetVideoParam() has
+//   more counters
 mfxStatus MFXVideoDECODE_GetDecodeStat(mfxSession session, mfxDecodeStat *stat) {
     VPL_TRACE_FUNC;
-    return MFX_ERR_NOT_IMPLEMENTED;
+    RET_IF_FALSE(session, MFX_ERR_INVALID_HANDLE);
+    RET_IF_FALSE(stat, MFX_ERR_NULL_PTR);
+
+    CpuWorkstream *ws  = reinterpret_cast<CpuWorkstream *>(session);
+    CpuDecode *decoder = ws->GetDecoder();
+    RET_IF_FALSE(decoder, MFX_ERR_NOT_INITIALIZED);
+
+    return decoder->GetDecodeStat(stat);
 }
+
+// NOTES - each MFX_SKIPMODE_MORE step drops more work, in order:
+//   deblocking of non-reference frames, non-reference frames, all
+//   deblocking, B frames, everything but key frames
+// MFX_WRN_VALUE_NOT_CHANGED is returned at either end of the ladder
 mfxStatus MFXVideoDECODE_SetSkipMode(mfxSession session, mfxSkipMode mode) {
     VPL_TRACE_FUNC;
-    return MFX_ERR_NOT_IMPLEMENTED;
+    RET_IF_FALSE(session, MFX_ERR_INVALID_HANDLE);
+
+    CpuWorkstream *ws  = reinterpret_cast<CpuWorkstream *>(session);
+    CpuDecode *decoder = ws->GetDecoder();
+    RET_IF_FALSE(decoder, MFX_ERR_NOT_INITIALIZED);
+
+    return decoder->SetSkipMode(mode);
 }
+
+// stubs
 mfxStatus MFXVideoDECODE_GetPayload(mfxSession session, mfxU64 *ts, mfxPayload *payload) {
     VPL_TRACE_FUNC;
     return MFX_ERR_NOT_IMPLEMENTED;
@@ -32,6 +32,9 @@ mfxStatus MFXVideoENCODE_Init(mfxSession session, mfxVideoParam *par) {
 
     CpuWorkstream *ws = reinterpret_cast<CpuWorkstream *>(session);
     RET_IF_FALSE(ws->GetEncoder() == nullptr, MFX_ERR_UNDEFINED_BEHAVIOR);
+    // the pipeline feeds a single stream
+    if (CpuPipeline::IsEnabled(par) && ws->GetVPP() && ws->GetVPP()->HasExtraOutputs())
+        return MFX_ERR_INVALID_VIDEO_PARAM;
 
     std::unique_ptr<CpuEncode> encoder(new CpuEncode(ws));
     RET_IF_FALSE(encoder, MFX_ERR_MEMORY_ALLOC);
@@ -42,6 +45,33 @@ mfxStatus MFXVideoENCODE_Init(mfxSession session, mfxVideoParam *par) {
     else
         ws->SetEncoder(encoder.release());
 
+    // extra rungs are encoders of their own, see src/cpu_ladder.h
+    if (CpuEncodeLadder::IsEnabled(par)) {
+        std::unique_ptr<CpuEncodeLadder> ladder(new CpuEncodeLadder(ws));
+        mfxStatus ladderSts = ladder->InitLadder(par);
+        if (ladderSts < MFX_ERR_NONE) {
+            ladder.reset();
+            ws->SetEncoder(nullptr);
+            return ladderSts;
+        }
+        ws->SetLadder(ladder.release());
+    }
+
+    // chunks are encoded by encoders of their own, see src/cpu_chunk.h
+    if (CpuEncodeChunks::IsEnabled(par)) {
+        std::unique_ptr<CpuEncodeChunks> chunks(new CpuEncodeChunks(ws));
+        mfxStatus chunksSts = chunks->InitChunks(par);
+        if (chunksSts < MFX_ERR_NONE) {
+            chunks.reset();
+            ws->SetEncoder(nullptr);
+            return chunksSts;
+        }
+        ws->SetChunks(chunks.release());
+    }
+
+    if (CpuPipeline::IsEnabled(par))
+        ws->SetPipeline(new CpuPipeline(ws, par));
+
     return sts;
 }
 
@@ -51,8 +81,12 @@ mfxStatus MFXVideoENCODE_Close(mfxSession session) {
 
     CpuWorkstream *ws = reinterpret_cast<CpuWorkstream *>(session);
 
-    if (ws->GetEncoder() != nullptr)
+    if (ws->GetEncoder() != nullptr) {
+        ws->SetPipeline(nullptr);
+        ws->SetLadder(nullptr);
+        ws->SetChunks(nullptr);
         ws->SetEncoder(nullptr);
+    }
     else
         return MFX_ERR_NOT_INITIALIZED;
 
@@ -72,14 +106,39 @@ mfxStatus MFXVideoENCODE_EncodeFrameAsync(mfxSession session,
     CpuEncode *encoder = ws->GetEncoder();
     RET_IF_FALSE(encoder, MFX_ERR_NOT_INITIALIZED);
 
-    *syncp = (mfxSyncPoint)(0x12345678);
+    // set by the encoder only when a packet is output
+    *syncp = nullptr;
+
+    // input comes from the decoder, see src/cpu_pipeline.h
+    CpuPipeline *pipeline = ws->GetPipeline();
+    if (pipeline) {
+        RET_IF_FALSE(!surface, MFX_ERR_UNDEFINED_BEHAVIOR);
+        mfxStatus sts = pipeline->GetBitstream(bs, syncp);
+        RET_ERROR(sts);
+        return sts;
+    }
+
+    // every rung is encoded from surface, see src/cpu_ladder.h
+    CpuEncodeLadder *ladder = ws->GetLadder();
+    if (ladder) {
+        mfxStatus sts = ladder->EncodeFrame(ctrl, surface, bs, syncp);
+        RET_ERROR(sts);
+        return sts;
+    }
+
+    // input is collected into chunks, see src/cpu_chunk.h
+    CpuEncodeChunks *chunks = ws->GetChunks();
+    if (chunks) {
+        mfxStatus sts = chunks->EncodeFrame(ctrl, surface, bs, syncp);
+        RET_ERROR(sts);
+        return sts;
+    }
 
-    mfxStatus sts = encoder->EncodeFrame(surface, ctrl, bs);
+    mfxStatus sts = encoder->EncodeFrame(surface, ctrl, bs, syncp);
     RET_ERROR(sts);
     return sts;
 }
 
-// stubs
 mfxStatus MFXVideoENCODE_Reset(mfxSession session, mfxVideoParam *par) {
     VPL_TRACE_FUNC;
     RET_IF_FALSE(session, MFX_ERR_INVALID_HANDLE);
@@ -96,6 +155,17 @@ mfxStatus MFXVideoENCODE_Reset(mfxSession session, mfxVideoParam *par) {
     encoder->GetVideoParam(&oldParam);
     RET_ERROR(encoder->IsSameVideoParam(par, &oldParam));
 
+    // bitrate and QP changes go to the running encoder, which keeps its
+    //   references and frames in flight instead of restarting with an IDR
+    // the pipeline is reset first, its encode tasks use the encoder
+    CpuPipeline *pipeline = ws->GetPipeline();
+    if (pipeline)
+        pipeline->Reset();
+
+    mfxStatus sts = encoder->ReconfigureEncode(par);
+    if (sts != MFX_ERR_UNSUPPORTED)
+        return sts;
+
     RET_ERROR(MFXVideoENCODE_Close(session));
     return MFXVideoENCODE_Init(session, par);
 }
@@ -112,7 +182,16 @@ mfxStatus MFXVideoENCODE_GetVideoParam(mfxSession session, mfxVideoParam *par) {
     return encoder->GetVideoParam(par);
 }
 
+// NOTES - mfxExtCpuStat (src/cpu_stats.h) passed to GetVideoParam() has
+//   more counters
 mfxStatus MFXVideoENCODE_GetEncodeStat(mfxSession session, mfxEncodeStat *stat) {
     VPL_TRACE_FUNC;
-    return MFX_ERR_NOT_IMPLEMENTED;
+    RET_IF_FALSE(session, MFX_ERR_INVALID_HANDLE);
+    RET_IF_FALSE(stat, MFX_ERR_NULL_PTR);
+
+    CpuWorkstream *ws  = reinterpret_cast<CpuWorkstream *>(session);
+    CpuEncode *encoder = ws->GetEncoder();
+    RET_IF_FALSE(encoder, MFX_ERR_NOT_INITIALIZED);
+
+    return encoder->GetEncodeStat(stat);
 }
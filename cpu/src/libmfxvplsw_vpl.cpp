@@ -24,6 +24,8 @@ mfxStatus MFXInitialize(mfxInitializationParam par, mfxSession *session) {
     if (!session)
         return MFX_ERR_NULL_PTR;
 
+    CpuTrace::Init();
+
     // create CPU workstream
     CpuWorkstream *ws = new CpuWorkstream;
 
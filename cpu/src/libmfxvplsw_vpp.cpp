@@ -43,8 +43,12 @@ mfxStatus MFXVideoVPP_Init(mfxSession session, mfxVideoParam *par) {
 
     if (sts < MFX_ERR_NONE)
         return sts;
-    else
-        ws->SetVPP(vpp.release());
+
+    // the pipeline feeds a single stream
+    if (ws->GetPipeline() && vpp->HasExtraOutputs())
+        return MFX_ERR_INVALID_VIDEO_PARAM;
+
+    ws->SetVPP(vpp.release());
 
     return sts;
 }
@@ -84,9 +88,10 @@ mfxStatus MFXVideoVPP_RunFrameVPPAsync(mfxSession session,
     CpuVPP *vpp       = ws->GetVPP();
     RET_IF_FALSE(vpp, MFX_ERR_NOT_INITIALIZED);
 
-    *syncp = (mfxSyncPoint)(0x12345678);
+    // set by VPP only when a frame is output
+    *syncp = nullptr;
 
-    return vpp->ProcessFrame(in, out, aux);
+    return vpp->ProcessFrame(in, out, aux, syncp);
 }
 
 mfxStatus MFXVideoVPP_Reset(mfxSession session, mfxVideoParam *par) {
@@ -106,7 +111,16 @@ mfxStatus MFXVideoVPP_Reset(mfxSession session, mfxVideoParam *par) {
     return MFXVideoVPP_Init(session, par);
 }
 
+// NOTES - mfxExtCpuStat (src/cpu_stats.h) passed to GetVideoParam() has
+//   more counters
 mfxStatus MFXVideoVPP_GetVPPStat(mfxSession session, mfxVPPStat *stat) {
     VPL_TRACE_FUNC;
-    return MFX_ERR_NOT_IMPLEMENTED;
+    RET_IF_FALSE(session, MFX_ERR_INVALID_HANDLE);
+    RET_IF_FALSE(stat, MFX_ERR_NULL_PTR);
+
+    CpuWorkstream *ws = reinterpret_cast<CpuWorkstream *>(session);
+    CpuVPP *vpp       = ws->GetVPP();
+    RET_IF_FALSE(vpp, MFX_ERR_NOT_INITIALIZED);
+
+    return vpp->GetVPPStat(stat);
 }
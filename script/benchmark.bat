@@ -0,0 +1,41 @@
+::------------------------------------------------------------------------------
+:: Copyright (C) Intel Corporation
+::
+:: SPDX-License-Identifier: MIT
+::------------------------------------------------------------------------------
+:: start of boilerplate to switch to project root ------------------------------
+@echo off
+SETLOCAL
+FOR /D %%i IN ("%~dp0\..") DO (
+	set PROJ_DIR=%%~fi
+)
+cd %PROJ_DIR%
+:: start of commands -----------------------------------------------------------
+call "%PROJ_DIR%/test/tools/env/vars.bat"
+if defined VPL_BUILD_DEPENDENCIES (
+  set ffmpeg_dir=%VPL_BUILD_DEPENDENCIES%\bin
+) else (
+    echo VPL_BUILD_DEPENDENCIES not defined. Did you run bootstrap?
+    exit /b 1
+  )
+)
+set "PATH=%ffmpeg_dir%;%PATH%"
+
+if defined VPL_INSTALL_DIR (
+   if not defined VPL_ROOT (
+      call "%VPL_INSTALL_DIR%\env\vars.bat" || exit /b 1
+   )
+)
+
+
+cd _build\Release
+
+if not exist vpl-bench.exe (
+    echo vpl-bench not built. Is Google Benchmark installed?
+    exit /b 1
+)
+
+echo *** Running Benchmarks ***
+if not exist "%PROJ_DIR%\_logs" mkdir "%PROJ_DIR%\_logs"
+call vpl-bench.exe --benchmark_out=%PROJ_DIR%\_logs\vpl-bench.json --benchmark_out_format=json %*
+exit /B %errorlevel%
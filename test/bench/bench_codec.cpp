@@ -0,0 +1,187 @@
+/*############################################################################
+  # Copyright (C) 2020 Intel Corporation
+  #
+  # SPDX-License-Identifier: MIT
+  ############################################################################*/
+
+#include <string>
+#include <vector>
+#include "bench_common.h"
+
+#define BENCH_DECODE_SURFACES 16
+
+// one iteration decodes one frame, the clip is restarted when it runs out
+static void BM_Decode(benchmark::State &state, BenchCodec codec, BenchResolution res, int threads) {
+    const std::vector<mfxU8> &stream = GetSyntheticBitstream(codec.codecId, res.width, res.height);
+    if (stream.empty()) {
+        state.SkipWithError("encoder not available");
+        return;
+    }
+
+    mfxSession session = CreateBenchSession();
+    if (!session) {
+        state.SkipWithError("MFXInit failed");
+        return;
+    }
+
+    mfxBitstream bs = {};
+    auto rewind     = [&]() {
+        bs.Data       = const_cast<mfxU8 *>(stream.data());
+        bs.DataOffset = 0;
+        bs.DataLength = static_cast<mfxU32>(stream.size());
+        bs.MaxLength  = static_cast<mfxU32>(stream.size());
+        bs.DataFlag   = MFX_BITSTREAM_EOS;
+    };
+    rewind();
+
+    mfxVideoParam par  = {};
+    par.mfx.CodecId    = codec.codecId;
+    par.mfx.NumThread  = static_cast<mfxU16>(threads);
+    par.IOPattern      = MFX_IOPATTERN_OUT_SYSTEM_MEMORY;
+    mfxStatus sts      = MFXVideoDECODE_DecodeHeader(session, &bs, &par);
+    if (sts == MFX_ERR_NONE)
+        sts = MFXVideoDECODE_Init(session, &par);
+    if (sts != MFX_ERR_NONE) {
+        state.SkipWithError("decoder init failed");
+        MFXClose(session);
+        return;
+    }
+
+    // surfaces use the aligned size reported by the header
+    mfxU16 width       = par.mfx.FrameInfo.Width;
+    mfxU16 height      = par.mfx.FrameInfo.Height;
+    size_t surfaceSize = GetI420FrameSize(width, height);
+    std::vector<mfxU8> buffer(surfaceSize * BENCH_DECODE_SURFACES);
+    std::vector<mfxFrameSurface1> surfaces(BENCH_DECODE_SURFACES);
+    for (int i = 0; i < BENCH_DECODE_SURFACES; i++) {
+        SetI420Surface(&surfaces[i], width, height, buffer.data() + i * surfaceSize);
+        surfaces[i].Info = par.mfx.FrameInfo;
+    }
+
+    mfxBitstream *input = &bs;
+    for (auto _ : state) {
+        for (;;) {
+            mfxFrameSurface1 *work = nullptr;
+            for (auto &surface : surfaces) {
+                if (!surface.Data.Locked) {
+                    work = &surface;
+                    break;
+                }
+            }
+
+            mfxFrameSurface1 *out = nullptr;
+            mfxSyncPoint syncp;
+            sts = MFXVideoDECODE_DecodeFrameAsync(session, input, work, &out, &syncp);
+            if (sts == MFX_ERR_MORE_DATA && input) {
+                input = nullptr;
+                continue;
+            }
+            if (sts == MFX_ERR_MORE_DATA) {
+                state.PauseTiming();
+                MFXVideoDECODE_Close(session);
+                rewind();
+                sts   = MFXVideoDECODE_Init(session, &par);
+                input = &bs;
+                state.ResumeTiming();
+                if (sts != MFX_ERR_NONE)
+                    break;
+                continue;
+            }
+            if (sts == MFX_ERR_MORE_SURFACE || sts == MFX_WRN_DEVICE_BUSY)
+                continue;
+            if (sts >= MFX_ERR_NONE)
+                sts = MFXVideoCORE_SyncOperation(session, syncp, 60000);
+            break;
+        }
+        if (sts < MFX_ERR_NONE) {
+            state.SkipWithError("decode failed");
+            break;
+        }
+    }
+
+    state.SetItemsProcessed(state.iterations());
+    state.SetBytesProcessed(state.iterations() * GetI420FrameSize(res.width, res.height));
+    state.counters["threads"] = threads;
+
+    MFXVideoDECODE_Close(session);
+    MFXClose(session);
+}
+
+// one iteration submits one frame, frames still queued in the encoder at
+//   the end are not timed
+static void BM_Encode(benchmark::State &state, BenchCodec codec, BenchResolution res, int threads) {
+    mfxSession session = CreateBenchSession();
+    if (!session) {
+        state.SkipWithError("MFXInit failed");
+        return;
+    }
+
+    mfxVideoParam par;
+    SetEncodeParams(&par, codec.codecId, res.width, res.height, static_cast<mfxU16>(threads));
+    if (MFXVideoENCODE_Init(session, &par) != MFX_ERR_NONE) {
+        state.SkipWithError("encoder not available");
+        MFXClose(session);
+        return;
+    }
+
+    const std::vector<std::vector<mfxU8>> &frames = GetSyntheticFrames(res.width, res.height);
+    size_t frameSize = GetI420FrameSize(res.width, res.height);
+    std::vector<mfxU8> buffer(frameSize * 2);
+    int64_t bitstreamBytes = 0;
+    size_t index           = 0;
+
+    for (auto _ : state) {
+        mfxFrameSurface1 surface = {};
+        SetI420Surface(&surface,
+                       res.width,
+                       res.height,
+                       const_cast<mfxU8 *>(frames[index++ % frames.size()].data()));
+
+        mfxBitstream bs = {};
+        bs.Data         = buffer.data();
+        bs.MaxLength    = static_cast<mfxU32>(buffer.size());
+        mfxSyncPoint syncp;
+        mfxStatus sts = MFXVideoENCODE_EncodeFrameAsync(session, nullptr, &surface, &bs, &syncp);
+        if (sts == MFX_ERR_NONE)
+            sts = MFXVideoCORE_SyncOperation(session, syncp, 60000);
+        if (sts < MFX_ERR_NONE && sts != MFX_ERR_MORE_DATA) {
+            state.SkipWithError("encode failed");
+            break;
+        }
+        bitstreamBytes += bs.DataLength;
+    }
+
+    state.SetItemsProcessed(state.iterations());
+    state.SetBytesProcessed(state.iterations() * frameSize);
+    state.counters["threads"]         = threads;
+    state.counters["bitstream_bytes"] = static_cast<double>(bitstreamBytes);
+
+    MFXVideoENCODE_Close(session);
+    MFXClose(session);
+}
+
+void RegisterCodecBenchmarks() {
+    for (int c = 0; c < benchCodecCount; c++) {
+        for (int r = 0; r < benchResolutionCount; r++) {
+            for (int threads : GetBenchThreadCounts()) {
+                std::string suffix = std::string(benchCodecs[c].name) + "/" +
+                                     benchResolutions[r].name +
+                                     "/threads:" + std::to_string(threads);
+                benchmark::RegisterBenchmark(("Decode/" + suffix).c_str(),
+                                             BM_Decode,
+                                             benchCodecs[c],
+                                             benchResolutions[r],
+                                             threads)
+                    ->Unit(benchmark::kNanosecond)
+                    ->UseRealTime();
+                benchmark::RegisterBenchmark(("Encode/" + suffix).c_str(),
+                                             BM_Encode,
+                                             benchCodecs[c],
+                                             benchResolutions[r],
+                                             threads)
+                    ->Unit(benchmark::kNanosecond)
+                    ->UseRealTime();
+            }
+        }
+    }
+}
@@ -0,0 +1,215 @@
+/*############################################################################
+  # Copyright (C) 2020 Intel Corporation
+  #
+  # SPDX-License-Identifier: MIT
+  ############################################################################*/
+
+#include "bench_common.h"
+#include <cstdio>
+#include <cstdlib>
+#include <map>
+#include <string>
+#include <thread>
+#include <tuple>
+
+const BenchResolution benchResolutions[] = {
+    { "720p", 1280, 720 },
+    { "1080p", 1920, 1080 },
+    { "4K", 3840, 2160 },
+};
+const int benchResolutionCount = sizeof(benchResolutions) / sizeof(benchResolutions[0]);
+
+const BenchCodec benchCodecs[] = {
+    { "AVC", MFX_CODEC_AVC },
+    { "HEVC", MFX_CODEC_HEVC },
+    { "AV1", MFX_CODEC_AV1 },
+    { "JPEG", MFX_CODEC_JPEG },
+};
+const int benchCodecCount = sizeof(benchCodecs) / sizeof(benchCodecs[0]);
+
+#define SOURCE_WIDTH  128
+#define SOURCE_HEIGHT 96
+
+std::vector<int> GetBenchThreadCounts() {
+    std::vector<int> counts = { 1 };
+    int n = static_cast<int>(std::thread::hardware_concurrency());
+    if (n > 1)
+        counts.push_back(n);
+    return counts;
+}
+
+size_t GetI420FrameSize(mfxU16 width, mfxU16 height) {
+    return static_cast<size_t>(width) * height * 3 / 2;
+}
+
+void SetI420Surface(mfxFrameSurface1 *surface, mfxU16 width, mfxU16 height, mfxU8 *data) {
+    surface->Info.FourCC       = MFX_FOURCC_I420;
+    surface->Info.ChromaFormat = MFX_CHROMAFORMAT_YUV420;
+    surface->Info.Width        = width;
+    surface->Info.Height       = height;
+    surface->Info.CropW        = width;
+    surface->Info.CropH        = height;
+    surface->Data.Pitch        = width;
+    surface->Data.Y            = data;
+    surface->Data.U            = data + width * height;
+    surface->Data.V            = surface->Data.U + width * height / 4;
+}
+
+void SetEncodeParams(mfxVideoParam *par,
+                     mfxU32 codecId,
+                     mfxU16 width,
+                     mfxU16 height,
+                     mfxU16 numThread) {
+    *par                               = {};
+    par->mfx.CodecId                   = codecId;
+    par->mfx.TargetUsage               = MFX_TARGETUSAGE_BALANCED;
+    par->mfx.NumThread                 = numThread;
+    par->mfx.FrameInfo.FrameRateExtN   = 30;
+    par->mfx.FrameInfo.FrameRateExtD   = 1;
+    par->mfx.FrameInfo.FourCC          = MFX_FOURCC_I420;
+    par->mfx.FrameInfo.ChromaFormat    = MFX_CHROMAFORMAT_YUV420;
+    par->mfx.FrameInfo.PicStruct       = MFX_PICSTRUCT_PROGRESSIVE;
+    par->mfx.FrameInfo.CropW           = width;
+    par->mfx.FrameInfo.CropH           = height;
+    par->mfx.FrameInfo.Width           = width;
+    par->mfx.FrameInfo.Height          = height;
+    par->IOPattern                     = MFX_IOPATTERN_IN_SYSTEM_MEMORY;
+    if (codecId == MFX_CODEC_JPEG) {
+        par->mfx.Interleaved = 1;
+        par->mfx.Quality     = 80;
+    }
+    else {
+        par->mfx.RateControlMethod = MFX_RATECONTROL_VBR;
+        par->mfx.TargetKbps        = 4000;
+    }
+}
+
+mfxSession CreateBenchSession() {
+    mfxVersion ver     = {};
+    mfxSession session = nullptr;
+    if (MFXInit(MFX_IMPL_SOFTWARE, &ver, &session) != MFX_ERR_NONE)
+        return nullptr;
+    return session;
+}
+
+// the unit test clip, or a gradient if the content folder is not around
+static std::vector<std::vector<mfxU8>> LoadSourceFrames() {
+    const char *dir = getenv("VPL_BENCH_CONTENT_DIR");
+    std::string path =
+        std::string(dir ? dir : VPL_BENCH_CONTENT_DIR) + "/cars_128x96.i420";
+    size_t frameSize = GetI420FrameSize(SOURCE_WIDTH, SOURCE_HEIGHT);
+
+    std::vector<std::vector<mfxU8>> frames;
+    FILE *file = fopen(path.c_str(), "rb");
+    if (file) {
+        for (int i = 0; i < BENCH_CLIP_FRAMES; i++) {
+            std::vector<mfxU8> frame(frameSize);
+            if (fread(frame.data(), 1, frameSize, file) != frameSize)
+                break;
+            frames.push_back(std::move(frame));
+        }
+        fclose(file);
+    }
+    if (frames.empty()) {
+        fprintf(stderr, "%s not found, using generated content\n", path.c_str());
+        for (int i = 0; i < BENCH_CLIP_FRAMES; i++) {
+            std::vector<mfxU8> frame(frameSize, 128);
+            for (int y = 0; y < SOURCE_HEIGHT; y++) {
+                for (int x = 0; x < SOURCE_WIDTH; x++)
+                    frame[y * SOURCE_WIDTH + x] = static_cast<mfxU8>(x + y + i * 8);
+            }
+            frames.push_back(std::move(frame));
+        }
+    }
+    return frames;
+}
+
+static void ScalePlane(mfxU8 *dst, int dstW, int dstH, const mfxU8 *src, int srcW, int srcH) {
+    for (int y = 0; y < dstH; y++) {
+        const mfxU8 *srcRow = src + (y * srcH / dstH) * srcW;
+        for (int x = 0; x < dstW; x++)
+            dst[y * dstW + x] = srcRow[x * srcW / dstW];
+    }
+}
+
+const std::vector<std::vector<mfxU8>> &GetSyntheticFrames(mfxU16 width, mfxU16 height) {
+    static std::map<std::pair<mfxU16, mfxU16>, std::vector<std::vector<mfxU8>>> cache;
+    auto &frames = cache[std::make_pair(width, height)];
+    if (!frames.empty())
+        return frames;
+
+    static std::vector<std::vector<mfxU8>> source = LoadSourceFrames();
+    for (auto &src : source) {
+        std::vector<mfxU8> frame(GetI420FrameSize(width, height));
+        mfxU8 *dst = frame.data();
+        const mfxU8 *s = src.data();
+        ScalePlane(dst, width, height, s, SOURCE_WIDTH, SOURCE_HEIGHT);
+        dst += width * height;
+        s += SOURCE_WIDTH * SOURCE_HEIGHT;
+        ScalePlane(dst, width / 2, height / 2, s, SOURCE_WIDTH / 2, SOURCE_HEIGHT / 2);
+        dst += width * height / 4;
+        s += SOURCE_WIDTH * SOURCE_HEIGHT / 4;
+        ScalePlane(dst, width / 2, height / 2, s, SOURCE_WIDTH / 2, SOURCE_HEIGHT / 2);
+        frames.push_back(std::move(frame));
+    }
+    return frames;
+}
+
+static std::vector<mfxU8> EncodeClip(mfxU32 codecId, mfxU16 width, mfxU16 height) {
+    std::vector<mfxU8> stream;
+    mfxSession session = CreateBenchSession();
+    if (!session)
+        return stream;
+
+    mfxVideoParam par;
+    SetEncodeParams(&par, codecId, width, height, 0);
+    if (MFXVideoENCODE_Init(session, &par) != MFX_ERR_NONE) {
+        MFXClose(session);
+        return stream;
+    }
+
+    const std::vector<std::vector<mfxU8>> &frames = GetSyntheticFrames(width, height);
+    std::vector<mfxU8> buffer(GetI420FrameSize(width, height) * 2);
+    mfxStatus sts = MFX_ERR_NONE;
+
+    // one more pass with a null surface drains the encoder
+    for (size_t i = 0; i <= frames.size() && sts >= MFX_ERR_NONE; i++) {
+        mfxFrameSurface1 surface = {};
+        mfxFrameSurface1 *input  = nullptr;
+        if (i < frames.size()) {
+            SetI420Surface(&surface,
+                           width,
+                           height,
+                           const_cast<mfxU8 *>(frames[i].data()));
+            input = &surface;
+        }
+
+        do {
+            mfxBitstream bs = {};
+            bs.Data         = buffer.data();
+            bs.MaxLength    = static_cast<mfxU32>(buffer.size());
+            mfxSyncPoint syncp;
+            sts = MFXVideoENCODE_EncodeFrameAsync(session, nullptr, input, &bs, &syncp);
+            if (sts == MFX_ERR_NONE) {
+                sts = MFXVideoCORE_SyncOperation(session, syncp, 60000);
+                stream.insert(stream.end(), bs.Data + bs.DataOffset, bs.Data + bs.DataOffset + bs.DataLength);
+            }
+        } while (!input && sts == MFX_ERR_NONE);
+
+        if (sts == MFX_ERR_MORE_DATA)
+            sts = MFX_ERR_NONE;
+    }
+
+    MFXVideoENCODE_Close(session);
+    MFXClose(session);
+    return stream;
+}
+
+const std::vector<mfxU8> &GetSyntheticBitstream(mfxU32 codecId, mfxU16 width, mfxU16 height) {
+    static std::map<std::tuple<mfxU32, mfxU16, mfxU16>, std::vector<mfxU8>> cache;
+    auto key = std::make_tuple(codecId, width, height);
+    auto it  = cache.find(key);
+    if (it == cache.end())
+        it = cache.emplace(key, EncodeClip(codecId, width, height)).first;
+    return it->second;
+}
@@ -0,0 +1,57 @@
+/*############################################################################
+  # Copyright (C) 2020 Intel Corporation
+  #
+  # SPDX-License-Identifier: MIT
+  ############################################################################*/
+
+#ifndef TEST_BENCH_BENCH_COMMON_H_
+#define TEST_BENCH_BENCH_COMMON_H_
+
+#include <vector>
+#include "benchmark/benchmark.h"
+#include "vpl/mfxvideo.h"
+
+// number of frames in each synthetic clip
+#define BENCH_CLIP_FRAMES 8
+
+struct BenchResolution {
+    const char *name;
+    mfxU16 width;
+    mfxU16 height;
+};
+
+struct BenchCodec {
+    const char *name;
+    mfxU32 codecId;
+};
+
+extern const BenchResolution benchResolutions[];
+extern const int benchResolutionCount;
+extern const BenchCodec benchCodecs[];
+extern const int benchCodecCount;
+
+// 1 and the number of hardware threads
+std::vector<int> GetBenchThreadCounts();
+
+// I420 frames upscaled from the 128x96 test clip, packed (pitch == width)
+const std::vector<std::vector<mfxU8>> &GetSyntheticFrames(mfxU16 width, mfxU16 height);
+
+// the synthetic frames encoded with codecId, empty if the codec is not
+//   available in this build
+const std::vector<mfxU8> &GetSyntheticBitstream(mfxU32 codecId, mfxU16 width, mfxU16 height);
+
+// bytes in one I420 frame
+size_t GetI420FrameSize(mfxU16 width, mfxU16 height);
+
+// points surface planes at packed I420 data
+void SetI420Surface(mfxFrameSurface1 *surface, mfxU16 width, mfxU16 height, mfxU8 *data);
+
+void SetEncodeParams(mfxVideoParam *par,
+                     mfxU32 codecId,
+                     mfxU16 width,
+                     mfxU16 height,
+                     mfxU16 numThread);
+
+mfxSession CreateBenchSession();
+
+#endif // TEST_BENCH_BENCH_COMMON_H_
@@ -0,0 +1,133 @@
+/*############################################################################
+  # Copyright (C) 2020 Intel Corporation
+  #
+  # SPDX-License-Identifier: MIT
+  ############################################################################*/
+
+#include <string>
+#include <vector>
+#include "bench_common.h"
+
+enum BenchVPPOp { VPP_RESIZE, VPP_CSC, VPP_CROP };
+
+struct BenchVPP {
+    const char *name;
+    BenchVPPOp op;
+};
+
+static const BenchVPP benchVPPOps[] = {
+    { "Resize", VPP_RESIZE }, // to half size
+    { "CSC", VPP_CSC }, // I420 to BGRA
+    { "Crop", VPP_CROP }, // center quarter
+};
+
+// one iteration processes one frame
+static void BM_VPP(benchmark::State &state, BenchVPP vpp, BenchResolution res) {
+    mfxSession session = CreateBenchSession();
+    if (!session) {
+        state.SkipWithError("MFXInit failed");
+        return;
+    }
+
+    mfxVideoParam par        = {};
+    par.vpp.In.FourCC        = MFX_FOURCC_I420;
+    par.vpp.In.ChromaFormat  = MFX_CHROMAFORMAT_YUV420;
+    par.vpp.In.Width         = res.width;
+    par.vpp.In.Height        = res.height;
+    par.vpp.In.CropW         = res.width;
+    par.vpp.In.CropH         = res.height;
+    par.vpp.In.FrameRateExtN = 30;
+    par.vpp.In.FrameRateExtD = 1;
+    par.vpp.In.PicStruct     = MFX_PICSTRUCT_PROGRESSIVE;
+    par.vpp.Out              = par.vpp.In;
+    par.IOPattern            = MFX_IOPATTERN_IN_SYSTEM_MEMORY | MFX_IOPATTERN_OUT_SYSTEM_MEMORY;
+
+    switch (vpp.op) {
+        case VPP_RESIZE:
+            par.vpp.Out.Width  = res.width / 2;
+            par.vpp.Out.Height = res.height / 2;
+            par.vpp.Out.CropW  = res.width / 2;
+            par.vpp.Out.CropH  = res.height / 2;
+            break;
+        case VPP_CSC:
+            par.vpp.Out.FourCC       = MFX_FOURCC_BGRA;
+            par.vpp.Out.ChromaFormat = MFX_CHROMAFORMAT_YUV444;
+            break;
+        case VPP_CROP:
+            par.vpp.In.CropX   = res.width / 4;
+            par.vpp.In.CropY   = res.height / 4;
+            par.vpp.In.CropW   = res.width / 2;
+            par.vpp.In.CropH   = res.height / 2;
+            par.vpp.Out.Width  = res.width / 2;
+            par.vpp.Out.Height = res.height / 2;
+            par.vpp.Out.CropW  = res.width / 2;
+            par.vpp.Out.CropH  = res.height / 2;
+            break;
+    }
+
+    if (MFXVideoVPP_Init(session, &par) != MFX_ERR_NONE) {
+        state.SkipWithError("VPP init failed");
+        MFXClose(session);
+        return;
+    }
+
+    const std::vector<std::vector<mfxU8>> &frames = GetSyntheticFrames(res.width, res.height);
+
+    mfxU16 outW = par.vpp.Out.Width;
+    mfxU16 outH = par.vpp.Out.Height;
+    size_t outSize;
+    std::vector<mfxU8> outBuffer;
+    mfxFrameSurface1 out = {};
+    if (par.vpp.Out.FourCC == MFX_FOURCC_BGRA) {
+        outSize = static_cast<size_t>(outW) * outH * 4;
+        outBuffer.resize(outSize);
+        out.Data.B     = outBuffer.data();
+        out.Data.G     = out.Data.B + 1;
+        out.Data.R     = out.Data.B + 2;
+        out.Data.A     = out.Data.B + 3;
+        out.Data.Pitch = outW * 4;
+    }
+    else {
+        outSize = GetI420FrameSize(outW, outH);
+        outBuffer.resize(outSize);
+        SetI420Surface(&out, outW, outH, outBuffer.data());
+    }
+    out.Info = par.vpp.Out;
+
+    size_t index = 0;
+    for (auto _ : state) {
+        mfxFrameSurface1 in = {};
+        SetI420Surface(&in,
+                       res.width,
+                       res.height,
+                       const_cast<mfxU8 *>(frames[index++ % frames.size()].data()));
+        in.Info = par.vpp.In;
+
+        mfxSyncPoint syncp;
+        mfxStatus sts = MFXVideoVPP_RunFrameVPPAsync(session, &in, &out, nullptr, &syncp);
+        if (sts == MFX_ERR_NONE)
+            sts = MFXVideoCORE_SyncOperation(session, syncp, 60000);
+        if (sts != MFX_ERR_NONE) {
+            state.SkipWithError("VPP failed");
+            break;
+        }
+    }
+
+    state.SetItemsProcessed(state.iterations());
+    state.SetBytesProcessed(state.iterations() *
+                            (GetI420FrameSize(res.width, res.height) + outSize));
+
+    MFXVideoVPP_Close(session);
+    MFXClose(session);
+}
+
+void RegisterVPPBenchmarks() {
+    for (const BenchVPP &vpp : benchVPPOps) {
+        for (int r = 0; r < benchResolutionCount; r++) {
+            std::string name = std::string("VPP/") + vpp.name + "/" + benchResolutions[r].name;
+            benchmark::RegisterBenchmark(name.c_str(), BM_VPP, vpp, benchResolutions[r])
+                ->Unit(benchmark::kNanosecond)
+                ->UseRealTime();
+        }
+    }
+}
@@ -0,0 +1,26 @@
+/*############################################################################
+  # Copyright (C) 2020 Intel Corporation
+  #
+  # SPDX-License-Identifier: MIT
+  ############################################################################*/
+
+#include "benchmark/benchmark.h"
+
+void RegisterCodecBenchmarks();
+void RegisterVPPBenchmarks();
+void RegisterCopyBenchmarks();
+
+// time per iteration is ns/frame, items/s is frames/s and bytes/s is raw
+//   frame bytes moved; use --benchmark_out=<file> --benchmark_out_format=json
+//   for regression tracking
+int main(int argc, char **argv) {
+    RegisterCodecBenchmarks();
+    RegisterVPPBenchmarks();
+    RegisterCopyBenchmarks();
+
+    benchmark::Initialize(&argc, argv);
+    if (benchmark::ReportUnrecognizedArguments(argc, argv))
+        return 1;
+    benchmark::RunSpecifiedBenchmarks();
+    return 0;
+}
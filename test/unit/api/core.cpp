@@ -5,6 +5,7 @@
   ############################################################################*/
 
 #include <gtest/gtest.h>
+#include <cstdint>
 #include "vpl/mfxvideo.h"
 
 //SetFrameAllocator
@@ -104,8 +105,8 @@ TEST(GetHandle, NullSessionReturnsInvalidHandle) {
 }
 
 //Sync
-// success
-TEST(SyncOperation, ValidInputReturnsErrNone) {
+// null sync point
+TEST(SyncOperation, NullSyncPointReturnsNullPtr) {
     // Initialize the session.
     mfxVersion ver = {};
     mfxSession session;
@@ -114,13 +115,102 @@ TEST(SyncOperation, ValidInputReturnsErrNone) {
 
     mfxSyncPoint syncp = { 0 };
     sts                = MFXVideoCORE_SyncOperation(session, syncp, 1000);
+    ASSERT_EQ(sts, MFX_ERR_NULL_PTR);
+
+    //free internal resources
+    sts = MFXClose(session);
+    EXPECT_EQ(sts, MFX_ERR_NONE);
+}
+
+// sync point which was never handed out
+TEST(SyncOperation, UnknownSyncPointReturnsNotFound) {
+    mfxVersion ver = {};
+    mfxSession session;
+    mfxStatus sts = MFXInit(MFX_IMPL_SOFTWARE, &ver, &session);
     ASSERT_EQ(sts, MFX_ERR_NONE);
 
+    mfxSyncPoint syncp = reinterpret_cast<mfxSyncPoint>(static_cast<uintptr_t>(0x12345678));
+    sts                = MFXVideoCORE_SyncOperation(session, syncp, 1000);
+    ASSERT_EQ(sts, MFX_ERR_NOT_FOUND);
+
     //free internal resources
     sts = MFXClose(session);
     EXPECT_EQ(sts, MFX_ERR_NONE);
 }
 
+// output of an async operation is valid after sync
+TEST(SyncOperation, VPPOutputReadyAfterSync) {
+    mfxVersion ver = {};
+    mfxSession session;
+    mfxStatus sts = MFXInit(MFX_IMPL_SOFTWARE, &ver, &session);
+    ASSERT_EQ(sts, MFX_ERR_NONE);
+
+    mfxVideoParam mfxVPPParams;
+    memset(&mfxVPPParams, 0, sizeof(mfxVPPParams));
+
+    mfxVPPParams.vpp.In.FourCC        = MFX_FOURCC_I420;
+    mfxVPPParams.vpp.In.ChromaFormat  = MFX_CHROMAFORMAT_YUV420;
+    mfxVPPParams.vpp.In.CropW         = 128;
+    mfxVPPParams.vpp.In.CropH         = 96;
+    mfxVPPParams.vpp.In.FrameRateExtN = 30;
+    mfxVPPParams.vpp.In.FrameRateExtD = 1;
+    mfxVPPParams.vpp.In.Width         = mfxVPPParams.vpp.In.CropW;
+    mfxVPPParams.vpp.In.Height        = mfxVPPParams.vpp.In.CropH;
+    mfxVPPParams.vpp.Out              = mfxVPPParams.vpp.In;
+
+    mfxVPPParams.IOPattern = MFX_IOPATTERN_IN_SYSTEM_MEMORY | MFX_IOPATTERN_OUT_SYSTEM_MEMORY;
+
+    sts = MFXVideoVPP_Init(session, &mfxVPPParams);
+    ASSERT_EQ(sts, MFX_ERR_NONE);
+
+    mfxU32 nSurfNum               = 2;
+    mfxFrameSurface1 *vppSurfaces = new mfxFrameSurface1[nSurfNum];
+    mfxU32 surfW                  = mfxVPPParams.vpp.In.Width;
+    mfxU32 surfH                  = mfxVPPParams.vpp.In.Height;
+    mfxU32 surfSize               = surfW * surfH * 3 / 2;
+
+    mfxU8 *buf = new mfxU8[surfSize * nSurfNum];
+    memset(buf, 0x40, surfSize);
+    memset(buf + surfSize, 0, surfSize);
+
+    for (mfxU32 i = 0; i < nSurfNum; i++) {
+        vppSurfaces[i]            = { 0 };
+        vppSurfaces[i].Info       = mfxVPPParams.vpp.In;
+        vppSurfaces[i].Data.Y     = buf + i * surfSize;
+        vppSurfaces[i].Data.U     = vppSurfaces[i].Data.Y + (surfW * surfH);
+        vppSurfaces[i].Data.V     = vppSurfaces[i].Data.U + ((surfW / 2) * (surfH / 2));
+        vppSurfaces[i].Data.Pitch = surfW;
+    }
+
+    mfxSyncPoint syncp = nullptr;
+    sts = MFXVideoVPP_RunFrameVPPAsync(session, &vppSurfaces[0], &vppSurfaces[1], nullptr, &syncp);
+    ASSERT_EQ(sts, MFX_ERR_NONE);
+    ASSERT_NE(syncp, nullptr);
+
+    sts = MFXVideoCORE_SyncOperation(session, syncp, MFX_INFINITE);
+    ASSERT_EQ(sts, MFX_ERR_NONE);
+    EXPECT_EQ(memcmp(vppSurfaces[0].Data.Y, vppSurfaces[1].Data.Y, surfW * surfH), 0);
+
+    // sync points are unique per operation
+    mfxSyncPoint syncp2 = nullptr;
+    sts = MFXVideoVPP_RunFrameVPPAsync(session, &vppSurfaces[0], &vppSurfaces[1], nullptr, &syncp2);
+    ASSERT_EQ(sts, MFX_ERR_NONE);
+    EXPECT_NE(syncp2, syncp);
+
+    sts = MFXVideoCORE_SyncOperation(session, syncp2, MFX_INFINITE);
+    ASSERT_EQ(sts, MFX_ERR_NONE);
+
+    // a sync point is released by its sync
+    sts = MFXVideoCORE_SyncOperation(session, syncp2, MFX_INFINITE);
+    EXPECT_EQ(sts, MFX_ERR_NOT_FOUND);
+
+    sts = MFXClose(session);
+    EXPECT_EQ(sts, MFX_ERR_NONE);
+
+    delete[] vppSurfaces;
+    delete[] buf;
+}
+
 // null session
 TEST(SyncOperation, NullSessionReturnsInvalidHandle) {
     mfxStatus sts = MFXVideoCORE_SyncOperation(0, 0, 0);
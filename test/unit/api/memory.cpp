@@ -5,6 +5,11 @@
   ############################################################################*/
 
 #include <gtest/gtest.h>
+#include <stdlib.h>
+#include <chrono>
+#include <string>
+#include <thread>
+#include <vector>
 #include "api/test_bitstreams.h"
 #include "vpl/mfxvideo.h"
 
@@ -16,6 +21,38 @@
    MFX_ERR_NOT_INITIALIZED If VPP wasn't initialized
 */
 
+// sets the limit read when a surface pool is created, the previous value
+//   is restored when the scope ends so other tests see the default
+class ScopedPoolMaxBytes {
+public:
+    explicit ScopedPoolMaxBytes(const char* value) : m_hadValue(false), m_oldValue() {
+        const char* old = getenv("VPL_POOL_MAX_BYTES");
+        if (old) {
+            m_hadValue = true;
+            m_oldValue = old;
+        }
+        Set(value);
+    }
+    ~ScopedPoolMaxBytes() {
+        Set(m_hadValue ? m_oldValue.c_str() : nullptr);
+    }
+
+private:
+    static void Set(const char* value) {
+#if defined(_WIN32) || defined(_WIN64)
+        _putenv_s("VPL_POOL_MAX_BYTES", value ? value : "");
+#else
+        if (value)
+            setenv("VPL_POOL_MAX_BYTES", value, 1);
+        else
+            unsetenv("VPL_POOL_MAX_BYTES");
+#endif
+    }
+
+    bool m_hadValue;
+    std::string m_oldValue;
+};
+
 static mfxStatus InitDecodeBasic(mfxSession* session) {
     mfxVersion ver = {};
     ver.Major      = 2;
@@ -165,6 +202,123 @@ TEST(Memory_GetSurfaceForVPP, InitializedVPPReturnsSurface) {
     EXPECT_EQ(sts, MFX_ERR_NONE);
 }
 
+TEST(Memory_GetSurfaceForVPP, ReleasedSurfaceIsReused) {
+    mfxStatus sts;
+    mfxSession session;
+
+    sts = InitVPPBasic(&session);
+    EXPECT_EQ(sts, MFX_ERR_NONE);
+
+    mfxFrameSurface1* surface1 = nullptr;
+    sts                        = MFXMemory_GetSurfaceForVPP(session, &surface1);
+    ASSERT_EQ(sts, MFX_ERR_NONE);
+
+    mfxFrameSurface1* surface2 = nullptr;
+    sts                        = MFXMemory_GetSurfaceForVPP(session, &surface2);
+    ASSERT_EQ(sts, MFX_ERR_NONE);
+    EXPECT_NE(surface1, surface2);
+
+    // dropping the last reference returns the surface to the pool, the
+    //   most recently released surface is handed out first
+    surface1->FrameInterface->Release(surface1);
+
+    mfxFrameSurface1* surface3 = nullptr;
+    sts                        = MFXMemory_GetSurfaceForVPP(session, &surface3);
+    ASSERT_EQ(sts, MFX_ERR_NONE);
+    EXPECT_EQ(surface3, surface1);
+
+    mfxU32 counter = 0;
+    sts            = surface3->FrameInterface->GetRefCounter(surface3, &counter);
+    ASSERT_EQ(sts, MFX_ERR_NONE);
+    EXPECT_EQ(counter, 1);
+
+    surface2->FrameInterface->Release(surface2);
+    surface3->FrameInterface->Release(surface3);
+
+    sts = MFXClose(session);
+    EXPECT_EQ(sts, MFX_ERR_NONE);
+}
+
+TEST(Memory_GetSurfaceForVPP, PoolLimitReturnsAllocTimeout) {
+    mfxStatus sts;
+    mfxSession session;
+
+    sts = InitVPPBasic(&session);
+    EXPECT_EQ(sts, MFX_ERR_NONE);
+
+    // hold surfaces until the pool refuses to grow
+    std::vector<mfxFrameSurface1*> surfaces;
+    mfxFrameSurface1* surface = nullptr;
+    {
+        // 4 MB holds 27 352x288 I420 frames at most
+        ScopedPoolMaxBytes limit("4194304");
+        for (int i = 0; i < 1000; i++) {
+            surface = nullptr;
+            sts     = MFXMemory_GetSurfaceForVPP(session, &surface);
+            if (sts != MFX_ERR_NONE)
+                break;
+            surfaces.push_back(surface);
+        }
+    }
+    EXPECT_EQ(sts, MFX_WRN_ALLOC_TIMEOUT_EXPIRED);
+    EXPECT_EQ(surface, nullptr);
+    EXPECT_LE(surfaces.size(), 27u);
+
+    // a released surface can be handed out again
+    surfaces.back()->FrameInterface->Release(surfaces.back());
+    sts = MFXMemory_GetSurfaceForVPP(session, &surfaces.back());
+    EXPECT_EQ(sts, MFX_ERR_NONE);
+
+    for (mfxFrameSurface1* surf : surfaces)
+        surf->FrameInterface->Release(surf);
+
+    sts = MFXClose(session);
+    EXPECT_EQ(sts, MFX_ERR_NONE);
+}
+
+TEST(Memory_GetSurfaceForVPP, ReleaseWakesWaitingRequest) {
+    mfxStatus sts;
+    mfxSession session;
+
+    sts = InitVPPBasic(&session);
+    EXPECT_EQ(sts, MFX_ERR_NONE);
+
+    std::vector<mfxFrameSurface1*> surfaces;
+    mfxFrameSurface1* surface = nullptr;
+    {
+        ScopedPoolMaxBytes limit("4194304");
+        for (int i = 0; i < 1000; i++) {
+            surface = nullptr;
+            sts     = MFXMemory_GetSurfaceForVPP(session, &surface);
+            if (sts != MFX_ERR_NONE)
+                break;
+            surfaces.push_back(surface);
+        }
+    }
+    ASSERT_EQ(sts, MFX_WRN_ALLOC_TIMEOUT_EXPIRED);
+
+    // the waiting request gets the surface released by another thread
+    mfxFrameSurface1* released = surfaces.back();
+    surfaces.pop_back();
+    std::thread releaser([released]() {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        released->FrameInterface->Release(released);
+    });
+    surface = nullptr;
+    sts     = MFXMemory_GetSurfaceForVPP(session, &surface);
+    releaser.join();
+    EXPECT_EQ(sts, MFX_ERR_NONE);
+    EXPECT_EQ(surface, released);
+    if (surface)
+        surfaces.push_back(surface);
+
+    for (mfxFrameSurface1* surf : surfaces)
+        surf->FrameInterface->Release(surf);
+
+    sts = MFXClose(session);
+    EXPECT_EQ(sts, MFX_ERR_NONE);
+}
+
 TEST(Memory_GetSurfaceForVPP, NullSurfaceReturnsErrNull) {
     mfxStatus sts;
     mfxSession session;
@@ -319,6 +473,38 @@ TEST(Memory_GetSurfaceForDecode, InitializedDecodeReturnsSurface) {
     EXPECT_EQ(sts, MFX_ERR_NONE);
 }
 
+TEST(Memory_GetSurfaceForDecode, PoolLimitCountsUnfilledSurfaces) {
+    mfxStatus sts;
+    mfxSession session;
+
+    sts = InitDecodeBasic(&session);
+    EXPECT_EQ(sts, MFX_ERR_NONE);
+
+    // decode surfaces hold no data until the decoder fills them, they
+    //   count with the size of a 352x288 I420 frame
+    std::vector<mfxFrameSurface1*> surfaces;
+    mfxFrameSurface1* surface = nullptr;
+    {
+        ScopedPoolMaxBytes limit("4194304");
+        for (int i = 0; i < 1000; i++) {
+            surface = nullptr;
+            sts     = MFXMemory_GetSurfaceForDecode(session, &surface);
+            if (sts != MFX_ERR_NONE)
+                break;
+            surfaces.push_back(surface);
+        }
+    }
+    EXPECT_EQ(sts, MFX_WRN_ALLOC_TIMEOUT_EXPIRED);
+    EXPECT_EQ(surface, nullptr);
+    EXPECT_LE(surfaces.size(), 27u);
+
+    for (mfxFrameSurface1* surf : surfaces)
+        surf->FrameInterface->Release(surf);
+
+    sts = MFXClose(session);
+    EXPECT_EQ(sts, MFX_ERR_NONE);
+}
+
 TEST(Memory_GetSurfaceForDecode, NullSurfaceReturnsErrNull) {
     mfxStatus sts;
     mfxSession session;
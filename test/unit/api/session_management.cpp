@@ -5,7 +5,15 @@
   ############################################################################*/
 
 #include <gtest/gtest.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <map>
+#include <string>
+#include <thread>
 #include <tuple>
+#include <vector>
 #include "vpl/mfxvideo.h"
 
 // MFXInit tests
@@ -145,6 +153,154 @@ TEST(QueryVersion, NullSessionReturnsInvalidHandle) {
     ASSERT_EQ(sts, MFX_ERR_INVALID_HANDLE);
 }
 
+// MFXClose writes the trace when VPL_TRACE_FILE is set
+static void SetTraceFile(const char* value) {
+#if defined(_WIN32) || defined(_WIN64)
+    _putenv_s("VPL_TRACE_FILE", value ? value : "");
+#else
+    if (value)
+        setenv("VPL_TRACE_FILE", value, 1);
+    else
+        unsetenv("VPL_TRACE_FILE");
+#endif
+}
+
+// submit and sync a few copies, traced on the calling thread
+static void RunTracedVPP(int nFrames) {
+    mfxVersion ver = {};
+    mfxSession session;
+    mfxStatus sts = MFXInit(MFX_IMPL_SOFTWARE, &ver, &session);
+    ASSERT_EQ(sts, MFX_ERR_NONE);
+
+    mfxVideoParam par = {};
+
+    par.vpp.In.FourCC        = MFX_FOURCC_I420;
+    par.vpp.In.ChromaFormat  = MFX_CHROMAFORMAT_YUV420;
+    par.vpp.In.Width         = 64;
+    par.vpp.In.Height        = 32;
+    par.vpp.In.CropW         = 64;
+    par.vpp.In.CropH         = 32;
+    par.vpp.In.FrameRateExtN = 30;
+    par.vpp.In.FrameRateExtD = 1;
+    par.vpp.Out              = par.vpp.In;
+    par.IOPattern            = MFX_IOPATTERN_IN_SYSTEM_MEMORY | MFX_IOPATTERN_OUT_SYSTEM_MEMORY;
+
+    sts = MFXVideoVPP_Init(session, &par);
+    ASSERT_EQ(sts, MFX_ERR_NONE);
+
+    std::vector<mfxU8> buf(64 * 32 * 3);
+    mfxFrameSurface1 surfaces[2];
+    for (int i = 0; i < 2; i++) {
+        surfaces[i]            = {};
+        surfaces[i].Info       = par.vpp.In;
+        surfaces[i].Data.Y     = buf.data() + i * 64 * 32 * 3 / 2;
+        surfaces[i].Data.U     = surfaces[i].Data.Y + 64 * 32;
+        surfaces[i].Data.V     = surfaces[i].Data.U + 32 * 16;
+        surfaces[i].Data.Pitch = 64;
+    }
+
+    for (int i = 0; i < nFrames; i++) {
+        mfxSyncPoint syncp = nullptr;
+        sts = MFXVideoVPP_RunFrameVPPAsync(session, &surfaces[0], &surfaces[1], nullptr, &syncp);
+        ASSERT_EQ(sts, MFX_ERR_NONE);
+        sts = MFXVideoCORE_SyncOperation(session, syncp, 1000);
+        ASSERT_EQ(sts, MFX_ERR_NONE);
+    }
+
+    MFXClose(session);
+}
+
+struct TraceLine {
+    std::string name;
+    double ts;
+    double dur;
+};
+
+// Threads exit and new ones start between the two rounds, each thread
+//   must keep its own tid and the events of one tid must nest like the
+//   scopes of a single thread.
+TEST(Close, TraceKeepsEachThreadOnItsOwnTid) {
+    const char* path   = "vpl_unit_trace.json";
+    const int nThreads = 4;
+    const int nRounds  = 2;
+    const int nFrames  = 3;
+    SetTraceFile(path);
+
+    for (int round = 0; round < nRounds; round++) {
+        std::vector<std::thread> threads;
+        for (int i = 0; i < nThreads; i++)
+            threads.emplace_back(RunTracedVPP, nFrames);
+        for (auto& thread : threads)
+            thread.join();
+    }
+
+    // the last close writes every buffer
+    mfxVersion ver = {};
+    mfxSession session;
+    mfxStatus sts = MFXInit(MFX_IMPL_SOFTWARE, &ver, &session);
+    ASSERT_EQ(sts, MFX_ERR_NONE);
+    MFXClose(session);
+
+    // tracing stops at the next session created
+    SetTraceFile(nullptr);
+    sts = MFXInit(MFX_IMPL_SOFTWARE, &ver, &session);
+    ASSERT_EQ(sts, MFX_ERR_NONE);
+    MFXClose(session);
+
+    FILE* file = fopen(path, "r");
+    ASSERT_NE(file, nullptr);
+    std::map<int, std::vector<TraceLine>> events;
+    char line[1024];
+    while (fgets(line, sizeof(line), file)) {
+        const char* name = strstr(line, "{\"name\":\"");
+        const char* rest = strstr(line, "\",\"ph\":\"X\"");
+        if (!name || !rest)
+            continue;
+        int tid   = 0;
+        double ts = 0, dur = 0;
+        int n     = sscanf(rest,
+                       "\",\"ph\":\"X\",\"pid\":1,\"tid\":%d,\"ts\":%lf,\"dur\":%lf",
+                       &tid,
+                       &ts,
+                       &dur);
+        ASSERT_EQ(n, 3);
+        name += strlen("{\"name\":\"");
+        events[tid].push_back({ std::string(name, rest), ts, dur });
+    }
+    fclose(file);
+    remove(path);
+
+    int submitThreads = 0;
+    for (auto& it : events) {
+        std::vector<TraceLine>& list = it.second;
+        int submits                  = 0;
+        for (const TraceLine& event : list) {
+            size_t n = event.name.size();
+            if (n >= 6 && event.name.compare(n - 6, 6, "Submit") == 0)
+                submits++;
+        }
+        if (submits) {
+            submitThreads++;
+            EXPECT_EQ(submits, nFrames) << "tid " << it.first;
+        }
+
+        // scopes of one thread either nest or follow each other, allow
+        //   for the rounding of ts and dur to 1 ns
+        std::sort(list.begin(), list.end(), [](const TraceLine& a, const TraceLine& b) {
+            return a.ts < b.ts || (a.ts == b.ts && a.dur > b.dur);
+        });
+        std::vector<double> open;
+        for (const TraceLine& event : list) {
+            while (!open.empty() && open.back() <= event.ts + 0.001)
+                open.pop_back();
+            EXPECT_TRUE(open.empty() || event.ts + event.dur <= open.back() + 0.001)
+                << "tid " << it.first << " " << event.name;
+            open.push_back(event.ts + event.dur);
+        }
+    }
+    EXPECT_EQ(submitThreads, nThreads * nRounds);
+}
+
 // if linking directly against the runtime, we can
 //   test functions which the dispatcher does not
 //   expose directly to the application
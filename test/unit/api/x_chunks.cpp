@@ -0,0 +1,104 @@
+/*############################################################################
+  # Copyright (C) 2020 Intel Corporation
+  #
+  # SPDX-License-Identifier: MIT
+  ############################################################################*/
+
+#include <gtest/gtest.h>
+#include <algorithm>
+#include <vector>
+#include "vpl/mfxcpu.h"
+#include "vpl/mfxvideo.h"
+
+/* Chunked encode overview
+   mfxExtCpuEncodeChunks attached in MFXVideoENCODE_Init() splits offline
+   input into chunks of whole GOPs which are encoded in parallel, the
+   packets of a chunk come out after those of the chunk before it, see
+   vpl/mfxcpu.h
+
+*/
+
+TEST(EncodeFrameAsync, ChunksEncodeEveryFrameOnce) {
+    mfxVersion ver = {};
+    mfxSession session;
+    mfxStatus sts = MFXInit(MFX_IMPL_SOFTWARE, &ver, &session);
+    ASSERT_EQ(sts, MFX_ERR_NONE);
+
+    mfxExtCpuEncodeChunks chunks = {};
+    chunks.Header.BufferId       = MFX_EXTBUFF_CPU_ENCODE_CHUNKS;
+    chunks.Header.BufferSz       = sizeof(chunks);
+    chunks.NumChunk              = 2;
+    chunks.ChunkGops             = 1;
+    mfxExtBuffer *extParam[]     = { &chunks.Header };
+
+    mfxVideoParam mfxEncParams;
+    memset(&mfxEncParams, 0, sizeof(mfxEncParams));
+    mfxEncParams.mfx.CodecId                 = MFX_CODEC_HEVC;
+    mfxEncParams.mfx.GopPicSize              = 8;
+    mfxEncParams.mfx.TargetKbps              = 1000;
+    mfxEncParams.mfx.FrameInfo.FourCC        = MFX_FOURCC_I420;
+    mfxEncParams.mfx.FrameInfo.ChromaFormat  = MFX_CHROMAFORMAT_YUV420;
+    mfxEncParams.mfx.FrameInfo.CropW         = 128;
+    mfxEncParams.mfx.FrameInfo.CropH         = 96;
+    mfxEncParams.mfx.FrameInfo.Width         = 128;
+    mfxEncParams.mfx.FrameInfo.Height        = 96;
+    mfxEncParams.mfx.FrameInfo.FrameRateExtN = 30;
+    mfxEncParams.mfx.FrameInfo.FrameRateExtD = 1;
+    mfxEncParams.IOPattern                   = MFX_IOPATTERN_IN_SYSTEM_MEMORY;
+    mfxEncParams.ExtParam                    = extParam;
+    mfxEncParams.NumExtParam                 = 1;
+
+    sts = MFXVideoENCODE_Init(session, &mfxEncParams);
+    ASSERT_EQ(sts, MFX_ERR_NONE);
+
+    mfxU32 lumaSize = 128 * 96;
+    std::vector<mfxU8> surfaceBuffer(lumaSize * 3 / 2, 128);
+    mfxFrameSurface1 surface = {};
+    surface.Info             = mfxEncParams.mfx.FrameInfo;
+    surface.Data.Y           = surfaceBuffer.data();
+    surface.Data.U           = surface.Data.Y + lumaSize;
+    surface.Data.V           = surface.Data.U + lumaSize / 4;
+    surface.Data.Pitch       = 128;
+
+    std::vector<mfxU8> bsBuffer(lumaSize * 4);
+    std::vector<mfxU64> timeStamps;
+    mfxSyncPoint syncp = nullptr;
+
+    // three chunks, the last one is cut short by the end of the input
+    const int nFrames = 20;
+    for (int i = 0; i <= nFrames; i++) {
+        // the surface is copied, so it can change right away
+        memset(surfaceBuffer.data(), i * 10, lumaSize);
+        surface.Data.TimeStamp = (i + 1) * 3000;
+
+        do {
+            mfxBitstream mfxBS = { 0 };
+            mfxBS.MaxLength    = (mfxU32)bsBuffer.size();
+            mfxBS.Data         = bsBuffer.data();
+
+            sts = MFXVideoENCODE_EncodeFrameAsync(session,
+                                                  nullptr,
+                                                  (i < nFrames) ? &surface : nullptr,
+                                                  &mfxBS,
+                                                  &syncp);
+            if (sts == MFX_ERR_NONE) {
+                sts = MFXVideoCORE_SyncOperation(session, syncp, 10000);
+                ASSERT_EQ(sts, MFX_ERR_NONE);
+                ASSERT_GT(mfxBS.DataLength, 0u);
+                timeStamps.push_back(mfxBS.TimeStamp);
+            }
+        } while (i == nFrames && sts == MFX_ERR_NONE);
+        if (sts != MFX_ERR_NONE)
+            ASSERT_EQ(sts, MFX_ERR_MORE_DATA);
+    }
+
+    // every input comes out once, chunks in input order
+    ASSERT_EQ(timeStamps.size(), (size_t)nFrames);
+    std::vector<mfxU64> sorted(timeStamps);
+    std::sort(sorted.begin(), sorted.end());
+    for (int i = 0; i < nFrames; i++)
+        EXPECT_EQ(sorted[i], (mfxU64)(i + 1) * 3000);
+    EXPECT_LE(*std::max_element(timeStamps.begin(), timeStamps.begin() + 8), 8u * 3000);
+
+    MFXClose(session);
+}
@@ -0,0 +1,327 @@
+/*############################################################################
+  # Copyright (C) 2020 Intel Corporation
+  #
+  # SPDX-License-Identifier: MIT
+  ############################################################################*/
+
+#include <gtest/gtest.h>
+#include <vector>
+#include "vpl/mfxvideo.h"
+
+/* Encode control overview
+   mfxEncodeCtrl passed to MFXVideoENCODE_EncodeFrameAsync() changes the
+   picture type, QP or regions of interest of one frame, or skips it
+
+*/
+
+// 128x96 I420 libx264 session, MFX_ERR_UNSUPPORTED when the runtime was
+//   built without it
+// no B-frames and slice threads only, so every frame is encoded when it
+//   is sent
+static mfxStatus InitAVCEncode(mfxSession session, mfxVideoParam *par, mfxU16 rateControl) {
+    memset(par, 0, sizeof(*par));
+    par->mfx.CodecId                 = MFX_CODEC_AVC;
+    par->mfx.TargetUsage             = MFX_TARGETUSAGE_BEST_SPEED;
+    par->mfx.RateControlMethod       = rateControl;
+    par->mfx.TargetKbps              = 500;
+    par->mfx.QPI                     = 30;
+    par->mfx.QPP                     = 30;
+    par->mfx.QPB                     = 30;
+    par->mfx.GopRefDist              = 0;
+    par->mfx.FrameInfo.FourCC        = MFX_FOURCC_I420;
+    par->mfx.FrameInfo.ChromaFormat  = MFX_CHROMAFORMAT_YUV420;
+    par->mfx.FrameInfo.CropW         = 128;
+    par->mfx.FrameInfo.CropH         = 96;
+    par->mfx.FrameInfo.Width         = 128;
+    par->mfx.FrameInfo.Height        = 96;
+    par->mfx.FrameInfo.FrameRateExtN = 30;
+    par->mfx.FrameInfo.FrameRateExtD = 1;
+    par->IOPattern                   = MFX_IOPATTERN_IN_SYSTEM_MEMORY;
+    par->AsyncDepth                  = 1;
+
+    return MFXVideoENCODE_Init(session, par);
+}
+
+TEST(EncodeFrameAsync, EncCtrlForcesKeyFrameAndSkipsFrame) {
+    mfxVersion ver = {};
+    mfxSession session;
+    mfxStatus sts = MFXInit(MFX_IMPL_SOFTWARE, &ver, &session);
+    ASSERT_EQ(sts, MFX_ERR_NONE);
+
+    mfxVideoParam mfxEncParams;
+    memset(&mfxEncParams, 0, sizeof(mfxEncParams));
+    mfxEncParams.mfx.CodecId                 = MFX_CODEC_JPEG;
+    mfxEncParams.mfx.FrameInfo.FourCC        = MFX_FOURCC_I420;
+    mfxEncParams.mfx.FrameInfo.ChromaFormat  = MFX_CHROMAFORMAT_YUV420;
+    mfxEncParams.mfx.FrameInfo.CropW         = 128;
+    mfxEncParams.mfx.FrameInfo.CropH         = 96;
+    mfxEncParams.mfx.FrameInfo.Width         = 128;
+    mfxEncParams.mfx.FrameInfo.Height        = 96;
+    mfxEncParams.mfx.FrameInfo.FrameRateExtN = 30;
+    mfxEncParams.mfx.FrameInfo.FrameRateExtD = 1;
+    mfxEncParams.IOPattern                   = MFX_IOPATTERN_IN_SYSTEM_MEMORY;
+
+    mfxU32 lumaSize = mfxEncParams.mfx.FrameInfo.Width * mfxEncParams.mfx.FrameInfo.Height;
+    std::vector<mfxU8> surfaceBuffer(lumaSize * 3 / 2, 128);
+
+    mfxFrameSurface1 encSurface = { 0 };
+    encSurface.Info             = mfxEncParams.mfx.FrameInfo;
+    encSurface.Data.Y           = surfaceBuffer.data();
+    encSurface.Data.U           = encSurface.Data.Y + lumaSize;
+    encSurface.Data.V           = encSurface.Data.U + lumaSize / 4;
+    encSurface.Data.Pitch       = mfxEncParams.mfx.FrameInfo.Width;
+
+    sts = MFXVideoENCODE_Init(session, &mfxEncParams);
+    ASSERT_EQ(sts, MFX_ERR_NONE);
+
+    std::vector<mfxU8> bsBuffer(20000);
+    mfxBitstream mfxBS = { 0 };
+    mfxBS.MaxLength    = (mfxU32)bsBuffer.size();
+    mfxBS.Data         = bsBuffer.data();
+    mfxSyncPoint syncp = nullptr;
+
+    // key frames can be requested
+    mfxEncodeCtrl ctrl = { 0 };
+    ctrl.FrameType     = MFX_FRAMETYPE_I | MFX_FRAMETYPE_REF | MFX_FRAMETYPE_IDR;
+
+    sts = MFXVideoENCODE_EncodeFrameAsync(session, &ctrl, &encSurface, &mfxBS, &syncp);
+    ASSERT_EQ(sts, MFX_ERR_NONE);
+    sts = MFXVideoCORE_SyncOperation(session, syncp, 1000);
+    ASSERT_EQ(sts, MFX_ERR_NONE);
+    EXPECT_GT(mfxBS.DataLength, 0u);
+
+    // skipped input is not encoded, JPEG has nothing else to output
+    ctrl           = { 0 };
+    ctrl.SkipFrame = 1;
+    sts            = MFXVideoENCODE_EncodeFrameAsync(session, &ctrl, &encSurface, &mfxBS, &syncp);
+    ASSERT_EQ(sts, MFX_ERR_MORE_DATA);
+
+    MFXClose(session);
+}
+
+// size of one libx264 frame encoded with ctrl
+static mfxStatus EncodeAVCFrame(mfxU16 rateControl, mfxEncodeCtrl *ctrl, mfxU32 *size) {
+    *size = 0;
+
+    mfxVersion ver = {};
+    mfxSession session;
+    mfxStatus sts = MFXInit(MFX_IMPL_SOFTWARE, &ver, &session);
+    if (sts != MFX_ERR_NONE)
+        return sts;
+
+    mfxVideoParam mfxEncParams;
+    sts = InitAVCEncode(session, &mfxEncParams, rateControl);
+    if (sts != MFX_ERR_NONE) {
+        MFXClose(session);
+        return sts;
+    }
+
+    // detail for the quantizer to remove
+    mfxU32 lumaSize = mfxEncParams.mfx.FrameInfo.Width * mfxEncParams.mfx.FrameInfo.Height;
+    std::vector<mfxU8> surfaceBuffer(lumaSize * 3 / 2, 128);
+    for (mfxU32 i = 0; i < lumaSize; i++)
+        surfaceBuffer[i] = static_cast<mfxU8>((i * 37) ^ (i / 128 * 11));
+
+    mfxFrameSurface1 encSurface = { 0 };
+    encSurface.Info             = mfxEncParams.mfx.FrameInfo;
+    encSurface.Data.Y           = surfaceBuffer.data();
+    encSurface.Data.U           = encSurface.Data.Y + lumaSize;
+    encSurface.Data.V           = encSurface.Data.U + lumaSize / 4;
+    encSurface.Data.Pitch       = mfxEncParams.mfx.FrameInfo.Width;
+
+    std::vector<mfxU8> bsBuffer(lumaSize * 2);
+    mfxBitstream mfxBS = { 0 };
+    mfxBS.MaxLength    = (mfxU32)bsBuffer.size();
+    mfxBS.Data         = bsBuffer.data();
+    mfxSyncPoint syncp = nullptr;
+
+    sts = MFXVideoENCODE_EncodeFrameAsync(session, ctrl, &encSurface, &mfxBS, &syncp);
+    // the frame comes out while draining if libx264 holds it back
+    while (sts == MFX_ERR_MORE_DATA)
+        sts = MFXVideoENCODE_EncodeFrameAsync(session, nullptr, nullptr, &mfxBS, &syncp);
+    if (sts == MFX_ERR_NONE)
+        sts = MFXVideoCORE_SyncOperation(session, syncp, 1000);
+    *size = mfxBS.DataLength;
+
+    MFXClose(session);
+    return sts;
+}
+
+TEST(EncodeFrameAsync, EncCtrlQPSetsFrameQuantizer) {
+    mfxEncodeCtrl ctrl = { 0 };
+    mfxU32 fine        = 0;
+    mfxU32 coarse      = 0;
+
+    ctrl.QP       = 10;
+    mfxStatus sts = EncodeAVCFrame(MFX_RATECONTROL_CQP, &ctrl, &fine);
+    if (sts == MFX_ERR_UNSUPPORTED)
+        GTEST_SKIP() << "runtime built without libx264";
+    ASSERT_EQ(sts, MFX_ERR_NONE);
+    ctrl.QP = 45;
+    sts     = EncodeAVCFrame(MFX_RATECONTROL_CQP, &ctrl, &coarse);
+    ASSERT_EQ(sts, MFX_ERR_NONE);
+
+    EXPECT_GT(coarse, 0u);
+    EXPECT_GT(fine, coarse);
+}
+
+// the QP holds for its frame only, key frames leave the sizes independent
+//   of the frames before them
+// the first packet also carries the encoder's SEI, so frame 1 is compared
+TEST(EncodeFrameAsync, EncCtrlQPHoldsForOneFrame) {
+    mfxVersion ver = {};
+    mfxSession session;
+    mfxStatus sts = MFXInit(MFX_IMPL_SOFTWARE, &ver, &session);
+    ASSERT_EQ(sts, MFX_ERR_NONE);
+
+    mfxVideoParam mfxEncParams;
+    sts = InitAVCEncode(session, &mfxEncParams, MFX_RATECONTROL_CQP);
+    if (sts == MFX_ERR_UNSUPPORTED) {
+        MFXClose(session);
+        GTEST_SKIP() << "runtime built without libx264";
+    }
+    ASSERT_EQ(sts, MFX_ERR_NONE);
+
+    mfxU32 lumaSize = mfxEncParams.mfx.FrameInfo.Width * mfxEncParams.mfx.FrameInfo.Height;
+    std::vector<mfxU8> surfaceBuffer(lumaSize * 3 / 2, 128);
+    for (mfxU32 i = 0; i < lumaSize; i++)
+        surfaceBuffer[i] = static_cast<mfxU8>((i * 37) ^ (i / 128 * 11));
+
+    mfxFrameSurface1 encSurface = { 0 };
+    encSurface.Info             = mfxEncParams.mfx.FrameInfo;
+    encSurface.Data.Y           = surfaceBuffer.data();
+    encSurface.Data.U           = encSurface.Data.Y + lumaSize;
+    encSurface.Data.V           = encSurface.Data.U + lumaSize / 4;
+    encSurface.Data.Pitch       = mfxEncParams.mfx.FrameInfo.Width;
+
+    std::vector<mfxU8> bsBuffer(lumaSize * 2);
+    mfxSyncPoint syncp = nullptr;
+    mfxU32 size[4]     = {};
+
+    // every frame comes out of the call which sends it
+    for (int i = 0; i < 4; i++) {
+        mfxEncodeCtrl ctrl = { 0 };
+        ctrl.FrameType     = MFX_FRAMETYPE_I | MFX_FRAMETYPE_REF | MFX_FRAMETYPE_IDR;
+        ctrl.QP            = (i == 2) ? 45 : 0;
+
+        mfxBitstream mfxBS = { 0 };
+        mfxBS.MaxLength    = (mfxU32)bsBuffer.size();
+        mfxBS.Data         = bsBuffer.data();
+
+        sts = MFXVideoENCODE_EncodeFrameAsync(session, &ctrl, &encSurface, &mfxBS, &syncp);
+        ASSERT_EQ(sts, MFX_ERR_NONE);
+        sts = MFXVideoCORE_SyncOperation(session, syncp, 1000);
+        ASSERT_EQ(sts, MFX_ERR_NONE);
+        size[i] = mfxBS.DataLength;
+    }
+
+    EXPECT_GT(size[2], 0u);
+    EXPECT_GT(size[1], size[2]);
+    EXPECT_EQ(size[3], size[1]);
+
+    MFXClose(session);
+}
+
+// libx264 reads the QP when it encodes a frame, which may be after later
+//   frames were sent if it holds frames back
+TEST(EncodeFrameAsync, EncCtrlQPNeedsZeroDelay) {
+    mfxVersion ver = {};
+    mfxSession session;
+    mfxStatus sts = MFXInit(MFX_IMPL_SOFTWARE, &ver, &session);
+    ASSERT_EQ(sts, MFX_ERR_NONE);
+
+    mfxVideoParam mfxEncParams;
+    sts = InitAVCEncode(session, &mfxEncParams, MFX_RATECONTROL_CQP);
+    if (sts == MFX_ERR_UNSUPPORTED) {
+        MFXClose(session);
+        GTEST_SKIP() << "runtime built without libx264";
+    }
+    ASSERT_EQ(sts, MFX_ERR_NONE);
+
+    mfxU32 lumaSize = mfxEncParams.mfx.FrameInfo.Width * mfxEncParams.mfx.FrameInfo.Height;
+    std::vector<mfxU8> surfaceBuffer(lumaSize * 3 / 2, 128);
+
+    mfxFrameSurface1 encSurface = { 0 };
+    encSurface.Info             = mfxEncParams.mfx.FrameInfo;
+    encSurface.Data.Y           = surfaceBuffer.data();
+    encSurface.Data.U           = encSurface.Data.Y + lumaSize;
+    encSurface.Data.V           = encSurface.Data.U + lumaSize / 4;
+    encSurface.Data.Pitch       = mfxEncParams.mfx.FrameInfo.Width;
+
+    std::vector<mfxU8> bsBuffer(lumaSize * 2);
+    mfxBitstream mfxBS = { 0 };
+    mfxBS.MaxLength    = (mfxU32)bsBuffer.size();
+    mfxBS.Data         = bsBuffer.data();
+    mfxSyncPoint syncp = nullptr;
+    mfxEncodeCtrl ctrl = { 0 };
+    ctrl.QP            = 45;
+
+    // B-frames
+    MFXVideoENCODE_Close(session);
+    mfxEncParams.mfx.GopRefDist = 2;
+    sts                         = MFXVideoENCODE_Init(session, &mfxEncParams);
+    ASSERT_EQ(sts, MFX_ERR_NONE);
+    sts = MFXVideoENCODE_EncodeFrameAsync(session, &ctrl, &encSurface, &mfxBS, &syncp);
+    EXPECT_EQ(sts, MFX_ERR_INVALID_VIDEO_PARAM);
+
+    // frame threads
+    MFXVideoENCODE_Close(session);
+    mfxEncParams.mfx.GopRefDist = 0;
+    mfxEncParams.mfx.NumThread  = 2;
+    mfxEncParams.AsyncDepth     = 2;
+    sts                         = MFXVideoENCODE_Init(session, &mfxEncParams);
+    ASSERT_EQ(sts, MFX_ERR_NONE);
+    sts = MFXVideoENCODE_EncodeFrameAsync(session, &ctrl, &encSurface, &mfxBS, &syncp);
+    EXPECT_EQ(sts, MFX_ERR_INVALID_VIDEO_PARAM);
+
+    MFXClose(session);
+}
+
+// libx264 is the only encoder in this build which takes ROI (libx265
+//   would too, but HEVC is encoded by SVT-HEVC)
+TEST(EncodeFrameAsync, EncCtrlROIChangesFrameQuality) {
+    mfxExtEncoderROI roi     = {};
+    roi.Header.BufferId      = MFX_EXTBUFF_ENCODER_ROI;
+    roi.Header.BufferSz      = sizeof(roi);
+    roi.ROIMode              = MFX_ROI_MODE_QP_DELTA;
+    roi.NumROI               = 1;
+    roi.ROI[0].Right         = 128;
+    roi.ROI[0].Bottom        = 96;
+    mfxExtBuffer *extParam[] = { &roi.Header };
+
+    mfxEncodeCtrl ctrl = { 0 };
+    ctrl.NumExtParam   = 1;
+    ctrl.ExtParam      = extParam;
+    mfxU32 better      = 0;
+    mfxU32 worse       = 0;
+
+    roi.ROI[0].DeltaQP = -20;
+    mfxStatus sts      = EncodeAVCFrame(MFX_RATECONTROL_VBR, &ctrl, &better);
+    if (sts == MFX_ERR_UNSUPPORTED)
+        GTEST_SKIP() << "runtime built without libx264";
+    ASSERT_EQ(sts, MFX_ERR_NONE);
+    roi.ROI[0].DeltaQP = 20;
+    sts                = EncodeAVCFrame(MFX_RATECONTROL_VBR, &ctrl, &worse);
+    ASSERT_EQ(sts, MFX_ERR_NONE);
+
+    EXPECT_GT(worse, 0u);
+    EXPECT_GT(better, worse);
+
+    // constant QP has no adaptive quantization to apply them
+    mfxU32 size = 0;
+    sts         = EncodeAVCFrame(MFX_RATECONTROL_CQP, &ctrl, &size);
+    EXPECT_EQ(sts, MFX_ERR_INVALID_VIDEO_PARAM);
+
+    mfxVersion ver = {};
+    mfxSession session;
+    sts = MFXInit(MFX_IMPL_SOFTWARE, &ver, &session);
+    ASSERT_EQ(sts, MFX_ERR_NONE);
+    mfxVideoParam mfxEncParams;
+    InitAVCEncode(session, &mfxEncParams, MFX_RATECONTROL_CQP);
+    MFXVideoENCODE_Close(session);
+    mfxEncParams.ExtParam    = extParam;
+    mfxEncParams.NumExtParam = 1;
+    sts                      = MFXVideoENCODE_Init(session, &mfxEncParams);
+    EXPECT_EQ(sts, MFX_ERR_INVALID_VIDEO_PARAM);
+    MFXClose(session);
+}
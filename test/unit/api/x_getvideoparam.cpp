@@ -5,6 +5,8 @@
   ############################################################################*/
 
 #include <gtest/gtest.h>
+#include <vector>
+#include "vpl/mfxcpu.h"
 #include "vpl/mfxvideo.h"
 
 /* GetVideoParam overview
@@ -56,6 +58,42 @@ TEST(EncodeGetVideoParam, InitializedEncodeReturnsParams) {
     EXPECT_EQ(sts, MFX_ERR_NONE);
 }
 
+TEST(EncodeGetVideoParam, ExplicitNumThreadIsGranted) {
+    mfxVersion ver = {};
+    mfxSession session;
+    mfxStatus sts = MFXInit(MFX_IMPL_SOFTWARE, &ver, &session);
+    ASSERT_EQ(sts, MFX_ERR_NONE);
+
+    mfxVideoParam mfxEncParams = { 0 };
+
+    mfxEncParams.mfx.CodecId                 = MFX_CODEC_HEVC;
+    mfxEncParams.mfx.NumThread               = 2;
+    mfxEncParams.mfx.TargetUsage             = MFX_TARGETUSAGE_BALANCED;
+    mfxEncParams.mfx.TargetKbps              = 4000;
+    mfxEncParams.mfx.RateControlMethod       = MFX_RATECONTROL_VBR;
+    mfxEncParams.mfx.FrameInfo.FrameRateExtN = 30;
+    mfxEncParams.mfx.FrameInfo.FrameRateExtD = 1;
+    mfxEncParams.mfx.FrameInfo.FourCC        = MFX_FOURCC_I420;
+    mfxEncParams.mfx.FrameInfo.ChromaFormat  = MFX_CHROMAFORMAT_YUV420;
+    mfxEncParams.mfx.FrameInfo.PicStruct     = MFX_PICSTRUCT_PROGRESSIVE;
+    mfxEncParams.mfx.FrameInfo.CropW         = 128;
+    mfxEncParams.mfx.FrameInfo.CropH         = 96;
+    mfxEncParams.mfx.FrameInfo.Width         = 128;
+    mfxEncParams.mfx.FrameInfo.Height        = 96;
+    mfxEncParams.IOPattern                   = MFX_IOPATTERN_IN_SYSTEM_MEMORY;
+
+    sts = MFXVideoENCODE_Init(session, &mfxEncParams);
+    ASSERT_EQ(sts, MFX_ERR_NONE);
+
+    mfxVideoParam par = { 0 };
+    sts               = MFXVideoENCODE_GetVideoParam(session, &par);
+    ASSERT_EQ(sts, MFX_ERR_NONE);
+    EXPECT_EQ(par.mfx.NumThread, 2);
+
+    sts = MFXClose(session);
+    EXPECT_EQ(sts, MFX_ERR_NONE);
+}
+
 TEST(EncodeGetVideoParam, UninitializedEncodeReturnsNotInitialized) {
     mfxVersion ver = {};
     mfxSession session;
@@ -117,6 +155,62 @@ TEST(DecodeGetVideoParam, InitializedDecodeReturnsParams) {
     EXPECT_EQ(sts, MFX_ERR_NONE);
 }
 
+// HEVC decoder asking for numThread codec threads, returns the number
+//   GetVideoParam reports or -1
+static int InitDecodeThreads(mfxSession *session, mfxU16 numThread) {
+    mfxVersion ver = {};
+    mfxStatus sts  = MFXInit(MFX_IMPL_SOFTWARE, &ver, session);
+    EXPECT_EQ(sts, MFX_ERR_NONE);
+    if (sts != MFX_ERR_NONE)
+        return -1;
+
+    mfxVideoParam mfxDecParams              = { 0 };
+    mfxDecParams.mfx.CodecId                = MFX_CODEC_HEVC;
+    mfxDecParams.mfx.NumThread              = numThread;
+    mfxDecParams.IOPattern                  = MFX_IOPATTERN_OUT_SYSTEM_MEMORY;
+    mfxDecParams.mfx.FrameInfo.FourCC       = MFX_FOURCC_I420;
+    mfxDecParams.mfx.FrameInfo.ChromaFormat = MFX_CHROMAFORMAT_YUV420;
+    mfxDecParams.mfx.FrameInfo.CropW        = 128;
+    mfxDecParams.mfx.FrameInfo.CropH        = 96;
+    mfxDecParams.mfx.FrameInfo.Width        = 128;
+    mfxDecParams.mfx.FrameInfo.Height       = 96;
+
+    sts = MFXVideoDECODE_Init(*session, &mfxDecParams);
+    EXPECT_EQ(sts, MFX_ERR_NONE);
+    if (sts != MFX_ERR_NONE)
+        return -1;
+
+    mfxVideoParam par = { 0 };
+    sts               = MFXVideoDECODE_GetVideoParam(*session, &par);
+    EXPECT_EQ(sts, MFX_ERR_NONE);
+    return (sts == MFX_ERR_NONE) ? par.mfx.NumThread : -1;
+}
+
+TEST(DecodeGetVideoParam, ExplicitNumThreadIsGranted) {
+    mfxSession session;
+    EXPECT_EQ(InitDecodeThreads(&session, 3), 3);
+    MFXClose(session);
+}
+
+// automatic requests share the thread budget with the codecs already
+//   open, and closing a decoder gives its threads back
+TEST(DecodeGetVideoParam, AutomaticNumThreadSharesBudget) {
+    mfxSession first, second, third;
+
+    int nFirst = InitDecodeThreads(&first, 0);
+    EXPECT_GE(nFirst, 1);
+
+    int nSecond = InitDecodeThreads(&second, 0);
+    EXPECT_GE(nSecond, 1);
+    EXPECT_LE(nSecond, nFirst);
+
+    MFXClose(second);
+    EXPECT_EQ(InitDecodeThreads(&third, 0), nSecond);
+
+    MFXClose(third);
+    MFXClose(first);
+}
+
 TEST(DecodeGetVideoParam, DecodeUninitializedReturnsNotInitialized) {
     mfxVersion ver = {};
     mfxSession session;
@@ -225,3 +319,222 @@ TEST(VPPGetVideoParam, NullParamsOutReturnsErrNull) {
     sts = MFXClose(session);
     EXPECT_EQ(sts, MFX_ERR_NONE);
 }
+
+TEST(GetEncodeStat, CountsEncodedFramesAndBits) {
+    mfxVersion ver = {};
+    mfxSession session;
+    mfxStatus sts = MFXInit(MFX_IMPL_SOFTWARE, &ver, &session);
+    ASSERT_EQ(sts, MFX_ERR_NONE);
+
+    mfxEncodeStat stat = {};
+    sts                = MFXVideoENCODE_GetEncodeStat(session, &stat);
+    EXPECT_EQ(sts, MFX_ERR_NOT_INITIALIZED);
+
+    mfxVideoParam mfxEncParams;
+    memset(&mfxEncParams, 0, sizeof(mfxEncParams));
+    mfxEncParams.mfx.CodecId                 = MFX_CODEC_JPEG;
+    mfxEncParams.mfx.FrameInfo.FourCC        = MFX_FOURCC_I420;
+    mfxEncParams.mfx.FrameInfo.ChromaFormat  = MFX_CHROMAFORMAT_YUV420;
+    mfxEncParams.mfx.FrameInfo.CropW         = 128;
+    mfxEncParams.mfx.FrameInfo.CropH         = 96;
+    mfxEncParams.mfx.FrameInfo.Width         = 128;
+    mfxEncParams.mfx.FrameInfo.Height        = 96;
+    mfxEncParams.mfx.FrameInfo.FrameRateExtN = 30;
+    mfxEncParams.mfx.FrameInfo.FrameRateExtD = 1;
+    mfxEncParams.IOPattern                   = MFX_IOPATTERN_IN_SYSTEM_MEMORY;
+
+    mfxU32 lumaSize = mfxEncParams.mfx.FrameInfo.Width * mfxEncParams.mfx.FrameInfo.Height;
+    std::vector<mfxU8> surfaceBuffer(lumaSize * 3 / 2, 0);
+
+    mfxFrameSurface1 encSurface = { 0 };
+    encSurface.Info             = mfxEncParams.mfx.FrameInfo;
+    encSurface.Data.Y           = surfaceBuffer.data();
+    encSurface.Data.U           = encSurface.Data.Y + lumaSize;
+    encSurface.Data.V           = encSurface.Data.U + lumaSize / 4;
+    encSurface.Data.Pitch       = mfxEncParams.mfx.FrameInfo.Width;
+
+    sts = MFXVideoENCODE_Init(session, &mfxEncParams);
+    ASSERT_EQ(sts, MFX_ERR_NONE);
+
+    std::vector<mfxU8> bsBuffer(lumaSize * 2);
+    mfxU64 nBytes   = 0;
+    mfxU32 nPackets = 0;
+
+    // 4 frames, then drain
+    for (int i = 0; i < 16; i++) {
+        mfxBitstream mfxBS = { 0 };
+        mfxBS.MaxLength    = (mfxU32)bsBuffer.size();
+        mfxBS.Data         = bsBuffer.data();
+
+        mfxSyncPoint syncp         = nullptr;
+        mfxFrameSurface1 *surface = (i < 4) ? &encSurface : nullptr;
+        sts = MFXVideoENCODE_EncodeFrameAsync(session, NULL, surface, &mfxBS, &syncp);
+        if (sts == MFX_ERR_MORE_DATA) {
+            if (!surface)
+                break;
+            continue;
+        }
+        ASSERT_EQ(sts, MFX_ERR_NONE);
+        sts = MFXVideoCORE_SyncOperation(session, syncp, 1000);
+        ASSERT_EQ(sts, MFX_ERR_NONE);
+
+        nBytes += mfxBS.DataLength;
+        nPackets++;
+    }
+    EXPECT_EQ(nPackets, 4u);
+
+    sts = MFXVideoENCODE_GetEncodeStat(session, &stat);
+    ASSERT_EQ(sts, MFX_ERR_NONE);
+    EXPECT_EQ(stat.NumFrame, nPackets);
+    EXPECT_EQ(stat.NumBit, nBytes * 8);
+    EXPECT_EQ(stat.NumCachedFrame, 0u);
+
+    MFXClose(session);
+}
+
+// mfxExtCpuStat attached to GetVideoParam() returns the counters and the
+//   per call times of the encoder
+TEST(GetEncodeStat, CpuStatReportsTimesAndPercentiles) {
+    mfxVersion ver = {};
+    mfxSession session;
+    mfxStatus sts = MFXInit(MFX_IMPL_SOFTWARE, &ver, &session);
+    ASSERT_EQ(sts, MFX_ERR_NONE);
+
+    mfxVideoParam mfxEncParams;
+    memset(&mfxEncParams, 0, sizeof(mfxEncParams));
+    mfxEncParams.mfx.CodecId                 = MFX_CODEC_JPEG;
+    mfxEncParams.mfx.FrameInfo.FourCC        = MFX_FOURCC_I420;
+    mfxEncParams.mfx.FrameInfo.ChromaFormat  = MFX_CHROMAFORMAT_YUV420;
+    mfxEncParams.mfx.FrameInfo.CropW         = 128;
+    mfxEncParams.mfx.FrameInfo.CropH         = 96;
+    mfxEncParams.mfx.FrameInfo.Width         = 128;
+    mfxEncParams.mfx.FrameInfo.Height        = 96;
+    mfxEncParams.mfx.FrameInfo.FrameRateExtN = 30;
+    mfxEncParams.mfx.FrameInfo.FrameRateExtD = 1;
+    mfxEncParams.IOPattern                   = MFX_IOPATTERN_IN_SYSTEM_MEMORY;
+
+    mfxU32 lumaSize = mfxEncParams.mfx.FrameInfo.Width * mfxEncParams.mfx.FrameInfo.Height;
+    std::vector<mfxU8> surfaceBuffer(lumaSize * 3 / 2, 0);
+
+    mfxFrameSurface1 encSurface = { 0 };
+    encSurface.Info             = mfxEncParams.mfx.FrameInfo;
+    encSurface.Data.Y           = surfaceBuffer.data();
+    encSurface.Data.U           = encSurface.Data.Y + lumaSize;
+    encSurface.Data.V           = encSurface.Data.U + lumaSize / 4;
+    encSurface.Data.Pitch       = mfxEncParams.mfx.FrameInfo.Width;
+
+    sts = MFXVideoENCODE_Init(session, &mfxEncParams);
+    ASSERT_EQ(sts, MFX_ERR_NONE);
+
+    std::vector<mfxU8> bsBuffer(lumaSize * 2);
+    mfxU64 nBytes   = 0;
+    mfxU32 nPackets = 0;
+    for (int i = 0; i < 32; i++) {
+        mfxBitstream mfxBS = { 0 };
+        mfxBS.MaxLength    = (mfxU32)bsBuffer.size();
+        mfxBS.Data         = bsBuffer.data();
+
+        mfxSyncPoint syncp        = nullptr;
+        mfxFrameSurface1 *surface = (i < 16) ? &encSurface : nullptr;
+        sts = MFXVideoENCODE_EncodeFrameAsync(session, NULL, surface, &mfxBS, &syncp);
+        if (sts == MFX_ERR_MORE_DATA) {
+            if (!surface)
+                break;
+            continue;
+        }
+        ASSERT_EQ(sts, MFX_ERR_NONE);
+        sts = MFXVideoCORE_SyncOperation(session, syncp, 1000);
+        ASSERT_EQ(sts, MFX_ERR_NONE);
+
+        nBytes += mfxBS.DataLength;
+        nPackets++;
+    }
+    EXPECT_EQ(nPackets, 16u);
+
+    mfxExtCpuStat cpuStat    = {};
+    cpuStat.Header.BufferId  = MFX_EXTBUFF_CPU_STAT;
+    cpuStat.Header.BufferSz  = sizeof(cpuStat);
+    mfxExtBuffer *extParam[] = { &cpuStat.Header };
+
+    mfxVideoParam par = { 0 };
+    par.ExtParam      = extParam;
+    par.NumExtParam   = 1;
+    sts               = MFXVideoENCODE_GetVideoParam(session, &par);
+    ASSERT_EQ(sts, MFX_ERR_NONE);
+
+    EXPECT_EQ(cpuStat.NumFrameIn, 16u);
+    EXPECT_EQ(cpuStat.NumFrameOut, nPackets);
+    EXPECT_EQ(cpuStat.NumCorruptFrame, 0u);
+    EXPECT_EQ(cpuStat.NumByte, nBytes);
+
+    // totals hold the largest call, CPU time is that of one thread
+    EXPECT_GT(cpuStat.WallTime, 0u);
+    EXPECT_GT(cpuStat.WallTimeMax, 0u);
+    EXPECT_LE(cpuStat.WallTimeMax, cpuStat.WallTime);
+    EXPECT_LE(cpuStat.CpuTimeMax, cpuStat.CpuTime);
+    EXPECT_LE(cpuStat.CpuTime, cpuStat.WallTime + 1000);
+
+    // percentiles are bucket lower bounds, so never above the largest call
+    EXPECT_LE(cpuStat.WallTimeP50, cpuStat.WallTimeP90);
+    EXPECT_LE(cpuStat.WallTimeP90, cpuStat.WallTimeP99);
+    EXPECT_LE(cpuStat.WallTimeP99, cpuStat.WallTimeMax);
+
+    MFXClose(session);
+}
+
+TEST(GetVPPStat, CountsProcessedFrames) {
+    mfxVersion ver = {};
+    mfxSession session;
+    mfxStatus sts = MFXInit(MFX_IMPL_SOFTWARE, &ver, &session);
+    ASSERT_EQ(sts, MFX_ERR_NONE);
+
+    mfxVPPStat stat = {};
+    sts             = MFXVideoVPP_GetVPPStat(session, &stat);
+    EXPECT_EQ(sts, MFX_ERR_NOT_INITIALIZED);
+
+    mfxVideoParam mfxVPPParams;
+    memset(&mfxVPPParams, 0, sizeof(mfxVPPParams));
+    mfxVPPParams.vpp.In.FourCC        = MFX_FOURCC_I420;
+    mfxVPPParams.vpp.In.ChromaFormat  = MFX_CHROMAFORMAT_YUV420;
+    mfxVPPParams.vpp.In.CropW         = 128;
+    mfxVPPParams.vpp.In.CropH         = 96;
+    mfxVPPParams.vpp.In.FrameRateExtN = 30;
+    mfxVPPParams.vpp.In.FrameRateExtD = 1;
+    mfxVPPParams.vpp.In.Width         = mfxVPPParams.vpp.In.CropW;
+    mfxVPPParams.vpp.In.Height        = mfxVPPParams.vpp.In.CropH;
+    mfxVPPParams.vpp.Out              = mfxVPPParams.vpp.In;
+    mfxVPPParams.IOPattern = MFX_IOPATTERN_IN_SYSTEM_MEMORY | MFX_IOPATTERN_OUT_SYSTEM_MEMORY;
+
+    sts = MFXVideoVPP_Init(session, &mfxVPPParams);
+    ASSERT_EQ(sts, MFX_ERR_NONE);
+
+    mfxU32 surfW = mfxVPPParams.vpp.In.Width;
+    mfxU32 surfH = mfxVPPParams.vpp.In.Height;
+    std::vector<mfxU8> VPPbuf(surfW * surfH * 3);
+
+    mfxFrameSurface1 vppSurfaces[2];
+    for (mfxU32 i = 0; i < 2; i++) {
+        vppSurfaces[i]            = { 0 };
+        vppSurfaces[i].Info       = mfxVPPParams.vpp.In;
+        vppSurfaces[i].Data.Y     = VPPbuf.data() + i * surfW * surfH * 3 / 2;
+        vppSurfaces[i].Data.U     = vppSurfaces[i].Data.Y + surfW * surfH;
+        vppSurfaces[i].Data.V     = vppSurfaces[i].Data.U + (surfW / 2) * (surfH / 2);
+        vppSurfaces[i].Data.Pitch = surfW;
+    }
+
+    const mfxU32 nFrames = 3;
+    for (mfxU32 i = 0; i < nFrames; i++) {
+        mfxSyncPoint syncp = nullptr;
+        sts = MFXVideoVPP_RunFrameVPPAsync(session, &vppSurfaces[0], &vppSurfaces[1], nullptr, &syncp);
+        ASSERT_EQ(sts, MFX_ERR_NONE);
+        sts = MFXVideoCORE_SyncOperation(session, syncp, 1000);
+        ASSERT_EQ(sts, MFX_ERR_NONE);
+    }
+
+    sts = MFXVideoVPP_GetVPPStat(session, &stat);
+    ASSERT_EQ(sts, MFX_ERR_NONE);
+    EXPECT_EQ(stat.NumFrame, nFrames);
+    EXPECT_EQ(stat.NumCachedFrame, 0u);
+
+    MFXClose(session);
+}
@@ -5,6 +5,7 @@
   ############################################################################*/
 
 #include <gtest/gtest.h>
+#include <vector>
 #include "vpl/mfxjpeg.h"
 #include "vpl/mfxvideo.h"
 
@@ -1212,6 +1213,129 @@ TEST(EncodeReset, NullSessionInReturnsInvalidHandle) {
     ASSERT_EQ(sts, MFX_ERR_INVALID_HANDLE);
 }
 
+// quality changes are applied to the running encoder, which keeps its
+//   statistics instead of starting over
+TEST(EncodeReset, QualityChangeKeepsRunningEncoder) {
+    mfxVersion ver = {};
+    mfxSession session;
+    mfxStatus sts = MFXInit(MFX_IMPL_SOFTWARE, &ver, &session);
+    ASSERT_EQ(sts, MFX_ERR_NONE);
+
+    mfxVideoParam mfxEncParams               = { 0 };
+    mfxEncParams.mfx.CodecId                 = MFX_CODEC_JPEG;
+    mfxEncParams.mfx.Quality                 = 10;
+    mfxEncParams.mfx.FrameInfo.FourCC        = MFX_FOURCC_I420;
+    mfxEncParams.mfx.FrameInfo.ChromaFormat  = MFX_CHROMAFORMAT_YUV420;
+    mfxEncParams.mfx.FrameInfo.CropW         = 128;
+    mfxEncParams.mfx.FrameInfo.CropH         = 96;
+    mfxEncParams.mfx.FrameInfo.Width         = 128;
+    mfxEncParams.mfx.FrameInfo.Height        = 96;
+    mfxEncParams.mfx.FrameInfo.FrameRateExtN = 30;
+    mfxEncParams.mfx.FrameInfo.FrameRateExtD = 1;
+    mfxEncParams.IOPattern                   = MFX_IOPATTERN_IN_SYSTEM_MEMORY;
+
+    // detail for the quantizer to remove
+    mfxU32 lumaSize = mfxEncParams.mfx.FrameInfo.Width * mfxEncParams.mfx.FrameInfo.Height;
+    std::vector<mfxU8> surfaceBuffer(lumaSize * 3 / 2, 128);
+    for (mfxU32 i = 0; i < lumaSize; i++)
+        surfaceBuffer[i] = static_cast<mfxU8>((i * 37) ^ (i / 128 * 11));
+
+    mfxFrameSurface1 encSurface = { 0 };
+    encSurface.Info             = mfxEncParams.mfx.FrameInfo;
+    encSurface.Data.Y           = surfaceBuffer.data();
+    encSurface.Data.U           = encSurface.Data.Y + lumaSize;
+    encSurface.Data.V           = encSurface.Data.U + lumaSize / 4;
+    encSurface.Data.Pitch       = mfxEncParams.mfx.FrameInfo.Width;
+
+    sts = MFXVideoENCODE_Init(session, &mfxEncParams);
+    ASSERT_EQ(sts, MFX_ERR_NONE);
+
+    std::vector<mfxU8> bsBuffer(lumaSize * 2);
+    mfxU32 sizes[2] = {};
+    for (int i = 0; i < 2; i++) {
+        if (i == 1) {
+            mfxEncParams.mfx.Quality = 95;
+            sts                      = MFXVideoENCODE_Reset(session, &mfxEncParams);
+            ASSERT_EQ(sts, MFX_ERR_NONE);
+        }
+
+        mfxBitstream mfxBS = { 0 };
+        mfxBS.MaxLength    = (mfxU32)bsBuffer.size();
+        mfxBS.Data         = bsBuffer.data();
+
+        mfxSyncPoint syncp = nullptr;
+        sts = MFXVideoENCODE_EncodeFrameAsync(session, NULL, &encSurface, &mfxBS, &syncp);
+        ASSERT_EQ(sts, MFX_ERR_NONE);
+        sts = MFXVideoCORE_SyncOperation(session, syncp, 1000);
+        ASSERT_EQ(sts, MFX_ERR_NONE);
+        sizes[i] = mfxBS.DataLength;
+    }
+    EXPECT_GT(sizes[1], sizes[0]);
+
+    mfxEncodeStat stat = {};
+    sts                = MFXVideoENCODE_GetEncodeStat(session, &stat);
+    ASSERT_EQ(sts, MFX_ERR_NONE);
+    EXPECT_EQ(stat.NumFrame, 2u);
+
+    MFXClose(session);
+}
+
+TEST(EncodeReset, PeakRateChangeReachesRunningEncoder) {
+    mfxVersion ver = {};
+    mfxSession session;
+    mfxStatus sts = MFXInit(MFX_IMPL_SOFTWARE, &ver, &session);
+    ASSERT_EQ(sts, MFX_ERR_NONE);
+
+    mfxVideoParam mfxEncParams;
+    memset(&mfxEncParams, 0, sizeof(mfxEncParams));
+    mfxEncParams.mfx.CodecId                 = MFX_CODEC_AVC;
+    mfxEncParams.mfx.TargetUsage             = MFX_TARGETUSAGE_BEST_SPEED;
+    mfxEncParams.mfx.RateControlMethod       = MFX_RATECONTROL_VBR;
+    mfxEncParams.mfx.TargetKbps              = 500;
+    mfxEncParams.mfx.GopRefDist              = 1;
+    mfxEncParams.mfx.FrameInfo.FourCC        = MFX_FOURCC_I420;
+    mfxEncParams.mfx.FrameInfo.ChromaFormat  = MFX_CHROMAFORMAT_YUV420;
+    mfxEncParams.mfx.FrameInfo.CropW         = 128;
+    mfxEncParams.mfx.FrameInfo.CropH         = 96;
+    mfxEncParams.mfx.FrameInfo.Width         = 128;
+    mfxEncParams.mfx.FrameInfo.Height        = 96;
+    mfxEncParams.mfx.FrameInfo.FrameRateExtN = 30;
+    mfxEncParams.mfx.FrameInfo.FrameRateExtD = 1;
+    mfxEncParams.IOPattern                   = MFX_IOPATTERN_IN_SYSTEM_MEMORY;
+    mfxEncParams.AsyncDepth                  = 1;
+
+    // MFX_ERR_UNSUPPORTED when the runtime was built without libx264
+    sts = MFXVideoENCODE_Init(session, &mfxEncParams);
+    if (sts == MFX_ERR_UNSUPPORTED) {
+        MFXClose(session);
+        GTEST_SKIP() << "runtime built without libx264";
+    }
+    ASSERT_EQ(sts, MFX_ERR_NONE);
+
+    mfxEncParams.mfx.MaxKbps        = 1000;
+    mfxEncParams.mfx.BufferSizeInKB = 100;
+    sts                             = MFXVideoENCODE_Reset(session, &mfxEncParams);
+    ASSERT_EQ(sts, MFX_ERR_NONE);
+
+    mfxVideoParam par = {};
+    sts               = MFXVideoENCODE_GetVideoParam(session, &par);
+    ASSERT_EQ(sts, MFX_ERR_NONE);
+    EXPECT_EQ(par.mfx.TargetKbps, 500);
+    EXPECT_EQ(par.mfx.MaxKbps, 1000);
+    EXPECT_EQ(par.mfx.BufferSizeInKB, 100);
+
+    // no peak rate, no VBV
+    mfxEncParams.mfx.MaxKbps = 0;
+    sts                      = MFXVideoENCODE_Reset(session, &mfxEncParams);
+    ASSERT_EQ(sts, MFX_ERR_NONE);
+    par = {};
+    sts = MFXVideoENCODE_GetVideoParam(session, &par);
+    ASSERT_EQ(sts, MFX_ERR_NONE);
+    EXPECT_EQ(par.mfx.MaxKbps, 0);
+
+    MFXClose(session);
+}
+
 //DecodeReset
 TEST(DecodeReset, ValidParamsInReturnsErrNone) {
     mfxVersion ver = {};
@@ -0,0 +1,131 @@
+/*############################################################################
+  # Copyright (C) 2020 Intel Corporation
+  #
+  # SPDX-License-Identifier: MIT
+  ############################################################################*/
+
+#include <gtest/gtest.h>
+#include <vector>
+#include "vpl/mfxcpu.h"
+#include "vpl/mfxvideo.h"
+
+/* Encode ladder
+   mfxExtCpuEncodeLadder attached in MFXVideoENCODE_Init() encodes extra
+   rungs from the same input, their packets come out through
+   mfxExtCpuLadderBitstreams attached to the bitstream, see vpl/mfxcpu.h
+
+*/
+
+// frame size from the SOF0 segment of a JPEG picture
+static bool GetJPEGSize(const mfxBitstream &bs, mfxU16 *width, mfxU16 *height) {
+    const mfxU8 *data = bs.Data + bs.DataOffset;
+    for (mfxU32 i = 0; i + 8 < bs.DataLength; i++) {
+        if (data[i] == 0xFF && data[i + 1] == 0xC0) {
+            *height = (mfxU16)((data[i + 5] << 8) | data[i + 6]);
+            *width  = (mfxU16)((data[i + 7] << 8) | data[i + 8]);
+            return true;
+        }
+    }
+    return false;
+}
+
+TEST(EncodeFrameAsync, LadderEncodesEveryRung) {
+    mfxVersion ver = {};
+    mfxSession session;
+    mfxStatus sts = MFXInit(MFX_IMPL_SOFTWARE, &ver, &session);
+    ASSERT_EQ(sts, MFX_ERR_NONE);
+
+    mfxCpuLadderRung rung        = {};
+    rung.Width                   = 64;
+    rung.Height                  = 64;
+    mfxExtCpuEncodeLadder ladder = {};
+    ladder.Header.BufferId       = MFX_EXTBUFF_CPU_ENCODE_LADDER;
+    ladder.Header.BufferSz       = sizeof(ladder);
+    ladder.NumRung               = 1;
+    ladder.Rung                  = &rung;
+    mfxExtBuffer *extParam[]     = { &ladder.Header };
+
+    mfxVideoParam mfxEncParams;
+    memset(&mfxEncParams, 0, sizeof(mfxEncParams));
+    mfxEncParams.mfx.CodecId                 = MFX_CODEC_JPEG;
+    mfxEncParams.mfx.FrameInfo.FourCC        = MFX_FOURCC_I420;
+    mfxEncParams.mfx.FrameInfo.ChromaFormat  = MFX_CHROMAFORMAT_YUV420;
+    mfxEncParams.mfx.FrameInfo.CropW         = 128;
+    mfxEncParams.mfx.FrameInfo.CropH         = 128;
+    mfxEncParams.mfx.FrameInfo.Width         = 128;
+    mfxEncParams.mfx.FrameInfo.Height        = 128;
+    mfxEncParams.mfx.FrameInfo.FrameRateExtN = 30;
+    mfxEncParams.mfx.FrameInfo.FrameRateExtD = 1;
+    mfxEncParams.IOPattern                   = MFX_IOPATTERN_IN_SYSTEM_MEMORY;
+    mfxEncParams.ExtParam                    = extParam;
+    mfxEncParams.NumExtParam                 = 1;
+
+    // a rung larger than the input is rejected
+    rung.Width = 256;
+    sts        = MFXVideoENCODE_Init(session, &mfxEncParams);
+    EXPECT_EQ(sts, MFX_ERR_INVALID_VIDEO_PARAM);
+    rung.Width = 64;
+
+    sts = MFXVideoENCODE_Init(session, &mfxEncParams);
+    ASSERT_EQ(sts, MFX_ERR_NONE);
+
+    mfxU32 lumaSize = 128 * 128;
+    std::vector<mfxU8> surfaceBuffer(lumaSize * 3 / 2, 128);
+    mfxFrameSurface1 surface = {};
+    surface.Info             = mfxEncParams.mfx.FrameInfo;
+    surface.Data.Y           = surfaceBuffer.data();
+    surface.Data.U           = surface.Data.Y + lumaSize;
+    surface.Data.V           = surface.Data.U + lumaSize / 4;
+    surface.Data.Pitch       = 128;
+
+    std::vector<mfxU8> topBuffer(128 * 128 * 4), rungBuffer(64 * 64 * 4);
+    mfxBitstream rungBS                = { 0 };
+    mfxBitstream *bitstreams[]         = { &rungBS };
+    mfxExtCpuLadderBitstreams ladderBS = {};
+    ladderBS.Header.BufferId           = MFX_EXTBUFF_CPU_LADDER_BITSTREAMS;
+    ladderBS.Header.BufferSz           = sizeof(ladderBS);
+    ladderBS.NumBitstream              = 1;
+    ladderBS.Bitstreams                = bitstreams;
+    mfxExtBuffer *bsExtParam[]         = { &ladderBS.Header };
+
+    mfxSyncPoint syncp = nullptr;
+    mfxU32 nPackets    = 0;
+    for (int i = 0; i < 4; i++) {
+        mfxBitstream topBS = { 0 };
+        topBS.MaxLength    = (mfxU32)topBuffer.size();
+        topBS.Data         = topBuffer.data();
+        topBS.ExtParam     = bsExtParam;
+        topBS.NumExtParam  = 1;
+        rungBS             = { 0 };
+        rungBS.MaxLength   = (mfxU32)rungBuffer.size();
+        rungBS.Data        = rungBuffer.data();
+
+        sts = MFXVideoENCODE_EncodeFrameAsync(session, nullptr, &surface, &topBS, &syncp);
+        if (sts == MFX_ERR_MORE_DATA)
+            continue;
+        ASSERT_EQ(sts, MFX_ERR_NONE);
+        sts = MFXVideoCORE_SyncOperation(session, syncp, 1000);
+        ASSERT_EQ(sts, MFX_ERR_NONE);
+
+        // both rungs get their picture from the same call
+        mfxU16 width = 0, height = 0;
+        ASSERT_TRUE(GetJPEGSize(topBS, &width, &height));
+        EXPECT_EQ(width, 128);
+        EXPECT_EQ(height, 128);
+        ASSERT_TRUE(GetJPEGSize(rungBS, &width, &height));
+        EXPECT_EQ(width, 64);
+        EXPECT_EQ(height, 64);
+        nPackets++;
+    }
+    EXPECT_EQ(nPackets, 4u);
+
+    mfxBitstream topBS = { 0 };
+    topBS.MaxLength    = (mfxU32)topBuffer.size();
+    topBS.Data         = topBuffer.data();
+
+    // JPEG holds no frames back, so draining has nothing left to output
+    sts = MFXVideoENCODE_EncodeFrameAsync(session, nullptr, nullptr, &topBS, &syncp);
+    EXPECT_EQ(sts, MFX_ERR_MORE_DATA);
+
+    MFXClose(session);
+}
@@ -0,0 +1,156 @@
+/*############################################################################
+  # Copyright (C) 2020 Intel Corporation
+  #
+  # SPDX-License-Identifier: MIT
+  ############################################################################*/
+
+#include <gtest/gtest.h>
+#include <vector>
+#include "api/test_bitstreams.h"
+#include "vpl/mfxvideo.h"
+
+/* Low latency decode
+   AsyncDepth 1 selects low latency mode, the decoder threads slices only
+   and outputs each frame from the call which sends it
+
+*/
+
+// send the 96x64 HEVC stream one complete frame at a time and return how
+//   many frames were sent before the first one came out, oneInOneOut is
+//   set if every later frame came out on the call that sent it
+// with query set the parameters go through Query before Init
+static int DecodeLatencyInFrames(mfxU16 asyncDepth,
+                                 mfxU16 numThread,
+                                 bool *oneInOneOut,
+                                 bool query = false) {
+    *oneInOneOut = false;
+
+    mfxVersion ver = {};
+    mfxSession session;
+    mfxStatus sts = MFXInit(MFX_IMPL_SOFTWARE, &ver, &session);
+    EXPECT_EQ(sts, MFX_ERR_NONE);
+    if (sts != MFX_ERR_NONE)
+        return -1;
+
+    mfxVideoParam mfxDecParams = { 0 };
+    mfxDecParams.mfx.CodecId   = MFX_CODEC_HEVC;
+    mfxDecParams.IOPattern     = MFX_IOPATTERN_OUT_SYSTEM_MEMORY;
+
+    mfxBitstream mfxBS = { 0 };
+    mfxBS.MaxLength = mfxBS.DataLength = test_bitstream_96x64_8bit_hevc::getlen();
+    mfxBS.Data                         = test_bitstream_96x64_8bit_hevc::getdata();
+
+    sts = MFXVideoDECODE_DecodeHeader(session, &mfxBS, &mfxDecParams);
+    EXPECT_EQ(sts, MFX_ERR_NONE);
+
+    mfxDecParams.AsyncDepth    = asyncDepth;
+    mfxDecParams.mfx.NumThread = numThread;
+
+    const mfxU32 nSurfNumDec = 16;
+    mfxU32 surfW             = mfxDecParams.mfx.FrameInfo.Width;
+    mfxU32 surfH             = mfxDecParams.mfx.FrameInfo.Height;
+    std::vector<mfxU8> DECoutbuf(surfW * surfH * 3 / 2 * nSurfNumDec);
+
+    std::vector<mfxFrameSurface1> decSurfaces(nSurfNumDec);
+    for (mfxU32 i = 0; i < nSurfNumDec; i++) {
+        decSurfaces[i]            = { 0 };
+        decSurfaces[i].Info       = mfxDecParams.mfx.FrameInfo;
+        decSurfaces[i].Data.Y     = DECoutbuf.data() + i * surfW * surfH * 3 / 2;
+        decSurfaces[i].Data.U     = decSurfaces[i].Data.Y + surfW * surfH;
+        decSurfaces[i].Data.V     = decSurfaces[i].Data.U + (surfW / 2) * (surfH / 2);
+        decSurfaces[i].Data.Pitch = surfW;
+    }
+
+    if (query) {
+        sts = MFXVideoDECODE_Query(session, &mfxDecParams, &mfxDecParams);
+        EXPECT_GE(sts, MFX_ERR_NONE);
+        EXPECT_EQ(mfxDecParams.AsyncDepth, asyncDepth);
+    }
+
+    sts = MFXVideoDECODE_Init(session, &mfxDecParams);
+    EXPECT_EQ(sts, MFX_ERR_NONE);
+
+    int latency    = -1;
+    bool lockstep  = true;
+    mfxU32 nFrames = 0;
+    for (mfxU32 pos = 0; sts == MFX_ERR_NONE && pos < test_bitstream_96x64_8bit_hevc::getlen();
+         nFrames++) {
+        mfxU32 next = test_bitstream_96x64_8bit_hevc::getpos(nFrames + 1);
+        if (!next)
+            next = test_bitstream_96x64_8bit_hevc::getlen();
+
+        mfxBS           = { 0 };
+        mfxBS.Data      = test_bitstream_96x64_8bit_hevc::getdata() + pos;
+        mfxBS.MaxLength = mfxBS.DataLength = next - pos;
+        mfxBS.DataFlag                     = MFX_BITSTREAM_COMPLETE_FRAME;
+        pos                                = next;
+
+        mfxFrameSurface1 *pmfxOutSurface = nullptr;
+        mfxSyncPoint syncp               = {};
+        do {
+            // surfaces still referenced by the decoder stay locked
+            mfxFrameSurface1 *work = nullptr;
+            for (mfxFrameSurface1 &surface : decSurfaces) {
+                if (!surface.Data.Locked) {
+                    work = &surface;
+                    break;
+                }
+            }
+            EXPECT_NE(work, nullptr);
+            if (!work)
+                break;
+
+            sts = MFXVideoDECODE_DecodeFrameAsync(session, &mfxBS, work, &pmfxOutSurface, &syncp);
+        } while (sts == MFX_ERR_MORE_SURFACE);
+
+        if (sts == MFX_ERR_MORE_DATA) {
+            if (latency >= 0)
+                lockstep = false;
+            sts = MFX_ERR_NONE;
+            continue;
+        }
+        EXPECT_EQ(sts, MFX_ERR_NONE);
+        if (sts != MFX_ERR_NONE)
+            break;
+
+        sts = MFXVideoCORE_SyncOperation(session, syncp, 1000);
+        EXPECT_EQ(sts, MFX_ERR_NONE);
+        if (latency < 0)
+            latency = nFrames + 1;
+    }
+
+    *oneInOneOut = lockstep && latency > 0;
+    MFXClose(session);
+    return latency;
+}
+
+// AsyncDepth 1 only threads slices, so the decoder does not hold frames
+//   back for its frame threads
+TEST(DecodeFrameAsync, LowLatencyModeHasNoThreadingDelay) {
+    bool oneInOneOut = false;
+
+    int threaded = DecodeLatencyInFrames(4, 3, &oneInOneOut);
+    ASSERT_GT(threaded, 0);
+
+    int low_latency = DecodeLatencyInFrames(1, 3, &oneInOneOut);
+    ASSERT_GT(low_latency, 0);
+    EXPECT_LT(low_latency, threaded);
+    EXPECT_TRUE(oneInOneOut);
+}
+
+// Query keeps AsyncDepth 0, so Init after it still threads frames at the
+//   default depth instead of switching to low latency
+TEST(DecodeFrameAsync, QueryKeepsDefaultAsyncDepth) {
+    bool oneInOneOut = false;
+
+    int queried = DecodeLatencyInFrames(0, 3, &oneInOneOut, true);
+    ASSERT_GT(queried, 0);
+
+    int threaded = DecodeLatencyInFrames(0, 3, &oneInOneOut);
+    ASSERT_GT(threaded, 0);
+    EXPECT_EQ(queried, threaded);
+
+    int low_latency = DecodeLatencyInFrames(1, 3, &oneInOneOut);
+    ASSERT_GT(low_latency, 0);
+    EXPECT_LT(low_latency, queried);
+}
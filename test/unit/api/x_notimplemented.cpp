@@ -91,63 +91,6 @@ TEST(GetPriority, AlwaysReturnsNotImplemented) {
     EXPECT_EQ(sts, MFX_ERR_NONE);
 }
 
-TEST(GetEncodeStat, AlwaysReturnsNotImplemented) {
-    mfxVersion ver = {};
-    mfxSession session;
-    mfxStatus sts = MFXInit(MFX_IMPL_SOFTWARE, &ver, &session);
-    ASSERT_EQ(sts, MFX_ERR_NONE);
-
-    sts = MFXVideoENCODE_GetEncodeStat(session, nullptr);
-    ASSERT_EQ(sts, MFX_ERR_NOT_IMPLEMENTED);
-
-    //free internal resources
-    sts = MFXClose(session);
-    EXPECT_EQ(sts, MFX_ERR_NONE);
-}
-
-TEST(GetDecodeStat, AlwaysReturnsNotImplemented) {
-    mfxVersion ver = {};
-    mfxSession session;
-    mfxStatus sts = MFXInit(MFX_IMPL_SOFTWARE, &ver, &session);
-    ASSERT_EQ(sts, MFX_ERR_NONE);
-
-    sts = MFXVideoDECODE_GetDecodeStat(session, nullptr);
-    ASSERT_EQ(sts, MFX_ERR_NOT_IMPLEMENTED);
-
-    //free internal resources
-    sts = MFXClose(session);
-    EXPECT_EQ(sts, MFX_ERR_NONE);
-}
-
-TEST(GetVPPStat, AlwaysReturnsNotImplemented) {
-    mfxVersion ver = {};
-    mfxSession session;
-    mfxStatus sts = MFXInit(MFX_IMPL_SOFTWARE, &ver, &session);
-    ASSERT_EQ(sts, MFX_ERR_NONE);
-
-    sts = MFXVideoVPP_GetVPPStat(session, nullptr);
-    ASSERT_EQ(sts, MFX_ERR_NOT_IMPLEMENTED);
-
-    //free internal resources
-    sts = MFXClose(session);
-    EXPECT_EQ(sts, MFX_ERR_NONE);
-}
-
-TEST(DecodeSetSkipMode, AlwaysReturnsNotImplemented) {
-    mfxVersion ver = {};
-    mfxSession session;
-    mfxStatus sts = MFXInit(MFX_IMPL_SOFTWARE, &ver, &session);
-    ASSERT_EQ(sts, MFX_ERR_NONE);
-
-    mfxSkipMode M = MFX_SKIPMODE_NOSKIP;
-    sts           = MFXVideoDECODE_SetSkipMode(session, M);
-    ASSERT_EQ(sts, MFX_ERR_NOT_IMPLEMENTED);
-
-    //free internal resources
-    sts = MFXClose(session);
-    EXPECT_EQ(sts, MFX_ERR_NONE);
-}
-
 TEST(DecodeGetPayload, AlwaysReturnsNotImplemented) {
     mfxVersion ver = {};
     mfxSession session;
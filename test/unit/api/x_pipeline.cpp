@@ -0,0 +1,201 @@
+/*############################################################################
+  # Copyright (C) 2020 Intel Corporation
+  #
+  # SPDX-License-Identifier: MIT
+  ############################################################################*/
+
+#include <gtest/gtest.h>
+#include <vector>
+#include "api/test_bitstreams.h"
+#include "vpl/mfxcpu.h"
+#include "vpl/mfxvideo.h"
+
+/* Transcode pipeline
+   mfxExtCpuPipeline attached in MFXVideoENCODE_Init() chains decode, VPP
+   and encode inside the session, see vpl/mfxcpu.h
+
+*/
+
+// transcode the HEVC stream to JPEG in the decode -> encode pipeline,
+//   packets are only taken out when decoding reports MFX_WRN_DEVICE_BUSY
+//   and after the stream is drained
+static void RunPipeline(mfxU16 asyncDepth, mfxU32 *nPackets, mfxU32 *nBusy) {
+    *nPackets = 0;
+    *nBusy    = 0;
+
+    mfxVersion ver = {};
+    mfxSession session;
+    mfxStatus sts = MFXInit(MFX_IMPL_SOFTWARE, &ver, &session);
+    ASSERT_EQ(sts, MFX_ERR_NONE);
+
+    mfxBitstream mfxBS = { 0 };
+    mfxBS.MaxLength = mfxBS.DataLength = test_bitstream_96x64_8bit_hevc::getlen();
+    mfxBS.Data                         = test_bitstream_96x64_8bit_hevc::getdata();
+
+    mfxVideoParam mfxDecParams;
+    memset(&mfxDecParams, 0, sizeof(mfxDecParams));
+    mfxDecParams.mfx.CodecId = MFX_CODEC_HEVC;
+    mfxDecParams.IOPattern   = MFX_IOPATTERN_OUT_SYSTEM_MEMORY;
+
+    sts = MFXVideoDECODE_DecodeHeader(session, &mfxBS, &mfxDecParams);
+    ASSERT_EQ(sts, MFX_ERR_NONE);
+    sts = MFXVideoDECODE_Init(session, &mfxDecParams);
+    ASSERT_EQ(sts, MFX_ERR_NONE);
+
+    mfxExtCpuPipeline pipeline = {};
+    pipeline.Header.BufferId   = MFX_EXTBUFF_CPU_PIPELINE;
+    pipeline.Header.BufferSz   = sizeof(pipeline);
+    pipeline.Enable            = 1;
+    mfxExtBuffer *extParam[]   = { &pipeline.Header };
+
+    mfxVideoParam mfxEncParams;
+    memset(&mfxEncParams, 0, sizeof(mfxEncParams));
+    mfxEncParams.mfx.CodecId          = MFX_CODEC_JPEG;
+    mfxEncParams.mfx.FrameInfo        = mfxDecParams.mfx.FrameInfo;
+    mfxEncParams.mfx.FrameInfo.FourCC = MFX_FOURCC_I420;
+    mfxEncParams.IOPattern            = MFX_IOPATTERN_IN_SYSTEM_MEMORY;
+    mfxEncParams.AsyncDepth           = asyncDepth;
+    mfxEncParams.ExtParam             = extParam;
+    mfxEncParams.NumExtParam          = 1;
+
+    sts = MFXVideoENCODE_Init(session, &mfxEncParams);
+    ASSERT_EQ(sts, MFX_ERR_NONE);
+
+    std::vector<mfxU8> bsBuffer(96 * 64 * 4);
+    mfxSyncPoint syncp = nullptr;
+    auto getPacket     = [&]() {
+        mfxBitstream encBS = { 0 };
+        encBS.MaxLength    = (mfxU32)bsBuffer.size();
+        encBS.Data         = bsBuffer.data();
+
+        mfxStatus encSts =
+            MFXVideoENCODE_EncodeFrameAsync(session, nullptr, nullptr, &encBS, &syncp);
+        if (encSts == MFX_ERR_NONE) {
+            encSts = MFXVideoCORE_SyncOperation(session, syncp, 1000);
+            EXPECT_GT(encBS.DataLength, 0u);
+            (*nPackets)++;
+        }
+        return encSts;
+    };
+
+    // decoded frames never come out, the whole stream goes in unless the
+    //   application has to take packets first
+    mfxBitstream *bs = &mfxBS;
+    for (;;) {
+        mfxFrameSurface1 *pmfxOutSurface = nullptr;
+        sts = MFXVideoDECODE_DecodeFrameAsync(session, bs, nullptr, &pmfxOutSurface, &syncp);
+        EXPECT_EQ(pmfxOutSurface, nullptr);
+        if (sts == MFX_WRN_DEVICE_BUSY) {
+            (*nBusy)++;
+            ASSERT_EQ(getPacket(), MFX_ERR_NONE);
+            continue;
+        }
+        ASSERT_EQ(sts, MFX_ERR_MORE_DATA);
+        if (!bs)
+            break;
+        EXPECT_EQ(mfxBS.DataLength, 0u);
+        bs = nullptr;
+    }
+
+    for (;;) {
+        sts = getPacket();
+        if (sts == MFX_ERR_MORE_DATA)
+            break;
+        ASSERT_EQ(sts, MFX_ERR_NONE);
+    }
+
+    mfxDecodeStat decStat = {};
+    sts                   = MFXVideoDECODE_GetDecodeStat(session, &decStat);
+    ASSERT_EQ(sts, MFX_ERR_NONE);
+    mfxEncodeStat encStat = {};
+    sts                   = MFXVideoENCODE_GetEncodeStat(session, &encStat);
+    ASSERT_EQ(sts, MFX_ERR_NONE);
+
+    EXPECT_GT(*nPackets, 0u);
+    EXPECT_EQ(decStat.NumFrame, *nPackets);
+    EXPECT_EQ(encStat.NumFrame, *nPackets);
+
+    MFXClose(session);
+}
+
+TEST(EncodeFrameAsync, PipelineEncodesEveryDecodedFrame) {
+    mfxU32 nPackets = 0;
+    mfxU32 nBusy    = 0;
+    RunPipeline(0, &nPackets, &nBusy);
+}
+
+// with AsyncDepth 1 the lanes take one frame at a time, so a packet is
+//   waiting before the third frame is decoded
+TEST(EncodeFrameAsync, PipelineStopsDecodingAtAsyncDepth) {
+    mfxU32 nPackets = 0;
+    mfxU32 nBusy    = 0;
+    RunPipeline(1, &nPackets, &nBusy);
+    EXPECT_GT(nBusy, 0u);
+    EXPECT_LE(nBusy, nPackets);
+}
+
+// the pipeline encodes one stream, VPP outputs beyond vpp.Out would have
+//   no encoder, in whichever order the two are initialized
+TEST(EncodeFrameAsync, PipelineRejectsMultiOutputVPP) {
+    mfxVersion ver = {};
+    mfxSession session;
+    mfxStatus sts = MFXInit(MFX_IMPL_SOFTWARE, &ver, &session);
+    ASSERT_EQ(sts, MFX_ERR_NONE);
+
+    mfxVideoParam mfxVPPParams        = { 0 };
+    mfxVPPParams.vpp.In.FourCC        = MFX_FOURCC_I420;
+    mfxVPPParams.vpp.In.ChromaFormat  = MFX_CHROMAFORMAT_YUV420;
+    mfxVPPParams.vpp.In.CropW         = 128;
+    mfxVPPParams.vpp.In.CropH         = 96;
+    mfxVPPParams.vpp.In.FrameRateExtN = 30;
+    mfxVPPParams.vpp.In.FrameRateExtD = 1;
+    mfxVPPParams.vpp.In.Width         = mfxVPPParams.vpp.In.CropW;
+    mfxVPPParams.vpp.In.Height        = mfxVPPParams.vpp.In.CropH;
+    mfxVPPParams.vpp.Out              = mfxVPPParams.vpp.In;
+    mfxVPPParams.IOPattern = MFX_IOPATTERN_IN_SYSTEM_MEMORY | MFX_IOPATTERN_OUT_SYSTEM_MEMORY;
+
+    mfxFrameInfo rung = {};
+    rung.Width        = 64;
+    rung.Height       = 48;
+
+    mfxExtCpuVPPOutputs outputs  = {};
+    outputs.Header.BufferId      = MFX_EXTBUFF_CPU_VPP_OUTPUTS;
+    outputs.Header.BufferSz      = sizeof(outputs);
+    outputs.NumOutput            = 1;
+    outputs.Output               = &rung;
+    mfxExtBuffer *vppExtParams[] = { &outputs.Header };
+    mfxVPPParams.ExtParam        = vppExtParams;
+    mfxVPPParams.NumExtParam     = 1;
+
+    mfxExtCpuPipeline pipeline   = {};
+    pipeline.Header.BufferId     = MFX_EXTBUFF_CPU_PIPELINE;
+    pipeline.Header.BufferSz     = sizeof(pipeline);
+    pipeline.Enable              = 1;
+    mfxExtBuffer *encExtParams[] = { &pipeline.Header };
+
+    mfxVideoParam mfxEncParams;
+    memset(&mfxEncParams, 0, sizeof(mfxEncParams));
+    mfxEncParams.mfx.CodecId   = MFX_CODEC_JPEG;
+    mfxEncParams.mfx.FrameInfo = mfxVPPParams.vpp.Out;
+    mfxEncParams.IOPattern     = MFX_IOPATTERN_IN_SYSTEM_MEMORY;
+    mfxEncParams.ExtParam      = encExtParams;
+    mfxEncParams.NumExtParam   = 1;
+
+    sts = MFXVideoVPP_Init(session, &mfxVPPParams);
+    ASSERT_EQ(sts, MFX_ERR_NONE);
+    sts = MFXVideoENCODE_Init(session, &mfxEncParams);
+    EXPECT_EQ(sts, MFX_ERR_INVALID_VIDEO_PARAM);
+    MFXVideoVPP_Close(session);
+
+    sts = MFXVideoENCODE_Init(session, &mfxEncParams);
+    ASSERT_EQ(sts, MFX_ERR_NONE);
+    sts = MFXVideoVPP_Init(session, &mfxVPPParams);
+    EXPECT_EQ(sts, MFX_ERR_INVALID_VIDEO_PARAM);
+
+    // a single output VPP is accepted
+    mfxVPPParams.NumExtParam = 0;
+    sts                      = MFXVideoVPP_Init(session, &mfxVPPParams);
+    EXPECT_EQ(sts, MFX_ERR_NONE);
+
+    MFXClose(session);
+}
@@ -184,6 +184,8 @@ TEST(DecodeQuery, PopulatedParamsInReturnsCorrected) {
     ASSERT_EQ(128, par.mfx.FrameInfo.Width);
     ASSERT_EQ(96, par.mfx.FrameInfo.Height);
     ASSERT_EQ(MFX_IOPATTERN_OUT_SYSTEM_MEMORY, par.IOPattern);
+    // 0 keeps the default depth, 1 would select low latency
+    ASSERT_EQ(0, par.AsyncDepth);
 
     sts = MFXClose(session);
     EXPECT_EQ(sts, MFX_ERR_NONE);
@@ -291,6 +293,7 @@ TEST(VPPQuery, PopulatedParamsInReturnsCorrected) {
     ASSERT_EQ(128, par.vpp.Out.Width);
     ASSERT_EQ(96, par.vpp.Out.Height);
     ASSERT_EQ(MFX_IOPATTERN_IN_SYSTEM_MEMORY | MFX_IOPATTERN_OUT_SYSTEM_MEMORY, par.IOPattern);
+    ASSERT_EQ(0, par.AsyncDepth);
 
     sts = MFXClose(session);
     EXPECT_EQ(sts, MFX_ERR_NONE);
@@ -5,6 +5,7 @@
   ############################################################################*/
 
 #include <gtest/gtest.h>
+#include "vpl/mfxcpu.h"
 #include "vpl/mfxvideo.h"
 
 /* QueryIOSurf Overview
@@ -52,6 +53,81 @@ TEST(EncodeQueryIOSurf, PopulatedParamsInReturnsRequest) {
     EXPECT_EQ(sts, MFX_ERR_NONE);
 }
 
+TEST(EncodeQueryIOSurf, HigherAsyncDepthSuggestsMoreSurfaces) {
+    mfxVersion ver = {};
+    mfxSession session;
+    mfxStatus sts = MFXInit(MFX_IMPL_SOFTWARE, &ver, &session);
+    ASSERT_EQ(sts, MFX_ERR_NONE);
+
+    mfxVideoParam mfxEncParams;
+    memset(&mfxEncParams, 0, sizeof(mfxEncParams));
+
+    mfxEncParams.mfx.CodecId          = MFX_CODEC_HEVC;
+    mfxEncParams.mfx.FrameInfo.Width  = 128;
+    mfxEncParams.mfx.FrameInfo.Height = 96;
+    mfxEncParams.AsyncDepth           = 1;
+
+    mfxFrameAllocRequest request1;
+    sts = MFXVideoENCODE_QueryIOSurf(session, &mfxEncParams, &request1);
+    ASSERT_EQ(sts, MFX_ERR_NONE);
+
+    mfxEncParams.AsyncDepth = 8;
+
+    mfxFrameAllocRequest request8;
+    sts = MFXVideoENCODE_QueryIOSurf(session, &mfxEncParams, &request8);
+    ASSERT_EQ(sts, MFX_ERR_NONE);
+    ASSERT_EQ(request8.NumFrameSuggested, request1.NumFrameSuggested + 7);
+
+    sts = MFXClose(session);
+    EXPECT_EQ(sts, MFX_ERR_NONE);
+}
+
+TEST(EncodeQueryIOSurf, LookAheadSuggestsMoreSurfaces) {
+    mfxVersion ver = {};
+    mfxSession session;
+    mfxStatus sts = MFXInit(MFX_IMPL_SOFTWARE, &ver, &session);
+    ASSERT_EQ(sts, MFX_ERR_NONE);
+
+    mfxVideoParam mfxEncParams;
+    memset(&mfxEncParams, 0, sizeof(mfxEncParams));
+
+    mfxEncParams.mfx.CodecId           = MFX_CODEC_HEVC;
+    mfxEncParams.mfx.RateControlMethod = MFX_RATECONTROL_VBR;
+    mfxEncParams.mfx.FrameInfo.Width   = 128;
+    mfxEncParams.mfx.FrameInfo.Height  = 96;
+
+    mfxFrameAllocRequest requestVBR;
+    sts = MFXVideoENCODE_QueryIOSurf(session, &mfxEncParams, &requestVBR);
+    ASSERT_EQ(sts, MFX_ERR_NONE);
+
+    mfxExtCodingOption2 co2  = {};
+    co2.Header.BufferId      = MFX_EXTBUFF_CODING_OPTION2;
+    co2.Header.BufferSz      = sizeof(co2);
+    co2.LookAheadDepth       = 20;
+    mfxExtBuffer *extParam[] = { &co2.Header };
+
+    mfxEncParams.mfx.RateControlMethod = MFX_RATECONTROL_LA;
+    mfxEncParams.NumExtParam           = 1;
+    mfxEncParams.ExtParam              = extParam;
+
+    mfxFrameAllocRequest requestLA;
+    sts = MFXVideoENCODE_QueryIOSurf(session, &mfxEncParams, &requestLA);
+    ASSERT_EQ(sts, MFX_ERR_NONE);
+    ASSERT_EQ(requestLA.NumFrameMin, requestVBR.NumFrameMin + 20);
+    ASSERT_EQ(requestLA.NumFrameSuggested, requestVBR.NumFrameSuggested + 20);
+
+    // same range as MFXVideoENCODE_Init()
+    co2.LookAheadDepth = 5;
+    sts                = MFXVideoENCODE_QueryIOSurf(session, &mfxEncParams, &requestLA);
+    ASSERT_EQ(sts, MFX_ERR_INVALID_VIDEO_PARAM);
+    co2.LookAheadDepth = 101;
+    sts                = MFXVideoENCODE_QueryIOSurf(session, &mfxEncParams, &requestLA);
+    ASSERT_EQ(sts, MFX_ERR_INVALID_VIDEO_PARAM);
+
+    sts = MFXClose(session);
+    EXPECT_EQ(sts, MFX_ERR_NONE);
+}
+
 TEST(EncodeQueryIOSurf, NullSessionReturnsInvalidHandle) {
     mfxStatus sts = MFXVideoENCODE_QueryIOSurf(0, nullptr, nullptr);
     ASSERT_EQ(sts, MFX_ERR_INVALID_HANDLE);
@@ -217,6 +293,55 @@ TEST(VPPQueryIOSurf, PopulatedParamsInReturnsRequest) {
     EXPECT_EQ(sts, MFX_ERR_NONE);
 }
 
+TEST(VPPQueryIOSurf, ExtraOutputsSuggestMoreOutSurfaces) {
+    mfxVersion ver = {};
+    mfxSession session;
+    mfxStatus sts = MFXInit(MFX_IMPL_SOFTWARE, &ver, &session);
+    ASSERT_EQ(sts, MFX_ERR_NONE);
+
+    mfxVideoParam par;
+    memset(&par, 0, sizeof(par));
+    par.vpp.In.FourCC       = MFX_FOURCC_I420;
+    par.vpp.In.ChromaFormat = MFX_CHROMAFORMAT_YUV420;
+    par.vpp.In.Width        = 128;
+    par.vpp.In.Height       = 96;
+    par.vpp.Out             = par.vpp.In;
+    par.IOPattern           = MFX_IOPATTERN_IN_SYSTEM_MEMORY | MFX_IOPATTERN_OUT_SYSTEM_MEMORY;
+    par.AsyncDepth          = 2;
+
+    mfxFrameAllocRequest single[2] = {};
+    sts                            = MFXVideoVPP_QueryIOSurf(session, &par, single);
+    ASSERT_EQ(sts, MFX_ERR_NONE);
+
+    mfxFrameInfo rungs[2] = { par.vpp.Out, par.vpp.Out };
+    rungs[0].Width        = 64;
+    rungs[0].Height       = 48;
+    rungs[1].Width        = 32;
+    rungs[1].Height       = 24;
+
+    mfxExtCpuVPPOutputs outputs = {};
+    outputs.Header.BufferId     = MFX_EXTBUFF_CPU_VPP_OUTPUTS;
+    outputs.Header.BufferSz     = sizeof(outputs);
+    outputs.NumOutput           = 2;
+    outputs.Output              = rungs;
+    mfxExtBuffer *extParam[]    = { &outputs.Header };
+    par.ExtParam                = extParam;
+    par.NumExtParam             = 1;
+
+    mfxFrameAllocRequest multi[2] = {};
+
+    sts = MFXVideoVPP_QueryIOSurf(session, &par, multi);
+    ASSERT_EQ(sts, MFX_ERR_NONE);
+
+    // one surface of every output per frame in flight, input unchanged
+    EXPECT_EQ(multi[0].NumFrameSuggested, single[0].NumFrameSuggested);
+    EXPECT_EQ(multi[1].NumFrameMin, 3 * single[1].NumFrameMin);
+    EXPECT_EQ(multi[1].NumFrameSuggested, 3 * single[1].NumFrameSuggested);
+
+    sts = MFXClose(session);
+    EXPECT_EQ(sts, MFX_ERR_NONE);
+}
+
 TEST(VPPQueryIOSurf, NullSessionReturnsInvalidHandle) {
     mfxStatus sts = MFXVideoVPP_QueryIOSurf(0, nullptr, nullptr);
     ASSERT_EQ(sts, MFX_ERR_INVALID_HANDLE);
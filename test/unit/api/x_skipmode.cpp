@@ -0,0 +1,138 @@
+/*############################################################################
+  # Copyright (C) 2020 Intel Corporation
+  #
+  # SPDX-License-Identifier: MIT
+  ############################################################################*/
+
+#include <gtest/gtest.h>
+#include <vector>
+#include "api/test_bitstreams.h"
+#include "vpl/mfxvideo.h"
+
+/* SetSkipMode overview
+   MFXVideoDECODE_SetSkipMode() moves the decoder along a ladder of skip
+   levels, from decoding every frame to decoding key frames only
+
+*/
+
+TEST(DecodeSetSkipMode, StopsAtEitherEndOfLadder) {
+    mfxVersion ver = {};
+    mfxSession session;
+    mfxStatus sts = MFXInit(MFX_IMPL_SOFTWARE, &ver, &session);
+    ASSERT_EQ(sts, MFX_ERR_NONE);
+
+    sts = MFXVideoDECODE_SetSkipMode(session, MFX_SKIPMODE_MORE);
+    EXPECT_EQ(sts, MFX_ERR_NOT_INITIALIZED);
+
+    mfxVideoParam mfxDecParams = { 0 };
+    mfxDecParams.mfx.CodecId   = MFX_CODEC_HEVC;
+    mfxDecParams.IOPattern     = MFX_IOPATTERN_OUT_SYSTEM_MEMORY;
+
+    mfxBitstream mfxBS = { 0 };
+    mfxBS.MaxLength = mfxBS.DataLength = test_bitstream_96x64_8bit_hevc::getlen();
+    mfxBS.Data                         = test_bitstream_96x64_8bit_hevc::getdata();
+
+    sts = MFXVideoDECODE_DecodeHeader(session, &mfxBS, &mfxDecParams);
+    ASSERT_EQ(sts, MFX_ERR_NONE);
+    sts = MFXVideoDECODE_Init(session, &mfxDecParams);
+    ASSERT_EQ(sts, MFX_ERR_NONE);
+
+    EXPECT_EQ(MFXVideoDECODE_SetSkipMode(session, MFX_SKIPMODE_LESS), MFX_WRN_VALUE_NOT_CHANGED);
+    EXPECT_EQ(MFXVideoDECODE_SetSkipMode(session, MFX_SKIPMODE_NOSKIP), MFX_WRN_VALUE_NOT_CHANGED);
+
+    int steps = 0;
+    while (MFXVideoDECODE_SetSkipMode(session, MFX_SKIPMODE_MORE) == MFX_ERR_NONE && steps < 100)
+        steps++;
+    EXPECT_GT(steps, 1);
+    EXPECT_LT(steps, 100);
+
+    EXPECT_EQ(MFXVideoDECODE_SetSkipMode(session, MFX_SKIPMODE_LESS), MFX_ERR_NONE);
+    EXPECT_EQ(MFXVideoDECODE_SetSkipMode(session, MFX_SKIPMODE_NOSKIP), MFX_ERR_NONE);
+
+    sts = MFXClose(session);
+    EXPECT_EQ(sts, MFX_ERR_NONE);
+}
+
+// at the top of the ladder only key frames are decoded, the rest must
+//   show up as skipped
+TEST(DecodeSetSkipMode, SkippedFramesAreCountedInDecodeStat) {
+    mfxVersion ver = {};
+    mfxSession session;
+    mfxStatus sts = MFXInit(MFX_IMPL_SOFTWARE, &ver, &session);
+    ASSERT_EQ(sts, MFX_ERR_NONE);
+
+    mfxVideoParam mfxDecParams = { 0 };
+    mfxDecParams.mfx.CodecId   = MFX_CODEC_HEVC;
+    mfxDecParams.IOPattern     = MFX_IOPATTERN_OUT_SYSTEM_MEMORY;
+
+    mfxBitstream mfxBS = { 0 };
+    mfxBS.MaxLength = mfxBS.DataLength = test_bitstream_96x64_8bit_hevc::getlen();
+    mfxBS.Data                         = test_bitstream_96x64_8bit_hevc::getdata();
+
+    sts = MFXVideoDECODE_DecodeHeader(session, &mfxBS, &mfxDecParams);
+    ASSERT_EQ(sts, MFX_ERR_NONE);
+
+    const mfxU32 nSurfNumDec = 16;
+    mfxU32 surfW             = mfxDecParams.mfx.FrameInfo.Width;
+    mfxU32 surfH             = mfxDecParams.mfx.FrameInfo.Height;
+    std::vector<mfxU8> DECoutbuf(surfW * surfH * 3 / 2 * nSurfNumDec);
+
+    std::vector<mfxFrameSurface1> decSurfaces(nSurfNumDec);
+    for (mfxU32 i = 0; i < nSurfNumDec; i++) {
+        decSurfaces[i]            = { 0 };
+        decSurfaces[i].Info       = mfxDecParams.mfx.FrameInfo;
+        decSurfaces[i].Data.Y     = DECoutbuf.data() + i * surfW * surfH * 3 / 2;
+        decSurfaces[i].Data.U     = decSurfaces[i].Data.Y + surfW * surfH;
+        decSurfaces[i].Data.V     = decSurfaces[i].Data.U + (surfW / 2) * (surfH / 2);
+        decSurfaces[i].Data.Pitch = surfW;
+    }
+
+    sts = MFXVideoDECODE_Init(session, &mfxDecParams);
+    ASSERT_EQ(sts, MFX_ERR_NONE);
+
+    while (MFXVideoDECODE_SetSkipMode(session, MFX_SKIPMODE_MORE) == MFX_ERR_NONE) {
+    }
+
+    mfxBitstream *bsPtr = &mfxBS;
+    for (int i = 0; i < 64; i++) {
+        mfxFrameSurface1 *work = nullptr;
+        for (mfxFrameSurface1 &surface : decSurfaces) {
+            if (!surface.Data.Locked) {
+                work = &surface;
+                break;
+            }
+        }
+        ASSERT_NE(work, nullptr);
+
+        mfxFrameSurface1 *pmfxOutSurface = nullptr;
+        mfxSyncPoint syncp               = {};
+        sts = MFXVideoDECODE_DecodeFrameAsync(session, bsPtr, work, &pmfxOutSurface, &syncp);
+        if (sts == MFX_ERR_MORE_DATA) {
+            if (!bsPtr)
+                break; // drained
+            bsPtr = nullptr;
+            continue;
+        }
+        if (sts == MFX_ERR_MORE_SURFACE)
+            continue;
+        ASSERT_EQ(sts, MFX_ERR_NONE);
+
+        sts = MFXVideoCORE_SyncOperation(session, syncp, 1000);
+        ASSERT_EQ(sts, MFX_ERR_NONE);
+    }
+
+    mfxU32 nFrames = 1;
+    while (test_bitstream_96x64_8bit_hevc::getpos(nFrames))
+        nFrames++;
+
+    mfxDecodeStat stat = {};
+    sts                = MFXVideoDECODE_GetDecodeStat(session, &stat);
+    ASSERT_EQ(sts, MFX_ERR_NONE);
+    EXPECT_GE(stat.NumFrame, 1u);
+    EXPECT_GT(stat.NumSkippedFrame, 0u);
+    EXPECT_EQ(stat.NumFrame + stat.NumSkippedFrame, nFrames);
+    EXPECT_EQ(stat.NumCachedFrame, 0u);
+
+    sts = MFXClose(session);
+    EXPECT_EQ(sts, MFX_ERR_NONE);
+}
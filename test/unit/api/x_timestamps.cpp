@@ -0,0 +1,97 @@
+/*############################################################################
+  # Copyright (C) 2020 Intel Corporation
+  #
+  # SPDX-License-Identifier: MIT
+  ############################################################################*/
+
+#include <gtest/gtest.h>
+#include <algorithm>
+#include <vector>
+#include "vpl/mfxvideo.h"
+
+/* Encode timestamps overview
+   packets carry the TimeStamp of the surface they were encoded from and
+   a DecodeTimeStamp in decode order, both on the 90 kHz MFX clock
+
+*/
+
+TEST(EncodeFrameAsync, BitstreamDecodeTimestampsIncrease) {
+    mfxVersion ver = {};
+    mfxSession session;
+    mfxStatus sts = MFXInit(MFX_IMPL_SOFTWARE, &ver, &session);
+    ASSERT_EQ(sts, MFX_ERR_NONE);
+
+    mfxVideoParam mfxEncParams;
+    memset(&mfxEncParams, 0, sizeof(mfxEncParams));
+    mfxEncParams.mfx.CodecId                 = MFX_CODEC_HEVC;
+    mfxEncParams.mfx.GopPicSize              = 30;
+    mfxEncParams.mfx.GopRefDist              = 4;
+    mfxEncParams.mfx.TargetKbps              = 1000;
+    mfxEncParams.mfx.FrameInfo.FourCC        = MFX_FOURCC_I420;
+    mfxEncParams.mfx.FrameInfo.ChromaFormat  = MFX_CHROMAFORMAT_YUV420;
+    mfxEncParams.mfx.FrameInfo.CropW         = 128;
+    mfxEncParams.mfx.FrameInfo.CropH         = 96;
+    mfxEncParams.mfx.FrameInfo.Width         = 128;
+    mfxEncParams.mfx.FrameInfo.Height        = 96;
+    mfxEncParams.mfx.FrameInfo.FrameRateExtN = 30;
+    mfxEncParams.mfx.FrameInfo.FrameRateExtD = 1;
+    mfxEncParams.IOPattern                   = MFX_IOPATTERN_IN_SYSTEM_MEMORY;
+
+    sts = MFXVideoENCODE_Init(session, &mfxEncParams);
+    ASSERT_EQ(sts, MFX_ERR_NONE);
+
+    mfxU32 lumaSize = 128 * 96;
+    std::vector<mfxU8> surfaceBuffer(lumaSize * 3 / 2, 128);
+    mfxFrameSurface1 surface = {};
+    surface.Info             = mfxEncParams.mfx.FrameInfo;
+    surface.Data.Y           = surfaceBuffer.data();
+    surface.Data.U           = surface.Data.Y + lumaSize;
+    surface.Data.V           = surface.Data.U + lumaSize / 4;
+    surface.Data.Pitch       = 128;
+
+    std::vector<mfxU8> bsBuffer(lumaSize * 4);
+    std::vector<mfxU64> timeStamps;
+    mfxI64 lastDTS     = 0;
+    mfxSyncPoint syncp = nullptr;
+
+    // 90 kHz, one frame at 30 fps is 3000
+    const int nFrames = 30;
+    for (int i = 0; i <= nFrames; i++) {
+        memset(surfaceBuffer.data(), i * 8, lumaSize);
+        surface.Data.TimeStamp = 900000 + i * 3000;
+
+        do {
+            mfxBitstream mfxBS = { 0 };
+            mfxBS.MaxLength    = (mfxU32)bsBuffer.size();
+            mfxBS.Data         = bsBuffer.data();
+
+            sts = MFXVideoENCODE_EncodeFrameAsync(session,
+                                                  nullptr,
+                                                  (i < nFrames) ? &surface : nullptr,
+                                                  &mfxBS,
+                                                  &syncp);
+            if (sts == MFX_ERR_NONE) {
+                sts = MFXVideoCORE_SyncOperation(session, syncp, 10000);
+                ASSERT_EQ(sts, MFX_ERR_NONE);
+
+                // decode order, never after the picture is shown
+                ASSERT_NE(mfxBS.DecodeTimeStamp, (mfxI64)MFX_TIMESTAMP_UNKNOWN);
+                EXPECT_LE(mfxBS.DecodeTimeStamp, (mfxI64)mfxBS.TimeStamp);
+                if (!timeStamps.empty())
+                    EXPECT_GT(mfxBS.DecodeTimeStamp, lastDTS);
+                lastDTS = mfxBS.DecodeTimeStamp;
+                timeStamps.push_back(mfxBS.TimeStamp);
+            }
+        } while (i == nFrames && sts == MFX_ERR_NONE);
+        if (sts != MFX_ERR_NONE)
+            ASSERT_EQ(sts, MFX_ERR_MORE_DATA);
+    }
+
+    // time stamps come back unchanged, not in time base units
+    ASSERT_EQ(timeStamps.size(), (size_t)nFrames);
+    std::sort(timeStamps.begin(), timeStamps.end());
+    for (int i = 0; i < nFrames; i++)
+        EXPECT_EQ(timeStamps[i], (mfxU64)(900000 + i * 3000));
+
+    MFXClose(session);
+}
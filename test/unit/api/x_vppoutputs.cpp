@@ -0,0 +1,162 @@
+/*############################################################################
+  # Copyright (C) 2020 Intel Corporation
+  #
+  # SPDX-License-Identifier: MIT
+  ############################################################################*/
+
+#include <gtest/gtest.h>
+#include <vector>
+#include "vpl/mfxcpu.h"
+#include "vpl/mfxvideo.h"
+
+/* VPP outputs
+   mfxExtCpuVPPOutputs attached in MFXVideoVPP_Init() adds scaled outputs,
+   RunFrameVPPAsync() fills them from mfxExtCpuVPPOutSurfaces attached to
+   surface_out, see vpl/mfxcpu.h
+
+*/
+
+TEST(RunFrameVPPAsync, MultiOutputProducesEveryRung) {
+    mfxVersion ver = {};
+    mfxSession session;
+    mfxStatus sts = MFXInit(MFX_IMPL_SOFTWARE, &ver, &session);
+    ASSERT_EQ(sts, MFX_ERR_NONE);
+
+    mfxVideoParam mfxVPPParams;
+    memset(&mfxVPPParams, 0, sizeof(mfxVPPParams));
+    mfxVPPParams.vpp.In.FourCC        = MFX_FOURCC_I420;
+    mfxVPPParams.vpp.In.ChromaFormat  = MFX_CHROMAFORMAT_YUV420;
+    mfxVPPParams.vpp.In.CropW         = 128;
+    mfxVPPParams.vpp.In.CropH         = 96;
+    mfxVPPParams.vpp.In.FrameRateExtN = 30;
+    mfxVPPParams.vpp.In.FrameRateExtD = 1;
+    mfxVPPParams.vpp.In.Width         = mfxVPPParams.vpp.In.CropW;
+    mfxVPPParams.vpp.In.Height        = mfxVPPParams.vpp.In.CropH;
+    mfxVPPParams.vpp.Out              = mfxVPPParams.vpp.In;
+    mfxVPPParams.IOPattern = MFX_IOPATTERN_IN_SYSTEM_MEMORY | MFX_IOPATTERN_OUT_SYSTEM_MEMORY;
+
+    // smallest first, the runtime orders the cascade itself
+    mfxFrameInfo rungs[2] = {};
+    rungs[0].Width        = 32;
+    rungs[0].Height       = 24;
+    rungs[1].Width        = 64;
+    rungs[1].Height       = 48;
+
+    mfxExtCpuVPPOutputs outputs = {};
+    outputs.Header.BufferId     = MFX_EXTBUFF_CPU_VPP_OUTPUTS;
+    outputs.Header.BufferSz     = sizeof(outputs);
+    outputs.NumOutput           = 2;
+    outputs.Output              = rungs;
+    mfxExtBuffer *extParams[]   = { &outputs.Header };
+    mfxVPPParams.ExtParam       = extParams;
+    mfxVPPParams.NumExtParam    = 1;
+
+    sts = MFXVideoVPP_Init(session, &mfxVPPParams);
+    ASSERT_EQ(sts, MFX_ERR_NONE);
+
+    // flat input stays flat at every size
+    std::vector<mfxU8> inBuf(128 * 96 * 3 / 2, 200);
+    mfxFrameSurface1 surfIn = {};
+    surfIn.Info             = mfxVPPParams.vpp.In;
+    surfIn.Data.Y           = inBuf.data();
+    surfIn.Data.U           = surfIn.Data.Y + 128 * 96;
+    surfIn.Data.V           = surfIn.Data.U + 64 * 48;
+    surfIn.Data.Pitch       = 128;
+    surfIn.Data.TimeStamp   = 222222;
+
+    const mfxU16 outW[3] = { 128, 32, 64 };
+    const mfxU16 outH[3] = { 96, 24, 48 };
+    std::vector<mfxU8> outBuf[3];
+    mfxFrameSurface1 surfOut[3] = {};
+    for (int i = 0; i < 3; i++) {
+        outBuf[i].assign(outW[i] * outH[i] * 3 / 2, 0);
+        surfOut[i].Info        = mfxVPPParams.vpp.Out;
+        surfOut[i].Info.Width  = outW[i];
+        surfOut[i].Info.Height = outH[i];
+        surfOut[i].Info.CropW  = outW[i];
+        surfOut[i].Info.CropH  = outH[i];
+        surfOut[i].Data.Y      = outBuf[i].data();
+        surfOut[i].Data.U      = surfOut[i].Data.Y + outW[i] * outH[i];
+        surfOut[i].Data.V      = surfOut[i].Data.U + (outW[i] / 2) * (outH[i] / 2);
+        surfOut[i].Data.Pitch  = outW[i];
+    }
+
+    mfxFrameSurface1 *rungSurfaces[2]   = { &surfOut[1], &surfOut[2] };
+    mfxExtCpuVPPOutSurfaces outSurfaces = {};
+    outSurfaces.Header.BufferId         = MFX_EXTBUFF_CPU_VPP_OUT_SURFACES;
+    outSurfaces.Header.BufferSz         = sizeof(outSurfaces);
+    outSurfaces.NumSurface              = 2;
+    outSurfaces.Surfaces                = rungSurfaces;
+    mfxExtBuffer *surfExtParams[]       = { &outSurfaces.Header };
+    surfOut[0].Data.ExtParam            = surfExtParams;
+    surfOut[0].Data.NumExtParam         = 1;
+
+    mfxSyncPoint syncp = nullptr;
+    sts = MFXVideoVPP_RunFrameVPPAsync(session, &surfIn, &surfOut[0], nullptr, &syncp);
+    ASSERT_EQ(sts, MFX_ERR_NONE);
+    sts = MFXVideoCORE_SyncOperation(session, syncp, 1000);
+    ASSERT_EQ(sts, MFX_ERR_NONE);
+
+    for (int i = 0; i < 3; i++) {
+        EXPECT_EQ(surfOut[i].Info.CropW, outW[i]);
+        EXPECT_EQ(surfOut[i].Info.CropH, outH[i]);
+        EXPECT_EQ(surfOut[i].Data.TimeStamp, 222222);
+        EXPECT_NEAR(outBuf[i][0], 200, 2);
+        EXPECT_NEAR(outBuf[i][outW[i] * outH[i] - 1], 200, 2);
+    }
+
+    // extra outputs may not be larger than vpp.Out
+    MFXVideoVPP_Close(session);
+    rungs[1].Width  = 256;
+    rungs[1].Height = 192;
+    sts             = MFXVideoVPP_Init(session, &mfxVPPParams);
+    EXPECT_EQ(sts, MFX_ERR_INVALID_VIDEO_PARAM);
+
+    MFXClose(session);
+}
+
+// VPL_VPP_MAX_OUTPUTS, 8 unless overridden when building the runtime
+TEST(RunFrameVPPAsync, MultiOutputHonorsMaxOutputs) {
+    mfxVersion ver = {};
+    mfxSession session;
+    mfxStatus sts = MFXInit(MFX_IMPL_SOFTWARE, &ver, &session);
+    ASSERT_EQ(sts, MFX_ERR_NONE);
+
+    mfxVideoParam mfxVPPParams        = { 0 };
+    mfxVPPParams.vpp.In.FourCC        = MFX_FOURCC_I420;
+    mfxVPPParams.vpp.In.ChromaFormat  = MFX_CHROMAFORMAT_YUV420;
+    mfxVPPParams.vpp.In.CropW         = 128;
+    mfxVPPParams.vpp.In.CropH         = 96;
+    mfxVPPParams.vpp.In.FrameRateExtN = 30;
+    mfxVPPParams.vpp.In.FrameRateExtD = 1;
+    mfxVPPParams.vpp.In.Width         = mfxVPPParams.vpp.In.CropW;
+    mfxVPPParams.vpp.In.Height        = mfxVPPParams.vpp.In.CropH;
+    mfxVPPParams.vpp.Out              = mfxVPPParams.vpp.In;
+    mfxVPPParams.IOPattern = MFX_IOPATTERN_IN_SYSTEM_MEMORY | MFX_IOPATTERN_OUT_SYSTEM_MEMORY;
+
+    const mfxU16 maxOutputs = 8;
+    std::vector<mfxFrameInfo> rungs(maxOutputs + 1);
+    for (mfxFrameInfo &rung : rungs) {
+        rung.Width  = 32;
+        rung.Height = 24;
+    }
+
+    mfxExtCpuVPPOutputs outputs = {};
+    outputs.Header.BufferId     = MFX_EXTBUFF_CPU_VPP_OUTPUTS;
+    outputs.Header.BufferSz     = sizeof(outputs);
+    outputs.NumOutput           = maxOutputs;
+    outputs.Output              = rungs.data();
+    mfxExtBuffer *extParams[]   = { &outputs.Header };
+    mfxVPPParams.ExtParam       = extParams;
+    mfxVPPParams.NumExtParam    = 1;
+
+    sts = MFXVideoVPP_Init(session, &mfxVPPParams);
+    EXPECT_EQ(sts, MFX_ERR_NONE);
+    MFXVideoVPP_Close(session);
+
+    outputs.NumOutput = maxOutputs + 1;
+    sts               = MFXVideoVPP_Init(session, &mfxVPPParams);
+    EXPECT_EQ(sts, MFX_ERR_INVALID_VIDEO_PARAM);
+
+    MFXClose(session);
+}
@@ -5,6 +5,8 @@
   ############################################################################*/
 
 #include <gtest/gtest.h>
+#include <cstdint>
+#include <vector>
 #include "api/test_bitstreams.h"
 #include "vpl/mfxjpeg.h"
 #include "vpl/mfxvideo.h"
@@ -226,6 +228,7 @@ TEST(EncodeFrameAsync, EncCtrlReturnsErrInvalidVideoParam) {
     mfxI32 nEncSurfIdx = 0;
     mfxSyncPoint syncp;
 
+    // per-frame QP needs CQP rate control, which JPEG does not have
     mfxEncodeCtrl ctrl = { 0 };
     ctrl.QP            = 1;
 
@@ -235,6 +238,29 @@ TEST(EncodeFrameAsync, EncCtrlReturnsErrInvalidVideoParam) {
 
     ASSERT_EQ(sts, MFX_ERR_INVALID_VIDEO_PARAM);
 
+    ctrl.QP             = 0;
+    ctrl.MfxNalUnitType = 1;
+    sts =
+        MFXVideoENCODE_EncodeFrameAsync(session, &ctrl, &encSurfaces[nEncSurfIdx], &mfxBS, &syncp);
+    ASSERT_EQ(sts, MFX_ERR_INVALID_VIDEO_PARAM);
+
+    // ROI are only taken by encoders which have QP offsets
+    mfxExtEncoderROI roi     = {};
+    roi.Header.BufferId      = MFX_EXTBUFF_ENCODER_ROI;
+    roi.Header.BufferSz      = sizeof(roi);
+    roi.ROIMode              = MFX_ROI_MODE_QP_DELTA;
+    roi.NumROI               = 1;
+    roi.ROI[0].Right         = 64;
+    roi.ROI[0].Bottom        = 48;
+    roi.ROI[0].DeltaQP       = -10;
+    mfxExtBuffer *extParam[] = { &roi.Header };
+    ctrl                     = { 0 };
+    ctrl.NumExtParam         = 1;
+    ctrl.ExtParam            = extParam;
+    sts =
+        MFXVideoENCODE_EncodeFrameAsync(session, &ctrl, &encSurfaces[nEncSurfIdx], &mfxBS, &syncp);
+    ASSERT_EQ(sts, MFX_ERR_INVALID_VIDEO_PARAM);
+
     MFXClose(session);
 
     delete[] surfaceBuffers;
@@ -312,6 +338,203 @@ TEST(EncodeFrameAsync, InsufficientOutBufferReturnsNotEnoughBuffer) {
     delete[] mfxBS.Data;
 }
 
+TEST(EncodeFrameAsync, RetryAfterNotEnoughBufferReturnsPacket) {
+    mfxVersion ver = {};
+    mfxSession session;
+    mfxStatus sts = MFXInit(MFX_IMPL_SOFTWARE, &ver, &session);
+    ASSERT_EQ(sts, MFX_ERR_NONE);
+
+    mfxVideoParam mfxEncParams;
+    memset(&mfxEncParams, 0, sizeof(mfxEncParams));
+    mfxEncParams.mfx.CodecId                 = MFX_CODEC_JPEG;
+    mfxEncParams.mfx.FrameInfo.FourCC        = MFX_FOURCC_I420;
+    mfxEncParams.mfx.FrameInfo.ChromaFormat  = MFX_CHROMAFORMAT_YUV420;
+    mfxEncParams.mfx.FrameInfo.CropW         = 128;
+    mfxEncParams.mfx.FrameInfo.CropH         = 96;
+    mfxEncParams.mfx.FrameInfo.Width         = 128;
+    mfxEncParams.mfx.FrameInfo.Height        = 96;
+    mfxEncParams.mfx.FrameInfo.FrameRateExtN = 30;
+    mfxEncParams.mfx.FrameInfo.FrameRateExtD = 1;
+    mfxEncParams.IOPattern                   = MFX_IOPATTERN_IN_SYSTEM_MEMORY;
+
+    mfxU32 lumaSize = mfxEncParams.mfx.FrameInfo.Width * mfxEncParams.mfx.FrameInfo.Height;
+    std::vector<mfxU8> surfaceBuffer(lumaSize * 3 / 2, 0);
+
+    mfxFrameSurface1 encSurface = { 0 };
+    encSurface.Info             = mfxEncParams.mfx.FrameInfo;
+    encSurface.Data.Y           = surfaceBuffer.data();
+    encSurface.Data.U           = encSurface.Data.Y + lumaSize;
+    encSurface.Data.V           = encSurface.Data.U + lumaSize / 4;
+    encSurface.Data.Pitch       = mfxEncParams.mfx.FrameInfo.Width;
+
+    sts = MFXVideoENCODE_Init(session, &mfxEncParams);
+    ASSERT_EQ(sts, MFX_ERR_NONE);
+
+    std::vector<mfxU8> smallBuffer(20);
+    mfxBitstream mfxBS = { 0 };
+    mfxBS.MaxLength    = (mfxU32)smallBuffer.size();
+    mfxBS.Data         = smallBuffer.data();
+
+    // the encoder may buffer a few frames first
+    mfxSyncPoint syncp = nullptr;
+    for (int i = 0; i < 16; i++) {
+        sts = MFXVideoENCODE_EncodeFrameAsync(session, NULL, &encSurface, &mfxBS, &syncp);
+        if (sts != MFX_ERR_MORE_DATA)
+            break;
+    }
+    ASSERT_EQ(sts, MFX_ERR_NOT_ENOUGH_BUFFER);
+    EXPECT_EQ(mfxBS.DataLength, 0);
+
+    // same input with a larger buffer, the encoded frame was kept
+    std::vector<mfxU8> largeBuffer(lumaSize * 2);
+    mfxBS.MaxLength = (mfxU32)largeBuffer.size();
+    mfxBS.Data      = largeBuffer.data();
+
+    sts = MFXVideoENCODE_EncodeFrameAsync(session, NULL, &encSurface, &mfxBS, &syncp);
+    ASSERT_EQ(sts, MFX_ERR_NONE);
+    sts = MFXVideoCORE_SyncOperation(session, syncp, 1000);
+    ASSERT_EQ(sts, MFX_ERR_NONE);
+
+    // JPEG start of image marker
+    ASSERT_GT(mfxBS.DataLength, 20);
+    EXPECT_EQ(mfxBS.Data[0], 0xFF);
+    EXPECT_EQ(mfxBS.Data[1], 0xD8);
+
+    MFXClose(session);
+}
+
+TEST(EncodeFrameAsync, RetryWithOtherSurfaceKeepsPendingPacket) {
+    mfxVersion ver = {};
+    mfxSession session;
+    mfxStatus sts = MFXInit(MFX_IMPL_SOFTWARE, &ver, &session);
+    ASSERT_EQ(sts, MFX_ERR_NONE);
+
+    mfxVideoParam mfxEncParams;
+    memset(&mfxEncParams, 0, sizeof(mfxEncParams));
+    mfxEncParams.mfx.CodecId                 = MFX_CODEC_JPEG;
+    mfxEncParams.mfx.FrameInfo.FourCC        = MFX_FOURCC_I420;
+    mfxEncParams.mfx.FrameInfo.ChromaFormat  = MFX_CHROMAFORMAT_YUV420;
+    mfxEncParams.mfx.FrameInfo.CropW         = 128;
+    mfxEncParams.mfx.FrameInfo.CropH         = 96;
+    mfxEncParams.mfx.FrameInfo.Width         = 128;
+    mfxEncParams.mfx.FrameInfo.Height        = 96;
+    mfxEncParams.mfx.FrameInfo.FrameRateExtN = 30;
+    mfxEncParams.mfx.FrameInfo.FrameRateExtD = 1;
+    mfxEncParams.IOPattern                   = MFX_IOPATTERN_IN_SYSTEM_MEMORY;
+
+    mfxU32 lumaSize = mfxEncParams.mfx.FrameInfo.Width * mfxEncParams.mfx.FrameInfo.Height;
+    std::vector<mfxU8> surfaceBuffers[2] = { std::vector<mfxU8>(lumaSize * 3 / 2, 0),
+                                             std::vector<mfxU8>(lumaSize * 3 / 2, 255) };
+
+    mfxFrameSurface1 encSurfaces[2] = {};
+    for (int i = 0; i < 2; i++) {
+        encSurfaces[i].Info       = mfxEncParams.mfx.FrameInfo;
+        encSurfaces[i].Data.Y     = surfaceBuffers[i].data();
+        encSurfaces[i].Data.U     = encSurfaces[i].Data.Y + lumaSize;
+        encSurfaces[i].Data.V     = encSurfaces[i].Data.U + lumaSize / 4;
+        encSurfaces[i].Data.Pitch = mfxEncParams.mfx.FrameInfo.Width;
+    }
+
+    sts = MFXVideoENCODE_Init(session, &mfxEncParams);
+    ASSERT_EQ(sts, MFX_ERR_NONE);
+
+    std::vector<mfxU8> smallBuffer(20);
+    mfxBitstream mfxBS = { 0 };
+    mfxBS.MaxLength    = (mfxU32)smallBuffer.size();
+    mfxBS.Data         = smallBuffer.data();
+
+    mfxSyncPoint syncp = nullptr;
+    sts = MFXVideoENCODE_EncodeFrameAsync(session, NULL, &encSurfaces[0], &mfxBS, &syncp);
+    ASSERT_EQ(sts, MFX_ERR_NOT_ENOUGH_BUFFER);
+
+    // other input is refused while the packet of the first one is pending
+    std::vector<mfxU8> largeBuffer(lumaSize * 2);
+    mfxBS.MaxLength = (mfxU32)largeBuffer.size();
+    mfxBS.Data      = largeBuffer.data();
+
+    sts = MFXVideoENCODE_EncodeFrameAsync(session, NULL, &encSurfaces[1], &mfxBS, &syncp);
+    EXPECT_EQ(sts, MFX_ERR_NOT_ENOUGH_BUFFER);
+    EXPECT_EQ(mfxBS.DataLength, 0);
+
+    // each input gives one packet once the pending one is delivered
+    for (int i = 0; i < 2; i++) {
+        mfxBS.DataLength = 0;
+
+        sts = MFXVideoENCODE_EncodeFrameAsync(session, NULL, &encSurfaces[i], &mfxBS, &syncp);
+        ASSERT_EQ(sts, MFX_ERR_NONE);
+        sts = MFXVideoCORE_SyncOperation(session, syncp, 1000);
+        ASSERT_EQ(sts, MFX_ERR_NONE);
+        ASSERT_GT(mfxBS.DataLength, 20);
+        EXPECT_EQ(mfxBS.Data[0], 0xFF);
+        EXPECT_EQ(mfxBS.Data[1], 0xD8);
+    }
+
+    // nothing was encoded twice
+    mfxBS.DataLength = 0;
+    sts              = MFXVideoENCODE_EncodeFrameAsync(session, NULL, NULL, &mfxBS, &syncp);
+    EXPECT_EQ(sts, MFX_ERR_MORE_DATA);
+    EXPECT_EQ(mfxBS.DataLength, 0);
+
+    MFXClose(session);
+}
+
+TEST(EncodeFrameAsync, RepointedSurfaceEncodesNewMemory) {
+    mfxVersion ver = {};
+    mfxSession session;
+    mfxStatus sts = MFXInit(MFX_IMPL_SOFTWARE, &ver, &session);
+    ASSERT_EQ(sts, MFX_ERR_NONE);
+
+    mfxVideoParam mfxEncParams;
+    memset(&mfxEncParams, 0, sizeof(mfxEncParams));
+    mfxEncParams.mfx.CodecId                 = MFX_CODEC_JPEG;
+    mfxEncParams.mfx.FrameInfo.FourCC        = MFX_FOURCC_I420;
+    mfxEncParams.mfx.FrameInfo.ChromaFormat  = MFX_CHROMAFORMAT_YUV420;
+    mfxEncParams.mfx.FrameInfo.CropW         = 128;
+    mfxEncParams.mfx.FrameInfo.CropH         = 96;
+    mfxEncParams.mfx.FrameInfo.Width         = 128;
+    mfxEncParams.mfx.FrameInfo.Height        = 96;
+    mfxEncParams.mfx.FrameInfo.FrameRateExtN = 30;
+    mfxEncParams.mfx.FrameInfo.FrameRateExtD = 1;
+    mfxEncParams.IOPattern                   = MFX_IOPATTERN_IN_SYSTEM_MEMORY;
+
+    sts = MFXVideoENCODE_Init(session, &mfxEncParams);
+    ASSERT_EQ(sts, MFX_ERR_NONE);
+
+    // same surface pointed at a black and then at a white picture
+    mfxU32 lumaSize = mfxEncParams.mfx.FrameInfo.Width * mfxEncParams.mfx.FrameInfo.Height;
+    std::vector<mfxU8> buffers[2] = { std::vector<mfxU8>(lumaSize * 3 / 2, 0),
+                                      std::vector<mfxU8>(lumaSize * 3 / 2, 255) };
+    std::vector<mfxU8> outputs[2];
+
+    mfxFrameSurface1 encSurface = { 0 };
+    encSurface.Info             = mfxEncParams.mfx.FrameInfo;
+    encSurface.Data.Pitch       = mfxEncParams.mfx.FrameInfo.Width;
+
+    std::vector<mfxU8> bsBuffer(lumaSize * 2);
+    mfxSyncPoint syncp = nullptr;
+    for (int i = 0; i < 2; i++) {
+        encSurface.Data.Y = buffers[i].data();
+        encSurface.Data.U = encSurface.Data.Y + lumaSize;
+        encSurface.Data.V = encSurface.Data.U + lumaSize / 4;
+
+        mfxBitstream mfxBS = { 0 };
+        mfxBS.MaxLength    = (mfxU32)bsBuffer.size();
+        mfxBS.Data         = bsBuffer.data();
+
+        sts = MFXVideoENCODE_EncodeFrameAsync(session, NULL, &encSurface, &mfxBS, &syncp);
+        ASSERT_EQ(sts, MFX_ERR_NONE);
+        sts = MFXVideoCORE_SyncOperation(session, syncp, 1000);
+        ASSERT_EQ(sts, MFX_ERR_NONE);
+
+        // nothing references the input once its packet is out
+        EXPECT_EQ(encSurface.Data.Locked, 0);
+        outputs[i].assign(mfxBS.Data, mfxBS.Data + mfxBS.DataLength);
+    }
+    EXPECT_NE(outputs[0], outputs[1]);
+
+    MFXClose(session);
+}
+
 TEST(EncodeFrameAsync, NullSessionReturnsInvalidHandle) {
     mfxStatus sts = MFXVideoENCODE_EncodeFrameAsync(0, nullptr, nullptr, nullptr, nullptr);
     ASSERT_EQ(sts, MFX_ERR_INVALID_HANDLE);
@@ -607,6 +830,22 @@ TEST(DecodeFrameAsync, CompleteFrameJPEGReturnsFrame) {
                                           &syncp);
     ASSERT_EQ(sts, MFX_ERR_NONE);
 
+    sts = MFXVideoCORE_SyncOperation(session, syncp, 1000);
+    ASSERT_EQ(sts, MFX_ERR_NONE);
+
+    // full range JPEG samples come out in limited range
+    mfxFrameData &data = pmfxOutSurface->Data;
+    for (mfxU32 y = 0; y < surfH; y++) {
+        for (mfxU32 x = 0; x < surfW; x++) {
+            mfxU8 luma = data.Y[y * data.Pitch + x];
+            EXPECT_TRUE(luma >= 16 && luma <= 235);
+        }
+    }
+    for (mfxU32 i = 0; i < (surfW / 2) * (surfH / 2); i++) {
+        EXPECT_TRUE(data.U[i] >= 16 && data.U[i] <= 240);
+        EXPECT_TRUE(data.V[i] >= 16 && data.V[i] <= 240);
+    }
+
     sts = MFXClose(session);
     ASSERT_EQ(sts, MFX_ERR_NONE);
 
@@ -614,6 +853,94 @@ TEST(DecodeFrameAsync, CompleteFrameJPEGReturnsFrame) {
     delete[] decSurfaces;
 }
 
+// JPEG pictures come out of the call which sends them, so every call
+//   returns a surface at once and the picture is decoded behind it
+TEST(DecodeFrameAsync, CompleteFramesJPEGAreReadyAfterSync) {
+    mfxVersion ver = {};
+    mfxSession session;
+    mfxStatus sts = MFXInit(MFX_IMPL_SOFTWARE, &ver, &session);
+    ASSERT_EQ(sts, MFX_ERR_NONE);
+
+    mfxVideoParam mfxDecParams = { 0 };
+    mfxDecParams.mfx.CodecId   = MFX_CODEC_JPEG;
+    mfxDecParams.IOPattern     = MFX_IOPATTERN_OUT_SYSTEM_MEMORY;
+
+    mfxBitstream mfxBS = { 0 };
+    mfxBS.MaxLength = mfxBS.DataLength = test_bitstream_32x32_mjpeg::getlen();
+    mfxBS.Data                         = test_bitstream_32x32_mjpeg::getdata();
+
+    sts = MFXVideoDECODE_DecodeHeader(session, &mfxBS, &mfxDecParams);
+    ASSERT_EQ(sts, MFX_ERR_NONE);
+    mfxDecParams.AsyncDepth = 4;
+
+    const mfxU32 nSurfNumDec = 8;
+    mfxU32 surfW             = mfxDecParams.mfx.FrameInfo.Width;
+    mfxU32 surfH             = mfxDecParams.mfx.FrameInfo.Height;
+    std::vector<mfxU8> DECoutbuf(surfW * surfH * 3 / 2 * nSurfNumDec);
+
+    std::vector<mfxFrameSurface1> decSurfaces(nSurfNumDec);
+    for (mfxU32 i = 0; i < nSurfNumDec; i++) {
+        decSurfaces[i]            = { 0 };
+        decSurfaces[i].Info       = mfxDecParams.mfx.FrameInfo;
+        decSurfaces[i].Data.Y     = DECoutbuf.data() + i * surfW * surfH * 3 / 2;
+        decSurfaces[i].Data.U     = decSurfaces[i].Data.Y + surfW * surfH;
+        decSurfaces[i].Data.V     = decSurfaces[i].Data.U + (surfW / 2) * (surfH / 2);
+        decSurfaces[i].Data.Pitch = surfW;
+    }
+
+    sts = MFXVideoDECODE_Init(session, &mfxDecParams);
+    ASSERT_EQ(sts, MFX_ERR_NONE);
+
+    std::vector<mfxSyncPoint> syncps;
+    std::vector<mfxFrameSurface1 *> outputs;
+    for (mfxU32 pos = 0; pos < test_bitstream_32x32_mjpeg::getlen();) {
+        mfxU32 frame = static_cast<mfxU32>(outputs.size());
+        mfxU32 next  = test_bitstream_32x32_mjpeg::getpos(frame + 1);
+        if (!next)
+            next = test_bitstream_32x32_mjpeg::getlen();
+        ASSERT_LT(frame, nSurfNumDec);
+
+        mfxBS           = { 0 };
+        mfxBS.Data      = test_bitstream_32x32_mjpeg::getdata() + pos;
+        mfxBS.MaxLength = mfxBS.DataLength = next - pos;
+        mfxBS.DataFlag                     = MFX_BITSTREAM_COMPLETE_FRAME;
+        mfxBS.TimeStamp                    = 1000 * (frame + 1);
+        pos                                = next;
+
+        mfxFrameSurface1 *work           = &decSurfaces[frame];
+        mfxFrameSurface1 *pmfxOutSurface = nullptr;
+        mfxSyncPoint syncp               = {};
+
+        sts = MFXVideoDECODE_DecodeFrameAsync(session, &mfxBS, work, &pmfxOutSurface, &syncp);
+        ASSERT_EQ(sts, MFX_ERR_NONE);
+        ASSERT_EQ(pmfxOutSurface, &decSurfaces[frame]);
+        EXPECT_EQ(pmfxOutSurface->Data.FrameOrder, frame);
+        EXPECT_EQ(pmfxOutSurface->Data.TimeStamp, 1000u * (frame + 1));
+        syncps.push_back(syncp);
+        outputs.push_back(pmfxOutSurface);
+    }
+    EXPECT_EQ(outputs.size(), 4u);
+
+    for (size_t i = 0; i < outputs.size(); i++) {
+        sts = MFXVideoCORE_SyncOperation(session, syncps[i], 1000);
+        ASSERT_EQ(sts, MFX_ERR_NONE);
+        EXPECT_EQ(outputs[i]->Info.CropW, surfW);
+        EXPECT_EQ(outputs[i]->Info.CropH, surfH);
+
+        // full range JPEG samples come out in limited range
+        mfxFrameData &data = outputs[i]->Data;
+        for (mfxU32 y = 0; y < surfH; y++) {
+            for (mfxU32 x = 0; x < surfW; x++) {
+                mfxU8 luma = data.Y[y * data.Pitch + x];
+                EXPECT_TRUE(luma >= 16 && luma <= 235);
+            }
+        }
+    }
+
+    sts = MFXClose(session);
+    ASSERT_EQ(sts, MFX_ERR_NONE);
+}
+
 TEST(DecodeFrameAsync, EoSReturnsFrame) {
     mfxStatus sts = MFX_ERR_NONE;
 
@@ -835,6 +1162,149 @@ TEST(DecodeFrameAsync, CompleteFrameHEVCReturnsFrame) {
     delete[] decSurfaces;
 }
 
+// decode the first frame of the 96x64 HEVC stream into application
+//   surfaces with the given layout and return its Y, U and V samples
+static std::vector<mfxU8> DecodeFirstFrame(mfxU16 surfW,
+                                           mfxU16 surfH,
+                                           mfxU16 pitch,
+                                           mfxU32 fourcc = MFX_FOURCC_I420,
+                                           mfxU32 offset = 0) {
+    std::vector<mfxU8> luma;
+
+    mfxVersion ver = {};
+    mfxSession session;
+    mfxStatus sts = MFXInit(MFX_IMPL_SOFTWARE, &ver, &session);
+    EXPECT_EQ(sts, MFX_ERR_NONE);
+    if (sts != MFX_ERR_NONE)
+        return luma;
+
+    mfxVideoParam mfxDecParams = { 0 };
+    mfxDecParams.mfx.CodecId   = MFX_CODEC_HEVC;
+    mfxDecParams.IOPattern     = MFX_IOPATTERN_OUT_SYSTEM_MEMORY;
+
+    mfxBitstream mfxBS = { 0 };
+    mfxBS.MaxLength = mfxBS.DataLength = test_bitstream_96x64_8bit_hevc::getlen();
+    mfxBS.Data                         = test_bitstream_96x64_8bit_hevc::getdata();
+
+    sts = MFXVideoDECODE_DecodeHeader(session, &mfxBS, &mfxDecParams);
+    EXPECT_EQ(sts, MFX_ERR_NONE);
+    mfxDecParams.mfx.FrameInfo.FourCC = fourcc;
+
+    const mfxU32 nSurfNumDec = 8;
+    mfxU32 surfSize          = pitch * surfH * 3 / 2;
+    std::vector<mfxU8> DECoutbuf(surfSize * nSurfNumDec + 64 + offset);
+    mfxU8 *base = DECoutbuf.data() + 64 - reinterpret_cast<uintptr_t>(DECoutbuf.data()) % 64;
+    base += offset;
+
+    std::vector<mfxFrameSurface1> decSurfaces(nSurfNumDec);
+    for (mfxU32 i = 0; i < nSurfNumDec; i++) {
+        decSurfaces[i]             = { 0 };
+        decSurfaces[i].Info        = mfxDecParams.mfx.FrameInfo;
+        decSurfaces[i].Info.Width  = surfW;
+        decSurfaces[i].Info.Height = surfH;
+        decSurfaces[i].Data.Y      = base + i * surfSize;
+        decSurfaces[i].Data.U      = decSurfaces[i].Data.Y + pitch * surfH;
+        decSurfaces[i].Data.V      = decSurfaces[i].Data.U + (pitch / 2) * (surfH / 2);
+        decSurfaces[i].Data.Pitch  = pitch;
+        if (fourcc == MFX_FOURCC_NV12) {
+            decSurfaces[i].Data.V = decSurfaces[i].Data.UV + 1;
+        }
+    }
+
+    sts = MFXVideoDECODE_Init(session, &mfxDecParams);
+    EXPECT_EQ(sts, MFX_ERR_NONE);
+
+    mfxBitstream *bsPtr              = &mfxBS;
+    mfxFrameSurface1 *pmfxOutSurface = nullptr;
+    mfxSyncPoint syncp               = {};
+    for (int i = 0; i < 64 && sts == MFX_ERR_NONE && luma.empty(); i++) {
+        // surfaces still referenced by the decoder stay locked
+        mfxFrameSurface1 *work = nullptr;
+        for (mfxFrameSurface1 &surface : decSurfaces) {
+            if (!surface.Data.Locked) {
+                work = &surface;
+                break;
+            }
+        }
+        EXPECT_NE(work, nullptr);
+        if (!work)
+            break;
+
+        sts = MFXVideoDECODE_DecodeFrameAsync(session, bsPtr, work, &pmfxOutSurface, &syncp);
+        if (sts == MFX_ERR_MORE_DATA && bsPtr) {
+            bsPtr = nullptr;
+            sts   = MFX_ERR_NONE;
+            continue;
+        }
+        if (sts == MFX_ERR_MORE_SURFACE) {
+            sts = MFX_ERR_NONE;
+            continue;
+        }
+        EXPECT_EQ(sts, MFX_ERR_NONE);
+        if (sts != MFX_ERR_NONE)
+            break;
+
+        sts = MFXVideoCORE_SyncOperation(session, syncp, 1000);
+        EXPECT_EQ(sts, MFX_ERR_NONE);
+        EXPECT_EQ(pmfxOutSurface->Info.CropW, 96);
+        EXPECT_EQ(pmfxOutSurface->Info.CropH, 64);
+        mfxFrameData &data = pmfxOutSurface->Data;
+        for (mfxU16 y = 0; y < pmfxOutSurface->Info.CropH; y++) {
+            mfxU8 *row = data.Y + y * data.Pitch;
+            luma.insert(luma.end(), row, row + pmfxOutSurface->Info.CropW);
+        }
+
+        // chroma in planar order, whatever the surface layout
+        bool nv12        = pmfxOutSurface->Info.FourCC == MFX_FOURCC_NV12;
+        mfxU16 chromaW   = pmfxOutSurface->Info.CropW / 2;
+        mfxU16 chromaH   = pmfxOutSurface->Info.CropH / 2;
+        mfxU16 pitchC    = nv12 ? data.Pitch : data.Pitch / 2;
+        mfxU16 step      = nv12 ? 2 : 1;
+        mfxU8 *planes[2] = { nv12 ? data.UV : data.U, data.V };
+        for (mfxU8 *plane : planes) {
+            for (mfxU16 y = 0; y < chromaH; y++) {
+                for (mfxU16 x = 0; x < chromaW; x++)
+                    luma.push_back(plane[y * pitchC + x * step]);
+            }
+        }
+    }
+
+    MFXClose(session);
+    return luma;
+}
+
+// padded, aligned surfaces are decoded into directly instead of copied
+TEST(DecodeFrameAsync, AlignedSurfacesMatchCopiedOutput) {
+    std::vector<mfxU8> copied = DecodeFirstFrame(96, 64, 96);
+    ASSERT_EQ(copied.size(), 96u * 64u * 3 / 2);
+
+    std::vector<mfxU8> in_place = DecodeFirstFrame(128, 128, 256);
+    EXPECT_EQ(copied, in_place);
+}
+
+// NV12 surfaces get the same picture with U and V interleaved
+TEST(DecodeFrameAsync, NV12SurfacesMatchPlanarOutput) {
+    std::vector<mfxU8> planar = DecodeFirstFrame(96, 64, 96);
+    ASSERT_EQ(planar.size(), 96u * 64u * 3 / 2);
+
+    std::vector<mfxU8> nv12 = DecodeFirstFrame(96, 64, 96, MFX_FOURCC_NV12);
+    EXPECT_EQ(planar, nv12);
+
+    std::vector<mfxU8> padded = DecodeFirstFrame(128, 128, 256, MFX_FOURCC_NV12);
+    EXPECT_EQ(planar, padded);
+}
+
+// odd pitches and unaligned planes take the tails of the SIMD copy and
+//   interleave kernels, the result must match the planar copy
+TEST(DecodeFrameAsync, UnalignedSurfacesMatchPlanarOutput) {
+    std::vector<mfxU8> planar = DecodeFirstFrame(96, 64, 96);
+    ASSERT_EQ(planar.size(), 96u * 64u * 3 / 2);
+
+    EXPECT_EQ(planar, DecodeFirstFrame(96, 64, 101, MFX_FOURCC_I420, 1));
+    EXPECT_EQ(planar, DecodeFirstFrame(96, 64, 101, MFX_FOURCC_NV12, 1));
+    EXPECT_EQ(planar, DecodeFirstFrame(96, 64, 133, MFX_FOURCC_NV12, 7));
+}
+
 TEST(DecodeFrameAsync, InsufficientInBitstreamReturnsMoreData) {
     mfxVersion ver = {};
     mfxSession session;
@@ -1165,6 +1635,90 @@ TEST(RunFrameVPPAsync, ValidInputsReturnsErrNone) {
     delete[] DECoutbuf;
 }
 
+// I420 surface of width x height in buf at offset with an odd pitch
+static void SetI420Surface(mfxFrameSurface1 *surface,
+                           const mfxFrameInfo &info,
+                           std::vector<mfxU8> &buf,
+                           mfxU16 pitch,
+                           mfxU32 offset) {
+    buf.assign(offset + pitch * info.Height * 2, 0);
+    *surface            = { 0 };
+    surface->Info       = info;
+    surface->Data.Y     = buf.data() + offset;
+    surface->Data.U     = surface->Data.Y + pitch * info.Height;
+    surface->Data.V     = surface->Data.U + (pitch / 2) * ((info.Height + 1) / 2);
+    surface->Data.Pitch = pitch;
+}
+
+// plain C reference, row by row
+static bool SamePlane(const mfxU8 *a, int pitchA, const mfxU8 *b, int pitchB, int w, int h) {
+    for (int y = 0; y < h; y++) {
+        for (int x = 0; x < w; x++) {
+            if (a[y * pitchA + x] != b[y * pitchB + x])
+                return false;
+        }
+    }
+    return true;
+}
+
+// widths which are not a multiple of the SIMD width, odd pitches and
+//   unaligned planes go through the copy kernel tails
+TEST(RunFrameVPPAsync, UnalignedCopyMatchesInput) {
+    mfxVersion ver = {};
+    mfxSession session;
+    mfxStatus sts = MFXInit(MFX_IMPL_SOFTWARE, &ver, &session);
+    ASSERT_EQ(sts, MFX_ERR_NONE);
+
+    // 226 = 3 * 64 + 34 luma and 113 chroma bytes per row
+    mfxVideoParam mfxVPPParams        = { 0 };
+    mfxVPPParams.vpp.In.FourCC        = MFX_FOURCC_I420;
+    mfxVPPParams.vpp.In.ChromaFormat  = MFX_CHROMAFORMAT_YUV420;
+    mfxVPPParams.vpp.In.Width         = 226;
+    mfxVPPParams.vpp.In.Height        = 18;
+    mfxVPPParams.vpp.In.CropW         = mfxVPPParams.vpp.In.Width;
+    mfxVPPParams.vpp.In.CropH         = mfxVPPParams.vpp.In.Height;
+    mfxVPPParams.vpp.In.FrameRateExtN = 30;
+    mfxVPPParams.vpp.In.FrameRateExtD = 1;
+    mfxVPPParams.vpp.Out              = mfxVPPParams.vpp.In;
+    mfxVPPParams.IOPattern = MFX_IOPATTERN_IN_SYSTEM_MEMORY | MFX_IOPATTERN_OUT_SYSTEM_MEMORY;
+
+    sts = MFXVideoVPP_Init(session, &mfxVPPParams);
+    ASSERT_EQ(sts, MFX_ERR_NONE);
+
+    const mfxFrameInfo &info = mfxVPPParams.vpp.In;
+    std::vector<mfxU8> inBuf, outBuf;
+    mfxFrameSurface1 in, out;
+    SetI420Surface(&in, info, inBuf, 229, 3);
+    SetI420Surface(&out, info, outBuf, 243, 1);
+
+    for (int y = 0; y < info.Height; y++) {
+        for (int x = 0; x < info.Width; x++)
+            in.Data.Y[y * in.Data.Pitch + x] = static_cast<mfxU8>(x * 7 + y * 13);
+    }
+    for (int y = 0; y < info.Height / 2; y++) {
+        for (int x = 0; x < info.Width / 2; x++) {
+            in.Data.U[y * (in.Data.Pitch / 2) + x] = static_cast<mfxU8>(x * 3 + y * 5 + 1);
+            in.Data.V[y * (in.Data.Pitch / 2) + x] = static_cast<mfxU8>(x * 11 + y * 17 + 2);
+        }
+    }
+
+    mfxSyncPoint syncp = nullptr;
+    sts                = MFXVideoVPP_RunFrameVPPAsync(session, &in, &out, nullptr, &syncp);
+    ASSERT_EQ(sts, MFX_ERR_NONE);
+    sts = MFXVideoCORE_SyncOperation(session, syncp, 1000);
+    ASSERT_EQ(sts, MFX_ERR_NONE);
+
+    int w = info.Width, h = info.Height;
+    EXPECT_TRUE(SamePlane(in.Data.Y, in.Data.Pitch, out.Data.Y, out.Data.Pitch, w, h));
+    EXPECT_TRUE(
+        SamePlane(in.Data.U, in.Data.Pitch / 2, out.Data.U, out.Data.Pitch / 2, w / 2, h / 2));
+    EXPECT_TRUE(
+        SamePlane(in.Data.V, in.Data.Pitch / 2, out.Data.V, out.Data.Pitch / 2, w / 2, h / 2));
+
+    sts = MFXClose(session);
+    EXPECT_EQ(sts, MFX_ERR_NONE);
+}
+
 TEST(RunFrameVPPAsync, NullSessionReturnsInvalidHandle) {
     mfxStatus sts = MFXVideoVPP_RunFrameVPPAsync(0, nullptr, nullptr, nullptr, nullptr);
     ASSERT_EQ(sts, MFX_ERR_INVALID_HANDLE);